@@ -0,0 +1,38 @@
+function W = bench_chili_lanczos_()
+
+% Lanczos solver for a nitroxide Liouvillian, as one system and as a batch
+% of several orientations
+
+Sys.g = [2.0088 2.0061 2.0027];
+Sys.Nucs = '14N';
+Sys.A = [16 16 86];
+Sys.tcorr = 3e-9;
+Sys.lwpp = 0.1;
+Exp.mwFreq = 9.5;
+Exp.nPoints = 512;
+Opt.LLMK = [24 15 8 4];
+Opt.Diagnostics = 'esbench_chili_diag';
+chili(Sys,Exp,Opt);
+Diag = evalin('base','esbench_chili_diag');
+evalin('base','clear esbench_chili_diag');
+
+% Rescaled matrix and frequency axis, as in chili
+scale = max(abs(Diag.L(:)));
+A = Diag.L/scale;
+b = full(Diag.sv);
+omega = complex(2*pi*linspace(-0.15,0.15,Exp.nPoints)*1e9,1e7);
+z = -1i*omega/scale;
+Lentz = 1;
+Threshold = 1e-6;
+
+W = benchworkload('chili_lanczos_','single',{A,b,z,Lentz,Threshold},3,...
+  Exp.nPoints,'points');
+
+nSystems = 8;
+A8 = repmat({A},1,nSystems);
+b8 = repmat({b},1,nSystems);
+z8 = repmat({z},1,nSystems);
+W(2) = benchworkload('chili_lanczos_','batch8',{A8,b8,z8,Lentz,Threshold},3,...
+  nSystems*Exp.nPoints,'points');
+
+end
@@ -0,0 +1,25 @@
+function W = bench_chili_lm()
+
+% Liouvillian of a nitroxide with a deuteron, at several Lemax. The
+% kernel inputs are captured from chili via Opt.Diagnostics.
+
+Sys.g = [2.0088 2.0061 2.0027];
+Sys.Nucs = '14N,2H';
+Sys.A = [16 16 86; 1 1 3];
+Sys.tcorr = 3e-9;
+Sys.lwpp = 0.1;
+Exp.mwFreq = 9.5;
+Exp.nPoints = 512;
+
+W = [];
+for Lemax = [8 16 24]
+  Opt.LLMK = [Lemax Lemax-1 6 2];
+  Opt.Diagnostics = 'esbench_chili_diag';
+  chili(Sys,Exp,Opt);
+  Diag = evalin('base','esbench_chili_diag');
+  evalin('base','clear esbench_chili_diag');
+  Name = sprintf('Lemax%d',Lemax);
+  W = [W benchworkload('chili_lm',Name,Diag.chili_lm,2,@(out)nnz(out{1}),'elements')]; %#ok<AGROW>
+end
+
+end
@@ -0,0 +1,12 @@
+function W = bench_cubicsolve()
+
+% Roots in [0,1] of columns of random cubic polynomials
+
+W = [];
+for N = [1e4 1e5 1e6]
+  C = randn(4,N);
+  Name = sprintf('N%d',N);
+  W = [W benchworkload('cubicsolve',Name,{C,true},4,N,'polynomials')]; %#ok<AGROW>
+end
+
+end
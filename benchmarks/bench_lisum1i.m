@@ -0,0 +1,31 @@
+function W = bench_lisum1i()
+
+% Summation of Gaussian lines into a spectrum, with the template used by
+% pepper, for one spectrum and for grouped spectra
+
+x0T = 5e4;
+wT = x0T/2.5;
+xT = 0:2*x0T-1;
+Template = gaussian(xT,x0T,wT,-1);
+xAxis = linspace(320,360,4096);
+
+W = [];
+for nLines = [1e4 1e5 1e6]
+  Pos = 330 + 20*rand(1,nLines);
+  Amp = rand(1,nLines);
+  Wid = 0.5 + rand(1,nLines);
+  Name = sprintf('lines%d',nLines);
+  W = [W benchworkload('lisum1i',Name,{Template,x0T,wT,Pos,Amp,Wid,xAxis},1,...
+    nLines,'lines')]; %#ok<AGROW>
+end
+
+nLines = 1e5;
+nGroups = 8;
+Pos = 330 + 20*rand(1,nLines);
+Amp = rand(1,nLines);
+Wid = 0.5 + rand(1,nLines);
+Group = randi(nGroups,1,nLines);
+W(end+1) = benchworkload('lisum1i','groups8',...
+  {Template,x0T,wT,Pos,Amp,Wid,xAxis,Group,nGroups},1,nLines,'lines');
+
+end
@@ -0,0 +1,30 @@
+function W = bench_mdhmm_fwdback()
+
+% Forward-backward E step of mdhmm_em for trajectories of dihedral angles
+
+nDims = 4;
+nSteps = 10000;
+nTraj = 8;
+
+W = [];
+for nStates = [4 8 16]
+  [data,initDistr,TransProb,mu,Sigma] = hmmmodel(nStates,nDims,nSteps,nTraj);
+  Name = sprintf('states%d',nStates);
+  W = [W benchworkload('mdhmm_fwdback',Name,{data,initDistr,TransProb,mu,Sigma},6,...
+    nSteps*nTraj,'steps')]; %#ok<AGROW>
+end
+
+end
+
+function [data,initDistr,TransProb,mu,Sigma] = hmmmodel(nStates,nDims,nSteps,nTraj)
+data = (rand(nDims,nSteps,nTraj)-0.5)*2*pi;
+initDistr = ones(1,nStates)/nStates;
+TransProb = eye(nStates)*nStates + rand(nStates);
+TransProb = TransProb./sum(TransProb,2);
+mu = (rand(nDims,nStates)-0.5)*2*pi;
+Sigma = zeros(nDims,nDims,nStates);
+for s = 1:nStates
+  Q = randn(nDims);
+  Sigma(:,:,s) = Q*Q.'/nDims + 0.5*eye(nDims);
+end
+end
@@ -0,0 +1,28 @@
+function W = bench_mdhmm_lbfgsb_wrapper()
+
+% Reversible MSM transition matrix estimation with the native objective,
+% from one and from several starting points
+
+W = [];
+for nStates = [10 30]
+  c = randi(100,nStates) + 1000*eye(nStates);
+  c_sym = c + c.';
+  n = nStates^2;
+  l = zeros(n,1);
+  u = Inf(n,1);
+  nbd = isfinite(l) + isfinite(u) + 2*isinf(l).*isfinite(u);
+  if ispc
+    nbd = int32(nbd);
+  else
+    nbd = int64(nbd);
+  end
+  for nStarts = [1 8]
+    x0 = c_sym(:).*(1+0.1*(0:nStarts-1));
+    Args = {5,x0,l,u,nbd,'msmreversible',1e7,1e-5,-1,1000,50000,c};
+    Name = sprintf('states%d_starts%d',nStates,nStarts);
+    W = [W benchworkload('mdhmm_lbfgsb_wrapper',Name,Args,5,...
+      @(out)sum(out{5}),'evaluations')]; %#ok<AGROW>
+  end
+end
+
+end
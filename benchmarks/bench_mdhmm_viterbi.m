@@ -0,0 +1,26 @@
+function W = bench_mdhmm_viterbi()
+
+% Viterbi decoding of trajectories of dihedral angles
+
+nDims = 4;
+nSteps = 10000;
+nTraj = 8;
+
+W = [];
+for nStates = [4 8 16]
+  data = (rand(nDims,nSteps,nTraj)-0.5)*2*pi;
+  eqDistr = ones(1,nStates)/nStates;
+  TransProb = eye(nStates)*nStates + rand(nStates);
+  TransProb = TransProb./sum(TransProb,2);
+  mu = (rand(nDims,nStates)-0.5)*2*pi;
+  Sigma = zeros(nDims,nDims,nStates);
+  for s = 1:nStates
+    Q = randn(nDims);
+    Sigma(:,:,s) = Q*Q.'/nDims + 0.5*eye(nDims);
+  end
+  Name = sprintf('states%d',nStates);
+  W = [W benchworkload('mdhmm_viterbi',Name,{data,eqDistr,TransProb,mu,Sigma},1,...
+    nSteps*nTraj,'steps')]; %#ok<AGROW>
+end
+
+end
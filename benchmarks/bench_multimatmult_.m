@@ -0,0 +1,31 @@
+function W = bench_multimatmult_()
+
+% Page-wise matrix products, for small pages (unrolled kernels), medium
+% pages and large pages (BLAS), and sandwich products R*T*R.'
+
+W = [];
+PageSizes = [3 10 40 200];
+nPages = [1e5 1e4 1e3 4];
+for k = 1:numel(PageSizes)
+  n = PageSizes(k);
+  A = randn(n,n,nPages(k));
+  B = randn(n,n,nPages(k));
+  Name = sprintf('%dx%dx%d',n,n,nPages(k));
+  W = [W benchworkload('multimatmult_',Name,{A,B},1,...
+    n^3*nPages(k),'mult-adds')]; %#ok<AGROW>
+end
+
+% Complex pages times a single real page (broadcast)
+A = complex(randn(4,4,1e5),randn(4,4,1e5));
+B = randn(4,4);
+W(end+1) = benchworkload('multimatmult_','complex4x4_broadcast',{A,B},1,...
+  2*4^3*1e5,'mult-adds');
+
+% Rotation of several tensors per orientation, R*T*R.'
+nOri = 1e5;
+R = randn(3,3,nOri);
+T = {randn(3,3),randn(3,3)};
+W(end+1) = benchworkload('multimatmult_','sandwich3x3_2T',{R,T,[]},1,...
+  2*2*3^3*nOri,'mult-adds');
+
+end
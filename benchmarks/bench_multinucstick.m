@@ -0,0 +1,31 @@
+function W = bench_multinucstick()
+
+% Stick spectra of many orientations with several nuclei, for a small
+% product space (all combinations enumerated) and a large one
+% (convolution of stick patterns)
+
+nOri = 1e4;
+Baxis = linspace(320,360,4096);
+dB = Baxis(2)-Baxis(1);
+
+W = [];
+Systems = {[3 3], [3 3 2 2 2 2 2 2 2 2]};
+Labels = {'N2','N2H8'};
+for k = 1:numel(Systems)
+  nStates = Systems{k};
+  nNuclei = numel(nStates);
+  B0 = 335 + 10*rand(1,nOri);
+  shifts = zeros(max(nStates),nNuclei,nOri);
+  a = 2*rand(nNuclei,nOri); % hyperfine shifts, mT
+  for iNuc = 1:nNuclei
+    I = (nStates(iNuc)-1)/2;
+    m = (-I:I).';
+    shifts(1:nStates(iNuc),iNuc,:) = reshape(m*a(iNuc,:),[nStates(iNuc) 1 nOri]);
+  end
+  Weights = rand(1,nOri);
+  Args = {B0,nStates,shifts,Baxis(1),dB,numel(Baxis),Weights};
+  W = [W benchworkload('multinucstick',Labels{k},Args,1,...
+    nOri*prod(nStates),'sticks')]; %#ok<AGROW>
+end
+
+end
@@ -0,0 +1,38 @@
+function W = bench_projecttriangles()
+
+% Triangle projection of a powder pattern as in pepper, for several grid
+% sizes, with three transitions (summed and separate)
+
+xAxis = linspace(300,380,4096);
+nTransitions = 3;
+
+W = [];
+for nKnots = [31 91 181]
+  [grid,tri] = sphgrid('Ci',nKnots);
+  idxTri = tri.idx.';
+  Areas = tri.areas;
+  [Pos,Amp] = powderpattern(grid,nTransitions);
+  Name = sprintf('knots%d',nKnots);
+  nTri = size(idxTri,2);
+  W = [W benchworkload('projecttriangles',Name,{idxTri,Areas,Pos,Amp,xAxis},1,...
+    nTri*nTransitions,'triangles')]; %#ok<AGROW>
+  if nKnots==91
+    W = [W benchworkload('projecttriangles',[Name '_separate'],...
+      {idxTri,Areas,Pos,Amp,xAxis,true},1,nTri*nTransitions,'triangles')]; %#ok<AGROW>
+  end
+end
+
+end
+
+% Resonance positions and amplitudes of an orthorhombic g tensor with one
+% hyperfine-split line per transition
+function [Pos,Amp] = powderpattern(grid,nTransitions)
+g = [2.1 2.05 2.0];
+v = grid.vecs;
+geff = sqrt(sum((g(:).*v).^2,1)).';
+Pos = zeros(numel(geff),nTransitions);
+for t = 1:nTransitions
+  Pos(:,t) = planck*9.5e9./(bmagn*geff)*1e3 + (t-2)*5*geff/2;
+end
+Amp = repmat(geff.^2,1,nTransitions);
+end
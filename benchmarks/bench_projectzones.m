@@ -0,0 +1,25 @@
+function W = bench_projectzones()
+
+% Projection of an axial powder pattern along theta, as in pepper, for
+% several numbers of knots, with three transitions
+
+xAxis = linspace(300,380,4096);
+nTransitions = 3;
+g = [2.1 2.0];
+
+W = [];
+for nKnots = [181 1801 18001]
+  theta = linspace(0,pi/2,nKnots);
+  SegWeights = -diff(cos(theta))*4*pi;
+  geff = sqrt((g(1)*sin(theta)).^2 + (g(2)*cos(theta)).^2).';
+  Pos = zeros(nKnots,nTransitions);
+  for t = 1:nTransitions
+    Pos(:,t) = planck*9.5e9./(bmagn*geff)*1e3 + (t-2)*5*geff/2;
+  end
+  Amp = repmat(geff.^2,1,nTransitions);
+  Name = sprintf('knots%d',nKnots);
+  W = [W benchworkload('projectzones',Name,{Pos,Amp,SegWeights,xAxis},1,...
+    (nKnots-1)*nTransitions,'segments')]; %#ok<AGROW>
+end
+
+end
@@ -0,0 +1,32 @@
+function W = bench_resfields_search()
+
+% Resonance search over spline models of the energy levels of an S=1/2,
+% I=1 system with anisotropic g, for batches of orientations
+
+mwFreq = 9500; % MHz
+gamma = 13.996; % MHz/mT per unit g
+a = 40; % MHz
+nKnots = 33;
+Bknots = linspace(300,380,nKnots).';
+ms = [-1 -1 -1 1 1 1]/2;
+mI = [-1 0 1 -1 0 1];
+Transitions = [1 4; 2 5; 3 6];
+
+W = [];
+for nOri = [256 4096]
+  geff = 2.0 + 0.1*rand(1,nOri);
+  curv = 1e-3*randn(6,nOri);
+  E = cell(1,nOri);
+  dEdB = cell(1,nOri);
+  for iOri = 1:nOri
+    dB = Bknots - 340;
+    E{iOri} = gamma*geff(iOri)*Bknots*ms + a*ms.*mI + dB.^2*curv(:,iOri).';
+    dEdB{iOri} = gamma*geff(iOri)*ones(nKnots,1)*ms + 2*dB*curv(:,iOri).';
+  end
+  Bk = repmat({Bknots.'},1,nOri);
+  Name = sprintf('ori%d',nOri);
+  W = [W benchworkload('resfields_search',Name,...
+    {Bk,E,dEdB,Transitions,mwFreq,true},5,nOri,'orientations')]; %#ok<AGROW>
+end
+
+end
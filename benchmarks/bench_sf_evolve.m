@@ -0,0 +1,20 @@
+function W = bench_sf_evolve()
+
+% HYSCORE time-domain signal (incrementation scheme [1 2]) for several
+% numbers of nuclear states
+
+nPoints = [128 128];
+dt = [0.008 0.008]; % us
+
+W = [];
+for nStates = [6 12]
+  Ea = sort(20*randn(nStates,1));
+  Eb = sort(20*randn(nStates,1));
+  rc = @() complex(randn(nStates),randn(nStates));
+  Args = {11,nPoints,dt,[1 2],[1 2],Ea,Eb,rc(),rc(),rc(),rc()};
+  Name = sprintf('hyscore_states%d',nStates);
+  W = [W benchworkload('sf_evolve',Name,Args,1,...
+    nStates^4*prod(nPoints),'peak-points')]; %#ok<AGROW>
+end
+
+end
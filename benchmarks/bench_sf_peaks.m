@@ -0,0 +1,40 @@
+function W = bench_sf_peaks()
+
+% HYSCORE peak binning (incrementation scheme [1 2]) for several numbers of
+% nuclear states, for one orientation and for a batch of orientations
+
+nPoints = 256;
+dt = [0.008 0.008]; % us
+
+W = [];
+for nStates = [6 12 24]
+  [Ea,Eb,G,D,M1l,M1r] = pathwaymatrices(nStates,1);
+  bufferRe = zeros(nPoints,nPoints);
+  bufferIm = zeros(nPoints,nPoints);
+  Args = {11,bufferRe,bufferIm,dt,[1 2],[1 2],Ea,Eb,G,D,M1l,M1r};
+  Name = sprintf('hyscore_states%d',nStates);
+  W = [W benchworkload('sf_peaks',Name,Args,2,@(out)out{1}+out{2},'peaks')]; %#ok<AGROW>
+end
+
+nStates = 12;
+nOri = 64;
+[Ea,Eb,G,D,M1l,M1r] = pathwaymatrices(nStates,nOri);
+Weights = rand(1,nOri);
+bufferRe = zeros(nPoints,nPoints);
+bufferIm = zeros(nPoints,nPoints);
+Args = {11,bufferRe,bufferIm,dt,[1 2],[1 2],Ea,Eb,G,D,M1l,M1r,Weights};
+W(end+1) = benchworkload('sf_peaks',sprintf('hyscore_states%d_ori%d',nStates,nOri),...
+  Args,2,@(out)out{1}+out{2},'peaks');
+
+end
+
+% Energies (MHz) and random complex matrices, stacked for nOri orientations
+function [Ea,Eb,G,D,M1l,M1r] = pathwaymatrices(nStates,nOri)
+Ea = sort(20*randn(nStates,nOri),1);
+Eb = sort(20*randn(nStates,nOri),1);
+rc = @() complex(randn(nStates,nStates,nOri),randn(nStates,nStates,nOri));
+G = rc();
+D = rc();
+M1l = rc();
+M1r = rc();
+end
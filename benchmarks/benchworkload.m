@@ -0,0 +1,19 @@
+% benchworkload   Define a benchmark workload for esbench
+%
+%   W = benchworkload(Kernel,Name,Args,nOut,Count,Unit)
+%
+%   Kernel   name of the MEX function in easyspin/private
+%   Name     workload label, used in reports and file names
+%   Args     cell array of input arguments of the kernel
+%   nOut     number of output arguments to request
+%   Count    number of elements processed per call, for throughput, or a
+%            function handle that computes it from the cell array of
+%            outputs
+%   Unit     unit of Count (e.g. 'peaks')
+
+function W = benchworkload(Kernel,Name,Args,nOut,Count,Unit)
+
+W = struct('Kernel',Kernel,'Name',Name,'Args',{Args},'nOut',nOut,...
+  'Count',{Count},'Unit',Unit);
+
+end
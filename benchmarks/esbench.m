@@ -0,0 +1,236 @@
+% esbench   Run benchmarks of the MEX kernels in easyspin/private
+%
+%   esbench
+%   esbench(BenchName)
+%   esbench(BenchName,params)
+%   results = esbench(...)
+%
+%   Runs all benchmark functions bench_*.m in this folder whose names
+%   start with bench_<BenchName>, and reports wall time, throughput and
+%   peak memory of each workload.
+%
+%   params is a character array with options:
+%     'q'   quick: time only one call per workload (default: 5)
+%     'w'   write the inputs of each workload to mexbench/data/, for
+%           running the kernel with the standalone C driver mexbench
+%
+%   results is a structure array with one element per workload, with
+%   fields Kernel, Name, Time (median wall time per call, in seconds),
+%   Throughput (Count/Time), Unit, and PeakMemory (peak increase of the
+%   resident memory during a call, in MB; NaN where not available).
+%
+%   Each benchmark file is run with the random number generator seeded
+%   to 0, so the workloads are reproducible.
+
+function results = esbench(BenchName,params)
+
+EasySpinPath = fileparts(which('easyspin'));
+if isempty(EasySpinPath)
+  error('EasySpin is not on the MATLAB path!');
+end
+
+if nargin<1
+  BenchName = '';
+end
+if nargin<2
+  params = '';
+end
+
+quickMode = any(params=='q');
+writeInputs = any(params=='w');
+if quickMode
+  nRepeats = 1;
+else
+  nRepeats = 5;
+end
+
+BenchPath = fileparts(mfilename('fullpath'));
+FileList = dir(fullfile(BenchPath,['bench_' BenchName '*.m']));
+if numel(FileList)==0
+  fprintf('No benchmark functions matching the pattern bench_%s*.m\n',BenchName);
+  return
+end
+BenchFileNames = sort({FileList.name});
+
+DataPath = fullfile(BenchPath,'mexbench','data');
+if writeInputs && ~exist(DataPath,'dir')
+  mkdir(DataPath);
+end
+
+fid = 1; % output to command window
+fprintf(fid,'=======================================================================\n');
+fprintf(fid,'EasySpin benchmarks                    %s\n(MATLAB %s)\n',char(datetime),version);
+fprintf(fid,'EasySpin location: %s\n',EasySpinPath);
+fprintf(fid,'Threads: %d, repeats: %d\n',maxNumCompThreads,nRepeats);
+fprintf(fid,'=======================================================================\n');
+fprintf(fid,'%-22s %-26s %10s %14s %-12s %8s\n',...
+  'kernel','workload','time (ms)','throughput','unit/s','MB');
+fprintf(fid,'-----------------------------------------------------------------------\n');
+
+results = struct('Kernel',{},'Name',{},'Time',{},'Throughput',{},...
+  'Unit',{},'PeakMemory',{});
+
+for iFile = 1:numel(BenchFileNames)
+
+  % Set up workloads
+  rng(0,'twister');
+  thisBench = BenchFileNames{iFile}(1:end-2);
+  Workloads = feval(thisBench);
+
+  for w = 1:numel(Workloads)
+    W = Workloads(w);
+    out = cell(1,W.nOut);
+
+    if writeInputs
+      FileName = fullfile(DataPath,sprintf('%s_%s.bin',W.Kernel,W.Name));
+      writeworkload(FileName,W);
+    end
+
+    % Warm-up call, also used for counts that depend on the outputs
+    [out{:}] = runprivate(W.Kernel,W.Args{:});
+    if isa(W.Count,'function_handle')
+      Count = W.Count(out);
+    else
+      Count = W.Count;
+    end
+    out = cell(1,W.nOut);
+
+    % Timed calls
+    t = zeros(1,nRepeats);
+    peakMem = zeros(1,nRepeats);
+    for r = 1:nRepeats
+      mem0 = resetpeakmemory();
+      tic;
+      [out{:}] = runprivate(W.Kernel,W.Args{:});
+      t(r) = toc;
+      peakMem(r) = peakmemory() - mem0;
+      out = cell(1,W.nOut);
+    end
+
+    Result.Kernel = W.Kernel;
+    Result.Name = W.Name;
+    Result.Time = median(t);
+    Result.Throughput = Count/Result.Time;
+    Result.Unit = W.Unit;
+    Result.PeakMemory = max(peakMem);
+    results(end+1) = Result; %#ok<AGROW>
+
+    fprintf(fid,'%-22s %-26s %10.3f %14.4g %-12s %8.1f\n',...
+      W.Kernel,W.Name,Result.Time*1e3,Result.Throughput,W.Unit,Result.PeakMemory);
+  end
+
+end
+
+fprintf(fid,'=======================================================================\n');
+
+if nargout==0
+  clear results
+end
+
+end
+
+%-------------------------------------------------------------------------------
+% Peak resident memory, in MB. On Linux, the peak (VmHWM) is reset to the
+% current resident memory (VmRSS), which is returned. Elsewhere, NaN.
+function mem = resetpeakmemory()
+mem = NaN;
+fid = fopen('/proc/self/clear_refs','w');
+if fid<0, return; end
+fprintf(fid,'5');
+fclose(fid);
+mem = procstatus('VmRSS');
+end
+
+function mem = peakmemory()
+mem = procstatus('VmHWM');
+end
+
+function val = procstatus(Field)
+val = NaN;
+fid = fopen('/proc/self/status','r');
+if fid<0, return; end
+txt = fread(fid,inf,'*char').';
+fclose(fid);
+tok = regexp(txt,[Field ':\s*(\d+)\s*kB'],'tokens','once');
+if ~isempty(tok)
+  val = str2double(tok{1})/1024;
+end
+end
+
+%-------------------------------------------------------------------------------
+% Writes the inputs of a workload in the binary format read by mexbench
+% (see mexbench/README.md).
+function writeworkload(FileName,W)
+fid = fopen(FileName,'w','ieee-le');
+if fid<0
+  error('Could not open %s for writing.',FileName);
+end
+if isa(W.Count,'function_handle')
+  Count = NaN; % not known before the call
+else
+  Count = W.Count;
+end
+fwrite(fid,'ESBENCH1','char');
+writestring(fid,W.Kernel);
+writestring(fid,W.Name);
+writestring(fid,W.Unit);
+fwrite(fid,Count,'double');
+fwrite(fid,W.nOut,'uint32');
+fwrite(fid,numel(W.Args),'uint32');
+for a = 1:numel(W.Args)
+  writearray(fid,W.Args{a});
+end
+fclose(fid);
+end
+
+function writestring(fid,str)
+fwrite(fid,numel(str),'uint32');
+fwrite(fid,str,'char');
+end
+
+function writearray(fid,x)
+if isa(x,'function_handle')
+  error('Function handles cannot be written to benchmark input files.');
+end
+writestring(fid,class(x));
+isCplx = isnumeric(x) && ~isreal(x);
+fwrite(fid,[isCplx issparse(x)],'uint8');
+fwrite(fid,ndims(x),'uint32');
+fwrite(fid,size(x),'uint64');
+if issparse(x)
+  [ir,jc,vals] = find(x); % column-major order
+  fwrite(fid,numel(ir),'uint64');
+  fwrite(fid,ir-1,'uint64');
+  fwrite(fid,[0; cumsum(accumarray(jc(:),1,[size(x,2) 1]))],'uint64');
+  if islogical(x)
+    fwrite(fid,vals,'uint8');
+  else
+    fwrite(fid,real(vals),'double');
+    if isCplx, fwrite(fid,imag(vals),'double'); end
+  end
+elseif iscell(x)
+  for k = 1:numel(x)
+    writearray(fid,x{k});
+  end
+elseif isstruct(x)
+  Fields = fieldnames(x);
+  fwrite(fid,numel(Fields),'uint32');
+  for f = 1:numel(Fields)
+    writestring(fid,Fields{f});
+  end
+  for k = 1:numel(x)
+    for f = 1:numel(Fields)
+      writearray(fid,x(k).(Fields{f}));
+    end
+  end
+elseif ischar(x)
+  fwrite(fid,double(x(:)),'uint16');
+elseif islogical(x)
+  fwrite(fid,x(:),'uint8');
+elseif isnumeric(x)
+  fwrite(fid,real(x(:)),class(x));
+  if isCplx, fwrite(fid,imag(x(:)),class(x)); end
+else
+  error('Class %s cannot be written to benchmark input files.',class(x));
+end
+end
@@ -0,0 +1,27 @@
+/*
+blas.h     BLAS declarations for running EasySpin kernels outside MATLAB
+
+  Declares the BLAS routines used by the kernels with the 64-bit integer
+  (ILP64) interface of MATLAB's libmwblas. Link with an ILP64 BLAS whose
+  symbols carry a trailing underscore, e.g. OpenBLAS built with
+  INTERFACE64=1.
+
+This is an EasySpin file.
+ */
+
+#ifndef MEXSHIM_BLAS_H
+#define MEXSHIM_BLAS_H
+
+#include <stddef.h>
+
+#define dgemm dgemm_
+#define sgemm sgemm_
+
+void dgemm(char *transa, char *transb, ptrdiff_t *m, ptrdiff_t *n,
+           ptrdiff_t *k, double *alpha, double *a, ptrdiff_t *lda,
+           double *b, ptrdiff_t *ldb, double *beta, double *c, ptrdiff_t *ldc);
+void sgemm(char *transa, char *transb, ptrdiff_t *m, ptrdiff_t *n,
+           ptrdiff_t *k, float *alpha, float *a, ptrdiff_t *lda,
+           float *b, ptrdiff_t *ldb, float *beta, float *c, ptrdiff_t *ldc);
+
+#endif
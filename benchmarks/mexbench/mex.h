@@ -0,0 +1,142 @@
+/*
+mex.h     MEX API shim for running EasySpin kernels outside MATLAB
+
+  Declares the subset of the MATLAB MEX and mx API that is used by the
+  kernels in easyspin/private, with the separate-complex storage of the
+  MATLAB API before R2018a. The implementation is in mexshim.c.
+
+This is an EasySpin file.
+ */
+
+#ifndef MEXSHIM_MEX_H
+#define MEXSHIM_MEX_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef size_t mwSize;
+typedef size_t mwIndex;
+typedef ptrdiff_t mwSignedIndex;
+typedef unsigned short mxChar;
+typedef bool mxLogical;
+
+typedef enum {
+  mxUNKNOWN_CLASS = 0, mxCELL_CLASS, mxSTRUCT_CLASS, mxLOGICAL_CLASS,
+  mxCHAR_CLASS, mxVOID_CLASS, mxDOUBLE_CLASS, mxSINGLE_CLASS,
+  mxINT8_CLASS, mxUINT8_CLASS, mxINT16_CLASS, mxUINT16_CLASS,
+  mxINT32_CLASS, mxUINT32_CLASS, mxINT64_CLASS, mxUINT64_CLASS,
+  mxFUNCTION_CLASS
+} mxClassID;
+
+typedef enum { mxREAL = 0, mxCOMPLEX = 1 } mxComplexity;
+
+typedef struct mxArray_tag mxArray;
+
+/* MEX functions */
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]);
+void mexErrMsgTxt(const char *msg);
+void mexErrMsgIdAndTxt(const char *id, const char *fmt, ...);
+void mexWarnMsgTxt(const char *msg);
+int mexPrintf(const char *fmt, ...);
+int mexCallMATLAB(int nlhs, mxArray *plhs[], int nrhs, mxArray *prhs[],
+                  const char *name);
+int mexAtExit(void (*fcn)(void));
+const mxArray *mexGetVariablePtr(const char *workspace, const char *name);
+void mexMakeMemoryPersistent(void *ptr);
+void mexMakeArrayPersistent(mxArray *pa);
+
+/* Memory */
+void *mxMalloc(size_t n);
+void *mxCalloc(size_t n, size_t size);
+void *mxRealloc(void *ptr, size_t n);
+void mxFree(void *ptr);
+
+/* Creation and destruction */
+mxArray *mxCreateNumericArray(mwSize ndim, const mwSize *dims,
+                              mxClassID classid, mxComplexity flag);
+mxArray *mxCreateNumericMatrix(mwSize m, mwSize n, mxClassID classid,
+                               mxComplexity flag);
+mxArray *mxCreateDoubleMatrix(mwSize m, mwSize n, mxComplexity flag);
+mxArray *mxCreateDoubleScalar(double value);
+mxArray *mxCreateLogicalScalar(bool value);
+mxArray *mxCreateString(const char *str);
+mxArray *mxCreateSparse(mwSize m, mwSize n, mwSize nzmax, mxComplexity flag);
+mxArray *mxCreateCellArray(mwSize ndim, const mwSize *dims);
+mxArray *mxCreateCellMatrix(mwSize m, mwSize n);
+mxArray *mxCreateStructArray(mwSize ndim, const mwSize *dims, int nfields,
+                             const char **fieldnames);
+mxArray *mxCreateStructMatrix(mwSize m, mwSize n, int nfields,
+                              const char **fieldnames);
+mxArray *mxDuplicateArray(const mxArray *pa);
+void mxDestroyArray(mxArray *pa);
+
+/* Data access */
+double *mxGetPr(const mxArray *pa);
+double *mxGetPi(const mxArray *pa);
+void *mxGetData(const mxArray *pa);
+void *mxGetImagData(const mxArray *pa);
+void mxSetPr(mxArray *pa, double *pr);
+void mxSetPi(mxArray *pa, double *pi);
+void mxSetData(mxArray *pa, void *pr);
+void mxSetImagData(mxArray *pa, void *pi);
+mwIndex *mxGetIr(const mxArray *pa);
+mwIndex *mxGetJc(const mxArray *pa);
+mwSize mxGetNzmax(const mxArray *pa);
+void mxSetIr(mxArray *pa, mwIndex *ir);
+void mxSetJc(mxArray *pa, mwIndex *jc);
+void mxSetNzmax(mxArray *pa, mwSize nzmax);
+mxArray *mxGetCell(const mxArray *pa, mwIndex i);
+void mxSetCell(mxArray *pa, mwIndex i, mxArray *value);
+mxArray *mxGetField(const mxArray *pa, mwIndex i, const char *fieldname);
+void mxSetField(mxArray *pa, mwIndex i, const char *fieldname, mxArray *value);
+mxArray *mxGetFieldByNumber(const mxArray *pa, mwIndex i, int fieldnumber);
+void mxSetFieldByNumber(mxArray *pa, mwIndex i, int fieldnumber, mxArray *value);
+const char *mxGetFieldNameByNumber(const mxArray *pa, int fieldnumber);
+int mxGetNumberOfFields(const mxArray *pa);
+double mxGetScalar(const mxArray *pa);
+char *mxArrayToString(const mxArray *pa);
+int mxGetString(const mxArray *pa, char *buf, mwSize buflen);
+
+/* Size */
+size_t mxGetM(const mxArray *pa);
+size_t mxGetN(const mxArray *pa);
+void mxSetM(mxArray *pa, mwSize m);
+void mxSetN(mxArray *pa, mwSize n);
+size_t mxGetNumberOfElements(const mxArray *pa);
+mwSize mxGetNumberOfDimensions(const mxArray *pa);
+const mwSize *mxGetDimensions(const mxArray *pa);
+int mxSetDimensions(mxArray *pa, const mwSize *dims, mwSize ndim);
+size_t mxGetElementSize(const mxArray *pa);
+
+/* Type */
+mxClassID mxGetClassID(const mxArray *pa);
+const char *mxGetClassName(const mxArray *pa);
+bool mxIsComplex(const mxArray *pa);
+bool mxIsSparse(const mxArray *pa);
+bool mxIsDouble(const mxArray *pa);
+bool mxIsSingle(const mxArray *pa);
+bool mxIsLogical(const mxArray *pa);
+bool mxIsChar(const mxArray *pa);
+bool mxIsCell(const mxArray *pa);
+bool mxIsStruct(const mxArray *pa);
+bool mxIsNumeric(const mxArray *pa);
+bool mxIsEmpty(const mxArray *pa);
+bool mxIsFunctionHandle(const mxArray *pa);
+bool mxIsInt8(const mxArray *pa);
+bool mxIsUint8(const mxArray *pa);
+bool mxIsInt16(const mxArray *pa);
+bool mxIsUint16(const mxArray *pa);
+bool mxIsInt32(const mxArray *pa);
+bool mxIsUint32(const mxArray *pa);
+bool mxIsInt64(const mxArray *pa);
+bool mxIsUint64(const mxArray *pa);
+
+/* Floating point */
+bool mxIsNaN(double x);
+bool mxIsInf(double x);
+bool mxIsFinite(double x);
+double mxGetNaN(void);
+double mxGetInf(void);
+double mxGetEps(void);
+
+#endif
@@ -0,0 +1,122 @@
+/*
+mexbench.c     Standalone driver for benchmarking EasySpin MEX kernels
+
+  Usage: <kernel>_bench workload.bin [nRepeats]
+
+  Reads a workload written by esbench (option 'w'), calls the kernel
+  once to warm up and then nRepeats times (default 5), and reports the
+  minimum and median wall time per call, the throughput, the peak memory
+  allocated through the MEX API during a call, and the peak resident
+  memory of the process. The kernel source is compiled into the same
+  executable, see README.md.
+
+This is an EasySpin file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "mexshim.h"
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+static int compare(const void *a, const void *b)
+{
+  double x = *(const double*)a, y = *(const double*)b;
+  return (x>y) - (x<y);
+}
+
+static void destroyoutputs(int nOut, mxArray **out)
+{
+  int k;
+  for (k=0; k<nOut; k++) {
+    mxDestroyArray(out[k]);
+    out[k] = NULL;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  struct Workload W;
+  struct rusage usage;
+  mxArray **out;
+  const char *err;
+  double *t, t0, tMedian;
+  size_t peakBytes = 0, base;
+  int r, nRepeats = 5, status;
+
+  if (argc<2 || argc>3) {
+    fprintf(stderr,"Usage: %s workload.bin [nRepeats]\n",argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (argc==3) nRepeats = atoi(argv[2]);
+  if (nRepeats<1) nRepeats = 1;
+
+  status = mexshim_readworkload(argv[1],&W);
+  if (status==1) {
+    fprintf(stderr,"Could not open %s.\n",argv[1]);
+    return EXIT_FAILURE;
+  }
+  if (status==2) {
+    fprintf(stderr,"%s is not a valid benchmark input file.\n",argv[1]);
+    return EXIT_FAILURE;
+  }
+
+  out = (mxArray**)calloc(W.nOut ? W.nOut : 1,sizeof(mxArray*));
+  t = (double*)malloc(nRepeats*sizeof(double));
+  if (out==NULL || t==NULL) {
+    fprintf(stderr,"Out of memory.\n");
+    return EXIT_FAILURE;
+  }
+
+  /* Warm-up call */
+  err = mexshim_call(W.nOut,out,W.nArgs,(const mxArray**)W.Args);
+  if (err!=NULL) {
+    fprintf(stderr,"%s: %s\n",W.Kernel,err);
+    return EXIT_FAILURE;
+  }
+  destroyoutputs(W.nOut,out);
+
+  /* Timed calls */
+  for (r=0; r<nRepeats; r++) {
+    base = mexshim_allocated();
+    mexshim_resetpeak();
+    t0 = now();
+    err = mexshim_call(W.nOut,out,W.nArgs,(const mxArray**)W.Args);
+    t[r] = now() - t0;
+    if (err!=NULL) {
+      fprintf(stderr,"%s: %s\n",W.Kernel,err);
+      return EXIT_FAILURE;
+    }
+    if (mexshim_peak()-base>peakBytes) peakBytes = mexshim_peak()-base;
+    destroyoutputs(W.nOut,out);
+  }
+
+  qsort(t,nRepeats,sizeof(double),compare);
+  tMedian = (nRepeats%2) ? t[nRepeats/2] : 0.5*(t[nRepeats/2-1]+t[nRepeats/2]);
+  getrusage(RUSAGE_SELF,&usage);
+
+  printf("kernel:      %s\n",W.Kernel);
+  printf("workload:    %s\n",W.Name);
+  printf("repeats:     %d\n",nRepeats);
+  printf("time (ms):   min %.3f, median %.3f\n",t[0]*1e3,tMedian*1e3);
+  if (W.Count==W.Count)
+    printf("throughput:  %.4g %s/s\n",W.Count/tMedian,W.Unit);
+  else
+    printf("throughput:  n/a (count depends on outputs)\n");
+  printf("mx peak:     %.1f MB\n",peakBytes/1048576.0);
+  printf("max RSS:     %.1f MB\n",usage.ru_maxrss/1024.0);
+
+  mexshim_exit();
+  mexshim_freeworkload(&W);
+  free(t);
+  free(out);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,719 @@
+/*
+mexshim.c     MEX API shim for running EasySpin kernels outside MATLAB
+
+  Implements the API declared in mex.h on top of the C library, together
+  with a reader for the workload files written by esbench (option 'w').
+
+  All memory allocated through the API is counted, so that the driver
+  can report the peak memory allocated during a kernel call. Unlike in
+  MATLAB, memory is not freed automatically when mexFunction returns.
+  Errors raised with mexErrMsgTxt jump back to the driver (see
+  mexshim_call).
+
+This is an EasySpin file.
+ */
+
+#include <math.h>
+#include <float.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mex.h"
+#include "mexshim.h"
+
+struct mxArray_tag {
+  mxClassID classID;
+  mwSize nDims;
+  mwSize *dims;
+  bool isComplex, isSparse;
+  void *pr, *pi;
+  mwIndex *ir, *jc;
+  mwSize nzmax;
+  int nFields;
+  char **fieldNames;
+  mxArray **elements; /* cells, or fields of struct elements */
+};
+
+/*
+=============================================================
+Counted memory. Each block is preceded by a header that holds
+its size, so that mxFree and mxRealloc can update the counts.
+=============================================================
+*/
+typedef union { size_t size; double align; } BlockHeader;
+static size_t allocatedBytes = 0, peakBytes = 0;
+
+void *mxMalloc(size_t n)
+{
+  BlockHeader *h = (BlockHeader*)malloc(sizeof(BlockHeader)+n);
+  if (h==NULL) mexErrMsgTxt("Out of memory.");
+  h->size = n;
+  allocatedBytes += n;
+  if (allocatedBytes>peakBytes) peakBytes = allocatedBytes;
+  return h+1;
+}
+
+void *mxCalloc(size_t n, size_t size)
+{
+  void *p = mxMalloc(n*size);
+  memset(p,0,n*size);
+  return p;
+}
+
+void mxFree(void *ptr)
+{
+  BlockHeader *h;
+  if (ptr==NULL) return;
+  h = (BlockHeader*)ptr - 1;
+  allocatedBytes -= h->size;
+  free(h);
+}
+
+void *mxRealloc(void *ptr, size_t n)
+{
+  void *p;
+  size_t oldSize;
+  if (ptr==NULL) return mxMalloc(n);
+  oldSize = ((BlockHeader*)ptr - 1)->size;
+  p = mxMalloc(n);
+  memcpy(p,ptr,(oldSize<n) ? oldSize : n);
+  mxFree(ptr);
+  return p;
+}
+
+void mexMakeMemoryPersistent(void *ptr) { (void)ptr; }
+void mexMakeArrayPersistent(mxArray *pa) { (void)pa; }
+
+size_t mexshim_allocated(void) { return allocatedBytes; }
+size_t mexshim_peak(void) { return peakBytes; }
+void mexshim_resetpeak(void) { peakBytes = allocatedBytes; }
+
+/*
+=============================================================
+Errors, output, and calls into MATLAB
+=============================================================
+*/
+static jmp_buf *errorJump = NULL;
+static char errorMessage[1024];
+
+void mexErrMsgTxt(const char *msg)
+{
+  snprintf(errorMessage,sizeof(errorMessage),"%s",msg);
+  if (errorJump!=NULL) longjmp(*errorJump,1);
+  fprintf(stderr,"Error: %s\n",msg);
+  exit(EXIT_FAILURE);
+}
+
+void mexErrMsgIdAndTxt(const char *id, const char *fmt, ...)
+{
+  char msg[1024];
+  va_list args;
+  (void)id;
+  va_start(args,fmt);
+  vsnprintf(msg,sizeof(msg),fmt,args);
+  va_end(args);
+  mexErrMsgTxt(msg);
+}
+
+void mexWarnMsgTxt(const char *msg)
+{
+  fprintf(stderr,"Warning: %s\n",msg);
+}
+
+int mexPrintf(const char *fmt, ...)
+{
+  int n;
+  va_list args;
+  va_start(args,fmt);
+  n = vprintf(fmt,args);
+  va_end(args);
+  return n;
+}
+
+int mexCallMATLAB(int nlhs, mxArray *plhs[], int nrhs, mxArray *prhs[],
+                  const char *name)
+{
+  (void)nlhs; (void)plhs; (void)nrhs; (void)prhs; (void)name;
+  mexErrMsgTxt("mexCallMATLAB is not available outside MATLAB.");
+  return 1;
+}
+
+/* There are no workspaces outside MATLAB. Kernels see the variables as
+   undefined, so EasySpinThreads falls back to OMP_NUM_THREADS. */
+const mxArray *mexGetVariablePtr(const char *workspace, const char *name)
+{
+  (void)workspace; (void)name;
+  return NULL;
+}
+
+static void (*atExitFcn)(void) = NULL;
+
+int mexAtExit(void (*fcn)(void))
+{
+  atExitFcn = fcn;
+  return 0;
+}
+
+const char *mexshim_call(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  jmp_buf jump;
+  errorJump = &jump;
+  if (setjmp(jump)) {
+    errorJump = NULL;
+    return errorMessage;
+  }
+  mexFunction(nlhs,plhs,nrhs,prhs);
+  errorJump = NULL;
+  return NULL;
+}
+
+void mexshim_exit(void)
+{
+  if (atExitFcn!=NULL) atExitFcn();
+  atExitFcn = NULL;
+}
+
+/*
+=============================================================
+Array creation and destruction
+=============================================================
+*/
+static size_t classsize(mxClassID classID)
+{
+  switch (classID) {
+  case mxDOUBLE_CLASS: case mxINT64_CLASS: case mxUINT64_CLASS: return 8;
+  case mxSINGLE_CLASS: case mxINT32_CLASS: case mxUINT32_CLASS: return 4;
+  case mxINT16_CLASS: case mxUINT16_CLASS: case mxCHAR_CLASS: return 2;
+  case mxINT8_CLASS: case mxUINT8_CLASS: case mxLOGICAL_CLASS: return 1;
+  case mxCELL_CLASS: case mxSTRUCT_CLASS: return sizeof(mxArray*);
+  default: return 0;
+  }
+}
+
+static mxArray *newarray(mxClassID classID, mwSize nDims, const mwSize *dims)
+{
+  mxArray *pa = (mxArray*)mxCalloc(1,sizeof(mxArray));
+  mwSize k;
+  pa->classID = classID;
+  pa->nDims = (nDims<2) ? 2 : nDims;
+  pa->dims = (mwSize*)mxMalloc(pa->nDims*sizeof(mwSize));
+  for (k=0; k<pa->nDims; k++)
+    pa->dims[k] = (k<nDims) ? dims[k] : 1;
+  if (nDims==0) pa->dims[0] = pa->dims[1] = 0;
+  return pa;
+}
+
+mxArray *mxCreateNumericArray(mwSize ndim, const mwSize *dims,
+                              mxClassID classid, mxComplexity flag)
+{
+  mxArray *pa = newarray(classid,ndim,dims);
+  size_t n = mxGetNumberOfElements(pa);
+  pa->isComplex = (flag==mxCOMPLEX);
+  pa->pr = mxCalloc(n ? n : 1,classsize(classid));
+  if (pa->isComplex) pa->pi = mxCalloc(n ? n : 1,classsize(classid));
+  return pa;
+}
+
+mxArray *mxCreateNumericMatrix(mwSize m, mwSize n, mxClassID classid,
+                               mxComplexity flag)
+{
+  mwSize dims[2];
+  dims[0] = m; dims[1] = n;
+  return mxCreateNumericArray(2,dims,classid,flag);
+}
+
+mxArray *mxCreateDoubleMatrix(mwSize m, mwSize n, mxComplexity flag)
+{
+  return mxCreateNumericMatrix(m,n,mxDOUBLE_CLASS,flag);
+}
+
+mxArray *mxCreateDoubleScalar(double value)
+{
+  mxArray *pa = mxCreateDoubleMatrix(1,1,mxREAL);
+  *(double*)pa->pr = value;
+  return pa;
+}
+
+mxArray *mxCreateLogicalScalar(bool value)
+{
+  mxArray *pa = mxCreateNumericMatrix(1,1,mxLOGICAL_CLASS,mxREAL);
+  *(mxLogical*)pa->pr = value;
+  return pa;
+}
+
+mxArray *mxCreateString(const char *str)
+{
+  size_t k, n = strlen(str);
+  mxArray *pa = mxCreateNumericMatrix(1,n,mxCHAR_CLASS,mxREAL);
+  for (k=0; k<n; k++) ((mxChar*)pa->pr)[k] = (mxChar)(unsigned char)str[k];
+  return pa;
+}
+
+mxArray *mxCreateSparse(mwSize m, mwSize n, mwSize nzmax, mxComplexity flag)
+{
+  mwSize dims[2];
+  mxArray *pa;
+  dims[0] = m; dims[1] = n;
+  pa = newarray(mxDOUBLE_CLASS,2,dims);
+  if (nzmax<1) nzmax = 1;
+  pa->isSparse = true;
+  pa->isComplex = (flag==mxCOMPLEX);
+  pa->nzmax = nzmax;
+  pa->pr = mxCalloc(nzmax,sizeof(double));
+  if (pa->isComplex) pa->pi = mxCalloc(nzmax,sizeof(double));
+  pa->ir = (mwIndex*)mxCalloc(nzmax,sizeof(mwIndex));
+  pa->jc = (mwIndex*)mxCalloc(n+1,sizeof(mwIndex));
+  return pa;
+}
+
+mxArray *mxCreateCellArray(mwSize ndim, const mwSize *dims)
+{
+  mxArray *pa = newarray(mxCELL_CLASS,ndim,dims);
+  size_t n = mxGetNumberOfElements(pa);
+  pa->elements = (mxArray**)mxCalloc(n ? n : 1,sizeof(mxArray*));
+  return pa;
+}
+
+mxArray *mxCreateCellMatrix(mwSize m, mwSize n)
+{
+  mwSize dims[2];
+  dims[0] = m; dims[1] = n;
+  return mxCreateCellArray(2,dims);
+}
+
+mxArray *mxCreateStructArray(mwSize ndim, const mwSize *dims, int nfields,
+                             const char **fieldnames)
+{
+  mxArray *pa = newarray(mxSTRUCT_CLASS,ndim,dims);
+  size_t n = mxGetNumberOfElements(pa);
+  int f;
+  pa->nFields = nfields;
+  pa->fieldNames = (char**)mxCalloc(nfields ? nfields : 1,sizeof(char*));
+  for (f=0; f<nfields; f++) {
+    pa->fieldNames[f] = (char*)mxMalloc(strlen(fieldnames[f])+1);
+    strcpy(pa->fieldNames[f],fieldnames[f]);
+  }
+  pa->elements = (mxArray**)mxCalloc((n*nfields>0) ? n*nfields : 1,sizeof(mxArray*));
+  return pa;
+}
+
+mxArray *mxCreateStructMatrix(mwSize m, mwSize n, int nfields,
+                              const char **fieldnames)
+{
+  mwSize dims[2];
+  dims[0] = m; dims[1] = n;
+  return mxCreateStructArray(2,dims,nfields,(const char**)fieldnames);
+}
+
+static size_t nelements(const mxArray *pa)
+{
+  size_t n = mxGetNumberOfElements(pa);
+  if (pa->classID==mxSTRUCT_CLASS) n *= pa->nFields;
+  return n;
+}
+
+mxArray *mxDuplicateArray(const mxArray *pa)
+{
+  mxArray *d;
+  size_t k, n, es;
+  if (pa==NULL) return NULL;
+  d = newarray(pa->classID,pa->nDims,pa->dims);
+  d->isComplex = pa->isComplex;
+  d->isSparse = pa->isSparse;
+  d->nzmax = pa->nzmax;
+  es = classsize(pa->classID);
+  if (pa->classID==mxCELL_CLASS || pa->classID==mxSTRUCT_CLASS) {
+    n = nelements(pa);
+    d->nFields = pa->nFields;
+    if (pa->nFields>0) {
+      d->fieldNames = (char**)mxCalloc(pa->nFields,sizeof(char*));
+      for (k=0; k<(size_t)pa->nFields; k++) {
+        d->fieldNames[k] = (char*)mxMalloc(strlen(pa->fieldNames[k])+1);
+        strcpy(d->fieldNames[k],pa->fieldNames[k]);
+      }
+    }
+    d->elements = (mxArray**)mxCalloc(n ? n : 1,sizeof(mxArray*));
+    for (k=0; k<n; k++) d->elements[k] = mxDuplicateArray(pa->elements[k]);
+    return d;
+  }
+  n = pa->isSparse ? pa->nzmax : mxGetNumberOfElements(pa);
+  if (n<1) n = 1;
+  d->pr = mxMalloc(n*es);
+  memcpy(d->pr,pa->pr,n*es);
+  if (pa->isComplex) {
+    d->pi = mxMalloc(n*es);
+    memcpy(d->pi,pa->pi,n*es);
+  }
+  if (pa->isSparse) {
+    d->ir = (mwIndex*)mxMalloc(n*sizeof(mwIndex));
+    memcpy(d->ir,pa->ir,n*sizeof(mwIndex));
+    d->jc = (mwIndex*)mxMalloc((mxGetN(pa)+1)*sizeof(mwIndex));
+    memcpy(d->jc,pa->jc,(mxGetN(pa)+1)*sizeof(mwIndex));
+  }
+  return d;
+}
+
+void mxDestroyArray(mxArray *pa)
+{
+  size_t k, n;
+  if (pa==NULL) return;
+  if (pa->elements!=NULL) {
+    n = nelements(pa);
+    for (k=0; k<n; k++) mxDestroyArray(pa->elements[k]);
+    mxFree(pa->elements);
+  }
+  for (k=0; k<(size_t)pa->nFields; k++) mxFree(pa->fieldNames[k]);
+  mxFree(pa->fieldNames);
+  mxFree(pa->pr);
+  mxFree(pa->pi);
+  mxFree(pa->ir);
+  mxFree(pa->jc);
+  mxFree(pa->dims);
+  mxFree(pa);
+}
+
+/*
+=============================================================
+Data access
+=============================================================
+*/
+double *mxGetPr(const mxArray *pa) { return (double*)pa->pr; }
+double *mxGetPi(const mxArray *pa) { return (double*)pa->pi; }
+void *mxGetData(const mxArray *pa) { return pa->pr; }
+void *mxGetImagData(const mxArray *pa) { return pa->pi; }
+void mxSetPr(mxArray *pa, double *pr) { pa->pr = pr; }
+void mxSetPi(mxArray *pa, double *pi) { pa->pi = pi; pa->isComplex = (pi!=NULL); }
+void mxSetData(mxArray *pa, void *pr) { pa->pr = pr; }
+void mxSetImagData(mxArray *pa, void *pi) { pa->pi = pi; pa->isComplex = (pi!=NULL); }
+mwIndex *mxGetIr(const mxArray *pa) { return pa->ir; }
+mwIndex *mxGetJc(const mxArray *pa) { return pa->jc; }
+mwSize mxGetNzmax(const mxArray *pa) { return pa->nzmax; }
+void mxSetIr(mxArray *pa, mwIndex *ir) { pa->ir = ir; }
+void mxSetJc(mxArray *pa, mwIndex *jc) { pa->jc = jc; }
+void mxSetNzmax(mxArray *pa, mwSize nzmax) { pa->nzmax = nzmax; }
+
+mxArray *mxGetCell(const mxArray *pa, mwIndex i)
+{
+  return pa->elements[i];
+}
+
+void mxSetCell(mxArray *pa, mwIndex i, mxArray *value)
+{
+  pa->elements[i] = value;
+}
+
+static int fieldnumber(const mxArray *pa, const char *fieldname)
+{
+  int f;
+  for (f=0; f<pa->nFields; f++)
+    if (strcmp(pa->fieldNames[f],fieldname)==0) return f;
+  return -1;
+}
+
+mxArray *mxGetField(const mxArray *pa, mwIndex i, const char *fieldname)
+{
+  int f;
+  if (pa->classID!=mxSTRUCT_CLASS) return NULL;
+  f = fieldnumber(pa,fieldname);
+  if (f<0) return NULL;
+  return pa->elements[i*pa->nFields+f];
+}
+
+void mxSetField(mxArray *pa, mwIndex i, const char *fieldname, mxArray *value)
+{
+  int f = fieldnumber(pa,fieldname);
+  if (f<0) mexErrMsgTxt("mxSetField: unknown field.");
+  pa->elements[i*pa->nFields+f] = value;
+}
+
+mxArray *mxGetFieldByNumber(const mxArray *pa, mwIndex i, int fieldnumber)
+{
+  return pa->elements[i*pa->nFields+fieldnumber];
+}
+
+void mxSetFieldByNumber(mxArray *pa, mwIndex i, int fieldnumber, mxArray *value)
+{
+  pa->elements[i*pa->nFields+fieldnumber] = value;
+}
+
+const char *mxGetFieldNameByNumber(const mxArray *pa, int fieldnumber)
+{
+  return pa->fieldNames[fieldnumber];
+}
+
+int mxGetNumberOfFields(const mxArray *pa) { return pa->nFields; }
+
+double mxGetScalar(const mxArray *pa)
+{
+  if (pa==NULL || pa->pr==NULL || mxGetNumberOfElements(pa)==0) return 0;
+  switch (pa->classID) {
+  case mxDOUBLE_CLASS: return *(double*)pa->pr;
+  case mxSINGLE_CLASS: return *(float*)pa->pr;
+  case mxINT8_CLASS: return *(signed char*)pa->pr;
+  case mxUINT8_CLASS: return *(unsigned char*)pa->pr;
+  case mxINT16_CLASS: return *(short*)pa->pr;
+  case mxUINT16_CLASS: return *(unsigned short*)pa->pr;
+  case mxINT32_CLASS: return *(int*)pa->pr;
+  case mxUINT32_CLASS: return *(unsigned int*)pa->pr;
+  case mxINT64_CLASS: return (double)*(long long*)pa->pr;
+  case mxUINT64_CLASS: return (double)*(unsigned long long*)pa->pr;
+  case mxLOGICAL_CLASS: return *(mxLogical*)pa->pr;
+  case mxCHAR_CLASS: return *(mxChar*)pa->pr;
+  default: return 0;
+  }
+}
+
+char *mxArrayToString(const mxArray *pa)
+{
+  size_t k, n;
+  char *str;
+  if (pa->classID!=mxCHAR_CLASS) return NULL;
+  n = mxGetNumberOfElements(pa);
+  str = (char*)mxMalloc(n+1);
+  for (k=0; k<n; k++) str[k] = (char)((mxChar*)pa->pr)[k];
+  str[n] = 0;
+  return str;
+}
+
+int mxGetString(const mxArray *pa, char *buf, mwSize buflen)
+{
+  char *str = mxArrayToString(pa);
+  if (str==NULL || buflen<1) { mxFree(str); return 1; }
+  strncpy(buf,str,buflen-1);
+  buf[buflen-1] = 0;
+  mxFree(str);
+  return 0;
+}
+
+/*
+=============================================================
+Size and type
+=============================================================
+*/
+size_t mxGetM(const mxArray *pa) { return pa->dims[0]; }
+
+size_t mxGetN(const mxArray *pa)
+{
+  size_t n = 1;
+  mwSize k;
+  for (k=1; k<pa->nDims; k++) n *= pa->dims[k];
+  return n;
+}
+
+void mxSetM(mxArray *pa, mwSize m) { pa->dims[0] = m; }
+
+void mxSetN(mxArray *pa, mwSize n)
+{
+  pa->nDims = 2;
+  pa->dims[1] = n;
+}
+
+size_t mxGetNumberOfElements(const mxArray *pa)
+{
+  return mxGetM(pa)*mxGetN(pa);
+}
+
+mwSize mxGetNumberOfDimensions(const mxArray *pa) { return pa->nDims; }
+const mwSize *mxGetDimensions(const mxArray *pa) { return pa->dims; }
+
+int mxSetDimensions(mxArray *pa, const mwSize *dims, mwSize ndim)
+{
+  mwSize k;
+  mxFree(pa->dims);
+  pa->nDims = (ndim<2) ? 2 : ndim;
+  pa->dims = (mwSize*)mxMalloc(pa->nDims*sizeof(mwSize));
+  for (k=0; k<pa->nDims; k++) pa->dims[k] = (k<ndim) ? dims[k] : 1;
+  return 0;
+}
+
+size_t mxGetElementSize(const mxArray *pa) { return classsize(pa->classID); }
+
+mxClassID mxGetClassID(const mxArray *pa) { return pa->classID; }
+
+static const char *ClassNames[] = {
+  "unknown", "cell", "struct", "logical", "char", "void", "double", "single",
+  "int8", "uint8", "int16", "uint16", "int32", "uint32", "int64", "uint64",
+  "function_handle"
+};
+
+const char *mxGetClassName(const mxArray *pa) { return ClassNames[pa->classID]; }
+
+bool mxIsComplex(const mxArray *pa) { return pa->isComplex; }
+bool mxIsSparse(const mxArray *pa) { return pa->isSparse; }
+bool mxIsDouble(const mxArray *pa) { return pa->classID==mxDOUBLE_CLASS; }
+bool mxIsSingle(const mxArray *pa) { return pa->classID==mxSINGLE_CLASS; }
+bool mxIsLogical(const mxArray *pa) { return pa->classID==mxLOGICAL_CLASS; }
+bool mxIsChar(const mxArray *pa) { return pa->classID==mxCHAR_CLASS; }
+bool mxIsCell(const mxArray *pa) { return pa->classID==mxCELL_CLASS; }
+bool mxIsStruct(const mxArray *pa) { return pa->classID==mxSTRUCT_CLASS; }
+bool mxIsEmpty(const mxArray *pa) { return mxGetNumberOfElements(pa)==0; }
+bool mxIsFunctionHandle(const mxArray *pa) { return pa->classID==mxFUNCTION_CLASS; }
+bool mxIsInt8(const mxArray *pa) { return pa->classID==mxINT8_CLASS; }
+bool mxIsUint8(const mxArray *pa) { return pa->classID==mxUINT8_CLASS; }
+bool mxIsInt16(const mxArray *pa) { return pa->classID==mxINT16_CLASS; }
+bool mxIsUint16(const mxArray *pa) { return pa->classID==mxUINT16_CLASS; }
+bool mxIsInt32(const mxArray *pa) { return pa->classID==mxINT32_CLASS; }
+bool mxIsUint32(const mxArray *pa) { return pa->classID==mxUINT32_CLASS; }
+bool mxIsInt64(const mxArray *pa) { return pa->classID==mxINT64_CLASS; }
+bool mxIsUint64(const mxArray *pa) { return pa->classID==mxUINT64_CLASS; }
+
+bool mxIsNumeric(const mxArray *pa)
+{
+  return pa->classID>=mxDOUBLE_CLASS && pa->classID<=mxUINT64_CLASS;
+}
+
+bool mxIsNaN(double x) { return x!=x; }
+bool mxIsInf(double x) { return x==HUGE_VAL || x==-HUGE_VAL; }
+bool mxIsFinite(double x) { return !mxIsNaN(x) && !mxIsInf(x); }
+double mxGetNaN(void) { return HUGE_VAL-HUGE_VAL; }
+double mxGetInf(void) { return HUGE_VAL; }
+double mxGetEps(void) { return DBL_EPSILON; }
+
+/*
+=============================================================
+Reader for workload files written by esbench
+=============================================================
+*/
+static int readbytes(FILE *f, void *buf, size_t n)
+{
+  return fread(buf,1,n,f)==n;
+}
+
+static char *readstring(FILE *f)
+{
+  unsigned int n;
+  char *str;
+  if (!readbytes(f,&n,4)) return NULL;
+  str = (char*)mxMalloc(n+1);
+  if (!readbytes(f,str,n)) { mxFree(str); return NULL; }
+  str[n] = 0;
+  return str;
+}
+
+static mxClassID classfromname(const char *name)
+{
+  int c;
+  for (c=0; c<=mxFUNCTION_CLASS; c++)
+    if (strcmp(name,ClassNames[c])==0) return (mxClassID)c;
+  return mxUNKNOWN_CLASS;
+}
+
+static mxArray *readarray(FILE *f)
+{
+  char *className;
+  unsigned char flags[2];
+  unsigned int nDims, nFields, k;
+  unsigned long long d, nnz, *idx;
+  mwSize *dims, dimsBuf[32];
+  size_t n, i, es;
+  mxClassID classID;
+  mxArray *pa = NULL;
+  char **fieldNames;
+
+  className = readstring(f);
+  if (className==NULL) return NULL;
+  classID = classfromname(className);
+  mxFree(className);
+  if (classID==mxUNKNOWN_CLASS) return NULL;
+  if (!readbytes(f,flags,2) || !readbytes(f,&nDims,4) || nDims>32) return NULL;
+  dims = dimsBuf;
+  for (k=0; k<nDims; k++) {
+    if (!readbytes(f,&d,8)) return NULL;
+    dims[k] = (mwSize)d;
+  }
+
+  if (flags[1]) { /* sparse */
+    if (!readbytes(f,&nnz,8)) return NULL;
+    pa = mxCreateSparse(dims[0],dims[1],(mwSize)nnz,flags[0] ? mxCOMPLEX : mxREAL);
+    if (classID==mxLOGICAL_CLASS) {
+      pa->classID = mxLOGICAL_CLASS;
+      mxFree(pa->pr);
+      pa->pr = mxCalloc(nnz ? nnz : 1,1);
+    }
+    idx = (unsigned long long*)mxMalloc((nnz+dims[1]+1)*8);
+    if (!readbytes(f,idx,(nnz+dims[1]+1)*8)) { mxFree(idx); mxDestroyArray(pa); return NULL; }
+    for (i=0; i<nnz; i++) pa->ir[i] = (mwIndex)idx[i];
+    for (i=0; i<=dims[1]; i++) pa->jc[i] = (mwIndex)idx[nnz+i];
+    mxFree(idx);
+    es = (classID==mxLOGICAL_CLASS) ? 1 : 8;
+    if (!readbytes(f,pa->pr,nnz*es) || (flags[0] && !readbytes(f,pa->pi,nnz*es))) {
+      mxDestroyArray(pa);
+      return NULL;
+    }
+    return pa;
+  }
+
+  switch (classID) {
+  case mxCELL_CLASS:
+    pa = mxCreateCellArray(nDims,dims);
+    n = mxGetNumberOfElements(pa);
+    for (i=0; i<n; i++) {
+      pa->elements[i] = readarray(f);
+      if (pa->elements[i]==NULL) { mxDestroyArray(pa); return NULL; }
+    }
+    return pa;
+  case mxSTRUCT_CLASS:
+    if (!readbytes(f,&nFields,4)) return NULL;
+    fieldNames = (char**)mxCalloc(nFields ? nFields : 1,sizeof(char*));
+    for (k=0; k<nFields; k++) fieldNames[k] = readstring(f);
+    pa = mxCreateStructArray(nDims,dims,(int)nFields,(const char**)fieldNames);
+    for (k=0; k<nFields; k++) mxFree(fieldNames[k]);
+    mxFree(fieldNames);
+    n = nelements(pa);
+    for (i=0; i<n; i++) {
+      pa->elements[i] = readarray(f);
+      if (pa->elements[i]==NULL) { mxDestroyArray(pa); return NULL; }
+    }
+    return pa;
+  default:
+    pa = mxCreateNumericArray(nDims,dims,classID,flags[0] ? mxCOMPLEX : mxREAL);
+    n = mxGetNumberOfElements(pa)*classsize(classID);
+    if (!readbytes(f,pa->pr,n) || (flags[0] && !readbytes(f,pa->pi,n))) {
+      mxDestroyArray(pa);
+      return NULL;
+    }
+    return pa;
+  }
+}
+
+int mexshim_readworkload(const char *fileName, struct Workload *W)
+{
+  FILE *f;
+  char magic[8];
+  unsigned int nOut, nArgs, a;
+
+  memset(W,0,sizeof(*W));
+  f = fopen(fileName,"rb");
+  if (f==NULL) return 1;
+  if (!readbytes(f,magic,8) || memcmp(magic,"ESBENCH1",8)!=0) { fclose(f); return 2; }
+  W->Kernel = readstring(f);
+  W->Name = readstring(f);
+  W->Unit = readstring(f);
+  if (W->Kernel==NULL || W->Name==NULL || W->Unit==NULL ||
+      !readbytes(f,&W->Count,8) || !readbytes(f,&nOut,4) || !readbytes(f,&nArgs,4)) {
+    fclose(f);
+    return 2;
+  }
+  W->nOut = (int)nOut;
+  W->nArgs = (int)nArgs;
+  W->Args = (mxArray**)mxCalloc(nArgs ? nArgs : 1,sizeof(mxArray*));
+  for (a=0; a<nArgs; a++) {
+    W->Args[a] = readarray(f);
+    if (W->Args[a]==NULL) { fclose(f); return 2; }
+  }
+  fclose(f);
+  return 0;
+}
+
+void mexshim_freeworkload(struct Workload *W)
+{
+  int a;
+  for (a=0; a<W->nArgs; a++) mxDestroyArray(W->Args[a]);
+  mxFree(W->Args);
+  mxFree(W->Kernel);
+  mxFree(W->Name);
+  mxFree(W->Unit);
+  memset(W,0,sizeof(*W));
+}
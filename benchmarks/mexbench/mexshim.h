@@ -0,0 +1,35 @@
+/*
+mexshim.h     Driver interface of the MEX API shim (see mexshim.c)
+
+This is an EasySpin file.
+ */
+
+#ifndef MEXSHIM_H
+#define MEXSHIM_H
+
+#include "mex.h"
+
+struct Workload {
+  char *Kernel, *Name, *Unit;
+  double Count;    /* work units per call, NaN if not known */
+  int nOut, nArgs;
+  mxArray **Args;
+};
+
+/* Reads a workload file. Returns 0 on success, 1 if the file cannot be
+   opened, and 2 if it is not a valid workload file. */
+int mexshim_readworkload(const char *fileName, struct Workload *W);
+void mexshim_freeworkload(struct Workload *W);
+
+/* Calls mexFunction. Returns NULL on success, or the error message. */
+const char *mexshim_call(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]);
+
+/* Runs the function registered with mexAtExit. */
+void mexshim_exit(void);
+
+/* Bytes allocated through the API: current, and peak since the last reset */
+size_t mexshim_allocated(void);
+size_t mexshim_peak(void);
+void mexshim_resetpeak(void);
+
+#endif
@@ -122,6 +122,13 @@
 %                    clustering; used for the Markov method
 %     LagTime        lag time for sliding window processing (only used for
 %                    'MD-direct')
+%     ChunkLength    number of spin propagation steps processed at a time
+%                    (only used for 'fast'); tensor trajectories,
+%                    propagators and density matrices are formed in
+%                    chunks of this length to limit their memory use; the
+%                    stochastic rotational trajectories are generated one
+%                    chunk at a time as well (except when trajectory
+%                    convergence is checked), default: all steps at once
 %
 %   MD: structure with molecular dynamics simulation parameters
 %
@@ -434,6 +441,15 @@ if ~isfield(Opt,'LagTime')
   Opt.LagTime = 2e-9; % seconds
 end
 
+% Number of spin propagation steps per chunk for streaming propagation
+if ~isfield(Opt,'ChunkLength') || isempty(Opt.ChunkLength)
+  Opt.ChunkLength = Inf;
+end
+if ~isnumeric(Opt.ChunkLength) || numel(Opt.ChunkLength)~=1 || ...
+    Opt.ChunkLength<1 || (isfinite(Opt.ChunkLength) && mod(Opt.ChunkLength,1))
+  error('Opt.ChunkLength must be a positive integer.');
+end
+
 % Check Par
 %-------------------------------------------------------------------------------
 
@@ -480,6 +496,16 @@ nStepsSpatial = nStepsSpin*round(Par.dtSpin/Par.dtSpatial);
 dtSpin = Par.dtSpin;
 dtSpatial = Par.dtSpatial;
 
+% For streaming propagation, generate the stochastic trajectories chunk by
+% chunk during the propagation instead of all steps at once. This is not
+% possible if their length is extended until convergence.
+streamTraj = strcmp(Opt.Method,'fast') && Opt.ChunkLength<nStepsSpin && ...
+  ~(isfield(Opt,'checkConvergence') && Opt.checkConvergence) && ...
+  (~isfield(Par,'Integrator') || strcmp(Par.Integrator,'Euler-Maruyama'));
+streamLocalTraj = streamTraj && ...
+  any(strcmp(LocalDynamicsModel,{'diffusion','jump','MD-HBD'}));
+ChunkFrames = Opt.ChunkLength*Par.BlockLength;
+
 % Set default number of (stochastic) trajectories
 if ~useMDdirect && ~isfield(Par,'nTraj')
   Par.nTraj = 100; 
@@ -534,7 +560,9 @@ switch LocalDynamicsModel
     end
     
     RTrajLocal = MD.RTraj;
-    qTrajLocal = rotmat2quat(RTrajLocal);
+    if strcmp(Opt.Method,'ISTOs')
+      qTrajLocal = rotmat2quat(RTrajLocal);
+    end
     
     switch LocalDynamicsModel
       case 'MD-HBD'
@@ -546,7 +574,9 @@ switch LocalDynamicsModel
         
         offset = 1;
         RTrajLocal = RTrajLocal(:,:,offset:HMM.nLag:end,:);
-        qTrajLocal = rotmat2quat(RTrajLocal);
+        if strcmp(Opt.Method,'ISTOs')
+          qTrajLocal = rotmat2quat(RTrajLocal);
+        end
         
     end
     
@@ -558,6 +588,11 @@ switch LocalDynamicsModel
       end
     end
     
+    % MD-HBD trajectories are generated in chunks from the potential
+    if streamLocalTraj
+      clear RTrajLocal qTrajLocal
+    end
+    
 end
 
 % Generate grids for powder averaging in the lab frame
@@ -647,17 +682,34 @@ while ~converged
           Sys.Potential = LocalPotential;
           Par.nSteps = 2*nStepsSpatial;
         end
-        [~, RTrajLocal, qTrajLocal] = stochtraj_diffusion(Sys,Par,Opt);
-        if useLocalPotential
-          RTrajLocal = RTrajLocal(:,:,nStepsSpatial+1:end,:);
-          qTrajLocal = qTrajLocal(:,:,nStepsSpatial+1:end,:);
+        if streamLocalTraj
+          Par.TrajLocal = trajchunks(Sys,Par,Opt,Par.nSteps-nStepsSpatial,ChunkFrames);
+        else
+          [~, RTrajLocal, qTrajLocal] = stochtraj_diffusion(Sys,Par,Opt);
+          if useLocalPotential
+            RTrajLocal = RTrajLocal(:,:,nStepsSpatial+1:end,:);
+            qTrajLocal = qTrajLocal(:,:,nStepsSpatial+1:end,:);
+          end
         end
         
       case 'jump'
         
         Par.dt = dtSpatial;
         Par.nSteps = nStepsSpatial;
-        [~, RTrajLocal, qTrajLocal] = stochtraj_jump(Sys,Par,Opt);
+        if streamLocalTraj
+          % keep the state trajectories, and form the rotation matrices of
+          % their states chunk by chunk
+          OptJump = Opt;
+          OptJump.statesOnly = true;
+          [~, Par.stateTraj] = stochtraj_jump(Sys,Par,OptJump);
+          StateOri = Sys.Orientations;
+          if size(StateOri,1)~=3
+            StateOri = StateOri.';
+          end
+          Par.RStates = quat2rotmat(euler2quat(StateOri));
+        else
+          [~, RTrajLocal, qTrajLocal] = stochtraj_jump(Sys,Par,Opt);
+        end
         
       case 'MD-direct'
         
@@ -674,10 +726,14 @@ while ~converged
           Par.nSteps = 2*nStepsSpatial;
         end
         Par.dt = dtSpatial;
-        [~, RTrajLocal, qTrajLocal] = stochtraj_diffusion(Sys,Par,Opt);
-        if useLocalPotential
-          RTrajLocal = RTrajLocal(:,:,nStepsSpatial+1:end,:);
-          qTrajLocal = qTrajLocal(:,nStepsSpatial+1:end,:);
+        if streamLocalTraj
+          Par.TrajLocal = trajchunks(Sys,Par,Opt,Par.nSteps-nStepsSpatial,ChunkFrames);
+        else
+          [~, RTrajLocal, qTrajLocal] = stochtraj_diffusion(Sys,Par,Opt);
+          if useLocalPotential
+            RTrajLocal = RTrajLocal(:,:,nStepsSpatial+1:end,:);
+            qTrajLocal = qTrajLocal(:,nStepsSpatial+1:end,:);
+          end
         end
         
       case 'MD-HMM'
@@ -699,12 +755,14 @@ while ~converged
     
     if strcmp(Opt.Method,'ISTOs')
       Par.qTraj = qTrajLocal;
-    else
+    elseif ~streamLocalTraj
       Par.RTraj = RTrajLocal;
     end
     
     qLab = euler2quat(0, gridTheta(iOri), gridPhi(iOri), 'active');
-    qLab = repmat(qLab,[1,nStepsSpin,Par.nTraj]);
+    if ~streamTraj
+      qLab = repmat(qLab,[1,nStepsSpin,Par.nTraj]);
+    end
     
     % Generate trajectory of global dynamics with a time step equal to that 
     % of the spin propagation (these rotations will be performed AFTER
@@ -714,14 +772,24 @@ while ~converged
       Sys_.Diff = Dynamics.DiffGlobal;
       Par.dt = dtSpin;
       Par.nSteps = nStepsSpin;
-      [~, ~, qTrajGlobal] = stochtraj_diffusion(Sys_,Par,Opt);
-      % Combine global trajectories with starting orientations
-      qLab = quatmult(qLab,qTrajGlobal);
+      if streamTraj
+        % combined with the starting orientation chunk by chunk
+        Par.TrajGlobal = trajchunks(Sys_,Par,Opt,0,Opt.ChunkLength);
+        Par.TrajGlobal.qLab = qLab;
+        qLab = [];
+      else
+        [~, ~, qTrajGlobal] = stochtraj_diffusion(Sys_,Par,Opt);
+        % Combine global trajectories with starting orientations
+        qLab = quatmult(qLab,qTrajGlobal);
+      end
     end
     
     if strcmp(Opt.Method,'ISTOs')
       Par.qLab = qLab;
+    elseif isempty(qLab)
+      Par.RLab = [];
     else
+      % with streaming propagation, a single starting orientation
       Par.RLab = quat2rotmat(qLab);
     end
     
@@ -729,7 +797,15 @@ while ~converged
     Par.nSteps = nStepsSpin;
     Par.dtSpin = dtSpin;
     Par.dtSpatial = dtSpatial;
+    if streamTraj
+      % the chunks of the trajectories are generated with their own random
+      % number states, continue after all of their random numbers
+      RandState = rng;
+    end
     Sprho = cardamom_propagatedm(Sys,Par,Opt,MD,omega0,CenterField);
+    if streamTraj
+      rng(RandState);
+    end
     
     % Calculate the time-domain signal, i.e. the expectation value of S_{+}
     iTDSignal{1,iOri} = 0;
@@ -954,6 +1030,35 @@ reverseStr = repmat(sprintf('\b'), 1, length(msg));
 
 end
 
+%-------------------------------------------------------------------------------
+% Set up stochastic diffusion trajectories of Par.nSteps steps that are
+% generated chunk by chunk with cardamom_trajchunk during streaming
+% propagation. The first nBurnIn steps are propagated and discarded here.
+% The random number generator is then advanced past the Gaussian deviates
+% of the remaining steps, drawn in chunks of ChunkFrames steps, so that the
+% random numbers of all later draws are the same as when all steps are
+% generated at once.
+function Traj = trajchunks(Sys,Par,Opt,nBurnIn,ChunkFrames)
+
+nSteps = Par.nSteps;
+Par.nSteps = 1;
+[~,~,q,Traj.Sim] = stochtraj_diffusion(Sys,Par,Opt);
+Traj.q = permute(q,[1 3 2]); % starting orientations, size (4,nTraj)
+Traj.First = true;
+Traj.State = rng;
+Traj.qLab = [];
+
+for iStart = 1:ChunkFrames:nBurnIn
+  [~,Traj] = cardamom_trajchunk(Traj,min(ChunkFrames,nBurnIn-iStart+1));
+end
+
+nSkip = nSteps - nBurnIn - Traj.First;
+for iStart = 1:ChunkFrames:nSkip
+  randn(3,Traj.Sim.nTraj,min(ChunkFrames,nSkip-iStart+1));
+end
+
+end
+
 function  y = zeropad(x, M)
   N = length(x);
   if iscolumn(x), y = [x; zeros(M-N, 1)]; end
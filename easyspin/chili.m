@@ -53,6 +53,10 @@
 %      Verbosity      0: no display, 1: show info
 %      GridSymmetry   grid symmetry to use for powder simulation
 %      separate       subspectra output, '' (default) or 'components'
+%      LanczosBatchSize   maximum number of orientations solved together
+%                     with the Lanczos solver, default 8
+%      LanczosBatchMemory maximum memory of the Liouvillians and Lanczos
+%                     work arrays of such a batch, in bytes, default 2^28
 %
 %   Output:
 %     B               magnetic field axis vector, in mT (for field sweeps)
@@ -522,6 +526,10 @@ if isfield(Opt,'Output')
   error('Options.Output is obsolete. Use Opt.separate instead.');
 end
 
+% Batches of orientations for the Lanczos solver
+if ~isfield(Opt,'LanczosBatchSize'), Opt.LanczosBatchSize = 8; end
+if ~isfield(Opt,'LanczosBatchMemory'), Opt.LanczosBatchMemory = 2^28; end
+
 % Undocumented
 if ~isfield(Opt,'Rescale'), Opt.Rescale = true; end
 if ~isfield(Opt,'Threshold'), Opt.Threshold = 1e-6; end
@@ -547,7 +555,7 @@ saveDiagnostics = ~isempty(Opt.Diagnostics);
 
 % Determine default method for constructing Liouvillian
 if ~isfield(Opt,'LiouvMethod') || isempty(Opt.LiouvMethod)
-  if (Sys.nElectrons==1) && (Sys.S==1/2) && (Sys.nNuclei<=2) && ...
+  if (Sys.nElectrons==1) && (Sys.S==1/2) && ...
       (~usePotential || oldStylePotential)
     Opt.LiouvMethod = 'fast';
   else
@@ -564,7 +572,7 @@ if generalLiouvillian
     error('Opt.LiouvMethod=''general'' does not support spin exchange (Sys.Exchange).');
   end
 else
-  if Sys.nElectrons>1 || Sys.S~=1/2 || Sys.nNuclei>2
+  if Sys.nElectrons>1 || Sys.S~=1/2
     error('Opt.LiouvMethod=''fast'' does not work with this spin system.');
   end
   if usePotential
@@ -581,10 +589,6 @@ if doPostConvolution
   if any(Opt.PostConvNucs<1) || any(Opt.PostConvNucs>Sys.nNuclei)
     error('Opt.PostConvNucs must contain indices of nuclei (1 to %d).',Sys.nNuclei);
   end
-  nPostConvNucs = numel(Opt.PostConvNucs);
-  if (Sys.nNuclei-nPostConvNucs>2) && ~generalLiouvillian
-    error('Cannot have more than two nuclei for the Stochastic Liouville equation with this Opt.LiouvMethod.');
-  end
   fullSys = Sys;
   Sys = nucspinrmv(Sys,Opt.PostConvNucs);
   Sys.processed = false;
@@ -715,21 +719,6 @@ end
 logmsg(1,'  solver: %s = %s',Opt.Solver,SolverString);
 
 
-% Set allocation block size, used in chili_lm
-%-------------------------------------------------------------------------------
-if ~generalLiouvillian
-  blockSize = 1e6;
-  minBlockSize = 1e3;
-  if ~isfield(Opt,'AllocationBlockSize')
-    Opt.AllocationBlockSize = blockSize;
-  end
-  Opt.AllocationBlockSize = Opt.AllocationBlockSize(1);
-  if Opt.AllocationBlockSize<minBlockSize
-    error('Opt.AllocationBlockSize = %d is too small. Increase its value to at least %d.',Opt.AllocationBlockSize,minBlockSize);
-  end
-  logmsg(2,'  allocating memory in blocks of %d non-zero elements',Opt.AllocationBlockSize);
-end
-
 % Precalculate spin operator matrices
 %-------------------------------------------------------------------------------
 if generalLiouvillian
@@ -763,6 +752,7 @@ includeNQI = false;
 if saveDiagnostics
   diagnostics.T = T;
   diagnostics.F = F;
+  diagnostics.KernelStats.chili_lm = [];
 end
                                      
 noAnisotropiesPresent = all(F.F1(:)==0) && all(F.F2(:)==0);
@@ -1064,6 +1054,7 @@ end
 % Loop over all orientations
 %===============================================================================
 spec = 0;
+LanczosBatch = struct('L',{{}},'b',{{}},'z',{{}},'Weights',[],'nBytes',0);
 for iOri = 1:nOrientations
   
   logmsg(1,'Orientation %d/%d: phi = %gdeg, theta = %gdeg (weight %g)',...
@@ -1129,15 +1120,6 @@ for iOri = 1:nOrientations
   else
     
     Sys.d2psi = wignerd(2,phi(iOri),theta(iOri),0);
-    if explicitFieldSweep
-      EZ0_ = Sys.EZ0;
-      EZ2_ = Sys.EZ2;
-      if isfield(Sys,'NZ0')
-        for iNuc = 1:numel(Sys.NZ0)
-          NZ0_(iNuc) = Sys.NZ0(iNuc);  %#ok
-        end
-      end
-    end
     
   end
     
@@ -1163,15 +1145,6 @@ for iOri = 1:nOrientations
       
     else
       
-      if explicitFieldSweep
-        Sys.EZ0 = EZ0_*B0(iB);
-        Sys.EZ2 = EZ2_*B0(iB);
-        if isfield(Sys,'NZ0')
-          for iNuc = 1:numel(Sys.NZ0)
-            Sys.NZ0(iNuc) = NZ0_(iNuc)*B0(iB);
-          end
-        end
-      end
       Sys.DirTilt = Basis.DirTilt; % used in chili_lm
       
       % Build xlk array needed by chili_lm (rearranged from XLMK)
@@ -1184,11 +1157,38 @@ for iOri = 1:nOrientations
       Dynamics.maxL = maxL;      
       Dynamics.Diff = Dynamics.R;
       
-      % Call mex function to get L matrix elements
-      [r,c,Vals,nDim] = chili_lm(Sys,Basis.v,Dynamics,Opt.AllocationBlockSize);
-      % (chili_lm constructs r/c/Vals for -1i*H + Gamma)
-      Vals = conj(Vals); % make sure L = +1i*H + Gamma (assumes Gamma is real)
-      L = sparse(r,c,Vals,BasisSize,BasisSize);
+      % Call mex function to get L = +1i*H + Gamma as a sparse matrix.
+      % When saving diagnostics, chili_lm also returns statistics of the
+      % call (counts, buffer sizes, phase timings).
+      lmStats = [];
+      if explicitFieldSweep
+        % Field-independent part LG and field-proportional part LB (Zeeman
+        % terms), on the same sparsity pattern; computed once per orientation
+        if iB==1
+          if saveDiagnostics
+            [LG,LB,nDim,lmStats] = chili_lm(Sys,Basis.v,Dynamics,true);
+          else
+            [LG,LB,nDim] = chili_lm(Sys,Basis.v,Dynamics);
+          end
+        end
+        L = LG + B0(iB)*LB;
+      else
+        if saveDiagnostics
+          [L,nDim,lmStats] = chili_lm(Sys,Basis.v,Dynamics,true);
+        else
+          [L,nDim] = chili_lm(Sys,Basis.v,Dynamics);
+        end
+      end
+      if saveDiagnostics && iOri==1
+        diagnostics.chili_lm = {Sys,Basis.v,Dynamics};
+      end
+      if ~isempty(lmStats)
+        lmStats.iOri = iOri;
+        diagnostics.KernelStats.chili_lm = [diagnostics.KernelStats.chili_lm lmStats];
+      end
+      if nDim~=BasisSize
+        error('Matrix size (%d) inconsistent with basis size (%d). Please report.',nDim,BasisSize);
+      end
       
       if saveDiagnostics && iOri==1
         % extract H and Gamma from L = 1i*H + Gamma
@@ -1260,14 +1260,32 @@ for iOri = 1:nOrientations
             error('L is not complex symmetric - cannot use Lanczos method.');
           end
         end
-        [thisspec,converged,dspec] = chili_lanczos(L,StartVector,-1i*omega,Opt);
-        if converged
-          logmsg(2,'  converged to within %g at iteration %d/%d',...
-            Opt.Threshold,numel(dspec),BasisSize);
-        else
-          thisspec = ones(size(omega));
-          logmsg(0,'  Tridiagonalization did not converge to within %g after %d steps!\n  Increase Options.LLMK (current settings [%d,%d,%d,%d])',...
-            Opt.Threshold,BasisSize,Opt.LLMK');
+        % Collect orientations and solve them in batches, limited in number
+        % and in memory: complex sparse L (16+8 bytes per nonzero) and about
+        % six complex work vectors per orientation
+        LanczosBatch.L{end+1} = L;
+        LanczosBatch.b{end+1} = StartVector;
+        LanczosBatch.z{end+1} = -1i*omega;
+        LanczosBatch.Weights(end+1) = Weights(iOri);
+        LanczosBatch.nBytes = LanczosBatch.nBytes + 24*nnz(L) + 96*BasisSize;
+        thisspec = 0;
+        if numel(LanczosBatch.L)>=Opt.LanczosBatchSize || ...
+            LanczosBatch.nBytes>=Opt.LanczosBatchMemory || iOri==nOrientations
+          [batchspec,converged,dspec] = chili_lanczos(LanczosBatch.L,...
+            LanczosBatch.b,LanczosBatch.z,Opt);
+          for k = 1:numel(LanczosBatch.L)
+            if converged(k)
+              logmsg(2,'  converged to within %g at iteration %d/%d',...
+                Opt.Threshold,numel(dspec{k}),BasisSize);
+              thisspec_ = reshape(batchspec(:,k),size(omega));
+            else
+              thisspec_ = ones(size(omega));
+              logmsg(0,'  Tridiagonalization did not converge to within %g after %d steps!\n  Increase Options.LLMK (current settings [%d,%d,%d,%d])',...
+                Opt.Threshold,BasisSize,Opt.LLMK');
+            end
+            spec = spec + thisspec_*LanczosBatch.Weights(k);
+          end
+          LanczosBatch = struct('L',{{}},'b',{{}},'z',{{}},'Weights',[],'nBytes',0);
         end
         
       case '\' % MATLAB backslash solver for sparse linear system
@@ -1593,12 +1611,6 @@ else
   Basis.pImaxall = min(Basis.pImaxall,sum(2*I));
 end
 
-% Set fields for fast two-nuclei code
-if nNuclei==2
-  Basis.pI1max = Basis.pImax(1);
-  Basis.pI2max = Basis.pImax(2);
-end
-
 % Assemble output array of basis set parameters for chili_lm
 %-------------------------------------------------------------------------------
 deltaK = Basis.evenK+1;
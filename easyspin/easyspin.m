@@ -5,16 +5,24 @@
 %  easyspin doc
 %  easyspin info
 %  easyspin compile
+%  easyspin threads
+%  easyspin threads n
 %
 %   If a parameter is given, various tasks are performed:
 %     ?        show options
 %     doc      display EasySpin documentation
 %     info     display information about current EasySpin installation
 %     compile  compile MEX files for EasySpin
+%     threads  display or set the number of threads used by the MEX
+%              files; n = 0 reverts to the default (all processors, or
+%              OMP_NUM_THREADS if set)
 %
 %  If no parameter is given, 'info' is used by default.
 
-function varargout = easyspin(str)
+function varargout = easyspin(str,nThreads)
+
+% The MEX files read the thread count from this global variable
+global EasySpinThreads
 
 if nargin==0
   str = 'info';
@@ -26,6 +34,7 @@ switch str
     disp(' easyspin info       Display information about EasySpin');
     disp(' easyspin doc        Display EasySpin documentation');
     disp(' easyspin compile    Compile MEX files for EasySpin');
+    disp(' easyspin threads n  Set number of threads used by MEX files');
     varargout = {};
 
   case 'info'
@@ -47,6 +56,30 @@ switch str
   case 'compile'
     easyspin_compile;
 
+  case 'threads'
+    if nargin>1
+      if ischar(nThreads), nThreads = str2double(nThreads); end
+      if ~isscalar(nThreads) || ~isreal(nThreads) || nThreads<0 || mod(nThreads,1)
+        error('The number of threads must be a non-negative integer.');
+      end
+      if nThreads==0
+        EasySpinThreads = [];
+      else
+        EasySpinThreads = nThreads;
+      end
+    end
+    Info = cpuinfo;
+    if nargout==0
+      if Info.OpenMP
+        fprintf('EasySpin MEX files use %d threads (%d processors).\n',Info.Threads,Info.Processors);
+      else
+        fprintf('EasySpin MEX files are compiled without OpenMP and use one thread.\n');
+      end
+      varargout = {};
+    else
+      varargout = {Info.Threads};
+    end
+
   otherwise
     error('Unknown option ''%s''.',str);
 
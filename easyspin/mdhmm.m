@@ -56,6 +56,9 @@ end
 if any(abs(dihedrals(:))>pi)
   error('Some dihedral angles are outside the interval [-pi,pi].');
 end
+% mdhmm_fwdback and mdhmm_viterbi are mex files
+checkmex;
+
 % Reshape from (nDihedrals,nTraj,nSteps) to (nDihedrals,nSteps,nTraj)
 dihedrals = permute(dihedrals,[1,3,2]);
 
@@ -210,17 +213,8 @@ end
 %-------------------------------------------------------------------------------
 function vTraj = viterbitrajectory(dihedrals,transmat,eqdistr,mu,Sigma)
 % dihedrals: (nDihedrals,nSteps,nTraj)
-nStates = size(transmat,1);
-[~,nSteps,nTraj] = size(dihedrals);
-vTraj = zeros(nSteps,nTraj);
-for iTraj = 1:nTraj
-  obs = dihedrals(:,:,iTraj);
-  obslikelihood = zeros(nStates,nSteps);
-  for iState = 1:nStates
-    obslikelihood(iState,:) = gaussian_prob_circular(obs,mu(:,iState),Sigma(:,:,iState));
-  end
-  vTraj(:,iTraj) = viterbi_path(eqdistr,transmat,obslikelihood).';
-end
+% Log-space Viterbi decoding, with trajectories distributed over threads
+vTraj = mdhmm_viterbi(double(dihedrals),eqdistr,transmat,mu,Sigma);
 
 end
 
@@ -315,112 +309,6 @@ N = full(N);
 
 end
 
-%===============================================================================
-function p = gaussian_prob_circular(x, m, C)
-% gaussian_prob_circular Evaluate a multivariate Gaussian density for angles
-%
-%   p = gaussian_prob_circular(x, m, C)
-%
-% Input:
-%   x   data array, d x N
-%         one d-dimensional datavector per column; N samples
-%   m   mean, vector d x 1
-%   C   covariance matrix, d x d
-% Output:
-%   p   probabilities, N x 1
-%       p(i) = Normal(x(:,i), m, C)
-%
-% This takes the circular nature of angles into account.
-
-if length(m)==1 % scalar
-  x = x(:).'; % make row vector
-end
-[d,N] = size(x);
-m = m(:);
-M = m*ones(1,N); % replicate the mean across columns
-denom = (2*pi)^(d/2)*sqrt(abs(det(C)));
-dx = dist_pbc(x,M).';
-mahal = sum((dx/C).*dx,2);
-if any(mahal<0)
-  warning('mahal < 0 => C is not positive semidefinite.')
-end
-p = exp(-0.5*mahal) / (denom+eps);
-
-end
-
-%===============================================================================
-function path = viterbi_path(prior, transmat, obslik)
-% VITERBI Find the most-probable (Viterbi) path through the HMM state trellis.
-% path = viterbi(prior, transmat, obslik)
-%
-% Inputs:
-% prior(i) = Pr(Q(1) = i)
-% transmat(i,j) = Pr(Q(t+1)=j | Q(t)=i)
-% obslik(i,t) = Pr(y(t) | Q(t)=i)
-%
-% Outputs:
-% path(t) = q(t), where q1 ... qT is the argmax of the above expression.
-
-
-% delta(j,t) = prob. of the best sequence of length t-1 and then going to state j, and O(1:t)
-% psi(j,t) = the best predecessor state, given that we ended up in state j at t
-
-scaled = 1;
-
-T = size(obslik, 2);
-prior = prior(:);
-Q = length(prior);
-
-delta = zeros(Q,T);
-psi = zeros(Q,T);
-path = zeros(1,T);
-scale = ones(1,T);
-
-
-t=1;
-delta(:,t) = prior .* obslik(:,t);
-if scaled
-  n = sum(delta(:,t));
-  if n~=0
-    delta(:,t) = delta(:,t)/n;
-  end
-  scale(t) = 1/n;
-end
-psi(:,t) = 0; % arbitrary value, since there is no predecessor to t=1
-for t=2:T
-  for j=1:Q
-    [delta(j,t), psi(j,t)] = max(delta(:,t-1) .* transmat(:,j));
-    delta(j,t) = delta(j,t) * obslik(j,t);
-  end
-  if scaled
-    n = sum(delta(:,t));
-    if n~=0
-      delta(:,t) = delta(:,t)/n;
-    end
-    scale(t) = 1/n;
-  end
-end
-[~, path(T)] = max(delta(:,T));
-for t=T-1:-1:1
-  path(t) = psi(path(t+1),t+1);
-end
-
-% If scaled==0, p = prob_path(best_path)
-% If scaled==1, p = Pr(replace sum with max and proceed as in the scaled forwards algo)
-% Both are different from p(data) as computed using the sum-product (forwards) algorithm
-
-%{
-if scaled
-  loglik = -sum(log(scale));
-  %loglik = prob_path(prior, transmat, obslik, path);
-else
-  loglik = log(p);
-end
-%}
-
-end
-
-
 %===============================================================================
 function [TPM, pi_i] = msmtransitionmatrix(N, maxIter)
 % estimate transition probability matrix TPM from count matrix N
@@ -454,15 +342,19 @@ N_i = sum(N, 2);
 %x_i = sum(x, 2);
 
 % optimization by L-BFGS-B
-fcn = @(x) myfunc_column(x, N, N_i, nStates);
-opts.x0 = x(:);
+% negative log-likelihood evaluated natively in mdhmm_lbfgsb_wrapper,
+% optimized in parallel from the symmetrized counts and from two smoothed
+% versions of them, which avoid starting on the zero bounds
+fcn = 'msmreversible';
+opts.counts = N;
+opts.x0 = [x(:), x(:)+1, x(:)+mean(x(:))];
 opts.maxIts = maxIter;
 opts.maxTotalIts = 50000;
 %opts.factr = 1e5;
 %opts.pgtol = 1e-7;
 
 [x, ~, ~] = mdhmm_lbfgsb(fcn, zeros(nStates*nStates, 1), Inf(nStates*nStates, 1), opts);
-x = reshape(x,nStates,nStates);
+x = reshape(x(:,1),nStates,nStates); % optimum with the lowest f
 
 x_i = sum(x,2);
 TPM = bsxfun(@rdivide,x,x_i);
@@ -470,32 +362,3 @@ TPM(isnan(TPM)) = 0;
 pi_i = x_i./sum(x_i);
 
 end
-
-%-------------------------------------------------------------------------------
-function [f, g] = myfunc_column(x, c, c_i, nStates)
-x = reshape(x,nStates,nStates);
-[f, g] = myfunc_matrix(x, c, c_i);
-g = g(:);
-
-end
-
-%-------------------------------------------------------------------------------
-function [f, g] = myfunc_matrix(x, c, c_i)
-x_i = sum(x, 2);
-
-% F
-tmp = c .* log(bsxfun(@rdivide, x, x_i));
-%index = ~(isnan(tmp));
-index = (x > (10*eps));
-f = - sum(tmp(index));
-
-% G
-t = c_i./x_i;
-g = (c./x) + (c'./x') - bsxfun(@plus, t, t');
-g((x_i < (10*eps)), :) = 0;
-index = ((x > (10*eps)) & (x' > (10*eps)));
-g(~index) = 0;
-g(isnan(g)) = 0;
-g = -g;
-
-end
@@ -596,6 +596,10 @@ MethodMsg{14} = 'frequency sweep, second-order perturbation theory';
 MethodMsg{15} = 'frequency sweep, hybrid (matrix diagonalization for electron spin, perturbation for nuclei)';
 logmsg(1,'  method: %s',MethodMsg{Method});
 
+% Statistics of MEX kernel calls, collected when logging is on
+% (Opt.Verbosity>0) and returned in info.KernelStats
+KernelStats = struct;
+
 if FieldSweep
   % Field sweeps
   %---------------------------------------------------------------------------
@@ -650,10 +654,10 @@ if FieldSweep
         [Pdat,Idat,Wdat,Transitions] = resfields(Sys,Exp1,Opt);
       case {3,5} % 2nd-order perturbation theory
         Opt.PerturbOrder = 2;
-        [Pdat,Idat,Wdat,Transitions,spec] = resfields_perturb(Sys,Exp1,Opt);
+        [Pdat,Idat,Wdat,Transitions,spec,KernelStats] = resfields_perturb(Sys,Exp1,Opt);
       case 4 % 1st-order perturbation theory
         Opt.PerturbOrder = 1;
-        [Pdat,Idat,Wdat,Transitions,spec] = resfields_perturb(Sys,Exp1,Opt);
+        [Pdat,Idat,Wdat,Transitions,spec,KernelStats] = resfields_perturb(Sys,Exp1,Opt);
     end
     logmsg(2,'  -exiting resfields*-----------------------------------');
     
@@ -685,10 +689,10 @@ else
       [Pdat,Idat,Wdat,Transitions] = resfreqs_matrix(Sys,Exp1,Opt);
     case {12,14} % 2nd-order perturbation theory
       Opt.PerturbOrder = 2;
-      [Pdat,Idat,Wdat,Transitions,spec] = resfreqs_perturb(Sys,Exp1,Opt);
+      [Pdat,Idat,Wdat,Transitions,spec,KernelStats] = resfreqs_perturb(Sys,Exp1,Opt);
     case 13 % 1st-order perturbation theory
       Opt.PerturbOrder = 1;
-      [Pdat,Idat,Wdat,Transitions,spec] = resfreqs_perturb(Sys,Exp1,Opt);
+      [Pdat,Idat,Wdat,Transitions,spec,KernelStats] = resfreqs_perturb(Sys,Exp1,Opt);
   end
   logmsg(2,'  -exiting resfreqs*-----------------------------------');
   Pdat = Pdat/1e3; % MHz -> GHz
@@ -862,6 +866,15 @@ elseif ~BruteForceSum
   else
     msg = 'triangle/segment projection';
   end
+  % With projection, the interpolation is fused with it: interpproject
+  % evaluates the interpolants given by their coefficients on the coarse
+  % grid tile by tile and projects the tiles directly, without storing
+  % the interpolated values on the fine grid.
+  fuseInterpolation = doProjection && doInterpolation && ...
+    ~any(NaN_in_Pdat) && Opt.GridSize(1)>3;
+  if fuseInterpolation
+    msg = [msg ', fused with interpolation'];
+  end
   logmsg(1,'  %s',msg);
 
   % Pre-allocation of spectral array
@@ -892,35 +905,36 @@ elseif ~BruteForceSum
       if ~anisotropicIntensities, thisInt = ones(nTransitions,1); end
       %if ~anisotropicWidths, thisWid = zeros(nTransitions,1); end
       
-      iOriSite = 1;  % index into Pdat/Idat/Wdat
-      spcidx = 0;  % index into spectral output array
-      for iOri = 1:nOrientations
-        if separateSiteSpectra, spcidx = 0;
-        elseif separateOrientationSpectra, spcidx = spcidx+1;
-        else, spcidx = 1;
-        end
-        for iSite = 1:nSites
-          if separateSiteSpectra, spcidx = spcidx + 1; end
-          %logmsg(3,'  orientation %d of %d, site %d of %d',iOri,nOrientations,iSite,nSites);
-
-          thisPos = Pdat(:,iOriSite);
-          if anisotropicIntensities, thisInt = Idat(:,iOriSite); end
-          if anisotropicWidths, thisWid = Wdat(:,iOriSite); end
-          
-          thisspec = lisum1i(Template,x0T,wT,thisPos,thisInt,thisWid,xAxis);
-          thisspec = thisspec/nSites/nOrientations;
-          thisspec = (2*pi)*thisspec; % for consistency with powder spectra (factor from integral over chi)
-          thisspec = Exp.OriWeights(iOri)*thisspec; % integral over (phi,theta)
-          
-          if ~separateSiteSpectra && ~separateOrientationSpectra
-            spec = spec + thisspec;
-          else
-            spec(spcidx,:) = spec(spcidx,:) + thisspec;
-          end
-          
-          iOriSite = iOriSite + 1;
-        end
+      % Sum all orientations and sites in one call, using the
+      % spectrum index of each line as group index
+      nOriSites = nOrientations*nSites;
+      iOri_ = reshape(repmat(1:nOrientations,nSites,1),1,nOriSites);
+      iSite_ = repmat(1:nSites,1,nOrientations);
+      if separateSiteSpectra
+        spcidx = iSite_;
+      elseif separateOrientationSpectra
+        spcidx = iOri_;
+      else
+        spcidx = ones(1,nOriSites);
+      end
+      OriWeights_ = reshape(Exp.OriWeights(iOri_),1,nOriSites);
+      % factor 2*pi for consistency with powder spectra (integral over chi),
+      % OriWeights for integral over (phi,theta)
+      LineWeights = (2*pi)*OriWeights_/nSites/nOrientations;
+      allPos = Pdat(:,1:nOriSites);
+      if anisotropicIntensities
+        allInt = Idat(:,1:nOriSites);
+      else
+        allInt = repmat(thisInt,1,nOriSites);
+      end
+      allInt = allInt.*repmat(LineWeights,nTransitions,1);
+      if anisotropicWidths
+        allWid = Wdat(:,1:nOriSites);
+      else
+        allWid = repmat(thisWid,1,nOriSites);
       end
+      allGroups = repmat(spcidx,nTransitions,1);
+      spec = spec + lisum1i(Template,x0T,wT,allPos,allInt,allWid,xAxis,allGroups,size(spec,1));
     end
     
   elseif ~usingGrid
@@ -932,25 +946,22 @@ elseif ~BruteForceSum
     if ~anisotropicIntensities, thisInt = 1; end
     %if ~anisotropicWidths, thisWid = 0; end
     
-    spcidx = 0;
-    for iTrans = 1:nTransitions
-      %logmsg(3,'  transition %d of %d',iTrans,nTransitions);
-
-      thisPos = Pdat(iTrans,:);
-      if anisotropicIntensities, thisInt = Idat(iTrans,:); end
-      if anisotropicWidths, thisWid = Wdat(iTrans,:); end
-      
-      thisspec = lisum1i(Template,x0T,wT,thisPos,thisInt,thisWid,xAxis);
-      thisspec = (2*pi)*thisspec; % integral over chi (0..2*pi)
-      thisspec = Exp.OriWeights*thisspec; % integral over (phi,theta)
-      
-      if ~separateTransitionSpectra
-        spec = spec + thisspec;
+    if nTransitions>0
+      % Sum all transitions in one call, with the transition as group index
+      % for separate transition spectra
+      thisPos = Pdat(1:nTransitions,:);
+      if anisotropicIntensities, thisInt = Idat(1:nTransitions,:); end
+      if anisotropicWidths, thisWid = Wdat(1:nTransitions,:); end
+      if separateTransitionSpectra
+        thisGroup = repmat((1:nTransitions).',1,size(thisPos,2));
       else
-        spcidx = spcidx + 1;
-        spec(spcidx,:) = thisspec;
+        thisGroup = ones(size(thisPos));
       end
-      
+    
+      thisspec = lisum1i(Template,x0T,wT,thisPos,thisInt,thisWid,xAxis,thisGroup,size(spec,1));
+      thisspec = (2*pi)*thisspec; % integral over chi (0..2*pi)
+      thisspec = Exp.OriWeights*thisspec; % integral over (phi,theta)
+      spec = spec + thisspec;
     end
     
   else
@@ -1021,11 +1032,27 @@ elseif ~BruteForceSum
     if ~anisotropicIntensities, fInt = ones(size(fthe)); end
     if ~anisotropicWidths, fWid = zeros(size(fthe)); end
     
+    % Cells of the coarse grid and local coordinates within them of the
+    % interpolation points, the same for all transitions
+    if fuseInterpolation
+      [~,fCells,fLocal] = gridinterp(Pdat(1,:),Opt.GridParams,fphi,fthe,InterpMode{1},'pp');
+    end
+    
     minBroadening = inf;
     nBroadenings = 0;
     sumBroadenings = 0;
     spcidx = 0;
     
+    % Lines from summation and position data for projection are collected
+    % over transitions and processed in batches with a single call to
+    % lisum1i, projectzones, projecttriangles or interpproject. A batch
+    % holds up to maxBatchValues positions: one per line, or, with fused
+    % interpolation, one per interpolant coefficient (coefficients per
+    % cell times coarse-grid cells for each transition), which is what
+    % interpproject keeps in memory, together with the intensities.
+    maxBatchValues = 2^22;
+    Batch = struct('Pos',{{}},'Int',{{}},'Wid',{{}},'Group',{{}},'nValues',0);
+    
     for iTrans = 1:nTransitions
       
       % Interpolation
@@ -1033,7 +1060,13 @@ elseif ~BruteForceSum
       %LoopTransition = any(isnan(Pdat(iTrans,:)));
       LoopTransition = false;
       interpolateThis = doInterpolation && ~LoopTransition;
-      if interpolateThis
+      if fuseInterpolation
+        % polynomial coefficients of interpolants over coarse grid cells
+        fPos = gridinterp(Pdat(iTrans,:),Opt.GridParams,fphi,fthe,InterpMode{1},'pp');
+        if anisotropicIntensities
+          fInt = gridinterp(Idat(iTrans,:),Opt.GridParams,fphi,fthe,InterpMode{2},'pp');
+        end
+      elseif interpolateThis
         fPos = gridinterp(Pdat(iTrans,:),Opt.GridParams,fphi,fthe,InterpMode{1});
         if anisotropicIntensities
           fInt = gridinterp(Idat(iTrans,:),Opt.GridParams,fphi,fthe,InterpMode{2});
@@ -1048,7 +1081,13 @@ elseif ~BruteForceSum
       end
       
       msg1 = '';
-      if ~nonEquiPops && any(fInt(:)<0), msg1 = 'intensities'; end
+      if fuseInterpolation
+        % the intensity interpolants are shape-preserving, check the coarse data
+        negativeInt = anisotropicIntensities && any(Idat(iTrans,:)<0);
+      else
+        negativeInt = any(fInt(:)<0);
+      end
+      if ~nonEquiPops && negativeInt, msg1 = 'intensities'; end
       if any(fWid(:)<0), msg1 = 'widths'; end
       if ~isempty(msg1)
         error('Negative %s encountered! Please report!',msg1);
@@ -1058,11 +1097,45 @@ elseif ~BruteForceSum
       %------------------------------------------------------
       projectThis = doProjection && ~LoopTransition;
       if projectThis
-        if axialGrid
-          thisspec = projectzones(fPos,fInt,fSegWeights,xAxis);
+        if separateTransitionSpectra, iGroup = spcidx+1; else, iGroup = 1; end
+        if fuseInterpolation
+          Batch.Pos{end+1} = fPos;
+          Batch.Int{end+1} = fInt;
         else
-          thisspec = projecttriangles(idxTri,Areas,fPos,fInt,xAxis);
+          Batch.Pos{end+1} = fPos(:);
+          Batch.Int{end+1} = fInt(:);
+        end
+        Batch.Group{end+1} = iGroup;
+        Batch.nValues = Batch.nValues + numel(fPos);
+        if Batch.nValues>=maxBatchValues || iTrans==nTransitions
+          if fuseInterpolation
+            if anisotropicIntensities, bInt = cat(3,Batch.Int{:}); else, bInt = 1; end
+            if axialGrid
+              bspec = interpproject(cat(3,Batch.Pos{:}),bInt,fCells,fLocal,[],...
+                fSegWeights,xAxis,separateTransitionSpectra);
+            else
+              bspec = interpproject(cat(3,Batch.Pos{:}),bInt,fCells,fLocal,idxTri,...
+                Areas,xAxis,separateTransitionSpectra);
+            end
+          else
+            if anisotropicIntensities, bInt = [Batch.Int{:}]; else, bInt = 1; end
+            if axialGrid
+              bspec = projectzones([Batch.Pos{:}],bInt,fSegWeights,xAxis,...
+                separateTransitionSpectra);
+            else
+              bspec = projecttriangles(idxTri,Areas,[Batch.Pos{:}],bInt,xAxis,...
+                separateTransitionSpectra);
+            end
+          end
+          if separateTransitionSpectra
+            iRows = [Batch.Group{:}];
+            spec(iRows,:) = spec(iRows,:) + (2*pi)*bspec;
+          else
+            spec = spec + (2*pi)*bspec;
+          end
+          Batch = struct('Pos',{{}},'Int',{{}},'Wid',{{}},'Group',{{}},'nValues',0);
         end
+        thisspec = 0; % added to spec in batches
         % minBroadening = ?
       else % do summation
         if axialGrid
@@ -1084,7 +1157,19 @@ elseif ~BruteForceSum
         gam(isinf(gam)) = 0;
         fWidC = fWidM.*(1 + Opt.Smoothing*gam);
         
-        thisspec = lisum1i(Template,x0T,wT,fPosC,fIntC,fWidC,xAxis);
+        if separateTransitionSpectra, iGroup = spcidx+1; else, iGroup = 1; end
+        Batch.Pos{end+1} = fPosC(:);
+        Batch.Int{end+1} = fIntC(:);
+        Batch.Wid{end+1} = fWidC(:);
+        Batch.Group{end+1} = iGroup*ones(numel(fPosC),1);
+        Batch.nValues = Batch.nValues + numel(fPosC);
+        if Batch.nValues>=maxBatchValues || iTrans==nTransitions
+          spec = spec + (2*pi)*lisum1i(Template,x0T,wT,vertcat(Batch.Pos{:}),...
+            vertcat(Batch.Int{:}),vertcat(Batch.Wid{:}),xAxis,...
+            vertcat(Batch.Group{:}),size(spec,1));
+          Batch = struct('Pos',{{}},'Int',{{}},'Wid',{{}},'Group',{{}},'nValues',0);
+        end
+        thisspec = 0; % added to spec in batches
         
         minBroadening = min(minBroadening,min(Lambda));
         sumBroadenings = sumBroadenings + sum(Lambda);
@@ -1099,7 +1184,7 @@ elseif ~BruteForceSum
         spec = spec + thisspec;
       else
         spcidx = spcidx + 1;
-        spec(spcidx,:) = thisspec;
+        spec(spcidx,:) = spec(spcidx,:) + thisspec;
       end
       
     end % for iTrans
@@ -1300,6 +1385,9 @@ switch nargout
     info.Transitions = Transitions;
     info.nSites = nSites;
     info.nOrientations = nOrientations;
+    if ~isempty(fieldnames(KernelStats))
+      info.KernelStats = KernelStats;
+    end
     varargout = {xAxis,spec,info};
 end
 
@@ -12,11 +12,20 @@
 %     BlockLength    block length for block averaging, no averaging if set to 1
 %     Model          'MD-HMM','MD-direct','MD-HBD','diffusion','jump'
 %     RTraj          rotation matrix trajectory
+%     RLab           rotation matrices of the global dynamics, or a single
+%                    starting orientation
+%     TrajLocal      'fast' in chunks: local trajectories generated chunk
+%                    by chunk with cardamom_trajchunk, instead of RTraj
+%     stateTraj      'fast' in chunks: jump state trajectories, with the
+%     RStates        rotation matrices of the states, instead of RTraj
+%     TrajGlobal     'fast' in chunks: global trajectories generated chunk by
+%                    chunk with cardamom_trajchunk, instead of RLab
 %   Exp: experimental parameter settings
 %     B              center magnetic field
 %   Opt: optional settings
 %     Method         'fast': propagate using the m_s=-1/2 subspace
 %                    'ISTOs': propagate using correlation functions
+%     ChunkLength    'fast' only: number of steps processed at a time
 %   MD:
 %     RTraj          numeric, size = (3,3,nTraj,nSteps)
 %                    externally provided rotation matrices
@@ -52,7 +61,7 @@ EasySpinLogLevel = Opt.Verbosity;
 PropagationMethod = Opt.Method;
 switch PropagationMethod
   case 'fast'
-    if ~isfield(Par,'RTraj')
+    if ~isfield(Par,'RTraj') && ~isfield(Par,'TrajLocal') && ~isfield(Par,'RStates')
       error('Par.RTraj must be provided.');
     end
   case 'ISTOs'
@@ -106,8 +115,24 @@ switch PropagationMethod
       if ~isequal(size(A),[1,3])
         error('A-tensor must be a 3-vector.')
       end
+    else
+      A = [];
     end
-        
+    
+    % Streaming propagation in chunks of Opt.ChunkLength steps
+    %---------------------------------------------------------------------------
+    if isfield(Opt,'ChunkLength') && Opt.ChunkLength<nSteps
+      logmsg(2,'  streaming propagation in chunks of %d steps',Opt.ChunkLength);
+      if isHMMfromMD && isempty(gTensorState)
+        logmsg(1,'  calculating state averages of tensors');
+        [gTensorState,ATensorState] = ...
+          statetensors(g,A,Par.RTraj,MD,Opt.ChunkLength*Par.BlockLength);
+      end
+      Sprho = propagatechunked(g,A,Par,MD,omega,Opt.ChunkLength,...
+        isHMMfromMD,doSlidingWindowProcessing,gTensorState,ATensorState);
+      return
+    end
+    
     % Calculate tensor trajectories
     %---------------------------------------------------------------------------
     RTrajInv = permute(Par.RTraj,[2,1,3,4]);
@@ -231,61 +256,21 @@ switch PropagationMethod
     %---------------------------------------------------------------------------
     logmsg(2,'  combine local with global dynamics');
     if ~isempty(Par.RLab)
-      RLabInv = permute(Par.RLab,[2,1,3,4]);
-      gTensor = multimatmult(Par.RLab, multimatmult(gTensor, RLabInv));
+      % R*T*R.' for all steps, sharing the rotations between g and A
       if includeHF
-        ATensor = multimatmult(Par.RLab, multimatmult(ATensor, RLabInv));
+        Tensors = multimatmult(Par.RLab, {gTensor, ATensor}, 't');
+        [gTensor,ATensor] = Tensors{:};
+      else
+        gTensor = multimatmult(Par.RLab, gTensor, 't');
       end
     end
     
     % Prepare propagators
     %---------------------------------------------------------------------------
-    gIso = sum(g)/3;
-    GpTensor = (gTensor - gIso)/gfree;    
-    Gp_zz = GpTensor(3,3,:,:);
-
     if includeHF
-      % Norm of expression in Eq. 24 in [1]
-      a = sqrt(ATensor(1,3,:,:).*ATensor(1,3,:,:) ...
-        + ATensor(2,3,:,:).*ATensor(2,3,:,:) ...
-        + ATensor(3,3,:,:).*ATensor(3,3,:,:));
-      
-      % Rotation angle and unit vector parallel to axis of rotation
-      % refer to paragraph below Eq. 37 in [1]
-      theta = dtSpin*0.5*squeeze(a);
-      nx = squeeze(ATensor(1,3,:,:)./a);
-      ny = squeeze(ATensor(2,3,:,:)./a);
-      nz = squeeze(ATensor(3,3,:,:)./a);
-      
-      % Eqs. A1-A2 in [1]
-      ct = cos(theta) - 1;
-      st = -sin(theta);
-      
-      % Matrix exponential of hyperfine part
-      % Eqs. A1-A2 are used to construct Eq. 37 in [1]
-      expadotI = zeros(3,3,size(Gp_zz,3),size(Gp_zz,4));
-      expadotI(1,1,:,:) = 1 + ct.*(nz.*nz + 0.5*(nx.*nx + ny.*ny)) ...
-        + 1i*st.*nz;
-      expadotI(1,2,:,:) = sqrt(0.5)*(st.*ny + ct.*nz.*nx) ...
-        + 1i*sqrt(0.5)*(st.*nx - ct.*nz.*ny);
-      expadotI(1,3,:,:) = 0.5*ct.*(nx.*nx - ny.*ny) ...
-        - 1i*ct.*nx.*ny;
-      expadotI(2,1,:,:) = sqrt(0.5)*(-st.*ny + ct.*nz.*nx) ...
-        + 1i*sqrt(0.5)*(st.*nx + ct.*nz.*ny);
-      expadotI(2,2,:,:) = 1 + ct.*(nx.*nx + ny.*ny);
-      expadotI(2,3,:,:) = sqrt(0.5)*(st.*ny - ct.*nz.*nx) ...
-        + 1i*sqrt(0.5)*(st.*nx + ct.*nz.*ny);
-      expadotI(3,1,:,:) = 0.5*ct.*(nx.*nx - ny.*ny) ...
-        + 1i*ct.*nx.*ny;
-      expadotI(3,2,:,:) = sqrt(0.5)*(-st.*ny - ct.*nz.*nx) ...
-        + 1i*sqrt(0.5)*(st.*nx - ct.*nz.*ny);
-      expadotI(3,3,:,:) = 1 + ct.*(nz.*nz + 0.5*(nx.*nx + ny.*ny))  ...
-        - 1i*st.*nz;
-      
-      % Calculate propagator, Eq. 35 in [1]
-      U = bsxfun(@times, exp(-1i*dtSpin*0.5*omega*Gp_zz), expadotI);
+      U = fastpropagator(g,gTensor,ATensor,dtSpin,omega);
     else
-      U = exp(-1i*dtSpin*0.5*omega*Gp_zz);
+      U = fastpropagator(g,gTensor,[],dtSpin,omega);
     end
     
     % Set up starting state of density matrix after pi/2 pulse, S_x
@@ -448,7 +433,7 @@ switch PropagationMethod
     %---------------------------------------------------------------------------
     % Only keep the m_S=\beta subspace part that contributes to tr(S_{+}\rho(t))
     projector = sop(Sys.Spins,'+1');
-    Sprho = multimatmult(repmat(projector,1,1,nSteps),rho);
+    Sprho = multimatmult(projector,rho);
 
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
   otherwise
@@ -497,6 +482,200 @@ end
 
 end
 
+%-------------------------------------------------------------------------------
+% Propagate the density matrix with the 'fast' method in chunks of
+% ChunkLength spin steps. Tensor trajectories, propagators and density
+% matrices are only formed for one chunk at a time, and the trajectory
+% average of a chunk is stored before the next chunk is processed. The
+% rotation matrices of stochastic trajectories are generated chunk by chunk
+% (Par.TrajLocal, Par.TrajGlobal), and those of jump trajectories are formed
+% from their states. MD frames (MD-direct) are indexed in Par.RTraj, which
+% is the MD trajectory given as input, without copying it.
+function Sprho = propagatechunked(g,A,Par,MD,omega,ChunkLength,...
+  isHMMfromMD,doSlidingWindowProcessing,gTensorState,ATensorState)
+
+nSteps = Par.nSteps;
+nTraj = Par.nTraj;
+BlockLength = Par.BlockLength;
+includeHF = ~isempty(A);
+
+% Principal frame tensors and starting state after pi/2 pulse, S_x
+Tensors = {diag(g)};
+if includeHF
+  Tensors{2} = diag(A)*1e6*2*pi; % MHz (s^-1) -> Hz (rad s^-1)
+  rhoNext = 0.5*repmat(eye(3),[1,1,1,nTraj]);
+  Sprho = zeros(3,3,nSteps);
+else
+  rhoNext = 0.5*ones(1,1,1,nTraj);
+  Sprho = zeros(1,1,nSteps);
+end
+
+for iStart = 1:ChunkLength:nSteps
+  idxSteps = iStart:min(iStart+ChunkLength-1,nSteps);
+  nChunk = numel(idxSteps);
+  
+  % Trajectory frames of all blocks in the chunk
+  idxFrames = bsxfun(@plus,(1:BlockLength).',(idxSteps-1)*BlockLength);
+  idxFrames = idxFrames(:);
+  
+  % Tensor trajectories of the chunk
+  if isHMMfromMD
+    states = Par.stateTraj(idxFrames,:);
+    TTraj = {reshape(gTensorState(:,:,states),3,3,numel(idxFrames),nTraj)};
+    if includeHF
+      TTraj{2} = reshape(ATensorState(:,:,states),3,3,numel(idxFrames),nTraj);
+    end
+  else
+    if doSlidingWindowProcessing
+      % trajectory iTraj starts (iTraj-1)*lag blocks into the MD trajectory
+      RTraj = zeros(3,3,numel(idxFrames),nTraj);
+      for iTraj = 1:nTraj
+        RTraj(:,:,:,iTraj) = ...
+          Par.RTraj(:,:,idxFrames+(iTraj-1)*Par.lag*BlockLength,1);
+      end
+    elseif isfield(Par,'TrajLocal')
+      [RTraj,Par.TrajLocal] = cardamom_trajchunk(Par.TrajLocal,numel(idxFrames));
+    elseif isfield(Par,'RStates')
+      RTraj = reshape(Par.RStates(:,:,Par.stateTraj(idxFrames,:)),...
+        3,3,numel(idxFrames),nTraj);
+    else
+      RTraj = Par.RTraj(:,:,idxFrames,:);
+    end
+    TTraj = multimatmult(RTraj,Tensors,'t');
+  end
+  
+  % Coarse-grain by block averaging
+  if BlockLength>1
+    for k = 1:numel(TTraj)
+      TTraj{k} = reshape(TTraj{k},3,3,BlockLength,nChunk,nTraj);
+      TTraj{k} = reshape(mean(TTraj{k},3),3,3,nChunk,nTraj);
+    end
+  end
+  
+  % Combine local and global dynamics
+  if isfield(Par,'TrajGlobal')
+    [RLab,Par.TrajGlobal] = cardamom_trajchunk(Par.TrajGlobal,nChunk);
+    TTraj = multimatmult(RLab,TTraj,'t');
+  elseif ismatrix(Par.RLab) && ~isempty(Par.RLab)
+    % the same starting orientation for all steps and trajectories
+    TTraj = multimatmult(Par.RLab,TTraj,'t');
+  elseif ~isempty(Par.RLab)
+    TTraj = multimatmult(Par.RLab(:,:,idxSteps,:),TTraj,'t');
+  end
+  
+  if includeHF
+    U = fastpropagator(g,TTraj{1},TTraj{2},Par.dtSpin,omega);
+  else
+    U = fastpropagator(g,TTraj{1},[],Par.dtSpin,omega);
+  end
+  
+  % Propagate over the chunk and one step further, to the starting state
+  % of the next chunk
+  rho = zeros(size(U,1),size(U,2),nChunk+1,nTraj);
+  rho(:,:,1,:) = rhoNext;
+  rho = propagate(rho,U,nChunk+1,'fast');
+  rhoNext = rho(:,:,end,:);
+  Sprho(:,:,idxSteps) = mean(rho(:,:,1:nChunk,:),4);
+end
+
+end
+
+%-------------------------------------------------------------------------------
+% Average g and A tensors of the HMM states, over all frames that the Viterbi
+% trajectories assign to each state, accumulated over chunks of ChunkFrames
+% trajectory frames
+function [gTensorState,ATensorState] = statetensors(g,A,RTraj,MD,ChunkFrames)
+
+includeHF = ~isempty(A);
+Tensors = {diag(g)};
+if includeHF
+  Tensors{2} = diag(A)*1e6*2*pi; % MHz (s^-1) -> Hz (rad s^-1)
+end
+
+nVitTraj = size(MD.viterbiTraj,1);
+nFrames = size(RTraj,3);
+TensorSum = repmat({zeros(3,3,MD.nStates,nVitTraj)},size(Tensors));
+nFramesState = zeros(1,1,MD.nStates,nVitTraj);
+for iStart = 1:ChunkFrames:nFrames
+  idx = iStart:min(iStart+ChunkFrames-1,nFrames);
+  for iTraj = 1:nVitTraj
+    TTraj = multimatmult(RTraj(:,:,idx,iTraj),Tensors,'t');
+    for iState = 1:MD.nStates
+      idxState = MD.viterbiTraj(iTraj,idx)==iState;
+      nFramesState(1,1,iState,iTraj) = nFramesState(1,1,iState,iTraj) + nnz(idxState);
+      for k = 1:numel(TTraj)
+        TensorSum{k}(:,:,iState,iTraj) = TensorSum{k}(:,:,iState,iTraj) + ...
+          sum(TTraj{k}(:,:,idxState),3);
+      end
+    end
+  end
+end
+
+% Average over time axis, then over trajectories
+gTensorState = mean(bsxfun(@rdivide,TensorSum{1},nFramesState),4,'omitnan');
+if includeHF
+  ATensorState = mean(bsxfun(@rdivide,TensorSum{2},nFramesState),4,'omitnan');
+else
+  ATensorState = [];
+end
+
+end
+
+%-------------------------------------------------------------------------------
+% Propagators in the m_S=-1/2 subspace for the 'fast' method, see Ref [1].
+% ATensor is empty for systems without hyperfine coupling.
+function U = fastpropagator(g,gTensor,ATensor,dtSpin,omega)
+
+gIso = sum(g)/3;
+GpTensor = (gTensor - gIso)/gfree;    
+Gp_zz = GpTensor(3,3,:,:);
+
+if ~isempty(ATensor)
+  % Norm of expression in Eq. 24 in [1]
+  a = sqrt(ATensor(1,3,:,:).*ATensor(1,3,:,:) ...
+    + ATensor(2,3,:,:).*ATensor(2,3,:,:) ...
+    + ATensor(3,3,:,:).*ATensor(3,3,:,:));
+  
+  % Rotation angle and unit vector parallel to axis of rotation
+  % refer to paragraph below Eq. 37 in [1]
+  theta = dtSpin*0.5*squeeze(a);
+  nx = squeeze(ATensor(1,3,:,:)./a);
+  ny = squeeze(ATensor(2,3,:,:)./a);
+  nz = squeeze(ATensor(3,3,:,:)./a);
+  
+  % Eqs. A1-A2 in [1]
+  ct = cos(theta) - 1;
+  st = -sin(theta);
+  
+  % Matrix exponential of hyperfine part
+  % Eqs. A1-A2 are used to construct Eq. 37 in [1]
+  expadotI = zeros(3,3,size(Gp_zz,3),size(Gp_zz,4));
+  expadotI(1,1,:,:) = 1 + ct.*(nz.*nz + 0.5*(nx.*nx + ny.*ny)) ...
+    + 1i*st.*nz;
+  expadotI(1,2,:,:) = sqrt(0.5)*(st.*ny + ct.*nz.*nx) ...
+    + 1i*sqrt(0.5)*(st.*nx - ct.*nz.*ny);
+  expadotI(1,3,:,:) = 0.5*ct.*(nx.*nx - ny.*ny) ...
+    - 1i*ct.*nx.*ny;
+  expadotI(2,1,:,:) = sqrt(0.5)*(-st.*ny + ct.*nz.*nx) ...
+    + 1i*sqrt(0.5)*(st.*nx + ct.*nz.*ny);
+  expadotI(2,2,:,:) = 1 + ct.*(nx.*nx + ny.*ny);
+  expadotI(2,3,:,:) = sqrt(0.5)*(st.*ny - ct.*nz.*nx) ...
+    + 1i*sqrt(0.5)*(st.*nx + ct.*nz.*ny);
+  expadotI(3,1,:,:) = 0.5*ct.*(nx.*nx - ny.*ny) ...
+    + 1i*ct.*nx.*ny;
+  expadotI(3,2,:,:) = sqrt(0.5)*(-st.*ny - ct.*nz.*nx) ...
+    + 1i*sqrt(0.5)*(st.*nx - ct.*nz.*ny);
+  expadotI(3,3,:,:) = 1 + ct.*(nz.*nz + 0.5*(nx.*nx + ny.*ny))  ...
+    - 1i*st.*nz;
+  
+  % Calculate propagator, Eq. 35 in [1]
+  U = bsxfun(@times, exp(-1i*dtSpin*0.5*omega*Gp_zz), expadotI);
+else
+  U = exp(-1i*dtSpin*0.5*omega*Gp_zz);
+end
+
+end
+
 %-------------------------------------------------------------------------------
 % calculate Wigner D-matrices of specified rank from quaternions for 
 % rotation of ISTOs
@@ -0,0 +1,46 @@
+% Continue stochastic rotational trajectories by one chunk of steps, for
+% streaming propagation in cardamom
+%
+% Input:
+%   Traj       trajectory set, as set up by cardamom
+%     Sim        settings of the stochastic propagation, from stochtraj_diffusion
+%     q          last orientations (quaternions), size (4,nTraj)
+%     First      true if q is the first step and has not been returned yet
+%     State      state of the random number generator for these trajectories
+%     qLab       starting orientation the chunks are combined with, or empty
+%   nFrames    number of steps in the chunk
+%
+% Output:
+%   RTraj      rotation matrices of the chunk, size (3,3,nFrames,nTraj)
+%   Traj       trajectory set, continued by the chunk
+%
+% The random number generator is set to Traj.State before propagation, so
+% that the chunks use the same Gaussian deviates as a single call to
+% stochtraj_diffusion over all steps.
+
+function [RTraj,Traj] = cardamom_trajchunk(Traj,nFrames)
+
+rng(Traj.State);
+
+Sim = Traj.Sim;
+if Traj.First
+  q = Traj.q;
+  if nFrames>1
+    Sim.nSteps = nFrames-1;
+    q = cat(3,q,stochtraj_proprottraj(Traj.q,Sim,2));
+  end
+  Traj.First = false;
+else
+  Sim.nSteps = nFrames;
+  q = stochtraj_proprottraj(Traj.q,Sim,2);
+end
+Traj.q = q(:,:,end);
+Traj.State = rng;
+
+q = permute(q,[1 3 2]); % -> (4,nFrames,nTraj)
+if ~isempty(Traj.qLab)
+  q = quatmult(repmat(Traj.qLab,[1,nFrames,Sim.nTraj]),q);
+end
+RTraj = quat2rotmat(q);
+
+end
@@ -0,0 +1,51 @@
+% checkmex   Compile mex files if they are missing or outdated
+%
+%   checkmex
+%   ok = checkmex
+%
+%   Compiles all mex files with easyspin_compile if any C source file in
+%   the private folder has no mex file, or if the mex files were compiled
+%   from an older version of the sources. The latter is detected with the
+%   interface version reported by cpuinfo, which must equal MexVersion
+%   below. Whenever the inputs or outputs of a mex function change,
+%   increase both MexVersion here and MEXVERSION in cpuinfo.c.
+%
+%   Without output argument, an error is thrown if the compilation fails.
+%   Otherwise, ok is false in this case.
+
+function ok = checkmex
+
+MexVersion = 2;
+
+% Check only once per session
+persistent isCurrent
+if isequal(isCurrent,true)
+  ok = true;
+  return
+end
+
+isCurrent = mexcurrent(MexVersion);
+if ~isCurrent
+  easyspin_compile;
+  isCurrent = mexcurrent(MexVersion);
+end
+
+if nargout>0
+  ok = isCurrent;
+elseif ~isCurrent
+  error('EasySpin: Generation of mex files failed.');
+end
+
+%-------------------------------------------------------------------------------
+function current = mexcurrent(MexVersion)
+
+SrcFiles = dir([fileparts(mfilename('fullpath')) filesep '*.c']);
+current = true;
+for k = 1:numel(SrcFiles)
+  if exist(SrcFiles(k).name(1:end-2),'file')~=3
+    current = false;
+    return
+  end
+end
+Info = cpuinfo;
+current = isfield(Info,'MexVersion') && Info.MexVersion==MexVersion;
@@ -1,5 +1,5 @@
 % Build basis with basis functions and ordering as used in the Freed program
-% (S = 1/2 and zero, one, or two nuclei).
+% (S = 1/2 and any number of nuclei).
 function Basis = chili_basisbuild(Basis,Sys)
 
 DirTilt = Basis.DirTilt;
@@ -14,15 +14,29 @@ deltaK = Basis.evenK+1;
 Mmax = Basis.Mmax;
 
 pSmin = Basis.pSmin;
-pImax = Basis.pImax;
-pI1max = pImax; pI2max = pImax;
-
 MpSymm = Basis.MpSymm;
 
 I = Sys.I;
 nNuclei = numel(I);
-if nNuclei>=1, I1 = I(1); end
-if nNuclei>=2, I2 = I(2); end
+pImax = Basis.pImax;
+if numel(pImax)==1, pImax = repmat(pImax,1,nNuclei); end
+
+% Nuclear quantum numbers [pI1 qI1 pI2 qI2 ...] of all nuclear sub-states,
+% with the first nucleus varying slowest
+nucStates = zeros(1,0);
+for iNuc = 1:nNuclei
+  pqI = zeros(0,2);
+  for pI = -pImax(iNuc):pImax(iNuc)
+    qImax = 2*I(iNuc) - abs(pI);
+    qI = (-qImax:2:qImax).';
+    pqI = [pqI; repmat(pI,numel(qI),1) qI]; %#ok<AGROW>
+  end
+  nStates = size(nucStates,1);
+  nNew = size(pqI,1);
+  nucStates = [kron(nucStates,ones(nNew,1)) repmat(pqI,nStates,1)];
+end
+pIsum = sum(nucStates(:,1:2:end),2);
+nNucStates = size(nucStates,1);
 
 iRow = 0;
 iSpatial = 0;
@@ -52,62 +66,22 @@ for L = 0:evenLmax
           qSmx = 1 - abs(pS);
           for qS = -qSmx:2:qSmx
             
-            % no nuclei ---------------------------------------
-            if nNuclei==0
-              if MpSymm && ~DirTilt && (pS-1)~=M, continue; end % Meirovitch Eq.(A47)
-              
-              iRow = iRow + 1;
-              if makeIndices
-                if mod(iRow,nRowBlock)==0
-                  Indices(iRow+nRowBlock,:) = 0;
-                end
-                Indices(iRow,:) = [L jK K M pS qS];
+            if MpSymm && ~DirTilt
+              keep = pIsum+pS-1==M; % Meirovitch Eq.(A47)
+            else
+              keep = true(nNucStates,1);
+            end
+            nKeep = sum(keep);
+            if nKeep==0, continue; end
+            
+            if makeIndices
+              if iRow+nKeep>size(Indices,1)
+                Indices(iRow+nKeep+nRowBlock,:) = 0;
               end
-                
-            % one nucleus ---------------------------------------
-            elseif nNuclei==1
-              
-              for pI1 = -pI1max:pI1max
-                if MpSymm && ~DirTilt && pI1+pS-1~=M, continue; end % Meirovich Eq.(A47)
-                qI1max = 2*I1 - abs(pI1);
-                for qI1 = -qI1max:2:qI1max
-                  
-                  iRow = iRow + 1;
-                  if makeIndices
-                    if mod(iRow,nRowBlock)==0
-                      Indices(iRow+nRowBlock,:) = 0;
-                    end
-                    Indices(iRow,:) = [L jK K M pS qS pI1 qI1];
-                  end
-                  
-                end % qI
-              end % pI
-              
-            % two nuclei ---------------------------------------
-            elseif nNuclei==2
-              
-              for pI1 = -pI1max:pI1max
-                qI1max = 2*I1 - abs(pI1);
-                for qI1 = -qI1max:2:qI1max
-                  for pI2 = -pI2max:pI2max
-                    if MpSymm && ~DirTilt && pI1+pI2+pS-1~=M, continue; end % Meirovich Eq.(A47)
-                    qI2max = 2*I2 - abs(pI2);
-                    for qI2 = -qI2max:2:qI2max
-                      
-                      iRow = iRow + 1;
-                      if makeIndices
-                        if mod(iRow,nRowBlock)==0
-                          Indices(iRow+nRowBlock,:) = 0;
-                        end
-                        Indices(iRow,:) = [L jK K M pS qS pI1 qI1 pI2 qI2];
-                      end
-                      
-                    end % qI2
-                  end % pI2
-                end % qI1
-              end % pI1
-
+              Indices(iRow+(1:nKeep),:) = ...
+                [repmat([L jK K M pS qS],nKeep,1) nucStates(keep,:)];
             end
+            iRow = iRow + nKeep;
             
           end % qS
         end % pS
@@ -124,13 +98,9 @@ Basis.K = Indices(:,3);
 Basis.M = Indices(:,4);
 Basis.pS = Indices(:,5);
 Basis.qS = Indices(:,6);
-if nNuclei>=1
-  Basis.pI1 = Indices(:,7);
-  Basis.qI1 = Indices(:,8);
-  if nNuclei>=2
-    Basis.pI2 = Indices(:,9);
-    Basis.qI2 = Indices(:,10);
-  end
+for iNuc = 1:nNuclei
+  Basis.(sprintf('pI%d',iNuc)) = Indices(:,5+2*iNuc);
+  Basis.(sprintf('qI%d',iNuc)) = Indices(:,6+2*iNuc);
 end
 
 return
@@ -3,9 +3,11 @@
 % [spec,converged,specchange] = chili_lanczos(A,b,z,Opt)
 %
 % Inputs:
-%   A           complex symmetrix square NxN matrix
-%   b           Nx1 starting vector
-%   z           variable vector over which to evaluate the spectral function
+%   A           complex symmetrix square NxN matrix, or cell array of
+%               matrices (e.g. one per orientation)
+%   b           Nx1 starting vector, or cell array of vectors
+%   z           variable vector over which to evaluate the spectral function,
+%               or cell array of vectors of equal length
 %   Opt         structure with fields
 %    .Lentz     if true (default), use Lentz method for the evaluation of the
 %               continued fraction expansion
@@ -13,9 +15,14 @@
 %               spectrum
 %
 % Outputs:
-%   spec        calculated spectrum
+%   spec        calculated spectrum; for cell array input, one column per
+%               matrix
 %   converged   whether spectrum is converged or not
-%   specchange  array if iteration-to-iteration spectral changes
+%   specchange  array if iteration-to-iteration spectral changes; for cell
+%               array input, a cell array
+%
+% Sparse matrices are handled by the native solver chili_lanczos_ if it is
+% compiled. It processes several matrices in parallel.
 
 % The modified Lentz method is implemented from
 %    W. H. Press et al, Numerical Recipes in C, 2nd edition
@@ -23,6 +30,37 @@
 
 function [spec,converged,specchange] = chili_lanczos(A,b,z,Opt)
 
+% Several matrices
+if iscell(A)
+  if ~iscell(b), b = repmat({b},size(A)); end
+  if ~iscell(z), z = repmat({z},size(A)); end
+  allSparse = all(cellfun(@issparse,A(:)));
+  if allSparse && exist('chili_lanczos_','file')==3
+    b = cellfun(@full,b,'UniformOutput',false);
+    [spec,converged,specchange] = chili_lanczos_(A,b,z,Opt.Lentz,Opt.Threshold);
+    converged = logical(converged);
+  else
+    nSys = numel(A);
+    spec = zeros(numel(z{1}),nSys);
+    converged = false(1,nSys);
+    specchange = cell(1,nSys);
+    for k = 1:nSys
+      [spec_,converged(k),specchange{k}] = chili_lanczos(A{k},b{k},z{k},Opt);
+      spec(:,k) = spec_(:);
+    end
+  end
+  return
+end
+
+% Native solver for sparse matrices
+if issparse(A) && exist('chili_lanczos_','file')==3
+  [spec,converged,specchange] = chili_lanczos_(A,full(b),z,Opt.Lentz,Opt.Threshold);
+  spec = reshape(spec,size(z));
+  converged = logical(converged);
+  specchange = specchange{1};
+  return
+end
+
 N = length(b);
 alpha = zeros(1,N);
 beta = zeros(1,N);
@@ -102,6 +140,11 @@ for k = 1:N
   
 end
 
+% Evaluate right-to-left continued fraction over the full axis
+if ~useLentzMethod
+  spec = chili_contfracspec(z,alpha,beta,k);
+end
+
 % Organize output
 specchange = specchange(1:k);
 specchange(isnan(specchange)) = [];
@@ -0,0 +1,397 @@
+/*
+[spec,converged,specchange] = chili_lanczos_(A,b,z,Lentz,Threshold)
+
+  Native Lanczos tridiagonalization and continued-fraction evaluation,
+  called by chili_lanczos.
+
+  A           complex symmetric NxN sparse matrix, or cell array of such
+              matrices (one per system, e.g. orientation)
+  b           Nx1 starting vector, or cell array of vectors
+  z           vector over which to evaluate the spectral function, or cell
+              array of vectors of equal length
+  Lentz       if nonzero, use modified Lentz method (left-to-right),
+              otherwise right-to-left evaluation of the continued fraction
+  Threshold   termination threshold for iteration-to-iteration change in
+              spectrum
+
+  spec        nz x nSystems array of spectra
+  converged   1 x nSystems, 1 if converged
+  specchange  cell array with iteration-to-iteration spectral changes, one
+              cell per system
+
+  Since A is complex symmetric, A*q is computed as A.'*q, i.e. column by
+  column from the CSC storage, which reads the matrix and writes the result
+  sequentially. With several systems, these are distributed over threads.
+  With a single system, the matrix-vector products are multithreaded.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include "mex.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "cpuinfo.h"
+
+/* number of points in the convergence test for right-to-left evaluation */
+#define NTESTPOINTS 201
+
+typedef struct { double re, im; } cplx;
+
+__inline cplx cmul(cplx a, cplx b)
+{ cplx c; c.re = a.re*b.re - a.im*b.im; c.im = a.re*b.im + a.im*b.re; return c; }
+
+__inline cplx cdiv(cplx a, cplx b)
+{
+  cplx c;
+  double r, d;
+  if (fabs(b.re)>=fabs(b.im)) {
+    r = b.im/b.re; d = b.re + r*b.im;
+    c.re = (a.re + a.im*r)/d; c.im = (a.im - a.re*r)/d;
+  }
+  else {
+    r = b.re/b.im; d = b.im + r*b.re;
+    c.re = (a.re*r + a.im)/d; c.im = (a.im*r - a.re)/d;
+  }
+  return c;
+}
+
+/* principal square root */
+__inline cplx csqrt_(cplx a)
+{
+  cplx c;
+  double m = sqrt(sqrt(a.re*a.re + a.im*a.im));
+  double phi = atan2(a.im,a.re)/2;
+  c.re = m*cos(phi); c.im = m*sin(phi);
+  return c;
+}
+
+/* One system: matrix, starting vector, axis and results */
+struct LanczosSystem {
+  long N;
+  const mwIndex *ir, *jc;
+  const double *Ar, *Ai;
+  const double *br, *bi;
+  const double *zr, *zi;
+  double *specRe, *specIm;  /* output, nz values */
+  double *specchange;       /* output, at most N values */
+  long nChanges;
+  bool converged;
+  bool Failed;
+};
+
+/* y = A.'*q for a CSC sparse matrix */
+static void matvec(const struct LanczosSystem *S, const cplx *q, cplx *y, bool parallel)
+{
+  long j;
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) if(parallel)
+#endif
+  for (j=0;j<S->N;j++) {
+    double yr = 0, yi = 0;
+    mwIndex p;
+    for (p=S->jc[j];p<S->jc[j+1];p++) {
+      const cplx qq = q[S->ir[p]];
+      const double ar = S->Ar[p], ai = S->Ai ? S->Ai[p] : 0;
+      yr += ar*qq.re - ai*qq.im;
+      yi += ar*qq.im + ai*qq.re;
+    }
+    y[j].re = yr;
+    y[j].im = yi;
+  }
+}
+
+/* u.'*v (no complex conjugation) */
+static cplx pdot(const cplx *u, const cplx *v, long N, bool parallel)
+{
+  cplx s;
+  double sr = 0, si = 0;
+  long i;
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) reduction(+:sr,si) if(parallel)
+#endif
+  for (i=0;i<N;i++) {
+    sr += u[i].re*v[i].re - u[i].im*v[i].im;
+    si += u[i].re*v[i].im + u[i].im*v[i].re;
+  }
+  s.re = sr; s.im = si;
+  return s;
+}
+
+/* Right-to-left evaluation of the continued fraction with k terms */
+static cplx contfrac(cplx z, const cplx *alpha, const cplx *beta, long k)
+{
+  cplx s, one = {1, 0};
+  long m;
+  s.re = z.re + alpha[k-1].re;
+  s.im = z.im + alpha[k-1].im;
+  for (m=k-2;m>=0;m--) {
+    cplx b2 = cdiv(cmul(beta[m],beta[m]),s);
+    s.re = z.re + alpha[m].re - b2.re;
+    s.im = z.im + alpha[m].im - b2.im;
+  }
+  return cdiv(one,s);
+}
+
+/* Lanczos tridiagonalization and continued fraction for one system,
+   following chili_lanczos.m */
+static void lanczos(struct LanczosSystem *S, long nz, bool Lentz,
+  double Threshold, bool parallel)
+{
+  const long N = S->N;
+  const long interval = (10<(N+19)/20) ? 10 : (N+19)/20;
+  const double tiny = 1e-30;
+  cplx *q, *y, *bq, *alpha, *beta, *C = NULL, *D = NULL, *spec = NULL;
+  cplx *zTest = NULL;
+  double *oldspec = NULL;
+  cplx nrm;
+  long i, k;
+
+  S->nChanges = 0;
+  S->converged = false;
+
+  q = malloc(N*sizeof(cplx));
+  y = malloc(N*sizeof(cplx));
+  bq = calloc(N,sizeof(cplx));
+  alpha = malloc(N*sizeof(cplx));
+  beta = malloc(N*sizeof(cplx));
+  if (Lentz) {
+    C = malloc(nz*sizeof(cplx));
+    D = malloc(nz*sizeof(cplx));
+    spec = malloc(nz*sizeof(cplx));
+  }
+  else {
+    zTest = malloc(NTESTPOINTS*sizeof(cplx));
+    oldspec = malloc(NTESTPOINTS*sizeof(double));
+  }
+  if (!q || !y || !bq || !alpha || !beta ||
+      (Lentz && (!C || !D || !spec)) || (!Lentz && (!zTest || !oldspec))) {
+    S->Failed = true;
+    goto cleanup;
+  }
+
+  if (Lentz) {
+    for (i=0;i<nz;i++) {
+      spec[i].re = C[i].re = tiny;
+      spec[i].im = C[i].im = 0;
+      D[i].re = D[i].im = 0;
+    }
+  }
+  else {
+    /* shorter axis for the convergence tests */
+    for (i=0;i<NTESTPOINTS;i++) {
+      const double f = (double)i/(NTESTPOINTS-1);
+      zTest[i].re = S->zr[0] + f*(S->zr[nz-1]-S->zr[0]);
+      zTest[i].im = S->zi ? S->zi[0] + f*(S->zi[nz-1]-S->zi[0]) : 0;
+      oldspec[i] = HUGE_VAL;
+    }
+  }
+
+  /* q = b/sqrt(b.'*b), pseudonorm instead of norm */
+  for (i=0;i<N;i++) {
+    y[i].re = S->br[i];
+    y[i].im = S->bi ? S->bi[i] : 0;
+  }
+  nrm = csqrt_(pdot(y,y,N,parallel));
+  for (i=0;i<N;i++) q[i] = cdiv(y[i],nrm);
+
+  for (k=0;k<N;k++) {
+    bool check = ((k+1) % interval)==0;
+
+    /* Lanczos step */
+    matvec(S,q,y,parallel);
+    alpha[k] = pdot(q,y,N,parallel);
+    for (i=0;i<N;i++) {
+      const cplx aq = cmul(alpha[k],q[i]);
+      y[i].re -= aq.re + bq[i].re;
+      y[i].im -= aq.im + bq[i].im;
+    }
+    beta[k] = csqrt_(pdot(y,y,N,parallel));
+    for (i=0;i<N;i++) {
+      bq[i] = cmul(beta[k],q[i]);
+      q[i] = cdiv(y[i],beta[k]);
+    }
+
+    /* Continued fraction: next convergent */
+    if (Lentz) {
+      cplx a;
+      double maxDelta = 0;
+      if (k==0) {
+        a.re = 1; a.im = 0;
+      }
+      else {
+        a = cmul(beta[k-1],beta[k-1]);
+        a.re = -a.re; a.im = -a.im;
+      }
+      for (i=0;i<nz;i++) {
+        cplx b, Delta;
+        b.re = alpha[k].re + S->zr[i];
+        b.im = alpha[k].im + (S->zi ? S->zi[i] : 0);
+        D[i] = cmul(a,D[i]);
+        D[i].re += b.re; D[i].im += b.im;
+        C[i] = cdiv(a,C[i]);
+        C[i].re += b.re; C[i].im += b.im;
+        {
+          cplx one = {1, 0};
+          D[i] = cdiv(one,D[i]);
+        }
+        Delta = cmul(C[i],D[i]);
+        spec[i] = cmul(spec[i],Delta);
+        if (check) {
+          const double d = sqrt((Delta.re-1)*(Delta.re-1) + Delta.im*Delta.im);
+          if (d>maxDelta || d!=d) maxDelta = d;
+        }
+      }
+      if (check) {
+        S->specchange[S->nChanges++] = maxDelta;
+        S->converged = maxDelta<Threshold;
+      }
+    }
+    else if (check) {
+      double maxchange = 0, maxspec = -HUGE_VAL;
+      for (i=0;i<NTESTPOINTS;i++) {
+        const double r = contfrac(zTest[i],alpha,beta,k+1).re;
+        const double d = fabs(r-oldspec[i]);
+        if (d>maxchange || d!=d) maxchange = d;
+        if (r>maxspec) maxspec = r;
+        oldspec[i] = r;
+      }
+      S->specchange[S->nChanges++] = maxchange/maxspec;
+      S->converged = maxchange/maxspec<Threshold;
+    }
+
+    if (S->converged) break;
+
+    /* as in chili_lanczos.m, the change of this iteration is set to
+       zero, replacing the value of a convergence check */
+    if (beta[k].re==0 && beta[k].im==0) {
+      if (check)
+        S->specchange[S->nChanges-1] = 0;
+      else
+        S->specchange[S->nChanges++] = 0;
+      break;
+    }
+  }
+  if (k==N) k = N-1;
+
+  /* Store spectrum */
+  for (i=0;i<nz;i++) {
+    cplx s;
+    if (Lentz) {
+      s = spec[i];
+    }
+    else {
+      cplx zz;
+      zz.re = S->zr[i];
+      zz.im = S->zi ? S->zi[i] : 0;
+      s = contfrac(zz,alpha,beta,k+1);
+    }
+    S->specRe[i] = s.re;
+    S->specIm[i] = s.im;
+  }
+
+cleanup:
+  free(q); free(y); free(bq); free(alpha); free(beta);
+  free(C); free(D); free(spec); free(zTest); free(oldspec);
+}
+
+/*===================================================================*/
+static const mxArray *item(const mxArray *a, int k)
+{
+  return mxIsCell(a) ? mxGetCell(a,k) : a;
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  struct LanczosSystem *Sys;
+  int nSys, s;
+  long nz, N;
+  bool Lentz, Failed = false;
+  double Threshold;
+  double *convergedOut;
+
+  if (nrhs!=5) mexErrMsgTxt("5 input arguments expected.");
+  if (nlhs>3) mexErrMsgTxt("Too many output arguments.");
+
+  setthreads();
+
+  nSys = mxIsCell(prhs[0]) ? (int)mxGetNumberOfElements(prhs[0]) : 1;
+  if (mxIsCell(prhs[1]) && ((int)mxGetNumberOfElements(prhs[1])!=nSys))
+    mexErrMsgTxt("b must have as many cells as A.");
+  if (mxIsCell(prhs[2]) && ((int)mxGetNumberOfElements(prhs[2])!=nSys))
+    mexErrMsgTxt("z must have as many cells as A.");
+  Lentz = mxGetScalar(prhs[3])!=0;
+  Threshold = mxGetScalar(prhs[4]);
+
+  nz = (long)mxGetNumberOfElements(item(prhs[2],0));
+  if (nz<1) mexErrMsgTxt("z must not be empty.");
+
+  Sys = mxCalloc(nSys>0 ? nSys : 1,sizeof(struct LanczosSystem));
+  plhs[0] = mxCreateDoubleMatrix(nz,nSys,mxCOMPLEX);
+  for (s=0;s<nSys;s++) {
+    const mxArray *A = item(prhs[0],s);
+    const mxArray *b = item(prhs[1],s);
+    const mxArray *z = item(prhs[2],s);
+    if (!A || !mxIsSparse(A) || !mxIsDouble(A))
+      mexErrMsgTxt("A must be a sparse double matrix.");
+    N = (long)mxGetM(A);
+    if ((long)mxGetN(A)!=N) mexErrMsgTxt("A must be square.");
+    if (!b || !mxIsDouble(b) || mxIsSparse(b) || ((long)mxGetNumberOfElements(b)!=N))
+      mexErrMsgTxt("b must be a full vector with as many elements as A has rows.");
+    if (!z || !mxIsDouble(z) || ((long)mxGetNumberOfElements(z)!=nz))
+      mexErrMsgTxt("All z must be double vectors of equal length.");
+    if (N<1) mexErrMsgTxt("A must not be empty.");
+    Sys[s].N = N;
+    Sys[s].ir = mxGetIr(A);
+    Sys[s].jc = mxGetJc(A);
+    Sys[s].Ar = mxGetPr(A);
+    Sys[s].Ai = mxGetPi(A);
+    Sys[s].br = mxGetPr(b);
+    Sys[s].bi = mxGetPi(b);
+    Sys[s].zr = mxGetPr(z);
+    Sys[s].zi = mxGetPi(z);
+    Sys[s].specRe = mxGetPr(plhs[0]) + s*nz;
+    Sys[s].specIm = mxGetPi(plhs[0]) + s*nz;
+    Sys[s].specchange = mxMalloc((N+1)*sizeof(double));
+    Sys[s].Failed = false;
+  }
+
+  if (nSys==1) {
+    lanczos(&Sys[0],nz,Lentz,Threshold,true);
+  }
+  else {
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic,1)
+#endif
+    for (s=0;s<nSys;s++)
+      lanczos(&Sys[s],nz,Lentz,Threshold,false);
+  }
+
+  for (s=0;s<nSys;s++)
+    if (Sys[s].Failed) Failed = true;
+  if (Failed) {
+    for (s=0;s<nSys;s++) mxFree(Sys[s].specchange);
+    mxFree(Sys);
+    mexErrMsgTxt("Out of memory in Lanczos solver.");
+  }
+
+  if (nlhs>1) {
+    plhs[1] = mxCreateDoubleMatrix(1,nSys,mxREAL);
+    convergedOut = mxGetPr(plhs[1]);
+    for (s=0;s<nSys;s++)
+      convergedOut[s] = Sys[s].converged;
+  }
+  if (nlhs>2) {
+    plhs[2] = mxCreateCellMatrix(1,nSys);
+    for (s=0;s<nSys;s++) {
+      mxArray *c = mxCreateDoubleMatrix(1,Sys[s].nChanges,mxREAL);
+      long i;
+      for (i=0;i<Sys[s].nChanges;i++)
+        mxGetPr(c)[i] = Sys[s].specchange[i];
+      mxSetCell(plhs[2],s,c);
+    }
+  }
+
+  for (s=0;s<nSys;s++) mxFree(Sys[s].specchange);
+  mxFree(Sys);
+}
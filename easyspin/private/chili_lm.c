@@ -1,37 +1,72 @@
+/*
+[r,c,Vals,nRows] = chili_lm(Sys,BasisOpts,Diff)
+[L,nRows] = chili_lm(Sys,BasisOpts,Diff)
+[LG,LB,nRows] = chili_lm(Sys,BasisOpts,Diff)
+[...,Stats] = chili_lm(Sys,BasisOpts,Diff,true)
+
+  Computes the Liouvillian in the LMK basis for S=1/2 with any number of
+  nuclear spins (up to MAX_NUCLEI). Sys.I, Sys.NZ0 and Sys.HF0 contain one
+  element per nucleus, Sys.HF2 one column per nucleus, and BasisOpts ends
+  with one pImax per nucleus.
+
+  With four outputs, returns the nonzero elements of -1i*H + Gamma as
+  1-based row and column indices r and c and complex values Vals.
+  With two outputs, returns L = +1i*H + Gamma directly as a complex
+  nRows x nRows sparse matrix.
+  With three outputs, returns L split into a field-independent part LG
+  (hyperfine and diffusion) and a part LB proportional to the magnetic
+  field (electron and nuclear Zeeman), such that L = LG + B*LB. Sys.EZ0,
+  Sys.EZ2 and Sys.NZ0 are interpreted as values for unit field. LG and LB
+  have identical sparsity patterns.
+  If the fourth input is true, an additional last output Stats is
+  returned, a structure with the basis and element counts, the size of
+  the element staging buffer, the size of the 3j table and the wall
+  times of the setup, counting, element and assembly phases.
+
+  The matrix is computed in two passes over the rows. The first pass only
+  counts the nonzero elements of each row, so that all arrays can be
+  allocated with their exact final size. The second pass computes the
+  elements and writes each row at its offset, directly into the output
+  arrays for four outputs, and into a staging buffer holding only the
+  upper triangle for sparse matrix outputs.
+ */
+
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
 #include <mex.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "cpuinfo.h"
 
 #include "jjj.h"
-
-bool Display = false;
+#include "kernelstats.h"
 
 __inline int isodd(int k) { return (k % 2); }
 __inline int parity(int k) { return (isodd(k) ? -1 : +1); }
 __inline int mini(int a,int b) { return ((a<b) ? a : b); }
 
-int nNuclei;
-
-long blockSize, allocatedSize;
-
 const double sqrt12 = 0.70710678118655; /* sqrt(1.0/2.0); */
 const double sqrt13 = 0.57735026918963; /* sqrt(1.0/3.0); */
 const double sqrt23 = 0.81649658092773; /* sqrt(2.0/3.0); */
 
-double *ridx, *cidx;
-double *MatrixRe, *MatrixIm;
-
-int nRows, nElements, nBasis;
+/* maximum number of nuclei */
+#ifndef MAX_NUCLEI
+#define MAX_NUCLEI 8
+#endif
 
-int Lemax, Lomax, Kmax, Mmax;
-int jKmin, pSmin, pImax, pIbmax, deltaK;
-int MeirovitchSymm;
+/* Interaction parameters of one nucleus */
+struct NucleusStruct {
+  double I, NZI0, HFI0, *ReHFI2, *ImHFI2;
+  int pImax;
+};
 
 struct SystemStruct {
   double EZI0, *ReEZI2, *ImEZI2;
   double *d2psi;
   double DirTilt;
-  double I, NZI0, HFI0, *ReHFI2, *ImHFI2;
-  double Ib, NZI0b, HFI0b, *ReHFI2b, *ImHFI2b;
+  struct NucleusStruct Nuc[MAX_NUCLEI];
 };
 
 struct DiffusionStruct {
@@ -41,13 +76,209 @@ struct DiffusionStruct {
   int maxL;
 };
 
-struct SystemStruct Sys;
-struct DiffusionStruct Diff;
+/* Spatial and electron spin quantum numbers of one basis function */
+struct BasisIndex {
+  int L, jK, K, M, pS, qS;
+};
+
+/* All settings of one chili_lm call: spin system, diffusion parameters,
+   basis limits and the basis itself. Passed to all matrix element
+   functions, so that several calls (and threads) do not share any state.
+   pI and qI hold the nuclear quantum numbers of the basis functions
+   (nNuclei per function), and blockEnd[i] is the index of the first
+   basis function after the (L,jK,K) block containing function i.
+   jjjTable holds all 3j symbols needed for the matrix elements.
+   If SplitField is set, the Zeeman terms are stored separately. */
+struct Context {
+  struct SystemStruct Sys;
+  struct DiffusionStruct Diff;
+  int nNuclei;
+  int Lemax, Lomax, Kmax, Mmax;
+  int jKmin, pSmin, deltaK;
+  int MeirovitchSymm;
+  bool Display;
+  bool SplitField;
+  int nRows;
+  struct BasisIndex *Rows;
+  int *pI, *qI, *blockEnd;
+  const struct JJJTable *jjjTable;
+};
+
+/* Destination of the elements of one row. In the counting pass (Count
+   set), the elements on and above the diagonal (nUpper) and all elements
+   including the mirror images below the diagonal (nTotal) are only
+   counted. Otherwise, they are written from position n on: with COO set,
+   as elements of -1i*H + Gamma with their mirror images and 1-based
+   indices into rOut, cOut, Re and Im; else as the upper triangle of
+   L = +1i*H + Gamma into cidx, Re, Im and, if not NULL, ImB (the
+   field-proportional part). */
+struct ElementBuffer {
+  bool Count, COO;
+  long nUpper, nTotal, n;
+  double *rOut, *cOut;
+  int *cidx;
+  double *Re, *Im, *ImB;
+};
+
+/* Stores element (iRow,iCol) and, for COO output, its mirror (iCol,iRow).
+   The destination arrays are sized exactly from the counting pass. */
+void storeelement(struct ElementBuffer *buf, int iRow, int iCol,
+  double GammaElement, double LiouvilleElement, double ZeemanElement)
+{
+  long n = buf->n;
+  buf->nUpper++;
+  buf->nTotal += (iRow==iCol) ? 1 : 2;
+  if (buf->Count) return;
+  if (buf->COO) {
+    buf->rOut[n] = iRow + 1;
+    buf->cOut[n] = iCol + 1;
+    buf->Re[n] = GammaElement;
+    buf->Im[n] = -LiouvilleElement;
+    n++;
+    if (iRow!=iCol) {
+      buf->rOut[n] = iCol + 1;
+      buf->cOut[n] = iRow + 1;
+      buf->Re[n] = GammaElement;
+      buf->Im[n] = -LiouvilleElement;
+      n++;
+    }
+  }
+  else {
+    buf->cidx[n] = iCol;
+    buf->Re[n] = GammaElement;
+    buf->Im[n] = LiouvilleElement;
+    if (buf->ImB) buf->ImB[n] = ZeemanElement;
+    n++;
+  }
+  buf->n = n;
+}
+
+#include "chili_lmn.inc" /* functions for S=1/2 and any number of nuclear spins */
+
+/* Enumerates all basis functions in the order of the matrix rows. Returns
+   the number of rows and, if ctx->Rows is not NULL, stores their quantum
+   numbers in ctx->Rows, ctx->pI and ctx->qI. */
+int basisrows(struct Context *ctx)
+{
+  int L1, jK1, K1, M1, pS1, qS1, k;
+  int K1max, M1max, qS1max;
+  int iRow = 0;
+  const int nNuclei = ctx->nNuclei;
+  const bool MeirovitchFilter = ctx->MeirovitchSymm && (ctx->Sys.DirTilt==0);
+  int pI[MAX_NUCLEI], qI[MAX_NUCLEI];
+
+  for (L1=0;L1<=ctx->Lemax;L1++) {
+    if (isodd(L1) && (L1>ctx->Lomax)) continue;
+    for (jK1=ctx->jKmin;jK1<=1;jK1+=2) {
+      K1max = mini(ctx->Kmax,L1);
+      for (K1=0;K1<=K1max;K1+=ctx->deltaK) {
+        if ((K1==0)&&(parity(L1)!=jK1)) continue;
+        M1max = mini(ctx->Mmax,L1);
+        for (M1=-M1max;M1<=M1max;M1++) {
+          for (pS1=ctx->pSmin;pS1<=1;pS1++) {
+            qS1max = 1 - abs(pS1);
+            for (qS1=-qS1max;qS1<=qS1max;qS1+=2) {
+
+              /* Loop over all nuclear quantum numbers (pI,qI) of all
+                 nuclei, with the first nucleus varying slowest */
+              for (k=0;k<nNuclei;k++) {
+                pI[k] = -ctx->Sys.Nuc[k].pImax;
+                qI[k] = -((int)(2*ctx->Sys.Nuc[k].I) - abs(pI[k]));
+              }
+              while (1) {
+                int pIsum = 0;
+                for (k=0;k<nNuclei;k++) pIsum += pI[k];
+                if (!(MeirovitchFilter && ((pIsum+pS1-M1)!=1))) {  /* Eq. (A47) */
+                  if (ctx->Rows) {
+                    struct BasisIndex *r = &ctx->Rows[iRow];
+                    r->L = L1; r->jK = jK1; r->K = K1; r->M = M1;
+                    r->pS = pS1; r->qS = qS1;
+                    for (k=0;k<nNuclei;k++) {
+                      ctx->pI[(long)iRow*nNuclei+k] = pI[k];
+                      ctx->qI[(long)iRow*nNuclei+k] = qI[k];
+                    }
+                  }
+                  iRow++;
+                }
+                /* next nuclear state */
+                for (k=nNuclei-1;k>=0;k--) {
+                  const int twoI = (int)(2*ctx->Sys.Nuc[k].I);
+                  if (qI[k]+2<=twoI-abs(pI[k])) {
+                    qI[k] += 2;
+                    break;
+                  }
+                  if (pI[k]<ctx->Sys.Nuc[k].pImax) {
+                    pI[k]++;
+                    qI[k] = -(twoI-abs(pI[k]));
+                    break;
+                  }
+                  pI[k] = -ctx->Sys.Nuc[k].pImax;
+                  qI[k] = -(twoI-abs(pI[k]));
+                }
+                if (k<0) break;
+              }
+
+            } /* qS1 */
+          } /* pS1 */
+        } /* M1 */
+      } /* K1 */
+    } /* jK1 */
+  } /* L1 */
+
+  return iRow;
+}
+
+/* Table of 3j symbols, kept in persistent memory across calls. It is
+   rebuilt only if a call needs larger L, rank or K/M limits than the
+   table covers, so all orientations and field points of a simulation
+   share one table. */
+static struct JJJTable jjjTable = {-1, -1, -1, NULL, 0, NULL};
+
+static void freejjjtable(void)
+{
+  if (jjjTable.offset) mxFree(jjjTable.offset);
+  if (jjjTable.values) mxFree(jjjTable.values);
+  jjjTable.offset = NULL;
+  jjjTable.values = NULL;
+  jjjTable.jmax = jjjTable.jbandmax = jjjTable.mmax = -1;
+}
+
+/* Makes sure the persistent 3j table covers the given limits. Returns
+   true if the table was rebuilt. */
+bool updatejjjtable(int jmax, int jbandmax, int mmax, bool Display)
+{
+  static bool exitRegistered = false;
+  long nValues;
+
+  if ((jmax<=jjjTable.jmax)&&(jbandmax<=jjjTable.jbandmax)&&(mmax<=jjjTable.mmax))
+    return false;
+
+  if (!exitRegistered) {
+    mexAtExit(freejjjtable);
+    exitRegistered = true;
+  }
 
-#include "chili_lm0.inc" /* functions for S=1/2 and no nuclear spins */
-#include "chili_lm1.inc" /* functions for S=1/2 and one nuclear spin */
-#include "chili_lm2.inc" /* functions for S=1/2 and two nuclear spins */
+  /* grow limits monotonically, so that alternating calls do not
+     rebuild the table every time */
+  if (jjjTable.jmax>jmax) jmax = jjjTable.jmax;
+  if (jjjTable.jbandmax>jbandmax) jbandmax = jjjTable.jbandmax;
+  if (jjjTable.mmax>mmax) mmax = jjjTable.mmax;
+  freejjjtable();
 
+  nValues = jjjtablesize(jmax,jbandmax,mmax,NULL);
+  if (Display)
+    mexPrintf("  building 3j table (L %d, rank %d, K/M %d): %ld values\n",
+      jmax,jbandmax,mmax,nValues);
+  jjjTable.jmax = jmax;
+  jjjTable.jbandmax = jbandmax;
+  jjjTable.mmax = mmax;
+  jjjTable.offset = mxMalloc((jbandmax/2+1)*sizeof(long));
+  jjjTable.values = mxMalloc(nValues*sizeof(double));
+  mexMakeMemoryPersistent(jjjTable.offset);
+  mexMakeMemoryPersistent(jjjTable.values);
+  jjjtablefill(&jjjTable);
+  return true;
+}
 
 /*============================================================================ */
 /*============================================================================ */
@@ -55,138 +286,299 @@ struct DiffusionStruct Diff;
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 {
 
-  mxArray *T, *D;
+  struct Context ctx;
+  struct KernelStats Stats;
+  long *rowUpper, *rowTotal;
+  mxArray *T;
   double *R;
-  double *basisopts, *allocationOptions;
-  int idxS, idxD, idx;
-  if (nrhs==1) {
-    double *jm = mxGetPr(prhs[0]);
-    /*mexPrintf("%0.10f\n",jjj(jm[0],jm[1],jm[2],jm[3],jm[4],jm[5])); */
-    return;
-  }
+  double *basisopts;
+  int *stageCidx = NULL;
+  double *stageRe = NULL, *stageIm = NULL, *stageImB = NULL;
+  long nElements, nUpper, idx;
+  int idxS, idxD, iRow, nRows, nThreads, k, nOut;
+  bool COO, wantStats, jjjRebuilt;
+  double tStart, tCount, tElements, tAssembly;
+
+  if (nrhs==1) return;
+
+  if ((nrhs!=3)&&(nrhs!=4)) mexErrMsgTxt("3 or 4 input arguments expected.");
+  tStart = walltime();
 
-  if (nrhs!=4) mexErrMsgTxt("4 input arguments expected.");
-  if (nlhs!=4) mexErrMsgTxt("4 output arguments expected.");
+  /* the statistics structure is an additional last output */
+  wantStats = (nrhs==4) && (mxGetScalar(prhs[3])!=0);
+  nOut = wantStats ? nlhs-1 : nlhs;
+  if ((nOut<2)||(nOut>4)) mexErrMsgTxt("2, 3 or 4 output arguments expected.");
+
+  ctx.Display = false;
+  ctx.SplitField = (nOut==3);
+  COO = (nOut==4);
 
   /* Parse spin system input structure */
-  if (Display) mexPrintf("Parsing system structure...\n");
+  if (ctx.Display) mexPrintf("Parsing system structure...\n");
   idxS = 0;
-  nNuclei = (int)mxGetScalar(mxGetField(prhs[idxS],0,"nNuclei"));
-  if (nNuclei>2)
-    mexErrMsgTxt("chili_lm0123 works only for 0, 1 or 2 nuclear spins.");  
-  Sys.EZI0 = mxGetScalar(mxGetField(prhs[idxS],0,"EZ0"));
-  Sys.DirTilt = mxGetScalar(mxGetField(prhs[idxS],0,"DirTilt"));
-  Sys.d2psi = mxGetPr(mxGetField(prhs[idxS],0,"d2psi"));
+  ctx.nNuclei = (int)mxGetScalar(mxGetField(prhs[idxS],0,"nNuclei"));
+  if (ctx.nNuclei>MAX_NUCLEI)
+    mexErrMsgTxt("Too many nuclear spins for chili_lm.");
+  ctx.Sys.EZI0 = mxGetScalar(mxGetField(prhs[idxS],0,"EZ0"));
+  ctx.Sys.DirTilt = mxGetScalar(mxGetField(prhs[idxS],0,"DirTilt"));
+  ctx.Sys.d2psi = mxGetPr(mxGetField(prhs[idxS],0,"d2psi"));
   T = mxGetField(prhs[idxS],0,"EZ2");
-  Sys.ReEZI2 = mxGetPr(T);
-  Sys.ImEZI2 = mxGetPi(T);
+  ctx.Sys.ReEZI2 = mxGetPr(T);
+  ctx.Sys.ImEZI2 = mxGetPi(T);
   
-  if (nNuclei>=1) {
-    Sys.I = mxGetScalar(mxGetField(prhs[idxS],0,"I"));
-    Sys.NZI0 = mxGetScalar(mxGetField(prhs[idxS],0,"NZ0"));
-    Sys.HFI0 = mxGetScalar(mxGetField(prhs[idxS],0,"HF0"));
+  /* nuclear spins, hyperfine and nuclear Zeeman interactions: one element
+     of I, NZ0 and HF0 and one column of HF2 per nucleus */
+  if (ctx.nNuclei>=1) {
+    double *I = mxGetPr(mxGetField(prhs[idxS],0,"I"));
+    double *NZ0 = mxGetPr(mxGetField(prhs[idxS],0,"NZ0"));
+    double *HF0 = mxGetPr(mxGetField(prhs[idxS],0,"HF0"));
+    double *ReHF2, *ImHF2;
     T = mxGetField(prhs[idxS],0,"HF2");
-    Sys.ReHFI2 = mxGetPr(T);
-    Sys.ImHFI2 = mxGetPi(T);
-  }
-  if (nNuclei==2) {
-    Sys.Ib = mxGetScalar(mxGetField(prhs[idxS],0,"Ib"));
-    Sys.NZI0b = mxGetScalar(mxGetField(prhs[idxS],0,"NZ0b"));
-    Sys.HFI0b = mxGetScalar(mxGetField(prhs[idxS],0,"HF0b"));
-    T = mxGetField(prhs[idxS],0,"HF2b");
-    Sys.ReHFI2b = mxGetPr(T);
-    Sys.ImHFI2b = mxGetPi(T);
+    ReHF2 = mxGetPr(T);
+    ImHF2 = mxGetPi(T);
+    for (k=0;k<ctx.nNuclei;k++) {
+      ctx.Sys.Nuc[k].I = I[k];
+      ctx.Sys.Nuc[k].NZI0 = NZ0[k];
+      ctx.Sys.Nuc[k].HFI0 = HF0[k];
+      ctx.Sys.Nuc[k].ReHFI2 = ReHF2 + 5*k;
+      ctx.Sys.Nuc[k].ImHFI2 = ImHF2 ? ImHF2 + 5*k : NULL;
+    }
   }
   
   /* Parsing basis set input structure */
-  if (Display) mexPrintf("Parsing basis structure...\n");
+  if (ctx.Display) mexPrintf("Parsing basis structure...\n");
   basisopts = mxGetPr(prhs[1]);
   
-  Lemax = (int)basisopts[0];
-  Lomax = (int)basisopts[1];
-  Kmax = (int)basisopts[2];
-  Mmax = (int)basisopts[3];
-  jKmin = (int)basisopts[4];
-  pSmin = (int)basisopts[5];
-  deltaK = (int)basisopts[6];
-  MeirovitchSymm = (int)basisopts[7];
-  pImax = (nNuclei>=1) ? (int)basisopts[8] : 0;
-  pIbmax = (nNuclei>=2) ? (int)basisopts[9] : 0;
+  ctx.Lemax = (int)basisopts[0];
+  ctx.Lomax = (int)basisopts[1];
+  ctx.Kmax = (int)basisopts[2];
+  ctx.Mmax = (int)basisopts[3];
+  ctx.jKmin = (int)basisopts[4];
+  ctx.pSmin = (int)basisopts[5];
+  ctx.deltaK = (int)basisopts[6];
+  ctx.MeirovitchSymm = (int)basisopts[7];
+  for (k=0;k<ctx.nNuclei;k++)
+    ctx.Sys.Nuc[k].pImax = (int)basisopts[8+k];
   
-  if (Display)
-    mexPrintf("  (%d %d %d %d) jKmin %d, pSmin %d, deltaK %d; pImax %d, pIbmax %d\n",
-      Lemax,Lomax,Kmax,Mmax,jKmin,pSmin,deltaK,pImax,pIbmax);
+  if (ctx.Display)
+    mexPrintf("  (%d %d %d %d) jKmin %d, pSmin %d, deltaK %d\n",
+      ctx.Lemax,ctx.Lomax,ctx.Kmax,ctx.Mmax,ctx.jKmin,ctx.pSmin,ctx.deltaK);
   
   /* Parse diffusion input structure */
-  if (Display) mexPrintf("Parsing diffusion structure...\n");
+  if (ctx.Display) mexPrintf("Parsing diffusion structure...\n");
   idxD = 2;
-  Diff.Exchange = mxGetScalar(mxGetField(prhs[idxD],0,"Exchange"));
-  Diff.xlk = mxGetPr(mxGetField(prhs[idxD],0,"xlk"));
-  Diff.maxL = (int)mxGetScalar(mxGetField(prhs[idxD],0,"maxL"));
+  ctx.Diff.Exchange = mxGetScalar(mxGetField(prhs[idxD],0,"Exchange"));
+  ctx.Diff.xlk = mxGetPr(mxGetField(prhs[idxD],0,"xlk"));
+  ctx.Diff.maxL = (int)mxGetScalar(mxGetField(prhs[idxD],0,"maxL"));
   R = mxGetPr(mxGetField(prhs[idxD],0,"Diff"));
-  Diff.Rxx = R[0];
-  Diff.Ryy = R[1];
-  Diff.Rzz = R[2];
-
-  /* Parse allocation settings */
-  allocationOptions = mxGetPr(prhs[3]);
-  blockSize = (long)allocationOptions[0];
-  if (Display) {
-    mexPrintf("  allocation block size: %d\n",blockSize);
+  ctx.Diff.Rxx = R[0];
+  ctx.Diff.Ryy = R[1];
+  ctx.Diff.Rzz = R[2];
+
+
+  /* 3j symbols: L up to Lemax, ranks up to 2 (Hamiltonian) or maxL
+     (potential), and projections up to Kmax or Mmax */
+  {
+    const int Lband = (ctx.Diff.maxL>=4) ? ctx.Diff.maxL : 2;
+    const int mmax = mini(ctx.Lemax,(ctx.Kmax>ctx.Mmax) ? ctx.Kmax : ctx.Mmax);
+    jjjRebuilt = updatejjjtable(ctx.Lemax,Lband,mmax,ctx.Display);
+    ctx.jjjTable = &jjjTable;
   }
-  
-  /* allocate memory for matrix element indices and values */
-  allocatedSize = blockSize;
-  ridx = mxCalloc(allocatedSize,sizeof(double));
-  cidx = mxCalloc(allocatedSize,sizeof(double));
-  MatrixRe = mxCalloc(allocatedSize,sizeof(double));
-  MatrixIm = mxCalloc(allocatedSize,sizeof(double));
-  if (!(cidx && ridx && MatrixRe && MatrixIm))
-    mexErrMsgTxt("Could not allocate initial arrays for Liouvillian.");
-  
-  /* calculate matrix elements */
-  if (Display) mexPrintf("  starting matrix calculation...\n");
-  if (nNuclei==0)
-    makematrix0();
-  else if (nNuclei==1)
-    makematrix1();
-  else if (nNuclei==2)
-    makematrix2();
-  if (Display) mexPrintf("  finishing matrix calculation...\n");
-  
-  /* reallocate (shrink) arrays to correct size */
-  allocatedSize = nElements;
-  MatrixRe = mxRealloc(MatrixRe,allocatedSize*sizeof(double));
-  MatrixIm = mxRealloc(MatrixIm,allocatedSize*sizeof(double));
-  ridx = mxRealloc(ridx,allocatedSize*sizeof(double));
-  cidx = mxRealloc(cidx,allocatedSize*sizeof(double));
-  if (!(cidx && ridx && MatrixRe && MatrixIm))
-    mexErrMsgTxt("Could not reallocate arrays for Liouvillian to final size.");
-  
-  /* adjust indices from 0-based to 1-based */
-  for (idx=0;idx<nElements;idx++) {
-    ridx[idx]+=1;
-    cidx[idx]+=1;
+
+  /* enumerate basis functions (matrix rows) */
+  ctx.Rows = NULL;
+  nRows = basisrows(&ctx);
+  ctx.nRows = nRows;
+  ctx.Rows = mxMalloc((nRows>0 ? nRows : 1)*sizeof(struct BasisIndex));
+  ctx.pI = mxMalloc(((long)nRows*ctx.nNuclei+1)*sizeof(int));
+  ctx.qI = mxMalloc(((long)nRows*ctx.nNuclei+1)*sizeof(int));
+  basisrows(&ctx);
+
+  /* end of each (L,jK,K) block of basis functions */
+  ctx.blockEnd = mxMalloc((nRows>0 ? nRows : 1)*sizeof(int));
+  for (iRow=nRows-1;iRow>=0;iRow--) {
+    const struct BasisIndex *r = &ctx.Rows[iRow];
+    if ((iRow==nRows-1) || (r[1].L!=r->L) || (r[1].jK!=r->jK) || (r[1].K!=r->K))
+      ctx.blockEnd[iRow] = iRow+1;
+    else
+      ctx.blockEnd[iRow] = ctx.blockEnd[iRow+1];
   }
-  
-  /* allocate and assign mex function output arrays */
-  plhs[0] = mxCreateDoubleMatrix(0,0,mxREAL);
-  mxSetPr(plhs[0],ridx);
-  mxSetM(plhs[0],allocatedSize);
-  mxSetN(plhs[0],1);
-  
-  plhs[1] = mxCreateDoubleMatrix(0,0,mxREAL);
-  mxSetPr(plhs[1],cidx);
-  mxSetM(plhs[1],allocatedSize);
-  mxSetN(plhs[1],1);
-  
-  plhs[2] = mxCreateDoubleMatrix(0,0,mxCOMPLEX);
-  mxSetPr(plhs[2],MatrixRe);
-  mxSetPi(plhs[2],MatrixIm);
-  mxSetM(plhs[2],allocatedSize);
-  mxSetN(plhs[2],1);
-  
-  plhs[3] = mxCreateDoubleScalar(nRows);
-  
+
+#ifdef _OPENMP
+  nThreads = ctx.Display ? 1 : setthreads();
+  if (nThreads>nRows) nThreads = nRows;
+  if (nThreads<1) nThreads = 1;
+#else
+  nThreads = 1;
+#endif
+
+  /* counting pass: number of elements of each row on and above the
+     diagonal, and including the mirror images below it */
+  if (ctx.Display) mexPrintf("  counting matrix elements...\n");
+  tCount = walltime();
+  rowUpper = mxMalloc((nRows+1)*sizeof(long));
+  rowTotal = mxMalloc((nRows+1)*sizeof(long));
+#ifdef _OPENMP
+  #pragma omp parallel for num_threads(nThreads) schedule(dynamic,16)
+#endif
+  for (iRow=0;iRow<nRows;iRow++) {
+    struct ElementBuffer buf;
+    memset(&buf,0,sizeof(buf));
+    buf.Count = true;
+    rowelements(&ctx,iRow,&buf);
+    rowUpper[iRow] = buf.nUpper;
+    rowTotal[iRow] = buf.nTotal;
+  }
+
+  /* convert counts to row offsets */
+  nUpper = 0;
+  nElements = 0;
+  for (iRow=0;iRow<nRows;iRow++) {
+    const long nu = rowUpper[iRow], nt = rowTotal[iRow];
+    rowUpper[iRow] = nUpper;
+    rowTotal[iRow] = nElements;
+    nUpper += nu;
+    nElements += nt;
+  }
+  rowUpper[nRows] = nUpper;
+  rowTotal[nRows] = nElements;
+  if (ctx.Display)
+    mexPrintf("       %ld elements, %d rows;\n",nElements,nRows);
+
+  /* allocate all arrays with their final size: the outputs for four
+     outputs, else the staging buffer for the upper triangle */
+  if (COO) {
+    plhs[0] = mxCreateDoubleMatrix(nElements,1,mxREAL);
+    plhs[1] = mxCreateDoubleMatrix(nElements,1,mxREAL);
+    plhs[2] = mxCreateDoubleMatrix(nElements,1,mxCOMPLEX);
+    plhs[3] = mxCreateDoubleScalar(nRows);
+  }
+  else {
+    stageCidx = mxMalloc((nUpper>0 ? nUpper : 1)*sizeof(int));
+    stageRe = mxMalloc((nUpper>0 ? nUpper : 1)*sizeof(double));
+    stageIm = mxMalloc((nUpper>0 ? nUpper : 1)*sizeof(double));
+    if (ctx.SplitField)
+      stageImB = mxMalloc((nUpper>0 ? nUpper : 1)*sizeof(double));
+  }
+
+  /* calculate matrix elements, distributing the rows over threads */
+  if (ctx.Display) mexPrintf("  starting matrix calculation...\n");
+  tElements = walltime();
+#ifdef _OPENMP
+  #pragma omp parallel for num_threads(nThreads) schedule(dynamic,16)
+#endif
+  for (iRow=0;iRow<nRows;iRow++) {
+    struct ElementBuffer buf;
+    memset(&buf,0,sizeof(buf));
+    buf.COO = COO;
+    if (COO) {
+      buf.n = rowTotal[iRow];
+      buf.rOut = mxGetPr(plhs[0]);
+      buf.cOut = mxGetPr(plhs[1]);
+      buf.Re = mxGetPr(plhs[2]);
+      buf.Im = mxGetPi(plhs[2]);
+    }
+    else {
+      buf.n = rowUpper[iRow];
+      buf.cidx = stageCidx;
+      buf.Re = stageRe;
+      buf.Im = stageIm;
+      buf.ImB = stageImB;
+    }
+    rowelements(&ctx,iRow,&buf);
+  }
+  if (ctx.Display) mexPrintf("  finishing matrix calculation...\n");
+  tAssembly = walltime();
+
+  if (!COO) {
+    /* CSC sparse matrix of L = +1i*H + Gamma from the upper triangle.
+       Scattering each element (r,c) and its mirror (c,r) row by
+       row gives sorted row indices within each column, since the
+       elements of column c with row indices <c come from rows <c, and
+       the others from row c in ascending order. */
+    mwIndex *ir, *jc, iNz;
+    double *Pr, *Pi, *PrB = NULL, *PiB = NULL;
+    plhs[0] = mxCreateSparse(nRows,nRows,(nElements>0 ? nElements : 1),mxCOMPLEX);
+    ir = mxGetIr(plhs[0]);
+    jc = mxGetJc(plhs[0]);
+    Pr = mxGetPr(plhs[0]);
+    Pi = mxGetPi(plhs[0]);
+    if (ctx.SplitField) {
+      plhs[1] = mxCreateSparse(nRows,nRows,(nElements>0 ? nElements : 1),mxCOMPLEX);
+      PrB = mxGetPr(plhs[1]);
+      PiB = mxGetPi(plhs[1]);
+    }
+    /* column counts, then column offsets, shifted by one column so that
+       jc[c] is the insertion point of column c during the scatter */
+    memset(jc,0,(nRows+1)*sizeof(mwIndex));
+    for (iRow=0;iRow<nRows;iRow++) {
+      for (idx=rowUpper[iRow];idx<rowUpper[iRow+1];idx++) {
+        jc[stageCidx[idx]]++;
+        if (stageCidx[idx]!=iRow) jc[iRow]++;
+      }
+    }
+    for (iNz=0,iRow=0;iRow<nRows;iRow++) {
+      const mwIndex nc = jc[iRow];
+      jc[iRow] = iNz;
+      iNz += nc;
+    }
+    jc[nRows] = iNz;
+    for (iRow=0;iRow<nRows;iRow++) {
+      for (idx=rowUpper[iRow];idx<rowUpper[iRow+1];idx++) {
+        const int c = stageCidx[idx];
+        iNz = jc[c]++;
+        ir[iNz] = iRow;
+        Pr[iNz] = stageRe[idx];
+        Pi[iNz] = stageIm[idx];
+        if (PiB) { PrB[iNz] = 0; PiB[iNz] = stageImB[idx]; }
+        if (c!=iRow) {
+          iNz = jc[iRow]++;
+          ir[iNz] = c;
+          Pr[iNz] = stageRe[idx];
+          Pi[iNz] = stageIm[idx];
+          if (PiB) { PrB[iNz] = 0; PiB[iNz] = stageImB[idx]; }
+        }
+      }
+    }
+    /* jc[c] now holds the start of column c+1; restore the offsets */
+    for (iRow=nRows;iRow>0;iRow--)
+      jc[iRow] = jc[iRow-1];
+    jc[0] = 0;
+    if (ctx.SplitField) {
+      /* same sparsity pattern for the field-proportional part */
+      memcpy(mxGetIr(plhs[1]),ir,nElements*sizeof(mwIndex));
+      memcpy(mxGetJc(plhs[1]),jc,(nRows+1)*sizeof(mwIndex));
+    }
+    plhs[nOut-1] = mxCreateDoubleScalar(nRows);
+
+    mxFree(stageCidx);
+    mxFree(stageRe);
+    mxFree(stageIm);
+    if (stageImB) mxFree(stageImB);
+  }
+
+  mxFree(rowUpper);
+  mxFree(rowTotal);
+  mxFree(ctx.Rows);
+  mxFree(ctx.pI);
+  mxFree(ctx.qI);
+  mxFree(ctx.blockEnd);
+
+  if (wantStats) {
+    Stats.nFields = 0;
+    setstat(&Stats,"nRows",nRows);
+    setstat(&Stats,"nElements",nElements);
+    setstat(&Stats,"nThreads",nThreads);
+    setstat(&Stats,"StagingElements",COO ? 0 : nUpper);
+    setstat(&Stats,"JJJTableSize",(double)(jjjTable.jmax+1)*jjjTable.stride);
+    setstat(&Stats,"JJJTableRebuilt",jjjRebuilt);
+    setstat(&Stats,"tSetup",tCount-tStart);
+    setstat(&Stats,"tCount",tElements-tCount);
+    setstat(&Stats,"tElements",tAssembly-tElements);
+    setstat(&Stats,"tAssembly",walltime()-tAssembly);
+    setstat(&Stats,"tTotal",walltime()-tStart);
+    plhs[nOut] = statsstruct(&Stats);
+  }
+
   return;
 }
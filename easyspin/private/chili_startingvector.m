@@ -7,10 +7,16 @@ end
 isPotential = any(lambda);
 maxKp = 2;
 
-isNuc1 = isfield(Basis,'pI1');
-isNuc2 = isfield(Basis,'pI2');
-
 nBasis = numel(Basis.L);
+
+% Basis functions with zero nuclear coherence order for all nuclei
+pIzero = true(nBasis,1);
+iNuc = 1;
+while isfield(Basis,sprintf('pI%d',iNuc))
+  pIzero = pIzero & Basis.(sprintf('pI%d',iNuc))==0;
+  iNuc = iNuc + 1;
+end
+
 stvec = zeros(nBasis,1);
   
 absTol = 1e-8; % for numerical integration
@@ -27,8 +33,7 @@ for b = 1:nBasis
   if Basis.M(b)~=0, continue; end
   if Basis.jK(b)~=1, continue; end
   if abs(Basis.pS(b))~=1, continue; end
-  if isNuc1 && Basis.pI1(b)~=0, continue; end
-  if isNuc2 && Basis.pI2(b)~=0, continue; end
+  if ~pIzero(b), continue; end
   
   if ~isPotential
     % Zero potential: non-zero value only for L==K==0
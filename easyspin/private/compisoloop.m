@@ -119,6 +119,9 @@ for iComponent = 1:nComponents
       if isfield(info_,'resfields')
         info.resfields{idx} = info_.resfields;
       end
+      if isfield(info_,'KernelStats')
+        info = appendkernelstats(info,info_.KernelStats,iComponent,iIsotopologue);
+      end
     end
 
   end
@@ -144,7 +147,7 @@ if thirdOutput
       if fdProvided
         info_.fd = data_invdomain;
       end
-      info_fields = fieldnames(info_);
+      info_fields = setdiff(fieldnames(info_),{'KernelStats'},'stable');
       for i = 1:numel(info_fields)
         info.(info_fields{i}) = info_.(info_fields{i});
       end
@@ -153,3 +156,24 @@ if thirdOutput
 end
 
 end
+
+%-------------------------------------------------------------------------------
+% Appends the kernel statistics of one component/isotopologue simulation to
+% info.KernelStats, kernel by kernel, tagged with the component and
+% isotopologue indices
+function info = appendkernelstats(info,KernelStats,iComponent,iIsotopologue)
+
+kernels = fieldnames(KernelStats);
+for k = 1:numel(kernels)
+  Stats = KernelStats.(kernels{k});
+  if isempty(Stats), continue; end
+  [Stats.iComponent] = deal(iComponent);
+  [Stats.iIsotopologue] = deal(iIsotopologue);
+  if isfield(info,'KernelStats') && isfield(info.KernelStats,kernels{k})
+    info.KernelStats.(kernels{k}) = [info.KernelStats.(kernels{k}) Stats];
+  else
+    info.KernelStats.(kernels{k}) = Stats;
+  end
+end
+
+end
@@ -0,0 +1,70 @@
+/*
+cpuinfo.c    instruction set and threads used by the MEX functions
+
+  Info = cpuinfo
+
+  Info.SIMD        instruction set of the vectorized kernel variants
+                   selected on this CPU: 'AVX-512', 'AVX2', 'SSE2',
+                   'NEON' or 'scalar'
+  Info.Clones      true if the kernels compiled for several instruction
+                   sets (SIMD_CLONES, see cpuinfo.h) are dispatched at
+                   load time, false if they run the baseline variant
+  Info.OpenMP      true if the MEX functions are multithreaded
+  Info.Threads     number of threads used, see easyspin('threads',n)
+  Info.Processors  number of processors available
+  Info.MexVersion  interface version of the MEX functions, compared by
+                   checkmex to detect MEX files compiled from older
+                   sources
+
+  All MEX files are compiled with the same options by easyspin_compile,
+  so the values apply to every kernel.
+
+This is an EasySpin function.
+ */
+
+#include <mex.h>
+#include "cpuinfo.h"
+
+/* Increase together with MexVersion in checkmex.m whenever the inputs
+   or outputs of a MEX function change. */
+#define MEXVERSION 2
+
+static const char *isaname(int isa)
+{
+  switch (isa) {
+    case ISA_SSE2: return "SSE2";
+    case ISA_AVX2: return "AVX2";
+    case ISA_AVX512: return "AVX-512";
+    case ISA_NEON: return "NEON";
+    default: return "scalar";
+  }
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  const char *Fields[] = {"SIMD","Clones","OpenMP","Threads","Processors","MexVersion"};
+  mxArray *Info;
+  bool Clones = false, OpenMP = false;
+  int nThreads, nProcessors = 1;
+
+  if (nrhs!=0) mexErrMsgTxt("No input arguments expected.");
+  if (nlhs>1) mexErrMsgTxt("One output argument expected.");
+
+#ifdef SIMD_HAVE_CLONES
+  Clones = true;
+#endif
+  nThreads = setthreads();
+#ifdef _OPENMP
+  OpenMP = true;
+  nProcessors = omp_get_num_procs();
+#endif
+
+  Info = mxCreateStructMatrix(1,1,6,Fields);
+  mxSetField(Info,0,"SIMD",mxCreateString(isaname(isalevel())));
+  mxSetField(Info,0,"Clones",mxCreateLogicalScalar(Clones));
+  mxSetField(Info,0,"OpenMP",mxCreateLogicalScalar(OpenMP));
+  mxSetField(Info,0,"Threads",mxCreateDoubleScalar(nThreads));
+  mxSetField(Info,0,"Processors",mxCreateDoubleScalar(nProcessors));
+  mxSetField(Info,0,"MexVersion",mxCreateDoubleScalar(MEXVERSION));
+  plhs[0] = Info;
+}
@@ -0,0 +1,81 @@
+/*
+cpuinfo.h    instruction set and thread count used by the MEX functions
+
+  Vectorized variants of the hot loops are compiled into each MEX file
+  for several instruction sets, and the variant matching the CPU is
+  selected at run time:
+
+  - Functions marked SIMD_CLONES are compiled for AVX-512, AVX2 and the
+    baseline (SSE2 on x86-64). The dynamic loader picks one when the MEX
+    file is loaded (GCC and Clang on x86-64 Linux; elsewhere the
+    baseline is used).
+  - Explicitly vectorized code is compiled with SIMD_TARGET and selected
+    with isalevel(), which uses the same CPU feature tests.
+  - NEON is part of the baseline on ARM64 and is used unconditionally.
+
+  Defining NOSIMD at compile time disables all of this.
+
+  setthreads() applies the thread count option set with
+  easyspin('threads',n), stored in the global variable EasySpinThreads,
+  to the OpenMP regions of the calling MEX function.
+ */
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if (defined(__x86_64__)||defined(__i386__)) && defined(__GNUC__) && !defined(NOSIMD)
+#include <immintrin.h>
+#define SIMD_X86
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#if defined(__linux__) && ((defined(__clang__) && __clang_major__>=14) || (!defined(__clang__) && __GNUC__>=6))
+#define SIMD_CLONES __attribute__((target_clones("avx512f","avx2","default")))
+#define SIMD_HAVE_CLONES
+#endif
+#elif defined(__ARM_NEON) && defined(__aarch64__) && !defined(NOSIMD)
+#include <arm_neon.h>
+#define SIMD_NEON
+#endif
+
+#ifndef SIMD_CLONES
+#define SIMD_CLONES
+#endif
+
+enum {ISA_SCALAR, ISA_SSE2, ISA_AVX2, ISA_AVX512, ISA_NEON};
+
+/* Instruction set of the vectorized variants that run on this CPU */
+static inline int isalevel(void)
+{
+#if defined(SIMD_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return ISA_AVX512;
+  if (__builtin_cpu_supports("avx2")) return ISA_AVX2;
+  if (__builtin_cpu_supports("sse2")) return ISA_SSE2;
+  return ISA_SCALAR;
+#elif defined(SIMD_NEON)
+  return ISA_NEON;
+#else
+  return ISA_SCALAR;
+#endif
+}
+
+/* Sets the number of OpenMP threads from the global EasySpinThreads, or
+   to the OpenMP default if it is empty or not defined, and returns it.
+   Call from the MATLAB thread, outside of parallel regions. */
+static inline int setthreads(void)
+{
+#ifdef _OPENMP
+  static int defaultThreads = 0;
+  const mxArray *opt;
+  int nThreads;
+  if (defaultThreads==0) defaultThreads = omp_get_max_threads();
+  nThreads = defaultThreads;
+  opt = mexGetVariablePtr("global","EasySpinThreads");
+  if ((opt!=NULL) && mxIsNumeric(opt) && !mxIsEmpty(opt) && (mxGetScalar(opt)>=1))
+    nThreads = (int)mxGetScalar(opt);
+  omp_set_num_threads(nThreads);
+  return nThreads;
+#else
+  return 1;
+#endif
+}
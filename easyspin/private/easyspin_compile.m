@@ -27,6 +27,14 @@ end
 mexoptions = {mexoptions,'-silent'};
 fprintf('  mex extension: %s, %d-bit\n',mexext,nBits);
 
+% Optimization level. Vectorized variants of the hot loops for several
+% instruction sets (AVX-512, AVX2, baseline) are compiled into each mex
+% file and selected at run time (see cpuinfo.h), so no instruction set
+% flags are needed.
+if ~ispc
+  mexoptions = [mexoptions {'COPTIMFLAGS=$COPTIMFLAGS -O3'}];
+end
+
 
 % Determine mex configuration
 %-------------------------------------------------------------------------------
@@ -38,6 +46,27 @@ else
 end
 
 
+% Determine OpenMP options (used for multithreaded mex files)
+%-------------------------------------------------------------------------------
+if ispc
+  ompoptions = {'COMPFLAGS=$COMPFLAGS /openmp'};
+elseif ismac
+  ompoptions = {}; % Apple clang does not ship with OpenMP
+else
+  ompoptions = {'CFLAGS=$CFLAGS -fopenmp','LDFLAGS=$LDFLAGS -fopenmp'};
+end
+if isempty(ompoptions)
+  fprintf('  OpenMP: not available\n');
+else
+  fprintf('  OpenMP: %s\n',ompoptions{1});
+end
+
+
+% Libraries needed by individual mex files
+%-------------------------------------------------------------------------------
+LinkLibraries.multimatmult_ = {'-lmwblas'};
+
+
 % Get list of *.c files
 %-------------------------------------------------------------------------------
 SourceFiles = dir('*.c');
@@ -49,8 +78,19 @@ nFiles = numel(SourceFiles);
 fprintf('  compiling %d c-files...\n',nFiles);
 for f = 1:nFiles
   fprintf('  (%d/%d) %-25s ',f,nFiles,SourceFiles(f).name);
+  [~,mexName] = fileparts(SourceFiles(f).name);
+  if isfield(LinkLibraries,mexName)
+    libraries = LinkLibraries.(mexName);
+  else
+    libraries = {};
+  end
   try
-    mex(SourceFiles(f).name,mexoptions{:});
+    try
+      mex(SourceFiles(f).name,mexoptions{:},ompoptions{:},libraries{:});
+    catch
+      % compiler without OpenMP support: build single-threaded
+      mex(SourceFiles(f).name,mexoptions{:},libraries{:});
+    end
     fprintf('  complete\n');
     ok(f) = true;
   catch
@@ -60,6 +100,13 @@ for f = 1:nFiles
   end
 end
 
+% Report the kernel variants selected on this computer
+if exist('cpuinfo','file')==3
+  Info = cpuinfo;
+  fprintf('  SIMD variant: %s\n',Info.SIMD);
+  fprintf('  threads: %d\n',Info.Threads);
+end
+
 cd(olddir);
 
 % A hack that was needed at the EasySpin workshop at Cornell 2007, no idea why.
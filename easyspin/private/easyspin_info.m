@@ -45,6 +45,9 @@ VersionInfo.Date = esDate;
 VersionInfo.ExpiryDate = esExpiryDate;
 VersionInfo.MATLABversion = MATLABversion;
 VersionInfo.Platform = platform;
+if exist('cpuinfo','file')==3
+  VersionInfo.MEX = cpuinfo;
+end
 if nargout>0
   varargout = {VersionInfo};
   return
@@ -77,6 +80,9 @@ if ~all(mexed)
   else
     fprintf('\nEasySpin compilation unsuccessful.\n\n');
   end
+elseif ~checkmex
+  % mex files compiled from older sources are recompiled by checkmex
+  fprintf('\nEasySpin recompilation unsuccessful.\n\n');
 end
 clear functions
 
@@ -106,6 +112,19 @@ if Display
     fprintf([mexext, ', %d/%d missing'],sum(~mexed)/numel(mexed));
   end
   fprintf('\n');
+  if exist('cpuinfo','file')==3
+    Kernels = cpuinfo;
+    fprintf('  MEX variant:      %s',Kernels.SIMD);
+    if ~Kernels.Clones
+      fprintf(' (lisum1i only, other kernels baseline)');
+    end
+    fprintf('\n');
+    if Kernels.OpenMP
+      fprintf('  MEX threads:      %d of %d processors\n',Kernels.Threads,Kernels.Processors);
+    else
+      fprintf('  MEX threads:      1 (compiled without OpenMP)\n');
+    end
+  end
 
   % Display information about MATLAB and system
   fprintf('------------------------------------------------------------------\n');
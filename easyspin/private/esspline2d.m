@@ -2,6 +2,7 @@
 %
 %    yy = esspline2d(y,rr,cc);
 %    yy = esspline2d(y,rr,cc,EndCon);
+%    C = esspline2d(y,[],[],EndCon);
 %
 %    y, a real 2D array, is interpolated using cubic
 %    tensor product splines. y is assumed to defined over
@@ -19,6 +20,15 @@
 %                      Matches first and second derivative
 %                      at first and last point.
 %
+%    If rr and cc are empty, the polynomial coefficients of
+%    all cells of the grid are returned instead, in a 16xN
+%    array C for the N polynomial pieces (N=(nr-1)*(nc-1)
+%    for nr,nc>3), with column index ir+(nr-1)*(ic-1) for
+%    the cell starting at row ir and column ic. Within the
+%    cell, the interpolant is sum(C(a+4*b+1)*r^(3-a)*c^(3-b))
+%    over a,b = 0..3, at local coordinates r and c from 0
+%    to 1.
+%
 %    Call spparms('autommd',0) before calling ESSLPINE2D (speed-up)!
 
 % M-file dependencies
@@ -58,6 +68,12 @@ sizeg(1) = cL*4;
 % Locate interpolation points
 %------------------------------------------------------------
 % for each data point, compute its pp interval
+if n==0
+  % all cells
+  [ir,ic] = ndgrid(1:cL,1:rL);
+  points = [ir(:).'; ic(:).'];
+  n = size(points,2);
+end
 ipoint = fix(points);
 ipoint(1,ipoint(1,:)>cL) = cL;
 ipoint(2,ipoint(2,:)>rL) = rL;
@@ -74,6 +90,10 @@ offset = reshape(sub2ind(sizeg,idx{:}),16,1);
 base = ipoint(1,:) - 1 + sizeg(1)*(ipoint(2,:)-1);
 
 coefs = reshape(values(base(ones(16,1),:)+offset(:,ones(1,n))),[4,4,n]);
+if isempty(ri)
+  F = reshape(coefs,16,n);
+  return
+end
 
 % Compute interpolated values
 %-------------------------------------------------------------------
@@ -1,6 +1,7 @@
 % gridinterp  Interpolates spherical-grid data
 %
 %   yi = gridinterp(y,gridParams,phi,theta,InterpType)
+%   [pp,Cells,Local] = gridinterp(y,gridParams,phi,theta,InterpType,'pp')
 %   
 % Inputs:
 %   y            data, in row vectors. Matrices get interpolated along rows.
@@ -9,6 +10,12 @@
 %   InterpType   interpolation type, 'G3' (default),'L3','L1'
 % Outputs:
 %   yi           y interpolated over interpolation points
+%   pp           polynomial coefficients of the interpolant over the cells of
+%                the (rectangular) data grid, 4xNxm (1D) or 16xN (2D) for N
+%                cells and m rows of y, highest power first, see interpproject
+%   Cells        cell index of each interpolation point
+%   Local        local coordinates of the interpolation points within their
+%                cells, 1xM (1D, theta) or 2xM (2D, theta and phi)
 
 % List of unique phi intervals as set by sphgrid(), octant numbers, and end
 % conditions (p is periodic, z is zero endslopes).
@@ -27,11 +34,12 @@
 % Dinfh   0     0
 % O3     -1     0
 
-function yi = gridinterp(y,gridParams,phi,theta,InterpType)
+function [yi,Cells,Local] = gridinterp(y,gridParams,phi,theta,InterpType,Mode)
 
-if nargin<4 || nargin>5
-  error('4 or 5 input arguments ar required.')
+if nargin<4 || nargin>6
+  error('4 to 6 input arguments ar required.')
 end
+returnPP = nargin==6 && strcmp(Mode,'pp');
 
 % Set default or user-defined parameters
 if nargin<5 || isempty(InterpType)
@@ -71,6 +79,13 @@ case 0
   Factor = (numel(phi)-1)/(n-1);
   iphi = 1:1/Factor:n;
   
+  if returnPP
+    yi = pp1d(y,cubicInterpolation,globalInterpolation);
+    Cells = min(fix(iphi),n-1);
+    Local = iphi - Cells;
+    return
+  end
+  
   if ~cubicInterpolation % linear interpolation
     yi = interp1(y.',iphi);
     
@@ -125,6 +140,32 @@ otherwise
     ithe = 1 + 2*(GridSize-1) * (theta/pi);
   end
   
+  if returnPP
+    [nr,nc] = size(z);
+    if ~cubicInterpolation
+      % bilinear: z00 + (z10-z00)*r + (z01-z00)*c + (z11-z10-z01+z00)*r*c
+      z00 = z(1:nr-1,1:nc-1); z10 = z(2:nr,1:nc-1);
+      z01 = z(1:nr-1,2:nc); z11 = z(2:nr,2:nc);
+      yi = zeros(16,(nr-1)*(nc-1));
+      yi(16,:) = z00(:);
+      yi(15,:) = z10(:) - z00(:);
+      yi(12,:) = z01(:) - z00(:);
+      yi(11,:) = z11(:) - z10(:) - z01(:) + z00(:);
+    elseif globalInterpolation
+      yi = esspline2d(z,[],[]);
+      if size(yi,2)~=(nr-1)*(nc-1)
+        error('Polynomial coefficients need at least 4 grid points along theta and phi.');
+      end
+    else
+      error('Local cubic interpolator for %d (oct) not available!',nOctants);
+    end
+    ir = min(fix(ithe(:).'),nr-1);
+    ic = min(fix(iphi(:).'),nc-1);
+    Cells = ir + (nr-1)*(ic-1);
+    Local = [ithe(:).'-ir; iphi(:).'-ic];
+    return
+  end
+  
   if ~cubicInterpolation
     yi = interp2(z,iphi,ithe,'linear');
   elseif globalInterpolation
@@ -138,6 +179,39 @@ end
 return
 
 
+%--------------------------------------------------------------------------
+function C = pp1d(y,cubicInterp,globalInterp)
+%--------------------------------------------------------------------------
+% Polynomial coefficients of the 1D interpolants of the rows of y over the
+% n-1 intervals between the data points, as 4x(n-1)xm array, highest power
+% first. The same interpolants as in the Dinfh branch of gridinterp.
+
+[m,n] = size(y);
+if ~cubicInterp
+  dy = diff(y,1,2);
+  C = [zeros(2,n-1,m); permute(dy,[3 2 1]); permute(y(:,1:n-1),[3 2 1])];
+elseif globalInterp
+  [~,coefs,L,k,d] = unmkpp(esspline1d(y,1));
+  if k<4, coefs = [zeros(d*L,4-k) coefs]; end
+  C = permute(reshape(coefs,d,L,4),[3 2 1]);
+else
+  % Hermite polynomials with Fritsch-Carlson monotone slopes
+  H = [2 -2 1 1; -3 3 -2 -1; 0 0 1 0; 1 0 0 0];
+  C = zeros(4,n-1,m);
+  for r = 1:m
+    del = diff(y(r,:));
+    k = find(sign(del(1:n-2)).*sign(del(2:n-1))>0);
+    dmax = max(abs(del(k)), abs(del(k+1)));
+    dmin = min(abs(del(k)), abs(del(k+1)));
+    Tangents = zeros(1,n);
+    Tangents(k+1) = 2*dmin.*dmax./(del(k)+del(k+1));
+    C(:,:,r) = H*[y(r,1:end-1); y(r,2:end); Tangents(1:end-1); Tangents(2:end)];
+  end
+end
+
+return
+
+
 %--------------------------------------------------------------------------
 function z = rectify(y,GridSize,nOctants,periodic,cubicInterp)
 %--------------------------------------------------------------------------
@@ -0,0 +1,271 @@
+/*
+========================================================================
+Spectrum = interpproject(Pos,Amp,Cells,Local,Tri,Weights,x)
+Spectrum = interpproject(Pos,Amp,Cells,Local,Tri,Weights,x,Separate)
+========================================================================
+
+  Interpolates line positions (and amplitudes) from a coarse
+  orientational grid onto a fine one and projects them onto the
+  spectral axis x, without storing the fine-grid values.
+
+  The interpolant is given as piecewise polynomials over the cells of
+  the coarse grid, see gridinterp(...,'pp'). Each fine-grid vertex lies
+  in one cell, at local coordinates within the cell.
+
+  Pos:       position coefficients, 4xCxL (1D) or 16xCxL (2D) array
+             for C cells and L transitions, highest power first
+  Amp:       amplitude coefficients, same size as Pos, or 1x1
+  Cells:     1xM array, cell index of each of the M fine-grid vertices
+  Local:     1xM (1D) or 2xM (2D) local coordinates of the vertices,
+             theta in the first and phi in the second row
+  Tri:       triangulation of the vertices, 3xN uint32 array (2D),
+             empty (1D: segments between subsequent vertices)
+  Weights:   N triangle areas (2D) or M-1 segment weights (1D)
+  x:         1xK array, x axis vector for spectrum
+  Separate:  if true, return one spectrum per transition (LxK),
+             otherwise the sum over all transitions (1xK);
+             default false
+
+  The triangles (or segments) are processed in tiles, distributed over
+  threads. For each tile, the values of all transitions are computed at
+  the vertices used by it and projected with triproject (or
+  zoneproject) into a spectrum per thread. The vertices of a tile of
+  triangles are gathered into a sorted list without duplicates, and the
+  triangles are renumbered to refer to it, so that a tile never uses
+  more than 3*TILESIZE vertices, however the triangles are ordered.
+  Temporary memory is proportional to the tile size, not to the size of
+  the fine grid.
+
+========================================================================
+*/
+
+#include <stdlib.h>
+#include <mex.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "cpuinfo.h"
+#include "projection.h"
+
+#define TILESIZE 1024
+
+/* Value of the polynomial with coefficients c (highest power first) at
+   local coordinates r (theta) and s (phi). In 2D, c[a+4*b] multiplies
+   r^(3-a)*s^(3-b). */
+static double ppval(const double *c, int nDims, double r, double s)
+{
+  double p[4];
+  int a;
+  if (nDims==1)
+    return ((c[0]*r + c[1])*r + c[2])*r + c[3];
+  for (a=0; a<4; a++)
+    p[a] = ((c[a]*s + c[a+4])*s + c[a+8])*s + c[a+12];
+  return ((p[0]*r + p[1])*r + p[2])*r + p[3];
+}
+
+/* Evaluates the coefficients coef of all nTrans transitions at the
+   nVert vertices vList[0..nVert-1], or, if vList is NULL, at vertices
+   vFirst..vFirst+nVert-1. The value of the v-th vertex and transition t
+   is stored at val[v*nTrans+t] if vertexMajor is set, otherwise at
+   val[t*nVert+v]. */
+static void tilevalues(double *val, const double *coef, long nCoef,
+         long nCells, long nTrans, const INT32 *cell, const double *loc,
+         int nDims, const long *vList, long vFirst, long nVert, int vertexMajor)
+{
+  long v, t, k;
+  double r, s;
+  for (v=0; v<nVert; v++) {
+    k = vList ? vList[v] : vFirst + v;
+    r = loc[nDims*k];
+    s = (nDims==2) ? loc[nDims*k+1] : 0;
+    for (t=0; t<nTrans; t++)
+      val[vertexMajor ? v*nTrans+t : t*nVert+v] =
+        ppval(coef+(t*nCells+cell[k])*nCoef,nDims,r,s);
+  }
+}
+
+static int comparelong(const void *a, const void *b)
+{
+  const long u = *(const long*)a, w = *(const long*)b;
+  return (u>w) - (u<w);
+}
+
+/* Position of vertex v in the sorted list vList[0..n-1], which must
+   contain it */
+static long vertexposition(const long *vList, long n, long v)
+{
+  long lo = 0, hi = n-1, mid;
+  while (lo<hi) {
+    mid = (lo+hi)/2;
+    if (vList[mid]<v) lo = mid+1; else hi = mid;
+  }
+  return lo;
+}
+
+void mexFunction(int nlhs, mxArray *plhs[],
+         int nrhs, const mxArray *prhs[])
+{
+  const mwSize *dims;
+  double *Pos, *Amp, *Cells, *Local, *Weights, *x, *Spectrum, *buffer;
+  double *val, *amp;
+  INT32 *Tri, *cell, *tileTri;
+  long *tileVert;
+  long nCoef, nCells, nTrans, nVert, nTri, nUnits, nTiles, nPoints;
+  long nSpec, maxSpan, iTile, v, t, i;
+  int nDims, isoAmp, Separate, nThreads, iThread;
+
+  if ((nrhs!=7)&&(nrhs!=8))
+    mexErrMsgTxt("Wrong number of input arguments!");
+  if (nlhs!=1)
+    mexErrMsgTxt("Wrong number of output arguments!");
+
+  /* get all input parameters */
+  if (!mxIsDouble(prhs[0]) || mxIsComplex(prhs[0]))
+    mexErrMsgTxt("Coefficients must be a real double array!");
+  dims = mxGetDimensions(prhs[0]);
+  nCoef = (long)dims[0];
+  nCells = (mxGetNumberOfDimensions(prhs[0])>1) ? (long)dims[1] : 1;
+  nTrans = (mxGetNumberOfDimensions(prhs[0])>2) ? (long)dims[2] : 1;
+  Pos = mxGetPr(prhs[0]);
+
+  nDims = (int)mxGetM(prhs[3]);
+  if ((nDims!=1)&&(nDims!=2))
+    mexErrMsgTxt("Local coordinates must have 1 or 2 rows!");
+  if (nCoef!=((nDims==1) ? 4 : 16))
+    mexErrMsgTxt("Coefficients must have 4 (1D) or 16 (2D) rows!");
+  nVert = (long)mxGetN(prhs[3]);
+  Local = mxGetPr(prhs[3]);
+  if ((long)mxGetNumberOfElements(prhs[2])!=nVert)
+    mexErrMsgTxt("Number of cell indices and local coordinates must match!");
+  Cells = mxGetPr(prhs[2]);
+
+  if (!mxIsDouble(prhs[1]) || mxIsComplex(prhs[1]))
+    mexErrMsgTxt("Amplitudes must be a real double array!");
+  isoAmp = (mxGetNumberOfElements(prhs[1])==1);
+  if (!isoAmp && ((long)mxGetNumberOfElements(prhs[1])!=nCoef*nCells*nTrans))
+    mexErrMsgTxt("Amplitude coefficients must have the same size as the position coefficients!");
+  Amp = mxGetPr(prhs[1]);
+
+  if (nDims==2) {
+    if ((mxGetM(prhs[4])!=3)||!mxIsUint32(prhs[4]))
+      mexErrMsgTxt("Triangulation array must be a 3xN uint32 array!");
+    Tri = (INT32*)mxGetData(prhs[4]);
+    nTri = (long)mxGetN(prhs[4]);
+    nUnits = nTri;
+  }
+  else {
+    Tri = NULL;
+    nTri = 0;
+    nUnits = nVert-1;
+  }
+  if ((long)mxGetNumberOfElements(prhs[5])!=nUnits)
+    mexErrMsgTxt("Number of weights must match the number of triangles or segments!");
+  Weights = mxGetPr(prhs[5]);
+
+  x = mxGetPr(prhs[6]);
+  nPoints = (long)mxGetNumberOfElements(prhs[6]);
+
+  Separate = 0;
+  if (nrhs==8)
+    Separate = (mxGetScalar(prhs[7])!=0);
+
+  /* allocate result array */
+  nSpec = Separate ? nTrans : 1;
+  plhs[0] = mxCreateDoubleMatrix(nSpec,nPoints,mxREAL);
+  Spectrum = mxGetPr(plhs[0]);
+  if ((nUnits<1)||(nTrans<1)) return;
+
+  /* zero-based cell indices */
+  cell = (INT32*)mxMalloc(nVert*sizeof(INT32));
+  for (v=0; v<nVert; v++) {
+    if (!(Cells[v]>=1 && Cells[v]<=nCells))
+      mexErrMsgTxt("Cell indices out of range!");
+    cell[v] = (INT32)Cells[v]-1;
+  }
+
+  if (nDims==2)
+    for (i=0; i<3*nTri; i++)
+      if ((Tri[i]<1)||(Tri[i]>nVert))
+        mexErrMsgTxt("Triangulation refers to nonexistent vertices!");
+
+  /* maximum number of vertices used by a tile: three per triangle, or
+     one more than the number of segments */
+  nTiles = (nUnits+TILESIZE-1)/TILESIZE;
+  maxSpan = (nDims==2) ? 3*TILESIZE : TILESIZE+1;
+
+  nThreads = 1;
+  #ifdef _OPENMP
+  nThreads = setthreads();
+  if (nThreads>nTiles) nThreads = (int)nTiles;
+  #endif
+
+  /* spectra and tile buffers of each thread */
+  buffer = (double*)mxCalloc(nThreads*nSpec*nPoints,sizeof(double));
+  val = (double*)mxMalloc(nThreads*maxSpan*nTrans*sizeof(double));
+  amp = isoAmp ? NULL : (double*)mxMalloc(nThreads*maxSpan*nTrans*sizeof(double));
+  tileTri = (nDims==2) ? (INT32*)mxMalloc(nThreads*3*TILESIZE*sizeof(INT32)) : NULL;
+  tileVert = (nDims==2) ? (long*)mxMalloc(nThreads*3*TILESIZE*sizeof(long)) : NULL;
+
+  #ifdef _OPENMP
+  #pragma omp parallel for num_threads(nThreads) schedule(dynamic)
+  #endif
+  for (iTile=0; iTile<nTiles; iTile++) {
+    long first = iTile*TILESIZE;
+    long last = (first+TILESIZE<nUnits) ? first+TILESIZE : nUnits;
+    long nSpan, j, tt;
+    double *s, *tval, *tamp;
+    int th = 0;
+    #ifdef _OPENMP
+    th = omp_get_thread_num();
+    #endif
+    s = buffer + th*nSpec*nPoints;
+    tval = val + th*maxSpan*nTrans;
+    tamp = isoAmp ? Amp : amp + th*maxSpan*nTrans;
+
+    if (nDims==2) {
+      /* sorted vertices of the tile without duplicates, and triangulation
+         of the tile referring to them (one-based) */
+      INT32 *tri = tileTri + th*3*TILESIZE;
+      long *vList = tileVert + th*3*TILESIZE;
+      long nIdx = 3*(last-first);
+      for (j=0; j<nIdx; j++)
+        vList[j] = Tri[3*first+j] - 1;
+      qsort(vList,nIdx,sizeof(long),comparelong);
+      nSpan = 1;
+      for (j=1; j<nIdx; j++)
+        if (vList[j]!=vList[nSpan-1]) vList[nSpan++] = vList[j];
+      for (j=0; j<nIdx; j++)
+        tri[j] = (INT32)vertexposition(vList,nSpan,Tri[3*first+j]-1) + 1;
+      tilevalues(tval,Pos,nCoef,nCells,nTrans,cell,Local,nDims,vList,0,nSpan,1);
+      if (!isoAmp)
+        tilevalues(tamp,Amp,nCoef,nCells,nTrans,cell,Local,nDims,vList,0,nSpan,1);
+      triproject(s,tri,Weights+first,tval,tamp,x,(INT32)nPoints,
+                 (INT32)(last-first),(INT32)nTrans,0,(INT32)nTrans,isoAmp,!Separate);
+    }
+    else {
+      /* segments first..last-1 use vertices first..last */
+      nSpan = last-first+1;
+      tilevalues(tval,Pos,nCoef,nCells,nTrans,cell,Local,nDims,NULL,first,nSpan,0);
+      if (!isoAmp)
+        tilevalues(tamp,Amp,nCoef,nCells,nTrans,cell,Local,nDims,NULL,first,nSpan,0);
+      for (tt=0; tt<nTrans; tt++)
+        zoneproject(s+(Separate ? tt*nPoints : 0),NULL,tval+tt*nSpan,
+                    isoAmp ? tamp : tamp+tt*nSpan,NULL,isoAmp ? 1 : nSpan,
+                    Weights+first,x,nPoints,nSpan,false);
+    }
+  }
+
+  /* collect results */
+  for (iThread=0; iThread<nThreads; iThread++)
+    for (t=0; t<nSpec; t++)
+      for (i=0; i<nPoints; i++)
+        Spectrum[t+i*nSpec] += buffer[(iThread*nSpec+t)*nPoints+i];
+
+  mxFree(buffer);
+  mxFree(val);
+  if (!isoAmp) mxFree(amp);
+  if (tileTri!=NULL) mxFree(tileTri);
+  if (tileVert!=NULL) mxFree(tileVert);
+  mxFree(cell);
+
+}
@@ -1,6 +1,7 @@
-/* Lanczos approximation to the logarithm of the Gamma function
- for integer arguments.
- (taken from "Numerical Recipes", error 2e-10) */
+#include <math.h>
+#include <string.h>
+
+/* Logarithm of N!, tabulated up to N=200 and from lgamma beyond */
 double facln(const int N)
 {
 const double values[201] =
@@ -73,37 +74,20 @@ const double values[201] =
 847.35209797043840919, 852.64036500113294442, 857.93366982585743682, 
 863.23198719240547350};
 
-const double c[6] = {76.18009172947146,-86.50532032941677,
-  24.01409824083091,-1.231739572450155,0.1208650973866179e-2,
-  -0.5395239384953e-5};
-
-double x, y, tmp, Series, lnGamma;
-int j;
-
 if (N<=200)
   return values[N];
 
-x = N + 1;
-tmp = x + 5.5;
-tmp -= (x+0.5)*log(tmp);
-
-y = N + 1;
-Series = 1 + 1.90015e-10;
-for (j=0;j<6;j++) Series +=c[j]/++y;
-
-lnGamma = -tmp + log(2.5066282746310005024*Series/x);
-
-return lnGamma;
+return lgamma(N+1.0);
 }
 
 /*=========================================================================*/
 /* mex implementation of wigner 3j symbols */
-/* (used by chili_lm0, chili_lm1, and chili_lm2) */
+/* (used by chili_lm) */
 /*=========================================================================*/
 double jjj(int j1, int j2, int j3, int m1, int m2, int m3)
 {
 
-double w3j;
+double w3j = 0;
 
 
 int k;
@@ -257,3 +241,285 @@ else {
 return phase*w3j;
 
 }
+
+/*=========================================================================*/
+/* Rows of 3j and 6j symbols by recursion                                  */
+/*=========================================================================*/
+/* K. Schulten, R. G. Gordon, J. Math. Phys. 16, 1961-1970 (1975)
+   https://doi.org/10.1063/1.522426
+   The symbols f[i], i = 0..n-1, of a row satisfy a three-term recursion
+     X[i]*f[i+1] + Y[i]*f[i] + Z[i]*f[i-1] = 0
+   with Z[0] = X[n-1] = 0. jjjrecursion solves it up to a common factor.
+   The values are small at the ends of a row (classically forbidden
+   regions) and oscillate in between. The forward recursion from i = 0
+   is run while |f| increases, and the backward recursion from i = n-1
+   for the rest, so that both run in the direction of growing values and
+   are stable. The two parts are matched in least squares at the two
+   points where they meet, and rescaled on the way to avoid overflow.
+   work must hold n values. */
+void jjjrecursion(int n, const double *X, const double *Y, const double *Z,
+  double *f, double *work)
+{
+  const double big = 1e150;
+  double *g = work, scale;
+  int i, k, r;
+
+  f[0] = 1;
+  if (n==1) return;
+  f[1] = -Y[0]*f[0]/X[0];
+  for (k=1; fabs(f[k])>=fabs(f[k-1]); k++) {
+    if (k==n-1) return;
+    f[k+1] = -(Y[k]*f[k] + Z[k]*f[k-1])/X[k];
+    if (fabs(f[k+1])>big)
+      for (r=0; r<=k+1; r++) f[r] /= big;
+  }
+
+  /* backward recursion down to k-1, then match at k-1 and k */
+  g[n-1] = 1;
+  g[n-2] = -Y[n-1]*g[n-1]/Z[n-1];
+  for (i=n-2; i>=k; i--) {
+    g[i-1] = -(X[i]*g[i+1] + Y[i]*g[i])/Z[i];
+    if (fabs(g[i-1])>big)
+      for (r=i-1; r<n; r++) g[r] /= big;
+  }
+  scale = (f[k-1]*g[k-1] + f[k]*g[k])/(f[k-1]*f[k-1] + f[k]*f[k]);
+  for (i=0; i<k-1; i++) f[i] *= scale;
+  for (i=k-1; i<n; i++) f[i] = g[i];
+
+  /* values below the rounding error of the recursion step are zeros
+     of the symbol, make them exact */
+  for (i=1; i<n-1; i++)
+    if (fabs(f[i])<1e-14*(fabs(f[i-1])+fabs(f[i+1]))) f[i] = 0;
+}
+
+/* Scales f[0..n-1] to sum(w.*f.^2) = 1, with the sign s for f[n-1] */
+void jjjnormalize(int n, double *f, const double *w, int s)
+{
+  double norm = 0;
+  int i;
+  for (i=0; i<n; i++) norm += w[i]*f[i]*f[i];
+  norm = 1/sqrt(norm);
+  if ((f[n-1]<0)!=(s<0)) norm = -norm;
+  for (i=0; i<n; i++) f[i] *= norm;
+}
+
+/* (-1)^k for integer k */
+int jjjsign(double k)
+{
+  return (((long)fabs(floor(k+0.5)))%2) ? -1 : +1;
+}
+
+/* All 3j symbols
+     ( j1  j2  j3 )
+     ( m1  m2  m3 )  with m1 = -m2-m3
+   for j1 = *j1min...j2+j3, by recursion in j1. The j and m can be
+   half-integers and must be valid (|m2|<=j2, |m3|<=j3, j2-m2 and j3-m3
+   integer). Returns the number of values, 0 if all vanish. values must
+   hold 2*min(j2,j3)+1 elements and work four times as many. */
+int jjjrowj(double j2, double j3, double m2, double m3, double *j1min,
+  double *values, double *work)
+{
+  const double m1 = -m2-m3;
+  const double jdsq = (j2-j3)*(j2-j3), jssq = (j2+j3+1)*(j2+j3+1);
+  const int nmax = (int)floor(2*((j2<j3) ? j2 : j3) + 1.5);
+  double *X = work, *Y = work+nmax, *Z = work+2*nmax;
+  double jmin, j, A, Aprev;
+  int i, n;
+
+  jmin = fabs(j2-j3);
+  if (fabs(m1)>jmin) jmin = fabs(m1);
+  *j1min = jmin;
+  if (jmin>j2+j3) return 0;
+  n = (int)floor(j2+j3-jmin+1.5);
+
+  /* j1*A(j1+1)*f(j1+1) + B(j1)*f(j1) + (j1+1)*A(j1)*f(j1-1) = 0 */
+  Aprev = 0;
+  for (i=0; i<n; i++) {
+    j = jmin + i;
+    A = (i<n-1) ? sqrt(((j+1)*(j+1)-jdsq)*(jssq-(j+1)*(j+1))*((j+1)*(j+1)-m1*m1)) : 0;
+    X[i] = j*A;
+    Y[i] = -(2*j+1)*((j2*(j2+1)-j3*(j3+1))*m1 - j*(j+1)*(m3-m2));
+    Z[i] = (j+1)*Aprev;
+    Aprev = A;
+  }
+  if ((jmin==0)&&(n>1)) {
+    /* singular at j1 = 0 (j2 = j3, m1 = 0), use f(1)/f(0) */
+    X[0] = 1;
+    Y[0] = -m2/sqrt(j2*(j2+1));
+  }
+  jjjrecursion(n,X,Y,Z,values,work+3*nmax);
+
+  /* sum over j1 of (2*j1+1)*f^2 is 1, sign of f(j2+j3) is (-1)^(j2-j3-m1) */
+  for (i=0; i<n; i++) X[i] = 2*(jmin+i)+1;
+  jjjnormalize(n,values,X,jjjsign(j2-j3-m1));
+  return n;
+}
+
+/* All 3j symbols
+     ( j1  j2  j3 )
+     ( m1  m2  m3 )  with m3 = -m1-m2
+   for m2 = *m2min...*m2min+n-1, by recursion in m2. Returns n, 0 if all
+   vanish. values must hold 2*j2+1 elements and work four times as
+   many. */
+int jjjrowm(double j1, double j2, double j3, double m1, double *m2min,
+  double *values, double *work)
+{
+  const int nmax = (int)floor(2*j2+1.5);
+  double *X = work, *Y = work+nmax, *Z = work+2*nmax;
+  double mmin, mmax, m2, m3, C, Cprev;
+  int i, n;
+
+  mmin = (-j2>-j3-m1) ? -j2 : -j3-m1;
+  mmax = (j2<j3-m1) ? j2 : j3-m1;
+  *m2min = mmin;
+  if ((fabs(m1)>j1)||(j3<fabs(j1-j2))||(j3>j1+j2)||(mmin>mmax)) return 0;
+  n = (int)floor(mmax-mmin+1.5);
+
+  /* C(m2+1)*f(m2+1) + D(m2)*f(m2) + C(m2)*f(m2-1) = 0 */
+  Cprev = 0;
+  for (i=0; i<n; i++) {
+    m2 = mmin + i;
+    m3 = -m1-m2-1;
+    C = (i<n-1) ? sqrt((j2-m2)*(j2+m2+1)*(j3+m3+1)*(j3-m3)) : 0;
+    X[i] = C;
+    Y[i] = j2*(j2+1) + j3*(j3+1) + 2*m2*(m3+1) - j1*(j1+1);
+    Z[i] = Cprev;
+    Cprev = C;
+  }
+  jjjrecursion(n,X,Y,Z,values,work+3*nmax);
+
+  /* sum over m2 of f^2 is 1/(2*j1+1), sign of f(m2max) is (-1)^(j2-j3-m1) */
+  for (i=0; i<n; i++) X[i] = 2*j1+1;
+  jjjnormalize(n,values,X,jjjsign(j2-j3-m1));
+  return n;
+}
+
+/* All 6j symbols
+     { j1  j2  j3 }
+     { l1  l2  l3 }
+   for j1 = *j1min...*j1min+n-1, by recursion in j1. Returns n, 0 if all
+   vanish. values must hold 2*min(j2,j3)+1 elements and work four times
+   as many. */
+int sixjrowj(double j2, double j3, double l1, double l2, double l3,
+  double *j1min, double *values, double *work)
+{
+  const int nmax = (int)floor(2*((j2<j3) ? j2 : j3) + 1.5);
+  const double jdsq = (j2-j3)*(j2-j3), jssq = (j2+j3+1)*(j2+j3+1);
+  const double ldsq = (l2-l3)*(l2-l3), lssq = (l2+l3+1)*(l2+l3+1);
+  const double J2 = j2*(j2+1), J3 = j3*(j3+1);
+  const double L1 = l1*(l1+1), L2 = l2*(l2+1), L3 = l3*(l3+1);
+  double *X = work, *Y = work+nmax, *Z = work+2*nmax;
+  double jmin, jmax, j, J, E, Eprev;
+  int i, n;
+
+  jmin = (fabs(j2-j3)>fabs(l2-l3)) ? fabs(j2-j3) : fabs(l2-l3);
+  jmax = (j2+j3<l2+l3) ? j2+j3 : l2+l3;
+  *j1min = jmin;
+  if ((jmin>jmax)||(l1<fabs(j2-l3))||(l1>j2+l3)||(l1<fabs(l2-j3))||(l1>l2+j3))
+    return 0;
+  if ((fmod(j2+j3+l2+l3,1)!=0)||(fmod(l1+j2+l3,1)!=0)||(fmod(l1+l2+j3,1)!=0))
+    return 0;
+  n = (int)floor(jmax-jmin+1.5);
+
+  /* j1*E(j1+1)*f(j1+1) + F(j1)*f(j1) + (j1+1)*E(j1)*f(j1-1) = 0 */
+  Eprev = 0;
+  for (i=0; i<n; i++) {
+    j = jmin + i;
+    J = j*(j+1);
+    E = (i<n-1) ? sqrt(((j+1)*(j+1)-jdsq)*(jssq-(j+1)*(j+1))*
+                       ((j+1)*(j+1)-ldsq)*(lssq-(j+1)*(j+1))) : 0;
+    X[i] = j*E;
+    Y[i] = (2*j+1)*(J*(-J+J2+J3-2*L1) + L2*(J+J2-J3) + L3*(J-J2+J3));
+    Z[i] = (j+1)*Eprev;
+    Eprev = E;
+  }
+  if ((jmin==0)&&(n>1)) {
+    /* singular at j1 = 0 (j2 = j3, l2 = l3), use f(1)/f(0) */
+    X[0] = 1;
+    Y[0] = (J2+L2-L1)/(2*sqrt(J2*L2));
+  }
+  jjjrecursion(n,X,Y,Z,values,work+3*nmax);
+
+  /* sum over j1 of (2*j1+1)*(2*l1+1)*f^2 is 1, sign of f(j1max) is
+     (-1)^(j2+j3+l2+l3) */
+  for (i=0; i<n; i++) X[i] = (2*(jmin+i)+1)*(2*l1+1);
+  jjjnormalize(n,values,X,jjjsign(j2+j3+l2+l3));
+  return n;
+}
+
+/*=========================================================================*/
+/* Table of wigner 3j symbols                                              */
+/*=========================================================================*/
+/* Holds all 3j symbols
+     ( j1  j  j2 )
+     ( m1  m  -m1-m )
+   with 0<=j1<=jmax, even j from 0 to jbandmax, |j1-j2|<=j, and
+   |m1|<=mmax. These are all that chili_lm needs, with jmax the
+   maximum L, jbandmax the maximum rank of the interactions and the
+   potential, and mmax the larger of Kmax and Mmax.
+   For each j1 and j, values are stored for j2 = j1-j...j1+j and
+   m = -j...j, and m1 runs fastest. Symbols that violate the triangle
+   condition or have |m|>j are stored as zero. The values for all j2 of
+   given j1, j, m1 and m are computed together with jjjrowj. */
+struct JJJTable {
+  int jmax, jbandmax, mmax;
+  long *offset; /* start of block j=2*e within the block of one j1 */
+  long stride;  /* number of values per j1 */
+  double *values;
+};
+
+/* Size of the table for the given limits */
+long jjjtablesize(int jmax, int jbandmax, int mmax, long *offset)
+{
+  long n = 0;
+  int e;
+  for (e=0;2*e<=jbandmax;e++) {
+    if (offset) offset[e] = n;
+    n += (long)(4*e+1)*(4*e+1)*(2*mmax+1);
+  }
+  return n*(jmax+1);
+}
+
+/* Computes all values of the table. tab->offset and tab->values must be
+   allocated to the sizes given by jjjtablesize(). */
+void jjjtablefill(struct JJJTable *tab)
+{
+  const int nm = 2*tab->mmax+1;
+  int j1;
+  tab->stride = jjjtablesize(0,tab->jbandmax,tab->mmax,tab->offset);
+  memset(tab->values,0,(tab->jmax+1)*tab->stride*sizeof(double));
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic,1)
+#endif
+  for (j1=0;j1<=tab->jmax;j1++) {
+    double *row = malloc(5*(2*tab->jbandmax+1)*sizeof(double));
+    double *work = row + (2*tab->jbandmax+1);
+    double j2min;
+    int j, m1, m, n, k;
+    for (j=0;j<=tab->jbandmax;j+=2) {
+      double *v = tab->values + j1*tab->stride + tab->offset[j/2];
+      for (m=-j;m<=j;m++) {
+        for (m1=-tab->mmax;m1<=tab->mmax;m1++) {
+          if (abs(m1)>j1) continue;
+          /* ( j1 j j2 ; m1 m -m1-m ) = ( j2 j1 j ; -m1-m m1 m ) */
+          n = jjjrowj(j1,j,m1,m,&j2min,row,work);
+          for (k=0;k<n;k++) {
+            const int j2 = (int)j2min + k;
+            v[((j2-j1+j)*(2*j+1)+(m+j))*nm+(m1+tab->mmax)] = row[k];
+          }
+        }
+      }
+    }
+    free(row);
+  }
+}
+
+/* Looks up ( j1 j j2 ; m1 m -m1-m ). The arguments must be within the
+   limits of the table, and j must be even. */
+__inline double jjjtab(const struct JJJTable *tab, int j1, int j, int j2, int m1, int m)
+{
+  const int nm = 2*tab->mmax+1;
+  if (abs(j2-j1)>j) return 0;
+  return tab->values[j1*tab->stride + tab->offset[j/2] +
+    ((j2-j1+j)*(2*j+1)+(m+j))*nm + (m1+tab->mmax)];
+}
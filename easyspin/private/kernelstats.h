@@ -0,0 +1,58 @@
+/*
+kernelstats.h    statistics output of MEX functions
+
+  Shared by the MEX functions that can return a structure with statistics
+  of a call, such as phase timings, element or peak counts, and buffer
+  sizes. The statistics are collected in a KernelStats and converted to
+  a scalar MATLAB structure with one numeric field per entry at the end
+  of the call. Timings are wall times in seconds (CPU time in builds
+  without OpenMP).
+ */
+
+#include <string.h>
+#include <time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define MAX_STATS 32
+
+struct KernelStats {
+  int nFields;
+  const char *Names[MAX_STATS];
+  double Values[MAX_STATS];
+};
+
+static double walltime(void)
+{
+#ifdef _OPENMP
+  return omp_get_wtime();
+#else
+  return (double)clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+/* Sets the value of field Name, adding the field if necessary. Name must
+   be a string literal or otherwise outlive the KernelStats. */
+static void setstat(struct KernelStats *Stats, const char *Name, double Value)
+{
+  int f;
+  for (f=0; f<Stats->nFields; f++)
+    if (strcmp(Stats->Names[f],Name)==0) break;
+  if (f==MAX_STATS) return;
+  if (f==Stats->nFields) {
+    Stats->Names[f] = Name;
+    Stats->nFields++;
+  }
+  Stats->Values[f] = Value;
+}
+
+static mxArray *statsstruct(const struct KernelStats *Stats)
+{
+  mxArray *S;
+  int f;
+  S = mxCreateStructMatrix(1,1,Stats->nFields,(const char**)Stats->Names);
+  for (f=0; f<Stats->nFields; f++)
+    mxSetFieldByNumber(S,0,f,mxCreateDoubleScalar(Stats->Values[f]));
+  return S;
+}
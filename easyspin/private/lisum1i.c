@@ -1,6 +1,7 @@
 /* lisum1c = LInear SUMmation, 1D, programmed in C
 
   y = lisum1ic(T,PosT,WidT,Pos,Amp,Wid,x)
+  y = lisum1ic(T,PosT,WidT,Pos,Amp,Wid,x,Group,nGroups)
 
   Accumulates line shapes into a 1D spectrum by
   interpolatively copying from a shape integral template
@@ -15,136 +16,353 @@
     Amp: line amplitudes in spectrum
     Wid: line widths in spectrum
     x:  x axis of spectrum
+    Group: spectrum index (1..nGroups) for each line
+    nGroups: number of spectra
 
   The x axis of T is assumed to be 1:length(T).
   PosT is the Matlab index of the center. Pos, Wid
   and Amp must contain the same number of elements,
-  they are accessed as Pos(:) etc.
-  y will be a row vector the same length as x.
+  they are accessed as Pos(:) etc. Amp and Wid can
+  also be scalars, which are then used for all lines.
+  y will be a row vector the same length as x, or,
+  with Group and nGroups, an nGroups x length(x)
+  array with line k added to row Group(k).
+
+  Large sets of lines are distributed over threads,
+  each accumulating into a private spectrum array.
+  These are summed at the end.
+
+  Lines with NaN or Inf parameters are removed in one
+  pass before the accumulation. On CPUs with AVX-512 or
+  AVX2 (x86, selected at run time) or NEON (ARM64), the
+  template is interpolated for several spectral points
+  at once. The scalar code is the fallback and
+  reference; the vectorized code agrees with it to
+  within rounding.
 
  */
 
 #include <math.h>
+#include <stdlib.h>
+#include <limits.h>
 #include <mex.h>
+#include "cpuinfo.h"
+
+/* minimum number of lines per thread */
+#define MINLINESPERTHREAD 2000
+
+/* Line shape template and spectral axis, shared by all lines */
+struct Template {
+  const double *T;
+  long nT;
+  double PosT, WidT;
+  double x0, delta, beta;
+  long nx;
+  int isa;
+};
+
+/* Flags for invalid line parameters */
+struct LineFlags {
+  bool Inf, NaN, Neg;
+};
+
+#ifdef SIMD_X86
+/* Interpolates the template for four spectral points at a time, from
+   idx up to last, and returns the index of the next point. pT and
+   ValueOld are updated as in the scalar loop in addline. The template
+   positions of the points are kept in one vector and advanced by
+   4*alpha, and the previous value of each point is taken from the
+   neighbouring lane. */
+SIMD_TARGET("avx2")
+static long addpoints_avx2(const double *T, long nT, double alpha,
+  double Amplitude, long idx, long last, double *pT, double *ValueOld,
+  double *y)
+{
+  const __m256d one = _mm256_set1_pd(1.0);
+  const __m256d vAmp = _mm256_set1_pd(Amplitude);
+  const __m256d vStep = _mm256_set1_pd(4*alpha);
+  __m256d vp = _mm256_add_pd(_mm256_set1_pd(*pT),
+    _mm256_mul_pd(_mm256_set1_pd(alpha),_mm256_set_pd(3,2,1,0)));
+  const __m128i viMax = _mm_set1_epi32((int)(nT-2));
+  __m256d vOld = _mm256_set1_pd(*ValueOld);
+  for (; idx+4<=last; idx+=4) {
+    /* clamp guards against rounding of the positions at the end */
+    const __m128i vi = _mm_min_epi32(_mm256_cvttpd_epi32(vp),viMax);
+    const __m256d vr = _mm256_sub_pd(vp,_mm256_cvtepi32_pd(vi));
+    const __m256d t0 = _mm256_i32gather_pd(T,vi,8);
+    const __m256d t1 = _mm256_i32gather_pd(T+1,vi,8);
+    const __m256d v = _mm256_add_pd(_mm256_mul_pd(t0,_mm256_sub_pd(one,vr)),
+      _mm256_mul_pd(t1,vr));
+    const __m256d vPrev = _mm256_blend_pd(_mm256_permute4x64_pd(v,0x90),
+      _mm256_permute4x64_pd(vOld,0xFF),1);
+    __m256d vy = _mm256_loadu_pd(y+idx);
+    vy = _mm256_add_pd(vy,_mm256_mul_pd(vAmp,_mm256_sub_pd(v,vPrev)));
+    _mm256_storeu_pd(y+idx,vy);
+    vOld = v;
+    vp = _mm256_add_pd(vp,vStep);
+  }
+  *pT = _mm256_cvtsd_f64(vp);
+  *ValueOld = _mm256_cvtsd_f64(_mm256_permute4x64_pd(vOld,0xFF));
+  return idx;
+}
+
+/* Same as addpoints_avx2, with eight spectral points at a time */
+SIMD_TARGET("avx512f")
+static long addpoints_avx512(const double *T, long nT, double alpha,
+  double Amplitude, long idx, long last, double *pT, double *ValueOld,
+  double *y)
+{
+  const __m512d one = _mm512_set1_pd(1.0);
+  const __m512d vAmp = _mm512_set1_pd(Amplitude);
+  const __m512d vStep = _mm512_set1_pd(8*alpha);
+  const __m512i lastLane = _mm512_set1_epi64(7);
+  /* lane 7 of the previous vector, followed by lanes 0-6 of the current */
+  const __m512i shift = _mm512_set_epi64(6,5,4,3,2,1,0,15);
+  __m512d vp = _mm512_add_pd(_mm512_set1_pd(*pT),
+    _mm512_mul_pd(_mm512_set1_pd(alpha),_mm512_set_pd(7,6,5,4,3,2,1,0)));
+  const __m256i viMax = _mm256_set1_epi32((int)(nT-2));
+  __m512d vOld = _mm512_set1_pd(*ValueOld);
+  for (; idx+8<=last; idx+=8) {
+    const __m256i vi = _mm256_min_epi32(_mm512_cvttpd_epi32(vp),viMax);
+    const __m512d vr = _mm512_sub_pd(vp,_mm512_cvtepi32_pd(vi));
+    const __m512d t0 = _mm512_i32gather_pd(vi,T,8);
+    const __m512d t1 = _mm512_i32gather_pd(vi,T+1,8);
+    const __m512d v = _mm512_add_pd(_mm512_mul_pd(t0,_mm512_sub_pd(one,vr)),
+      _mm512_mul_pd(t1,vr));
+    const __m512d vPrev = _mm512_permutex2var_pd(v,shift,vOld);
+    __m512d vy = _mm512_loadu_pd(y+idx);
+    vy = _mm512_add_pd(vy,_mm512_mul_pd(vAmp,_mm512_sub_pd(v,vPrev)));
+    _mm512_storeu_pd(y+idx,vy);
+    vOld = v;
+    vp = _mm512_add_pd(vp,vStep);
+  }
+  *pT = _mm_cvtsd_f64(_mm512_castpd512_pd128(vp));
+  *ValueOld = _mm_cvtsd_f64(_mm512_castpd512_pd128(_mm512_permutexvar_pd(lastLane,vOld)));
+  return idx;
+}
+#endif
+
+/* Adds one line to the spectrum y (nx points). Pos, Amp and Wid must
+   be finite. */
+static void addline(const struct Template *tp, double Pos, double Amp, double Wid,
+  double *y)
+{
+  const double *T = tp->T;
+  const long nT = tp->nT, nx = tp->nx;
+  const double delta = tp->delta;
+  long idx, first, last, idxT;
+  double alpha, left, right, WidS, Amplitude, pT, remT, Value, ValueOld;
+
+  /* Set to zero if negative width */
+  WidS = Wid;
+  if (WidS<0) WidS = 0;
+
+  /* If width is zero, set it to a small value */
+  if (WidS<delta/100) WidS = delta/100;
+
+  /* Scaling factor between template and spectrum abscissae */
+  alpha = tp->WidT/WidS * tp->beta;
+
+  /* Left and right border of line in spectrum. */
+  left = (Pos-tp->x0)/delta - tp->PosT/alpha;
+  left -= 0.5; /* Integration */
+  right = left + (nT-1)/alpha;
+
+  /* Skip peak if completely outside. */
+  if ((left>=nx-1)||(right<=0)) return;
+
+  /* Chop if necessary. */
+  first = (long)((left<0) ? 0 : ceil(left));
+  last = (long)((right>nx-1) ? nx-1 : ceil(right));
+
+  /* scaled amplitude */
+  Amplitude = Amp/tp->beta;
+
+  /* Loop over all points in spectrum to update. */
+  pT = alpha*(first-left);
+  idxT = (long)(pT-alpha);
+  remT = pT - alpha - idxT;
+  ValueOld = (idxT<0) ? T[0] : (T[idxT]*(1-remT) + T[idxT+1]*remT);
+  idx = first;
+
+#ifdef SIMD_X86
+  if ((tp->isa==ISA_AVX512)&&(last-first>=16)&&(nT<INT_MAX))
+    idx = addpoints_avx512(T,nT,alpha,Amplitude,idx,last,&pT,&ValueOld,y);
+  else if ((tp->isa>=ISA_AVX2)&&(last-first>=8)&&(nT<INT_MAX))
+    idx = addpoints_avx2(T,nT,alpha,Amplitude,idx,last,&pT,&ValueOld,y);
+#endif
+#ifdef SIMD_NEON
+  /* Two spectral points at a time, with template indices and
+     interpolation fractions computed in vector registers */
+  if (last-first>=4) {
+    const float64x2_t vOne = vdupq_n_f64(1.0);
+    const float64x2_t vAmp = vdupq_n_f64(Amplitude);
+    const float64x2_t vStep = vdupq_n_f64(2*alpha);
+    const double off[2] = {0, 1};
+    float64x2_t vp = vfmaq_f64(vdupq_n_f64(pT),vdupq_n_f64(alpha),vld1q_f64(off));
+    float64x2_t vOld = vdupq_n_f64(ValueOld);
+    for (; idx+2<=last; idx+=2) {
+      const int64x2_t vi = vcvtq_s64_f64(vp);
+      const float64x2_t vr = vsubq_f64(vp,vcvtq_f64_s64(vi));
+      long i0 = (long)vgetq_lane_s64(vi,0), i1 = (long)vgetq_lane_s64(vi,1);
+      float64x2_t t0, t1, v, vPrev;
+      if (i0>nT-2) i0 = nT-2;
+      if (i1>nT-2) i1 = nT-2;
+      t0 = vdupq_n_f64(T[i0]);
+      t1 = vdupq_n_f64(T[i0+1]);
+      t0 = vsetq_lane_f64(T[i1],t0,1);
+      t1 = vsetq_lane_f64(T[i1+1],t1,1);
+      v = vaddq_f64(vmulq_f64(t0,vsubq_f64(vOne,vr)),vmulq_f64(t1,vr));
+      vPrev = vextq_f64(vOld,v,1);
+      vst1q_f64(y+idx,vaddq_f64(vld1q_f64(y+idx),vmulq_f64(vAmp,vsubq_f64(v,vPrev))));
+      vOld = v;
+      vp = vaddq_f64(vp,vStep);
+    }
+    pT = vgetq_lane_f64(vp,0);
+    ValueOld = vgetq_lane_f64(vOld,1);
+  }
+#endif
+
+  for (; idx<last; idx++, pT+=alpha, ValueOld=Value) {
+    idxT = (long)pT;
+    remT = pT - idxT;
+    Value = T[idxT]*(1-remT) + T[idxT+1]*remT;
+    y[idx] += Amplitude*(Value-ValueOld);
+  }
+  idxT = (long)pT;
+  remT = pT - idxT;
+  Value = idxT<nT-2 ? T[idxT]*(1-remT) + T[idxT+1]*remT : T[nT-1];
+  y[idx] += Amplitude*(Value-ValueOld);
+}
 
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 {
 
   /* input parameters */
-  double WidT, PosT;
-  double *T, *Pos, *Wid, *Amp, *x;
+  struct Template tp;
+  double *Pos, *Wid, *Amp, *x, *Group = NULL;
+  long *Lines, nLines;
   /* output parameters */
   double *y;
   /* working variables */
-  long nT, nx, nPdat, nIdat, nWdat;
-  long idx, first, last, k, idxT;
-  double alpha, beta, delta, deltaT;
-  double left, right, WidS, Amplitude, pT, remT, Value, ValueOld;
-  bool Verbose, InfEncountered, NaNEncountered, NegEncountered;
-  /*int Harmonic; */
-
-  Verbose = false;
+  long nPdat, nIdat, nWdat, nGroups = 1;
+  long k, g, idx;
+  int nThreads, t;
+  double **Acc;
+  struct LineFlags flags = {false, false, false};
+  bool Failed = false;
 
   /* Argument checks. */
-  if (nrhs!=7) mexErrMsgTxt("Wrong number of input parameters!");
+  if ((nrhs!=7)&&(nrhs!=9)) mexErrMsgTxt("Wrong number of input parameters!");
   if (nlhs!=1) mexErrMsgTxt("Wrong number of output parameters!");
 
   /* Get all input arguments. */
-  T = mxGetPr(prhs[0]);
-  PosT = mxGetScalar(prhs[1]) - 1; /* Matlab -> C array indices */
-  WidT = mxGetScalar(prhs[2]);
+  tp.T = mxGetPr(prhs[0]);
+  tp.PosT = mxGetScalar(prhs[1]) - 1; /* Matlab -> C array indices */
+  tp.WidT = mxGetScalar(prhs[2]);
   Pos = mxGetPr(prhs[3]);
   Amp = mxGetPr(prhs[4]);
   Wid = mxGetPr(prhs[5]);
   x = mxGetPr(prhs[6]);
-  /*Harmonic = 0;*/
 
   /* Get vector lengths. */
   nPdat = mxGetNumberOfElements(prhs[3]);
   nIdat = mxGetNumberOfElements(prhs[4]);
   nWdat = mxGetNumberOfElements(prhs[5]);
 
-  if ((nPdat!=nIdat)||(nPdat!=nWdat))
+  if (((nIdat!=nPdat)&&(nIdat!=1))||((nWdat!=nPdat)&&(nWdat!=1)))
     mexErrMsgTxt("Pos, Amp, Wid must have the same number of elements!");
-  
-  nT = mxGetNumberOfElements(prhs[0]);
-  nx = mxGetNumberOfElements(prhs[6]);
+
+  tp.nT = mxGetNumberOfElements(prhs[0]);
+  tp.nx = mxGetNumberOfElements(prhs[6]);
+  tp.x0 = x[0];
+  tp.isa = isalevel();
+
+  /* Spectrum index of each line */
+  if (nrhs==9) {
+    if ((long)mxGetNumberOfElements(prhs[7])!=nPdat)
+      mexErrMsgTxt("Group must have as many elements as Pos!");
+    Group = mxGetPr(prhs[7]);
+    nGroups = (long)mxGetScalar(prhs[8]);
+    if (nGroups<1) mexErrMsgTxt("nGroups must be positive!");
+    for (k=0; k<nPdat; k++)
+      if ((Group[k]<1)||(Group[k]>nGroups)||(Group[k]!=floor(Group[k])))
+        mexErrMsgTxt("Group must contain integers between 1 and nGroups!");
+  }
 
   /* Allocate result array. */
-  plhs[0] = mxCreateDoubleMatrix(1,nx,mxREAL);
+  plhs[0] = mxCreateDoubleMatrix((nrhs==9) ? nGroups : 1,tp.nx,mxREAL);
+
+  /* Screen all lines for NaN, Inf and negative widths, and keep the
+     indices of the valid ones */
+  Lines = mxMalloc((nPdat>0 ? nPdat : 1)*sizeof(long));
+  nLines = 0;
+  for (k=0; k<nPdat; k++) {
+    const double P = Pos[k], A = Amp[(nIdat==1) ? 0 : k], W = Wid[(nWdat==1) ? 0 : k];
+    if (mxIsNaN(P)||mxIsNaN(A)||mxIsNaN(W)) {flags.NaN=true; continue;}
+    if (mxIsInf(P)||mxIsInf(A)||mxIsInf(W)) {flags.Inf=true; continue;}
+    if (W<0) flags.Neg=true;
+    Lines[nLines++] = k;
+  }
   y = mxGetPr(plhs[0]);
 
-  delta = x[1]-x[0];
-  deltaT = 1;
-  beta = delta/deltaT;
+  tp.delta = x[1]-x[0];
+  tp.beta = tp.delta/1; /* deltaT = 1 */
 
-  /*if (Verbose) mexPrintf("begin of lisum1ic loop\n"); */
-  /* Loop over all peaks to add. */
-  InfEncountered = false;
-  NaNEncountered = false;
-  NegEncountered = false;
-  for (k=0; k<nPdat; k++) {
+  /* Distribute lines over threads, each with its own accumulator
+     (nGroups spectra of nx points, spectrum by spectrum). */
+#ifdef _OPENMP
+  nThreads = setthreads();
+  if (nThreads>nLines/MINLINESPERTHREAD) nThreads = (int)(nLines/MINLINESPERTHREAD);
+  if (nThreads<1) nThreads = 1;
+#else
+  nThreads = 1;
+#endif
+  Acc = mxCalloc(nThreads,sizeof(double*));
+  for (t=0; t<nThreads; t++) {
+    Acc[t] = calloc(nGroups*tp.nx,sizeof(double));
+    if (!Acc[t]) Failed = true;
+  }
+  if (Failed) {
+    for (t=0; t<nThreads; t++) free(Acc[t]);
+    mxFree(Acc);
+    mxFree(Lines);
+    mexErrMsgTxt("Out of memory in lisum1i.");
+  }
 
-    /* Skip if NaN or inf. */
-    if (mxIsNaN(Pos[k])||mxIsNaN(Amp[k])||mxIsNaN(Wid[k])) {NaNEncountered=true; continue;}
-    if (mxIsInf(Pos[k])||mxIsInf(Amp[k])||mxIsInf(Wid[k])) {InfEncountered=true; continue;}
-    
-    /* Set to zero if negative width */
-    WidS = Wid[k];
-    if (WidS<0) {NegEncountered=true; WidS=0;}
-    
-    /* If width is zero, set it to a small value */
-    if (WidS<delta/100) WidS = delta/100;
-
-    /* Scaling factor between template and spectrum abscissae */
-    alpha = WidT/WidS * beta;
-    
-    /* Left and right border of line in spectrum. */
-    left = (Pos[k]-x[0])/delta - PosT/alpha;
-    left -= 0.5; /* Integration */
-    right = left + (nT-1)/alpha;
-
-    /* Skip peak if completely outside. */
-    if ((left>=nx-1)||(right<=0)) continue; 
-
-    /* Chop if necessary. */
-    first = (long)((left<0) ? 0 : ceil(left));
-    last = (long)((right>nx-1) ? nx-1 : ceil(right));
-
-    /* scaled amplitude */
-    Amplitude = Amp[k]/beta;
-    /*if (Harmonic>0) { */
-    /*  Amplitude *= WidT/WidS; */
-    /*  if (Harmonic>1) Amplitude *= WidT/WidS; */
-    /*} */
-    /*if (Verbose) */
-    /*  mexPrintf("  setup> left %g  right %g   first %d  last %d    A %g\n",left,right,first,last,Amplitude); */
-
-    /* Loop over all points in spectrum to update. */
-    pT = alpha*(first-left);
-    idxT = (long)(pT-alpha);
-    remT = pT - alpha - idxT;
-    ValueOld = (idxT<0) ? T[0] : (T[idxT]*(1-remT) + T[idxT+1]*remT);
-    /*if (Verbose) mexPrintf("    start: pT %5f    %11e ...\n",pT-alpha,ValueOld); */
-    
-    for (idx=first; idx<last; idx++, pT+=alpha, ValueOld=Value) {
-      idxT = (long)pT;
-      remT = pT - idxT;
-      Value = T[idxT]*(1-remT) + T[idxT+1]*remT;
-      /*if (Verbose) */
-      /*  mexPrintf("    idxS %4d  pT %5f    %11e - %-11e...",idx,pT,Value,ValueOld); */
-      y[idx] += Amplitude*(Value-ValueOld);
-      /*if (Verbose) mexPrintf("added\n"); */
+#ifdef _OPENMP
+  #pragma omp parallel num_threads(nThreads) private(k,t)
+#endif
+  {
+    long i, iStart, iEnd;
+#ifdef _OPENMP
+    t = omp_get_thread_num();
+#else
+    t = 0;
+#endif
+    /* contiguous block of lines for each thread */
+    iStart = (long)((double)nLines*t/nThreads);
+    iEnd = (long)((double)nLines*(t+1)/nThreads);
+    for (i=iStart; i<iEnd; i++) {
+      double *yg = Acc[t];
+      k = Lines[i];
+      if (Group) yg += ((long)Group[k]-1)*tp.nx;
+      addline(&tp,Pos[k],Amp[(nIdat==1) ? 0 : k],Wid[(nWdat==1) ? 0 : k],yg);
     }
-    idxT = (long)pT;
-    remT = pT - idxT;
-    Value = idxT<nT-2 ? T[idxT]*(1-remT) + T[idxT+1]*remT : T[nT-1];
-    /*if (Verbose) */
-    /*    mexPrintf("  L:idxS %4d  pT %5f    %11e - %-11e...",idx,pT,Value,ValueOld); */
-    y[idx] += Amplitude*(Value-ValueOld);
-    /*if (Verbose) mexPrintf("added\n"); */
-  } /* loop over all lines */
-  /*if (Verbose) mexPrintf("end of lisum1ic loop\n"); */
-  if (InfEncountered) mexPrintf("********** lisum1ic: Inf encountered!! Please report! **************\n");
-  if (NegEncountered) mexPrintf("********** lisum1ic: Negative width encountered!! Please report! **************\n");
+  }
+
+  /* Sum accumulators into output (nGroups x nx, column-major) */
+  for (t=0; t<nThreads; t++) {
+    for (g=0; g<nGroups; g++) {
+      const double *a = Acc[t] + g*tp.nx;
+      for (idx=0; idx<tp.nx; idx++)
+        y[g+idx*nGroups] += a[idx];
+    }
+    free(Acc[t]);
+  }
+  mxFree(Acc);
+  mxFree(Lines);
+
+  if (flags.Inf) mexPrintf("********** lisum1ic: Inf encountered!! Please report! **************\n");
+  if (flags.Neg) mexPrintf("********** lisum1ic: Negative width encountered!! Please report! **************\n");
 } /* void mexFunction */
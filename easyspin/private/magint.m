@@ -206,14 +206,6 @@ else
   else
     System.NZ0 = zeros(1,nNucSpins);
   end
-
-  % Adaption for two nuclei, to feed to chili_liouvmatrix2
-  if (System.nNuclei>=2)
-    System.Ib = System.I(2);
-    System.NZ0b = System.NZ0(2);
-    System.HF0b = System.HF0(2);
-    System.HF2b = System.HF2(:,2);
-  end
 end
 
 % Nuclear electric quadrupole interaction terms
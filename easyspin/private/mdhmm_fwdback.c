@@ -0,0 +1,285 @@
+/*
+mdhmm_fwdback.c     E step of Baum-Welch training for mdhmm_em
+
+  [logLik,transCounts,expNumVisits1,weightsSummed,muUpdater,gammaLast] = ...
+       mdhmm_fwdback(data,initDistr,TransProb,mu,Sigma)
+
+  Runs the scaled forward-backward algorithm for a multivariate Gaussian
+  HMM of periodic (dihedral) data over all trajectories, and accumulates
+  the sufficient statistics needed for the M step.
+
+  data           nDims x nSteps x nTraj array, or cell array with one
+                 nDims x nSteps array per trajectory, in radians
+  initDistr      initial state distribution (nStates elements)
+  TransProb      nStates x nStates transition probability matrix
+  mu             nDims x nStates array of Gaussian centers
+  Sigma          nDims x nDims x nStates array of covariance matrices
+
+  logLik         sum of the log-likelihoods of all trajectories
+  transCounts    nStates x nStates expected transition counts (summed xi)
+  expNumVisits1  nStates x 1 summed state posteriors of the first step
+  weightsSummed  nStates x 1 summed state posteriors over all steps
+  muUpdater      nDims x nStates summed posterior-weighted periodic
+                 distances of the data from mu
+  gammaLast      nStates x nSteps state posteriors of the last trajectory
+
+  The observation likelihoods are Gaussians in the periodic distance
+  (period 2*pi) from the state centers (see mdhmm_gaussian.h). The
+  trajectories are distributed over threads. The statistics of each
+  trajectory are computed into a separate buffer and summed in
+  trajectory order afterwards, so results do not depend on the number
+  of threads.
+
+  muUpdater is summed over all trajectories, like the other statistics.
+  The former MATLAB E step reset it at the start of each trajectory, so
+  that only the last trajectory contributed to the update of mu.
+
+This is an EasySpin function.
+ */
+
+#include <stdlib.h>
+#include <mex.h>
+#include "mdhmm_gaussian.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "cpuinfo.h"
+
+struct Model {
+  struct Gaussians g;
+  const double *initDistr, *TransProb;
+};
+
+/* Sufficient statistics of one trajectory */
+struct Stats {
+  double logLik;
+  double *transCounts, *expNumVisits1, *weightsSummed, *muUpdater;
+  long nNegativeMahal;
+};
+
+/* Scales x (n elements) to unit sum and returns the sum. A zero sum
+   leaves x unchanged, as in normalise. */
+static double normalise(double *x, int n)
+{
+  int i;
+  double z = 0, s;
+  for (i=0; i<n; i++) z += x[i];
+  s = (z==0) ? 1 : z;
+  for (i=0; i<n; i++) x[i] /= s;
+  return z;
+}
+
+/* Observation likelihoods B (nStates x nSteps) of one trajectory */
+static void obslik(const struct Model *m, const double *obs, long nSteps,
+                   double *B, double *dist, long *nNegativeMahal)
+{
+  const int nS = m->g.nStates, nD = m->g.nDims;
+  long t;
+  int i;
+  double mahal;
+
+  for (t=0; t<nSteps; t++) {
+    for (i=0; i<nS; i++) {
+      mahal = mahalanobis(&m->g,obs+t*nD,i,dist);
+      if (mahal<0) (*nNegativeMahal)++;
+      B[i+t*nS] = exp(-0.5*mahal)*m->g.prefactor[i];
+    }
+  }
+}
+
+/* Forward-backward pass and statistics of one trajectory. If gamma is
+   not NULL, the state posteriors are stored there. Returns nonzero if
+   memory could not be allocated. */
+SIMD_CLONES
+static int fwdback(const struct Model *m, const double *obs, long nSteps,
+                   struct Stats *st, double *gammaOut)
+{
+  const int nS = m->g.nStates, nD = m->g.nDims;
+  const double *A = m->TransProb;
+  double *B, *alpha, *beta, *b, *g, *xi, *dist, s, z;
+  long t;
+  int i, j;
+  bool zeroScale = false;
+
+  st->logLik = 0;
+  st->nNegativeMahal = 0;
+  if (nSteps<1) return 0;
+
+  B = (double*)malloc(nS*nSteps*sizeof(double));
+  alpha = (double*)malloc(nS*nSteps*sizeof(double));
+  beta = (double*)malloc(nS*sizeof(double));
+  b = (double*)malloc(2*nS*sizeof(double));
+  xi = (double*)malloc(nS*nS*sizeof(double));
+  dist = (double*)malloc(nD*sizeof(double));
+  if (B==NULL || alpha==NULL || beta==NULL || b==NULL || xi==NULL || dist==NULL) {
+    free(B); free(alpha); free(beta); free(b); free(xi); free(dist);
+    return 1;
+  }
+  g = b + nS;
+
+  obslik(m,obs,nSteps,B,dist,&st->nNegativeMahal);
+
+  /* Forwards */
+  for (i=0; i<nS; i++)
+    alpha[i] = m->initDistr[i]*B[i];
+  z = normalise(alpha,nS);
+  if (z==0) zeroScale = true; else st->logLik += log(z);
+  for (t=1; t<nSteps; t++) {
+    double *a = alpha + t*nS, *aprev = alpha + (t-1)*nS;
+    for (j=0; j<nS; j++) {
+      s = 0;
+      for (i=0; i<nS; i++) s += A[i+j*nS]*aprev[i];
+      a[j] = s*B[j+t*nS];
+    }
+    z = normalise(a,nS);
+    if (z==0) zeroScale = true; else st->logLik += log(z);
+  }
+  if (zeroScale) st->logLik = -HUGE_VAL;
+
+  /* Backwards, with gamma and xi statistics */
+  for (i=0; i<nS; i++) {
+    beta[i] = 1;
+    g[i] = alpha[i+(nSteps-1)*nS];
+  }
+  normalise(g,nS);
+  for (i=0; i<nS; i++) {
+    st->weightsSummed[i] += g[i];
+    if (gammaOut!=NULL) gammaOut[i+(nSteps-1)*nS] = g[i];
+  }
+  if (nSteps==1)
+    for (i=0; i<nS; i++) st->expNumVisits1[i] += g[i];
+  for (i=0; i<nS; i++)
+    for (j=0; j<nD; j++)
+      st->muUpdater[j+i*nD] += g[i]*dist_pbc(obs[j+(nSteps-1)*nD] - m->g.mu[j+i*nD]);
+
+  for (t=nSteps-2; t>=0; t--) {
+    const double *a = alpha + t*nS;
+    for (i=0; i<nS; i++)
+      b[i] = beta[i]*B[i+(t+1)*nS];
+    for (i=0; i<nS; i++) {
+      s = 0;
+      for (j=0; j<nS; j++) s += A[i+j*nS]*b[j];
+      beta[i] = s;
+    }
+    normalise(beta,nS);
+    z = 0;
+    for (j=0; j<nS; j++)
+      for (i=0; i<nS; i++) {
+        xi[i+j*nS] = A[i+j*nS]*a[i]*b[j];
+        z += xi[i+j*nS];
+      }
+    s = (z==0) ? 1 : z;
+    for (i=0; i<nS*nS; i++)
+      st->transCounts[i] += xi[i]/s;
+
+    for (i=0; i<nS; i++) g[i] = a[i]*beta[i];
+    normalise(g,nS);
+    for (i=0; i<nS; i++) {
+      st->weightsSummed[i] += g[i];
+      if (gammaOut!=NULL) gammaOut[i+t*nS] = g[i];
+    }
+    if (t==0)
+      for (i=0; i<nS; i++) st->expNumVisits1[i] += g[i];
+    for (i=0; i<nS; i++)
+      for (j=0; j<nD; j++)
+        st->muUpdater[j+i*nD] += g[i]*dist_pbc(obs[j+t*nD] - m->g.mu[j+i*nD]);
+  }
+
+  free(B); free(alpha); free(beta); free(b); free(xi); free(dist);
+  return 0;
+}
+
+/*
+****************************************************************
+           MEX gateway function for MATLAB
+****************************************************************
+*/
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  struct Model m;
+  struct Stats *Stats;
+  const double **obs;
+  long *nSteps, nTraj, iTraj, nStatsPerTraj, nNegativeMahal;
+  int nS, nD, i;
+  double *statsBuffer, *gammaLast;
+  double *logLik, *transCounts, *expNumVisits1, *weightsSummed, *muUpdater;
+  int nErrors;
+
+  if (nrhs!=5)
+    mexErrMsgTxt("Wrong number of input arguments!");
+  if (nlhs>6)
+    mexErrMsgTxt("Wrong number of output arguments!");
+
+  setthreads();
+
+  /* model parameters */
+  nS = (int)mxGetNumberOfElements(prhs[1]);
+  if (mxGetM(prhs[2])!=nS || mxGetN(prhs[2])!=nS)
+    mexErrMsgTxt("TransProb must be a square matrix with one row per state!");
+  setupgaussians(&m.g,prhs[3],prhs[4],nS);
+  nD = m.g.nDims;
+  m.initDistr = mxGetPr(prhs[1]);
+  m.TransProb = mxGetPr(prhs[2]);
+
+  /* trajectories */
+  nTraj = collecttrajectories(prhs[0],nD,&obs,&nSteps);
+
+  /* statistics buffers, one per trajectory */
+  nStatsPerTraj = (long)nS*nS + 2*nS + (long)nD*nS;
+  statsBuffer = (double*)mxCalloc(nTraj*nStatsPerTraj+1,sizeof(double));
+  Stats = (struct Stats*)mxCalloc(nTraj+1,sizeof(struct Stats));
+  for (iTraj=0; iTraj<nTraj; iTraj++) {
+    double *p = statsBuffer + iTraj*nStatsPerTraj;
+    Stats[iTraj].transCounts = p;
+    Stats[iTraj].expNumVisits1 = p + nS*nS;
+    Stats[iTraj].weightsSummed = p + nS*nS + nS;
+    Stats[iTraj].muUpdater = p + nS*nS + 2*nS;
+  }
+
+  plhs[5] = mxCreateDoubleMatrix(nS,(nTraj>0) ? nSteps[nTraj-1] : 0,mxREAL);
+  gammaLast = mxGetPr(plhs[5]);
+
+  /* forward-backward over all trajectories */
+  nErrors = 0;
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic) reduction(+:nErrors)
+  #endif
+  for (iTraj=0; iTraj<nTraj; iTraj++)
+    nErrors += fwdback(&m,obs[iTraj],nSteps[iTraj],&Stats[iTraj],
+                       (iTraj==nTraj-1) ? gammaLast : NULL);
+
+  if (nErrors>0)
+    mexErrMsgTxt("Out of memory.");
+
+  /* sum statistics in trajectory order (muUpdater included, which the
+     former MATLAB E step only took from the last trajectory) */
+  plhs[0] = mxCreateDoubleMatrix(1,1,mxREAL);
+  plhs[1] = mxCreateDoubleMatrix(nS,nS,mxREAL);
+  plhs[2] = mxCreateDoubleMatrix(nS,1,mxREAL);
+  plhs[3] = mxCreateDoubleMatrix(nS,1,mxREAL);
+  plhs[4] = mxCreateDoubleMatrix(nD,nS,mxREAL);
+  logLik = mxGetPr(plhs[0]);
+  transCounts = mxGetPr(plhs[1]);
+  expNumVisits1 = mxGetPr(plhs[2]);
+  weightsSummed = mxGetPr(plhs[3]);
+  muUpdater = mxGetPr(plhs[4]);
+  nNegativeMahal = 0;
+  for (iTraj=0; iTraj<nTraj; iTraj++) {
+    *logLik += Stats[iTraj].logLik;
+    for (i=0; i<nS*nS; i++) transCounts[i] += Stats[iTraj].transCounts[i];
+    for (i=0; i<nS; i++) expNumVisits1[i] += Stats[iTraj].expNumVisits1[i];
+    for (i=0; i<nS; i++) weightsSummed[i] += Stats[iTraj].weightsSummed[i];
+    for (i=0; i<nD*nS; i++) muUpdater[i] += Stats[iTraj].muUpdater[i];
+    nNegativeMahal += Stats[iTraj].nNegativeMahal;
+  }
+  if (nNegativeMahal>0)
+    mexWarnMsgTxt("mahal < 0 => C is not psd");
+
+  mxFree(Stats);
+  mxFree(statsBuffer);
+  mxFree(nSteps);
+  mxFree(obs);
+  mxFree(m.g.prefactor);
+  mxFree(m.g.SigmaInv);
+
+} /* void mexFunction  */
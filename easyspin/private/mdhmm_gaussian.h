@@ -0,0 +1,159 @@
+/*
+mdhmm_gaussian.h    periodic Gaussian observation model of mdhmm
+
+  Shared by the mdhmm_fwdback and mdhmm_viterbi MEX functions. The state
+  observation likelihoods are multivariate Gaussians in the periodic
+  distance (period 2*pi) of the dihedral angles from the state centers.
+  All functions apart from setupgaussians and collecttrajectories can be
+  used in parallel regions.
+ */
+
+#include <math.h>
+#include <float.h>
+#include <string.h>
+
+#define PI 3.14159265358979323846
+
+struct Gaussians {
+  int nStates, nDims;
+  const double *mu;  /* nDims x nStates */
+  double *SigmaInv;  /* nDims x nDims x nStates */
+  double *prefactor; /* 1/(denominator+eps) of each Gaussian */
+};
+
+/* Periodic distance with period 2*pi, as in dist_pbc */
+static double dist_pbc(double d)
+{
+  if (d>PI) return d - 2*PI;
+  if (d<-PI) return d + 2*PI;
+  return d;
+}
+
+/* Inverts the n x n matrix A (overwritten) into Ainv by Gauss-Jordan
+   elimination with partial pivoting. Returns the determinant. */
+static double invert(double *A, double *Ainv, int n)
+{
+  int i, j, k, p;
+  double det = 1, t;
+
+  for (i=0; i<n*n; i++) Ainv[i] = 0;
+  for (i=0; i<n; i++) Ainv[i+i*n] = 1;
+
+  for (k=0; k<n; k++) {
+    p = k;
+    for (i=k+1; i<n; i++)
+      if (fabs(A[i+k*n])>fabs(A[p+k*n])) p = i;
+    if (A[p+k*n]==0) return 0;
+    if (p!=k) {
+      for (j=0; j<n; j++) {
+        t = A[k+j*n]; A[k+j*n] = A[p+j*n]; A[p+j*n] = t;
+        t = Ainv[k+j*n]; Ainv[k+j*n] = Ainv[p+j*n]; Ainv[p+j*n] = t;
+      }
+      det = -det;
+    }
+    t = A[k+k*n];
+    det *= t;
+    for (j=0; j<n; j++) {
+      A[k+j*n] /= t;
+      Ainv[k+j*n] /= t;
+    }
+    for (i=0; i<n; i++) {
+      if (i==k) continue;
+      t = A[i+k*n];
+      if (t==0) continue;
+      for (j=0; j<n; j++) {
+        A[i+j*n] -= t*A[k+j*n];
+        Ainv[i+j*n] -= t*Ainv[k+j*n];
+      }
+    }
+  }
+  return det;
+}
+
+/* Checks mu (nDims x nStates) and Sigma (nDims x nDims x nStates) and
+   precomputes the inverse covariance matrices and the normalization
+   prefactors. Arrays are allocated with mxMalloc, and errors are raised
+   with mexErrMsgTxt. */
+static void setupgaussians(struct Gaussians *g, const mxArray *mu,
+                           const mxArray *Sigma, int nStates)
+{
+  const int nD = (int)mxGetM(mu);
+  double *SigmaCopy, det;
+  int i;
+
+  if (mxGetN(mu)!=nStates)
+    mexErrMsgTxt("mu must have one column per state!");
+  if (mxGetNumberOfElements(Sigma)!=(size_t)nD*nD*nStates)
+    mexErrMsgTxt("Sigma must be of size nDims x nDims x nStates!");
+
+  g->nStates = nStates;
+  g->nDims = nD;
+  g->mu = mxGetPr(mu);
+  g->SigmaInv = (double*)mxMalloc(((size_t)nD*nD*nStates+1)*sizeof(double));
+  g->prefactor = (double*)mxMalloc((nStates+1)*sizeof(double));
+  SigmaCopy = (double*)mxMalloc(((size_t)nD*nD+1)*sizeof(double));
+  for (i=0; i<nStates; i++) {
+    memcpy(SigmaCopy,mxGetPr(Sigma)+(long)i*nD*nD,nD*nD*sizeof(double));
+    det = invert(SigmaCopy,g->SigmaInv+(long)i*nD*nD,nD);
+    if (det==0)
+      mexErrMsgTxt("Covariance matrix is singular!");
+    g->prefactor[i] = 1/(pow(2*PI,nD/2.0)*sqrt(fabs(det)) + DBL_EPSILON);
+  }
+  mxFree(SigmaCopy);
+}
+
+/* Squared Mahalanobis distance of the data vector x from the center of
+   state iState, using dist (nDims elements) as workspace */
+static double mahalanobis(const struct Gaussians *g, const double *x,
+                          int iState, double *dist)
+{
+  const int nD = g->nDims;
+  const double *Ci = g->SigmaInv + (long)iState*nD*nD;
+  const double *m = g->mu + (long)iState*nD;
+  double mahal = 0;
+  int j, k;
+
+  for (j=0; j<nD; j++)
+    dist[j] = dist_pbc(x[j] - m[j]);
+  for (k=0; k<nD; k++)
+    for (j=0; j<nD; j++)
+      mahal += dist[j]*Ci[j+k*nD]*dist[k];
+  return mahal;
+}
+
+/* Collects pointers to the trajectories in data, which is either an
+   nDims x nSteps x nTraj array or a cell array with one nDims x nSteps
+   array per trajectory. Arrays are allocated with mxMalloc. Returns the
+   number of trajectories. */
+static long collecttrajectories(const mxArray *data, int nDims,
+                                const double ***obs, long **nSteps)
+{
+  bool isCell = mxIsCell(data);
+  long nTraj, iTraj;
+
+  if (isCell) {
+    nTraj = (long)mxGetNumberOfElements(data);
+  }
+  else {
+    const mwSize *dims = mxGetDimensions(data);
+    nTraj = (mxGetNumberOfDimensions(data)>2) ? (long)dims[2] : 1;
+  }
+  *obs = (const double**)mxMalloc((nTraj+1)*sizeof(double*));
+  *nSteps = (long*)mxMalloc((nTraj+1)*sizeof(long));
+  for (iTraj=0; iTraj<nTraj; iTraj++) {
+    const mxArray *d = isCell ? mxGetCell(data,iTraj) : data;
+    if (d==NULL || !mxIsDouble(d) || mxIsComplex(d))
+      mexErrMsgTxt("Data must be real double arrays!");
+    if (mxGetM(d)!=nDims)
+      mexErrMsgTxt("Data must have one row per dimension of mu!");
+    if (isCell) {
+      (*nSteps)[iTraj] = (long)mxGetN(d);
+      (*obs)[iTraj] = mxGetPr(d);
+    }
+    else {
+      (*nSteps)[iTraj] = (long)mxGetDimensions(d)[1];
+      (*obs)[iTraj] = mxGetPr(d) + iTraj*(*nSteps)[iTraj]*nDims;
+    }
+  }
+  return nTraj;
+}
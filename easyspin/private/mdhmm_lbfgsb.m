@@ -13,6 +13,15 @@ function [x,f,info] = mdhmm_lbfgsb( fcn, l, u, opts )
 % 'fcn' is a function handle that accepts an input, 'x',
 %   and returns two outputs, 'f' (function value), and 'g' (function gradient).
 %
+% 'fcn' can also be the name of an objective that is evaluated natively in
+%   mdhmm_lbfgsb_wrapper, without calling back into MATLAB:
+%       'msmreversible'   negative log-likelihood of a reversible Markov state
+%                         model, with x the vectorized matrix of symmetric
+%                         counts; the count matrix is given in opts.counts
+%   In this case, opts.x0 can have several columns, each a starting point.
+%   The starts are optimized in parallel, and x, f and the fields of info
+%   contain one column (element) per start, ranked by increasing f.
+%
 % 'l' and 'u' are column-vectors of constraints. Set their values to Inf
 %   if you want to ignore them. (You can set some values to Inf, but keep
 %   others enforced).
@@ -29,6 +38,7 @@ function [x,f,info] = mdhmm_lbfgsb( fcn, l, u, opts )
 %   Possible field name values:
 %
 %       opts.x0     The starting value (default: all zeros)
+%       opts.counts Count matrix for the native objective 'msmreversible'
 %       opts.m      Number of limited-memory vectors to use in the algorithm
 %                       Try 3 <= m <= 20. (default: 5 )
 %       opts.factr  Tolerance setting (see this source code for more info)
@@ -81,12 +91,19 @@ end
 n   = length(l); 
 if length(u) ~= length(l), error('l and u must be same length'); end
 x0  = setOpts( 'x0', zeros(n,1) );
+nativeObjective = ischar(fcn);
+if nativeObjective
+    if ~strcmp(fcn,'msmreversible'), error('Unknown native objective ''%s''',fcn); end
+    counts = setOpts( 'counts', [] );
+    if numel(counts) ~= n, error('opts.counts must have as many elements as l'); end
+    counts = full(double(counts));
+end
 x   = x0 + 0; % important: we want Matlab to make a copy of this. 
               %  just in case 'x' will be modified in-place
               % (Feb 2015 version of code, it should not be modified,
               %  but just-in-case, may as well leave this )
               
-if size(x0,2) ~= 1, error('x0 must be a column vector'); end
+if size(x0,2) ~= 1 && ~nativeObjective, error('x0 must be a column vector'); end
 if size(l,2) ~= 1, error('l must be a column vector'); end
 if size(u,2) ~= 1, error('u must be a column vector'); end
 if size(x,1) ~= n, error('x0 and l have mismatchig sizes'); end
@@ -157,6 +174,17 @@ iprint  = setOpts('verbose',-1);
 % I recommend you set this -1 and use the Matlab print features
 % (e.g., set printEvery )
 
+if nativeObjective
+    [f,x,taskInteger,outer_count, k] = mdhmm_lbfgsb_wrapper( m, x, l, u, nbd, ...
+        fcn, factr, pgtol, iprint, maxIts, maxTotalIts, counts);
+    info.iterations     = outer_count;
+    info.totalIterations = k;
+    info.lbfgs_message1  = arrayfun( @findTaskString, taskInteger, 'UniformOutput', false );
+    if numel(taskInteger)==1, info.lbfgs_message1 = info.lbfgs_message1{1}; end
+    info.err = [];
+    return
+end
+
 fcn_wrapper(); % initialized persistent variables
 callF_wrapped = @(x,varargin) fcn_wrapper( callF, errFcn, maxIts, ...
     printEvery, x, varargin{:} );
@@ -65,8 +65,22 @@
  * Warning: the following variables are modified in-place
  *  x, g, wa, iwa
  *
+ * Native objectives (EasySpin):
+ *  Instead of a function handle, fcn can be the name of an objective that
+ *  is evaluated in C, without calling back into MATLAB:
+ *      'msmreversible'  negative log-likelihood of a reversible Markov
+ *                       state model, x being the vectorized nStates x nStates
+ *                       matrix of symmetric counts. The observed count matrix
+ *                       is passed as an additional 12th input.
+ *  With a native objective, x can have several columns, one starting point
+ *  per column. The starts are optimized independently, in parallel if
+ *  OpenMP is available, and the outputs f, x, task, iterations and
+ *  total_iterations have one column per start, ranked by increasing f.
+ *
  *=================================================================*/
 #include <math.h>
+#include <float.h>
+#include <stdlib.h>
 /* #include "mex.h" */  /* now, mex.h included in lbfgsb.h */
 
 #include "mdhmm_lbfgsb.inc"
@@ -75,6 +89,23 @@
 #include <string.h>
 #include <limits.h> /* for CHAR_BIT */
 #include <assert.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "cpuinfo.h"
+
+/* The C translation of L-BFGS-B keeps the local variables of its routines
+ * in static storage (Fortran SAVE). To run several optimizations at once,
+ * each thread gets its own copy of them. */
+#ifdef _OPENMP
+#ifdef _MSC_VER
+#define LBFGSB_SAVE static __declspec(thread)
+#else
+#define LBFGSB_SAVE static __thread
+#endif
+#else
+#define LBFGSB_SAVE static
+#endif
 
 
 /* These are the fortran arguments in order */
@@ -90,6 +121,7 @@
 #define N_total_iterMax 10 /* new */
 
 #define N_fcn 5 /* new in 2015 */
+#define N_counts 11 /* native objective 'msmreversible' */
 
 /* these depend on the lbfgsb release version */
 #define LENGTH_STRING 60
@@ -135,6 +167,205 @@ mxLogical isInt( const mxArray *pm ) {
 }
 
 
+/* Optimization problem with a native objective */
+struct Problem {
+    integer n, m, iprint;
+    double *l, *u, factr, pgtol;
+    integer *nbd;
+    int iterMax, total_iterMax;
+    int nStates;
+    const double *c, *c_i; /* count matrix and its row sums */
+};
+
+/* Negative log-likelihood f and gradient g of a reversible Markov state
+ * model with symmetric count matrix x, as evaluated in MATLAB by
+ * myfunc_matrix in msmtransitionmatrix. work holds 2*nStates doubles. */
+static void msmreversible(const struct Problem *P, const double *x,
+        double *f, double *g, double *work)
+{
+    const int nS = P->nStates;
+    const double tol = 10*DBL_EPSILON;
+    const double *c = P->c;
+    double *x_i = work, *t = work + nS, sum, gij;
+    int i, j;
+
+    for (i=0;i<nS;i++) {
+        x_i[i] = 0;
+        for (j=0;j<nS;j++)
+            x_i[i] += x[i+j*nS];
+        t[i] = P->c_i[i]/x_i[i];
+    }
+
+    sum = 0;
+    for (j=0;j<nS;j++)
+        for (i=0;i<nS;i++)
+            if (x[i+j*nS] > tol)
+                sum += c[i+j*nS]*log(x[i+j*nS]/x_i[i]);
+    *f = -sum;
+
+    for (j=0;j<nS;j++)
+        for (i=0;i<nS;i++) {
+            gij = 0;
+            if (x_i[i] >= tol && x[i+j*nS] > tol && x[j+i*nS] > tol) {
+                gij = c[i+j*nS]/x[i+j*nS] + c[j+i*nS]/x[j+i*nS] - t[i] - t[j];
+                if (gij != gij) gij = 0; /* NaN */
+            }
+            g[i+j*nS] = -gij;
+        }
+}
+
+/* Runs L-BFGS-B with the native objective from the starting point x,
+ * which is overwritten by the result. Memory is allocated with malloc,
+ * so this can be called from several threads at once. Returns nonzero
+ * if memory could not be allocated. */
+static int runlbfgsb(const struct Problem *P, double *x, double *f,
+        integer *task, integer *iterations, integer *total_iterations)
+{
+    integer n = P->n, m = P->m, iprint = P->iprint, csave = 1;
+    double factr = P->factr, pgtol = P->pgtol;
+    logical lsave[LENGTH_LSAVE];
+    integer isave[LENGTH_ISAVE];
+    double  dsave[LENGTH_DSAVE];
+    double *g, *wa, *work;
+    integer *iwa;
+
+    g    = (double *)malloc( n * sizeof(double) );
+    wa   = (double *)malloc( (2*m*n + 5*n + 11*m*m + 8*m ) * sizeof(double) );
+    iwa  = (integer *)malloc( (3*n)*sizeof(integer) );
+    work = (double *)malloc( (2*P->nStates+1)*sizeof(double) );
+    if (g==NULL || wa==NULL || iwa==NULL || work==NULL) {
+        free(g); free(wa); free(iwa); free(work);
+        return 1;
+    }
+
+    *f = 0;
+    *task = (integer)START;
+    *iterations = 0;
+    *total_iterations = 0;
+    while ( (*iterations < P->iterMax) && (*total_iterations < P->total_iterMax) ){
+        (*total_iterations)++;
+
+        setulb(&n,&m,x,P->l,P->u,P->nbd,f,g,&factr,&pgtol,wa,iwa,task,&iprint,
+                &csave,lsave,isave,dsave);
+
+        if ( IS_FG(*task) ) {
+            msmreversible(P,x,f,g,work);
+            continue;
+        }
+        if ( *task==NEW_X ) {
+            (*iterations)++;
+            continue;
+        } else
+            break;
+    }
+
+    free(g); free(wa); free(iwa); free(work);
+    return 0;
+}
+
+/* Gateway for native objectives: runs L-BFGS-B from each column of
+ * x and returns the results ranked by increasing f. */
+static void nativeobjective(int nlhs, mxArray *plhs[], int nrhs,
+        const mxArray *prhs[], integer n, integer m, double *l, double *u,
+        integer *nbd, double factr, double pgtol, integer iprint,
+        int iterMax, int total_iterMax)
+{
+    struct Problem P;
+    char *name;
+    mxArray *Results[5];
+    double *x0, *x, *c_i, *fStart, *Out[5];
+    integer *taskStart, *itStart, *totalStart;
+    long nStarts, s, k, *order;
+    int i, j, nErrors;
+
+    name = mxArrayToString( prhs[N_fcn] );
+    if ( strcmp(name,"msmreversible") != 0 )
+        mexErrMsgTxt("Unknown native objective\n");
+    mxFree(name);
+
+    if ( nrhs < N_counts+1 )
+        mexErrMsgTxt("Objective 'msmreversible' needs the count matrix as input\n");
+    if ( !mxIsDouble(prhs[N_counts]) || mxGetM(prhs[N_counts]) != mxGetN(prhs[N_counts])
+            || mxGetNumberOfElements(prhs[N_counts]) != n )
+        mexErrMsgTxt("Count matrix must be square with as many elements as x has rows\n");
+    if ( nlhs > 5 )
+        mexErrMsgTxt("Did not expect more than 5 outputs\n");
+
+    P.n = n; P.m = m; P.iprint = iprint;
+    P.l = l; P.u = u; P.nbd = nbd;
+    P.factr = factr; P.pgtol = pgtol;
+    P.iterMax = iterMax; P.total_iterMax = total_iterMax;
+    P.nStates = (int)mxGetM(prhs[N_counts]);
+    P.c = mxGetPr(prhs[N_counts]);
+    c_i = (double *)mxMalloc( (P.nStates+1)*sizeof(double) );
+    for (i=0;i<P.nStates;i++) {
+        c_i[i] = 0;
+        for (j=0;j<P.nStates;j++)
+            c_i[i] += P.c[i+j*P.nStates];
+    }
+    P.c_i = c_i;
+
+    /* one optimization per column of x */
+    nStarts = (long)mxGetN(prhs[N_x]);
+    x0 = mxGetPr(prhs[N_x]);
+    x = (double *)mxMalloc( (n*nStarts+1)*sizeof(double) );
+    memcpy(x,x0,n*nStarts*sizeof(double));
+    fStart = (double *)mxMalloc( (nStarts+1)*sizeof(double) );
+    taskStart = (integer *)mxMalloc( 3*(nStarts+1)*sizeof(integer) );
+    itStart = taskStart + nStarts + 1;
+    totalStart = itStart + nStarts + 1;
+
+    /* L-BFGS-B prints through mexPrintf, which is not thread-safe, so
+     * threads are used only if it is quiet (iprint<0). All messages of
+     * the L-BFGS-B routines are conditional on iprint. */
+    nErrors = 0;
+    #ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic) reduction(+:nErrors) if(iprint<0)
+    #endif
+    for (s=0;s<nStarts;s++)
+        nErrors += runlbfgsb(&P,x+s*n,&fStart[s],&taskStart[s],
+                &itStart[s],&totalStart[s]);
+
+    if (nErrors>0)
+        mexErrMsgTxt("Out of memory.");
+
+    /* rank starts by f (insertion sort, NaN last) */
+    order = (long *)mxMalloc( (nStarts+1)*sizeof(long) );
+    for (s=0;s<nStarts;s++) {
+        k = s;
+        while ( k>0 && (fStart[order[k-1]] > fStart[s] ||
+                (fStart[order[k-1]] != fStart[order[k-1]] && fStart[s] == fStart[s])) ) {
+            order[k] = order[k-1];
+            k--;
+        }
+        order[k] = s;
+    }
+
+    for (i=0;i<5;i++) {
+        Results[i] = mxCreateDoubleMatrix( (i==1) ? n : 1, nStarts, mxREAL );
+        Out[i] = mxGetPr(Results[i]);
+    }
+    for (s=0;s<nStarts;s++) {
+        k = order[s];
+        Out[0][s] = fStart[k];
+        memcpy(Out[1]+s*n,x+k*n,n*sizeof(double));
+        Out[2][s] = (double)taskStart[k];
+        Out[3][s] = (double)itStart[k];
+        Out[4][s] = (double)totalStart[k];
+    }
+    for (i=0;i<5;i++)
+        if (i<nlhs)
+            plhs[i] = Results[i];
+        else
+            mxDestroyArray(Results[i]);
+
+    mxFree(order);
+    mxFree(taskStart);
+    mxFree(fStart);
+    mxFree(x);
+    mxFree(c_i);
+}
+
 /* Main mex gateway routine */
 void mexFunction( int nlhs, mxArray *plhs[], int nrhs, const mxArray*prhs[] )   { 
     
@@ -171,13 +402,17 @@ void mexFunction( int nlhs, mxArray *plhs[], int nrhs, const mxArray*prhs[] )
     if (nrhs < 5 ) mexErrMsgTxt("Needs at least 5 input arguments");
     m       = (int)*mxGetPr( prhs[N_m] );
     n       = (integer)mxGetM( prhs[N_x] );
-    if ( mxGetN(prhs[N_x]) != 1 ) mexErrMsgTxt("x must be a column vector");
+    if ( mxGetN(prhs[N_x]) != 1 && (nrhs <= N_fcn || !mxIsChar(prhs[N_fcn])) )
+        mexErrMsgTxt("x must be a column vector");
     if ( mxGetM(prhs[N_l]) != n ) mexErrMsgTxt("l must have same size as x");
     if ( mxGetM(prhs[N_u]) != n ) mexErrMsgTxt("u must have same size as x");
     if ( mxGetM(prhs[N_nbd]) != n ) mexErrMsgTxt("nbd must have same size as x");
 
 
     if (nlhs < 2 )  mexErrMsgTxt("Should have 2 or 3 output arguments");
+
+    setthreads();
+
     if (!mxIsDouble(prhs[N_x]))
             mexErrMsgTxt("x should be of type double!\n");
     plhs[1] = mxDuplicateArray( prhs[N_x] );
@@ -254,6 +489,16 @@ void mexFunction( int nlhs, mxArray *plhs[], int nrhs, const mxArray*prhs[] )
     if ( nrhs >= N_total_iterMax+1 ) 
         total_iterMax = (int)mxGetScalar( prhs[N_total_iterMax] );
     
+    /* native objective: optimize all starting points in C */
+    if ( nrhs > N_fcn && mxIsChar(prhs[N_fcn]) ) {
+        mxDestroyArray( plhs[1] );
+        nativeobjective(nlhs,plhs,nrhs,prhs,n,m,l,u,nbd,factr,pgtol,
+                iprint,iterMax,total_iterMax);
+        if (FREE_nbd)
+            mxFree(nbd);
+        return;
+    }
+    
     /* allocate memory for arrays */
     g   = (double *)mxMalloc( n * sizeof(double) );
     assert( g != NULL );
@@ -414,7 +659,7 @@ static integer c__1 = 1;
 
 
     /* Local variables */
-    static integer ld, lr, lt, lz, lwa, lwn, lss, lxp, lws, lwt, lsy, lwy, 
+    LBFGSB_SAVE integer ld, lr, lt, lz, lwa, lwn, lss, lxp, lws, lwt, lsy, lwy, 
 	    lsnd;
 
 /* -jlm-jn */
@@ -697,44 +942,44 @@ static double c_b7 = 0.;
     fileType o__1=NULL;
 
     /* Local variables */
-    static integer i__, k;
-    static double gd, dr, rr, dtd;
-    static integer col;
-    static double tol;
-    static logical wrk;
-    static double stp, cpu1, cpu2;
-    static integer head;
-    static double fold;
-    static integer nact;
-    static double ddum;
-    static integer info, nseg;
-    static double time;
-    static integer nfgv, ifun, iter;
-    static integer wordTemp;
-    static integer *word=&wordTemp;
-    static double time1, time2;
-    static integer iback;
-    static double gdold;
-    static integer nfree;
-    static logical boxed;
-    static integer itail;
-    static double theta;
-    static double dnorm;
-    static integer nskip, iword;
-    static double xstep, stpmx;
-    static integer ileave;
-    static double cachyt;
-    static integer itfile;
-    static double epsmch;
-    static logical updatd;
-    static double sbtime;
-    static logical prjctd;
-    static integer iupdat;
-    static double sbgnrm;
-    static logical cnstnd;
-    static integer nenter;
-    static double lnscht;
-    static integer nintol;
+    LBFGSB_SAVE integer i__, k;
+    LBFGSB_SAVE double gd, dr, rr, dtd;
+    LBFGSB_SAVE integer col;
+    LBFGSB_SAVE double tol;
+    LBFGSB_SAVE logical wrk;
+    LBFGSB_SAVE double stp, cpu1, cpu2;
+    LBFGSB_SAVE integer head;
+    LBFGSB_SAVE double fold;
+    LBFGSB_SAVE integer nact;
+    LBFGSB_SAVE double ddum;
+    LBFGSB_SAVE integer info, nseg;
+    LBFGSB_SAVE double time;
+    LBFGSB_SAVE integer nfgv, ifun, iter;
+    LBFGSB_SAVE integer wordTemp;
+    integer *word=&wordTemp;
+    LBFGSB_SAVE double time1, time2;
+    LBFGSB_SAVE integer iback;
+    LBFGSB_SAVE double gdold;
+    LBFGSB_SAVE integer nfree;
+    LBFGSB_SAVE logical boxed;
+    LBFGSB_SAVE integer itail;
+    LBFGSB_SAVE double theta;
+    LBFGSB_SAVE double dnorm;
+    LBFGSB_SAVE integer nskip, iword;
+    LBFGSB_SAVE double xstep, stpmx;
+    LBFGSB_SAVE integer ileave;
+    LBFGSB_SAVE double cachyt;
+    LBFGSB_SAVE integer itfile;
+    LBFGSB_SAVE double epsmch;
+    LBFGSB_SAVE logical updatd;
+    LBFGSB_SAVE double sbtime;
+    LBFGSB_SAVE logical prjctd;
+    LBFGSB_SAVE integer iupdat;
+    LBFGSB_SAVE double sbgnrm;
+    LBFGSB_SAVE logical cnstnd;
+    LBFGSB_SAVE integer nenter;
+    LBFGSB_SAVE double lnscht;
+    LBFGSB_SAVE integer nintol;
 
 /* -jlm-jn */
 /*     ************ */
@@ -1230,7 +1475,7 @@ L666:
     lnsrlb(n, &l[1], &u[1], &nbd[1], &x[1], f, &fold, &gd, &gdold, &g[1], &
             d__[1], &r__[1], &t[1], &z__[1], &stp, &dnorm, &dtd, &xstep, &
             stpmx, &iter, &ifun, &iback, &nfgv, &info, task, &boxed, &cnstnd, 
-            csave, &isave[22], &dsave[17]); /* (ftnlen)60, (ftnlen)60); */
+            csave, &isave[22], &dsave[17], iprint); /* (ftnlen)60, (ftnlen)60); */
     if (info != 0 || iback >= 20) {
         /*          restore the previous iterate. */
         dcopy(n, &t[1], &c__1, &x[1], &c__1);
@@ -1433,8 +1678,8 @@ L1000:
 	double *dnorm, double *dtd, double *xstep, double *
 	stpmx, integer *iter, integer *ifun, integer *iback, integer *nfgv, 
 	integer *info, integer *task, logical *boxed, logical *cnstnd, integer *
-	csave, integer *isave, double *dsave) /* ftnlen task_len, ftnlen 
-	csave_len) */
+	csave, integer *isave, double *dsave, integer *iprint) /* ftnlen task_len,
+	ftnlen csave_len) */
 {
     /*
     ********** 
@@ -1467,18 +1712,18 @@ L1000:
 
 
     /* Table of constant values */
-    static double c_b14 = FTOL;
-    static double c_b15 = GTOL;
-    static double c_b16 = XTOL;
-    static double c_b17 = STEPMIN;
+    LBFGSB_SAVE double c_b14 = FTOL;
+    LBFGSB_SAVE double c_b15 = GTOL;
+    LBFGSB_SAVE double c_b16 = XTOL;
+    LBFGSB_SAVE double c_b17 = STEPMIN;
     /* System generated locals */
     integer i__1;
     double d__1;
 
 
     /* Local variables */
-    static integer i__;
-    static double a1, a2;
+    LBFGSB_SAVE integer i__;
+    LBFGSB_SAVE double a1, a2;
 
     /* Parameter adjustments */
     --z__;
@@ -1549,7 +1794,9 @@ L556:
         if (*gd >= 0.) {
             /*  the directional derivative >=0. */
             /*  Line search is impossible. */
-            printf("ascend direction in projection gd = %.2e\n", *gd ); 
+            if (*iprint >= 0) {
+                printf("ascend direction in projection gd = %.2e\n", *gd );
+            }
             *info = -4;
             return 0;
         }
@@ -1592,10 +1839,10 @@ int dcsrch(double *f, double *g, double *stp,
 
 
     /* Local variables */
-    static double fm, gm, fx, fy, gx, gy, fxm, fym, gxm, gym, stx, sty;
-    static integer stage;
-    static double finit, ginit, width, ftest, gtest, stmin, stmax, width1;
-    static logical brackt;
+    LBFGSB_SAVE double fm, gm, fx, fy, gx, gy, fxm, fym, gxm, gym, stx, sty;
+    LBFGSB_SAVE integer stage;
+    LBFGSB_SAVE double finit, ginit, width, ftest, gtest, stmin, stmax, width1;
+    LBFGSB_SAVE logical brackt;
 
     /*
      ********** 
@@ -1918,7 +2165,7 @@ L1000:
     double sqrt(double);
 
     /* Local variables */
-    static double p, q, r__, s, sgnd, stpc, stpf, stpq, gamma, theta;
+    LBFGSB_SAVE double p, q, r__, s, sgnd, stpc, stpf, stpq, gamma, theta;
 
     /*
      ********** 
@@ -2205,7 +2452,7 @@ static integer c__11 = 11;
     integer i__1;
 
     /* Local variables */
-    static integer i__, nbdd;
+    LBFGSB_SAVE integer i__, nbdd;
 
 
 /*     ************ */
@@ -2320,8 +2567,8 @@ static integer c__11 = 11;
     double sqrt(double);
 
     /* Local variables */
-    static integer i__, k, i2;
-    static double sum;
+    LBFGSB_SAVE integer i__, k, i2;
+    LBFGSB_SAVE double sum;
 
 /*     ************ */
 
@@ -2468,28 +2715,28 @@ static integer c__11 = 11;
 
 
     /* Local variables */
-    static integer i__, j;
-    static double f1, f2, dt, tj, tl, tu, tj0;
-    static integer ibp;
-    static double dtm;
+    LBFGSB_SAVE integer i__, j;
+    LBFGSB_SAVE double f1, f2, dt, tj, tl, tu, tj0;
+    LBFGSB_SAVE integer ibp;
+    LBFGSB_SAVE double dtm;
     extern /* Subroutine */ int bmv(integer *, double *, double *, 
 	    integer *, double *, double *, integer *);
-    static double wmc, wmp, wmw;
-    static integer col2;
-    static double dibp;
-    static integer iter;
-    static double zibp, tsum, dibp2;
-    static logical bnded;
-    static double neggi;
-    static integer nfree;
-    static double bkmin;
-    static integer nleft;
-    static double f2_org__;
-    static integer nbreak, ibkmin;
+    LBFGSB_SAVE double wmc, wmp, wmw;
+    LBFGSB_SAVE integer col2;
+    LBFGSB_SAVE double dibp;
+    LBFGSB_SAVE integer iter;
+    LBFGSB_SAVE double zibp, tsum, dibp2;
+    LBFGSB_SAVE logical bnded;
+    LBFGSB_SAVE double neggi;
+    LBFGSB_SAVE integer nfree;
+    LBFGSB_SAVE double bkmin;
+    LBFGSB_SAVE integer nleft;
+    LBFGSB_SAVE double f2_org__;
+    LBFGSB_SAVE integer nbreak, ibkmin;
     extern /* Subroutine */ int hpsolb(integer *, double *, integer *, 
 	    integer *);
-    static integer pointr;
-    static logical xlower, xupper;
+    LBFGSB_SAVE integer pointr;
+    LBFGSB_SAVE logical xlower, xupper;
 
 /*     ************ */
 
@@ -3021,11 +3268,11 @@ L999:
 	    wt_dim1, wt_offset, i__1, i__2;
 
     /* Local variables */
-    static integer i__, j, k;
-    static double a1, a2;
+    LBFGSB_SAVE integer i__, j, k;
+    LBFGSB_SAVE double a1, a2;
     extern /* Subroutine */ int bmv(integer *, double *, double *, 
 	    integer *, double *, double *, integer *);
-    static integer pointr;
+    LBFGSB_SAVE integer pointr;
 
 /*     ************ */
 
@@ -3121,10 +3368,10 @@ L999:
 	    wy_dim1, wy_offset, sy_dim1, sy_offset, i__1, i__2, i__3;
 
     /* Local variables */
-    static integer i__, k, k1, m2, is, js, iy, jy, is1, js1, col2, dend, pend;
-    static integer upcl;
-    static double temp1, temp2, temp3, temp4;
-    static integer ipntr, jpntr, dbegin, pbegin;
+    LBFGSB_SAVE integer i__, k, k1, m2, is, js, iy, jy, is1, js1, col2, dend, pend;
+    LBFGSB_SAVE integer upcl;
+    LBFGSB_SAVE double temp1, temp2, temp3, temp4;
+    LBFGSB_SAVE integer ipntr, jpntr, dbegin, pbegin;
 
 /*     ************ */
 
@@ -3503,8 +3750,8 @@ L999:
 	    i__2, i__3;
 
     /* Local variables */
-    static integer i__, j, k, k1;
-    static double ddum;
+    LBFGSB_SAVE integer i__, j, k, k1;
+    LBFGSB_SAVE double ddum;
 
 /*     ************ */
 
@@ -3592,7 +3839,7 @@ L999:
     integer i__1;
 
     /* Local variables */
-    static integer i__, k, iact;
+    LBFGSB_SAVE integer i__, k, iact;
 
 
 /*     ************ */
@@ -3710,9 +3957,9 @@ L999:
     integer i__1;
 
     /* Local variables */
-    static integer i__, j, k;
-    static double out, ddum;
-    static integer indxin, indxou;
+    LBFGSB_SAVE integer i__, j, k;
+    LBFGSB_SAVE double out, ddum;
+    LBFGSB_SAVE integer indxin, indxou;
 
 /*     ************ */
 
@@ -3832,8 +4079,8 @@ L30:
 	    ss_dim1, ss_offset, i__1, i__2;
 
     /* Local variables */
-    static integer j;
-    static integer pointr;
+    LBFGSB_SAVE integer j;
+    LBFGSB_SAVE integer pointr;
 
 /*     ************ */
 
@@ -3939,8 +4186,8 @@ L30:
     double d__1, d__2;
 
     /* Local variables */
-    static integer i__;
-    static double gi;
+    LBFGSB_SAVE integer i__;
+    LBFGSB_SAVE double gi;
 
 /*     ************ */
 
@@ -4020,13 +4267,13 @@ L30:
     double d__1, d__2;
 
     /* Local variables */
-    static integer i__, j, k, m2;
-    static double dk;
-    static integer js, jy;
-    static double xk;
-    static integer ibd, col2;
-    static double dd_p__, temp1, temp2, alpha;
-    static integer pointr;
+    LBFGSB_SAVE integer i__, j, k, m2;
+    LBFGSB_SAVE double dk;
+    LBFGSB_SAVE integer js, jy;
+    LBFGSB_SAVE double xk;
+    LBFGSB_SAVE integer ibd, col2;
+    LBFGSB_SAVE double dd_p__, temp1, temp2, alpha;
+    LBFGSB_SAVE integer pointr;
 
 /*     ********************************************************************** */
 
@@ -4354,8 +4601,10 @@ L30:
     }
     if (dd_p__ > 0.) {
         dcopy(n, &xp[1], &c__1, &x[1], &c__1);
-        printf("Positive dir derivative in projection \n");
-        printf("Using the backtracking step\n");
+        if (*iprint >= 0) {
+            printf("Positive dir derivative in projection \n");
+            printf("Using the backtracking step\n");
+        }
     } else {
         goto L911;
     }
@@ -4454,7 +4703,7 @@ int prn1lb(integer *n, integer *m, double *l,
     integer i__1;
 
     /* Local variables */
-    static integer i__;
+    LBFGSB_SAVE integer i__;
 
     /* Parameter adjustments */
     --x;
@@ -4527,7 +4776,7 @@ int prn1lb(integer *n, integer *m, double *l,
     integer i__1;
 
     /* Local variables */
-    static integer i__, imod;
+    LBFGSB_SAVE integer i__, imod;
 
     /* Parameter adjustments */
     --g;
@@ -4610,7 +4859,7 @@ int prn3lb(integer *n, double *x, double *f, integer *
     integer i__1;
 
     /* Local variables */
-    static integer i__;
+    LBFGSB_SAVE integer i__;
     /* Parameter adjustments */
     --x;
 
@@ -4728,7 +4977,7 @@ int errclb(integer *n, integer *m, double *factr,
     integer i__1;
 
     /* Local variables */
-    static integer i__;
+    LBFGSB_SAVE integer i__;
 
     /* Parameter adjustments */
     --nbd;
@@ -4787,9 +5036,9 @@ int dpofa(double *a, integer *lda, integer *n, integer *
     double sqrt(double);
 
     /* Local variables */
-    static integer j, k;
-    static double s, t;
-    static integer jm1;
+    LBFGSB_SAVE integer j, k;
+    LBFGSB_SAVE double s, t;
+    LBFGSB_SAVE integer jm1;
 
 /*
     dpofa factors a double precision symmetric positive definite 
@@ -4884,8 +5133,8 @@ int dtrsl(double *t, integer *ldt, integer *n,
     integer t_dim1, t_offset, i__1, i__2;
 
     /* Local variables */
-    static integer j, jj, case__;
-    static double temp;
+    LBFGSB_SAVE integer j, jj, case__;
+    LBFGSB_SAVE double temp;
     /*
     extern double ddot(integer *, double *, integer *, double *, 
 	    integer *);
@@ -5123,7 +5372,7 @@ L150:
     integer i__1;
 
     /* Local variables */
-    static integer i, m, ix, iy, mp1;
+    LBFGSB_SAVE integer i, m, ix, iy, mp1;
 
 
 /*     constant times a vector plus a vector.   
@@ -5210,7 +5459,7 @@ L40:
     integer i__1;
 
     /* Local variables */
-    static integer i, m, ix, iy, mp1;
+    LBFGSB_SAVE integer i, m, ix, iy, mp1;
 
 
     /*     copies a vector, x, to a vector, y.   
@@ -5297,9 +5546,9 @@ double ddotRef(integer *n, double *dx, integer *incx, double *dy,
     double ret_val;
 
     /* Local variables */
-    static integer i, m;
-    static double dtemp;
-    static integer ix, iy, mp1;
+    LBFGSB_SAVE integer i, m;
+    LBFGSB_SAVE double dtemp;
+    LBFGSB_SAVE integer ix, iy, mp1;
 
 
     /*     forms the dot product of two vectors.   
@@ -5385,7 +5634,7 @@ L60:
     integer i__1, i__2;
 
     /* Local variables */
-    static integer i, m, nincx, mp1;
+    LBFGSB_SAVE integer i, m, nincx, mp1;
 
 
     /*     scales a vector by a constant.   
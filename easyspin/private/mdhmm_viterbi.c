@@ -0,0 +1,170 @@
+/*
+mdhmm_viterbi.c     Viterbi state trajectories for mdhmm
+
+  vTraj = mdhmm_viterbi(data,eqDistr,TransProb,mu,Sigma)
+
+  Decodes the most probable state sequence of each trajectory for a
+  multivariate Gaussian HMM of periodic (dihedral) data.
+
+  data           nDims x nSteps x nTraj array, or cell array with one
+                 nDims x nSteps array per trajectory (all of the same
+                 length), in radians
+  eqDistr        initial state distribution (nStates elements)
+  TransProb      nStates x nStates transition probability matrix
+  mu             nDims x nStates array of Gaussian centers
+  Sigma          nDims x nDims x nStates array of covariance matrices
+
+  vTraj          nSteps x nTraj array of state indices (1..nStates)
+
+  The recursion is done with log-probabilities, so no rescaling is
+  needed and long trajectories do not underflow. Only two columns of
+  delta are kept, and the backpointers are stored as 8-bit (up to 256
+  states) or 16-bit integers. The trajectories are distributed over
+  threads. Ties are resolved in favor of the lowest state index.
+
+This is an EasySpin function.
+ */
+
+#include <stdlib.h>
+#include <mex.h>
+#include "mdhmm_gaussian.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "cpuinfo.h"
+
+/* Decodes one trajectory into path (1-based state indices). Returns
+   nonzero if memory could not be allocated. */
+SIMD_CLONES
+static int viterbi(const struct Gaussians *g, const double *logPrior,
+                   const double *logA, const double *obs, long nSteps,
+                   double *path)
+{
+  const int nS = g->nStates, nD = g->nDims;
+  const bool smallPsi = nS<=256;
+  double *buffer, *delta, *deltaPrev, *tmp, *dist, best, d;
+  unsigned char *psi8 = NULL;
+  unsigned short *psi16 = NULL;
+  long t;
+  int i, j, iBest, state;
+
+  if (nSteps<1) return 0;
+
+  buffer = (double*)malloc(2*nS*sizeof(double));
+  dist = (double*)malloc(nD*sizeof(double));
+  if (smallPsi)
+    psi8 = (unsigned char*)malloc((size_t)nS*nSteps);
+  else
+    psi16 = (unsigned short*)malloc((size_t)nS*nSteps*sizeof(unsigned short));
+  if (buffer==NULL || dist==NULL || (psi8==NULL && psi16==NULL)) {
+    free(buffer); free(dist); free(psi8); free(psi16);
+    return 1;
+  }
+  delta = buffer;
+  deltaPrev = buffer + nS;
+
+  for (j=0; j<nS; j++)
+    delta[j] = logPrior[j] + log(g->prefactor[j])
+             - 0.5*mahalanobis(g,obs,j,dist);
+
+  for (t=1; t<nSteps; t++) {
+    tmp = deltaPrev; deltaPrev = delta; delta = tmp;
+    for (j=0; j<nS; j++) {
+      iBest = 0;
+      best = deltaPrev[0] + logA[j*nS];
+      for (i=1; i<nS; i++) {
+        d = deltaPrev[i] + logA[i+j*nS];
+        if (d>best) {
+          best = d;
+          iBest = i;
+        }
+      }
+      delta[j] = best + log(g->prefactor[j])
+               - 0.5*mahalanobis(g,obs+t*nD,j,dist);
+      if (smallPsi)
+        psi8[j+t*nS] = (unsigned char)iBest;
+      else
+        psi16[j+t*nS] = (unsigned short)iBest;
+    }
+  }
+
+  /* backtrack */
+  state = 0;
+  for (j=1; j<nS; j++)
+    if (delta[j]>delta[state]) state = j;
+  path[nSteps-1] = state + 1;
+  for (t=nSteps-1; t>0; t--) {
+    state = smallPsi ? psi8[state+t*nS] : psi16[state+t*nS];
+    path[t-1] = state + 1;
+  }
+
+  free(buffer); free(dist); free(psi8); free(psi16);
+  return 0;
+}
+
+/*
+****************************************************************
+           MEX gateway function for MATLAB
+****************************************************************
+*/
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  struct Gaussians g;
+  const double **obs, *prior, *A;
+  double *logPrior, *logA, *vTraj;
+  long *nSteps, nTraj, iTraj, nStepsMax;
+  int nS, i;
+  int nErrors;
+
+  if (nrhs!=5)
+    mexErrMsgTxt("Wrong number of input arguments!");
+  if (nlhs>1)
+    mexErrMsgTxt("Wrong number of output arguments!");
+
+  setthreads();
+
+  /* model parameters */
+  nS = (int)mxGetNumberOfElements(prhs[1]);
+  if (nS>65536)
+    mexErrMsgTxt("At most 65536 states are supported!");
+  if (mxGetM(prhs[2])!=nS || mxGetN(prhs[2])!=nS)
+    mexErrMsgTxt("TransProb must be a square matrix with one row per state!");
+  setupgaussians(&g,prhs[3],prhs[4],nS);
+  prior = mxGetPr(prhs[1]);
+  A = mxGetPr(prhs[2]);
+  logPrior = (double*)mxMalloc((nS+1)*sizeof(double));
+  logA = (double*)mxMalloc(((size_t)nS*nS+1)*sizeof(double));
+  for (i=0; i<nS; i++) logPrior[i] = log(prior[i]);
+  for (i=0; i<nS*nS; i++) logA[i] = log(A[i]);
+
+  /* trajectories */
+  nTraj = collecttrajectories(prhs[0],g.nDims,&obs,&nSteps);
+  nStepsMax = 0;
+  for (iTraj=0; iTraj<nTraj; iTraj++) {
+    if (iTraj>0 && nSteps[iTraj]!=nSteps[0])
+      mexErrMsgTxt("All trajectories must have the same number of steps!");
+    nStepsMax = nSteps[iTraj];
+  }
+
+  plhs[0] = mxCreateDoubleMatrix(nStepsMax,nTraj,mxREAL);
+  vTraj = mxGetPr(plhs[0]);
+
+  nErrors = 0;
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic) reduction(+:nErrors)
+  #endif
+  for (iTraj=0; iTraj<nTraj; iTraj++)
+    nErrors += viterbi(&g,logPrior,logA,obs[iTraj],nSteps[iTraj],
+                       vTraj+iTraj*nStepsMax);
+
+  mxFree(nSteps);
+  mxFree(obs);
+  mxFree(logA);
+  mxFree(logPrior);
+  mxFree(g.prefactor);
+  mxFree(g.SigmaInv);
+
+  if (nErrors>0)
+    mexErrMsgTxt("Out of memory.");
+
+} /* void mexFunction  */
@@ -7,36 +7,77 @@
 %   A = rand(3,3,100) + 1i*rand(3,3,100);
 %   B = rand(3,3,100) + 1i*rand(3,3,100);
 %   C = multimatmult(A,B);
+%
+%   A single matrix is multiplied with all pages of the other input:
+%   A = rand(3,3); B = rand(3,3,100);
+%   C = multimatmult(A,B);  % C(:,:,k) = A*B(:,:,k)
+%
+%   Sandwich products R*T*Rinv (or R*T*R.' with 't') are computed in one
+%   pass. Several tensors sharing the same R can be given in a cell array:
+%   C = multimatmult(R,T,Rinv);  % C(:,:,k) = R(:,:,k)*T(:,:,k)*Rinv(:,:,k)
+%   C = multimatmult(R,T,'t');   % C(:,:,k) = R(:,:,k)*T(:,:,k)*R(:,:,k).'
+%   C = multimatmult(R,{T1,T2},'t');  % C = {R*T1*R.', R*T2*R.'}
 
-function C = multimatmult(A,B)
+function C = multimatmult(A,B,Rinv)
 
-if ismatrix(A)||ismatrix(B)
-  mode = '2D';
-else
-  mode = 'ND';
+if nargin==3
+  C = sandwich(A,B,Rinv);
+  return
 end
 
-if any(size(A)~=size(B))
-  error('Size of input arrays must be equal.')
+if ismatrix(A) && ismatrix(B)
+  C = A*B;
+  return
 end
 
-iscomplex = ~isreal(A) || ~isreal(B);
+[A,B] = floatinputs(A,B);
+C = multimatmult_(A,B);
 
-switch mode
-  case '2D'
-    C = A*B;
-  case 'ND'
-    switch iscomplex
-      case 0
-        C = multimatmult_(A,B);
-      case 1
-        ArBr = multimatmult_(real(A),real(B));
-        AiBi = multimatmult_(imag(A),imag(B));
-        ArpAiBrpBi = multimatmult_(real(A)+imag(A),real(B)+imag(B));
+end
 
-        C = complex(ArBr - AiBi, ArpAiBrpBi - ArBr - AiBi);
-%         C = (ArBr - AiBi) + 1i*(ArpAiBrpBi - ArBr - AiBi);
-    end
+%-------------------------------------------------------------------------------
+function C = sandwich(R,T,Rinv)
+
+isCell = iscell(T);
+if ~isCell, T = {T}; end
+useTranspose = ischar(Rinv);
+if useTranspose
+  if ~strcmp(Rinv,'t')
+    error('Third input must be the array of inverses or ''t''.');
+  end
+  Rinv = [];
 end
 
-end
\ No newline at end of file
+if isreal(R) && isreal(Rinv)
+  % fused sandwich products in multimatmult_
+  [R,Rinv,T{:}] = floatinputs(R,Rinv,T{:});
+  C = multimatmult_(R,T,Rinv);
+else
+  % complex rotations: two separate products
+  if useTranspose
+    Rinv = permute(R,[2 1 3:ndims(R)]);
+  end
+  C = cell(size(T));
+  for k = 1:numel(T)
+    C{k} = multimatmult(R,multimatmult(T{k},Rinv));
+  end
+end
+
+if ~isCell, C = C{1}; end
+
+end
+
+%-------------------------------------------------------------------------------
+% Convert all inputs to full double arrays, or to full single arrays if any
+% of them is single
+function varargout = floatinputs(varargin)
+useSingle = any(cellfun(@(x)isa(x,'single'),varargin));
+for k = 1:nargin
+  x = full(varargin{k});
+  if useSingle
+    varargout{k} = single(x);
+  else
+    varargout{k} = double(x);
+  end
+end
+end
@@ -3,42 +3,206 @@
 Code adapted from mmx package on File Exchange
 www.mathworks.com/matlabcentral/fileexchange/37515-mmx-multithreaded-matrix-operations-on-n-d-matrices
 =======================
+
+  C = multimatmult_(A,B)
+  C = multimatmult_(R,T,Rinv)
+
+  Multiplies the pages A(:,:,i) and B(:,:,i) of two N-D arrays. A and B
+  must both be double or both be single, and either or both can be
+  complex. Either A or B can consist of a single page, which is then
+  multiplied with all pages of the other.
+
+  With three inputs, the sandwich products R(:,:,i)*T(:,:,i)*Rinv(:,:,i)
+  of square pages are computed in one pass, without a temporary array.
+  If Rinv is empty, the transpose of R(:,:,i) is used. T can be a cell
+  array of several tensor arrays sharing the same R, in which case C is
+  a cell array of the same size. R and Rinv must be real, T can be
+  complex. R or any T can consist of a single page.
+
+  Small pages are distributed over OpenMP threads, with unrolled kernels
+  for 2x2, 3x3 and 4x4 pages. Large pages are passed to BLAS one at a
+  time. Complex products are assembled from real page products.
 */
 
+#include <stddef.h>
+#include <stdlib.h>
 #include "mex.h"
-#include "string.h"
-#include <ctype.h>
-#include <math.h>
+#include "blas.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "cpuinfo.h"
 
-/*
-================
-global variables
-================
-*/
-double *A, *B, *C;
-int rA, cA, rB ,cB, rC, cC, strideA, strideB, strideC;
+/* Minimum number of multiply-adds per page for using BLAS */
+#define BLAS_MINFLOPS 32768
+/* Minimum total number of multiply-adds for using several threads */
+#define OMP_MINFLOPS 65536
+
+#define REAL double
+#define FUN(name) name##_d
+#define GEMM dgemm
+#include "multimatmult_.inc"
+#undef REAL
+#undef FUN
+#undef GEMM
+
+#define REAL float
+#define FUN(name) name##_s
+#define GEMM sgemm
+#include "multimatmult_.inc"
+#undef REAL
+#undef FUN
+#undef GEMM
+
+/* Number of pages of an N-D array */
+static long numpages(const mxArray *A)
+{
+  const mwSize *dims = mxGetDimensions(A);
+  mwSize i, ndim = mxGetNumberOfDimensions(A);
+  long n = 1;
+  for( i=2; i<ndim; i++ ) n *= (long)dims[i];
+  return n;
+}
+
+/* Checks whether two arrays have the same page dimensions, apart from
+   trailing singletons */
+static bool samepagedims(const mxArray *A, const mxArray *B)
+{
+  const mwSize *Adims = mxGetDimensions(A), *Bdims = mxGetDimensions(B);
+  mwSize i, Andim = mxGetNumberOfDimensions(A), Bndim = mxGetNumberOfDimensions(B);
+  mwSize nd = (Andim > Bndim) ? Andim : Bndim;
+  for( i=2; i<nd; i++ ) {
+    mwSize a = (i<Andim) ? Adims[i] : 1;
+    mwSize b = (i<Bndim) ? Bdims[i] : 1;
+    if (a != b) return false;
+  }
+  return true;
+}
 
 /*
-==================================================
-straightforward implementations of matrix multiply
-==================================================
+=====================================================
+sandwich products C = R*T*Rinv, for three-input calls
+=====================================================
 */
-void mulMatMat(double *A, const int rA, const int cA, 
-               double *B, const int rB, const int cB,
-               double *C) {
-  int i, j, k;
-  double *a, *c, tmp;  
-  for( i=0; i<cB; i++ ){
-    c = C + i*rA;
-    for( k=0; k<cA; k++ ){
-      tmp = B[i*cA+k];
-      a = A + k*rA;
-  /*        c   = C + i*rA; */
-      for( j=0; j<rA; j++ ){
-        c[j] += tmp * a[j];
-      }
+static void sandwich(mxArray *plhs[], const mxArray *prhs[])
+{
+  const mxArray *R = prhs[0], *Rinv = prhs[2], **T, *ref;
+  mxArray **C;
+  mxClassID classID = mxGetClassID(R);
+  bool isCell = mxIsCell(prhs[1]), useTranspose = mxIsEmpty(Rinv);
+  int n, nTensors, nParts, k, iPart;
+  long nR, N, incR, *incT;
+  void **Tparts, **Cparts;
+  mwSize i, ndim;
+  const mwSize *pdims;
+  mwSize *dims;
+  int nErrors;
+
+  /* check R and Rinv */
+  if ( (classID!=mxDOUBLE_CLASS && classID!=mxSINGLE_CLASS) || mxIsSparse(R) ) {
+    mexErrMsgTxt("R must be a full array of type 'double' or 'single'.");
+  }
+  if ( mxIsComplex(R) || (!useTranspose && mxIsComplex(Rinv)) ) {
+    mexErrMsgTxt("R and Rinv must be real.");
+  }
+  n = (int)mxGetM(R);
+  if ( mxGetDimensions(R)[1] != (mwSize)n ) {
+    mexErrMsgTxt("Pages of R must be square.");
+  }
+  if ( !useTranspose ) {
+    if ( mxGetClassID(Rinv)!=classID || mxIsSparse(Rinv) ||
+         mxGetM(Rinv)!=(mwSize)n || mxGetDimensions(Rinv)[1]!=(mwSize)n ||
+         numpages(Rinv)!=numpages(R) || !samepagedims(R,Rinv) ) {
+      mexErrMsgTxt("Rinv must have the same size and type as R.");
+    }
+  }
+  nR = numpages(R);
+
+  /* collect tensor arrays */
+  nTensors = isCell ? (int)mxGetNumberOfElements(prhs[1]) : 1;
+  T = (const mxArray**)mxMalloc((nTensors>0 ? nTensors : 1)*sizeof(mxArray*));
+  N = nR;
+  ref = R;
+  for (k=0; k<nTensors; k++) {
+    T[k] = isCell ? mxGetCell(prhs[1],k) : prhs[1];
+    if ( T[k]==NULL || mxGetClassID(T[k])!=classID || mxIsSparse(T[k]) ||
+         mxGetM(T[k])!=(mwSize)n || mxGetDimensions(T[k])[1]!=(mwSize)n ) {
+      mexErrMsgTxt("Tensors must be arrays of the same type and page size as R.");
+    }
+    if ( numpages(T[k])>N ) {
+      N = numpages(T[k]);
+      ref = T[k];
+    }
+  }
+  if ( N!=nR && nR!=1 ) {
+    mexErrMsgTxt("Page dimensions of R and tensors must agree, unless one of them is a single matrix.");
+  }
+  for (k=0; k<nTensors; k++) {
+    long nT = numpages(T[k]);
+    if ( nT!=1 && (nT!=N || !samepagedims(T[k],ref)) ) {
+      mexErrMsgTxt("Page dimensions of R and tensors must agree, unless one of them is a single matrix.");
+    }
+  }
+  incR = (nR==1) ? 0 : (long)n*n;
+
+  /* allocate outputs; page dimensions are taken from the input with
+     the most pages */
+  ndim = mxGetNumberOfDimensions(ref);
+  pdims = mxGetDimensions(ref);
+  dims = (mwSize*)mxMalloc(ndim*sizeof(mwSize));
+  dims[0] = n;
+  dims[1] = n;
+  for( i=2; i<ndim; i++ ) dims[i] = pdims[i];
+
+  C = (mxArray**)mxMalloc((nTensors>0 ? nTensors : 1)*sizeof(mxArray*));
+  Tparts = (void**)mxMalloc((2*nTensors+1)*sizeof(void*));
+  Cparts = (void**)mxMalloc((2*nTensors+1)*sizeof(void*));
+  incT = (long*)mxMalloc((2*nTensors+1)*sizeof(long));
+  nParts = 0;
+  for (k=0; k<nTensors; k++) {
+    bool cplx = mxIsComplex(T[k]);
+    long inc = (numpages(T[k])==1) ? 0 : (long)n*n;
+    C[k] = mxCreateNumericArray(ndim,dims,classID,cplx ? mxCOMPLEX : mxREAL);
+    /* real and imaginary parts are transformed separately, since R is real */
+    for (iPart=0; iPart<(cplx ? 2 : 1); iPart++) {
+      Tparts[nParts] = (iPart==0) ? mxGetData(T[k]) : mxGetImagData(T[k]);
+      Cparts[nParts] = (iPart==0) ? mxGetData(C[k]) : mxGetImagData(C[k]);
+      incT[nParts] = inc;
+      nParts++;
+    }
+  }
+  mxFree(dims);
+
+  nErrors = 0;
+  if ( n>0 && N>0 && nParts>0 ) {
+    if ( classID==mxDOUBLE_CLASS ) {
+      nErrors = sandwichPages_d((double*)mxGetData(R),
+                   useTranspose ? NULL : (double*)mxGetData(Rinv), incR,
+                   (const double**)Tparts, incT, (double**)Cparts, nParts, n, N);
     }
+    else {
+      nErrors = sandwichPages_s((float*)mxGetData(R),
+                   useTranspose ? NULL : (float*)mxGetData(Rinv), incR,
+                   (const float**)Tparts, incT, (float**)Cparts, nParts, n, N);
+    }
+  }
+  mxFree(incT);
+  mxFree(Cparts);
+  mxFree(Tparts);
+  mxFree(T);
+  if ( nErrors>0 ) {
+    mexErrMsgTxt("Out of memory.");
+  }
+
+  /* return a cell array if the tensors were given as one */
+  if ( isCell ) {
+    plhs[0] = mxCreateCellArray(mxGetNumberOfDimensions(prhs[1]),mxGetDimensions(prhs[1]));
+    for (k=0; k<nTensors; k++) mxSetCell(plhs[0],k,C[k]);
+  }
+  else {
+    plhs[0] = C[0];
   }
+  mxFree(C);
 }
 
 /*
@@ -48,10 +212,15 @@ mexFunction()
 */
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 {
-  mwSize  Andim, Bndim, Cndim;
-  mwSize *Adims, *Bdims, *Cdims;
-  double *Ai, *Bi;
-  int i, j, k, N;
+  mwSize Andim, Bndim, Cndim, pndim;
+  const mwSize *Adims, *Bdims, *pdims;
+  mwSize *Cdims;
+  mxClassID classID = mxDOUBLE_CLASS;
+  mxComplexity complexity;
+  int rA, cA, rB, cB;
+  mwSize i;
+  long nA, nB, N, incA, incB, incC;
+  bool isComplexA, isComplexB;
 
   /*
   ==============
@@ -59,107 +228,132 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
   ==============
   */
 
+  setthreads();
+
+  if( nrhs == 3 ) {
+    sandwich(plhs, prhs);
+    return;
+  }
   if( nrhs != 2 ) {
-    mexErrMsgTxt("Only 2 inputs can be accepted.");
+    mexErrMsgTxt("Only 2 or 3 inputs can be accepted.");
   }
 
   /*
   type check
   */
-  if ( (!mxIsDouble(prhs[0])) || (!mxIsDouble(prhs[1])) ) {
-    mexErrMsgTxt("Only inputs of type 'double' are supported.");
+  if ( mxIsDouble(prhs[0]) && mxIsDouble(prhs[1]) ) {
+    classID = mxDOUBLE_CLASS;
+  }
+  else if ( mxIsSingle(prhs[0]) && mxIsSingle(prhs[1]) ) {
+    classID = mxSINGLE_CLASS;
+  }
+  else {
+    mexErrMsgTxt("Inputs must both be of type 'double' or both of type 'single'.");
   }
+  if ( mxIsSparse(prhs[0]) || mxIsSparse(prhs[1]) ) {
+    mexErrMsgTxt("Sparse inputs are not supported.");
+  }
+  isComplexA = mxIsComplex(prhs[0]);
+  isComplexB = mxIsComplex(prhs[1]);
 
   /*
-  get rA, cA, rB, cB
+  get rA, cA, rB, cB and the number of pages
   */
-  A     = mxGetPr(prhs[0]);
   Andim = mxGetNumberOfDimensions(prhs[0]);
-  Adims = (mwSize *) mxGetDimensions(prhs[0]);
-  rA    = Adims[0];
-  cA    = Adims[1];    
+  Adims = mxGetDimensions(prhs[0]);
+  rA    = (int)Adims[0];
+  cA    = (int)Adims[1];
 
-  B     = mxGetPr(prhs[1]);
   Bndim = mxGetNumberOfDimensions(prhs[1]);
-  Bdims = (mwSize *) mxGetDimensions(prhs[1]);
-  rB    = Bdims[0];
-  cB    = Bdims[1]; 
+  Bdims = mxGetDimensions(prhs[1]);
+  rB    = (int)Bdims[0];
+  cB    = (int)Bdims[1];
 
+  nA = 1;
+  for( i=2; i<Andim; i++ ) nA *= (long)Adims[i];
+  nB = 1;
+  for( i=2; i<Bndim; i++ ) nB *= (long)Bdims[i];
 
   /*
   ================
   dimension checks
   ================
   */
-  
-  if ( (Andim != Bndim) ) {  /* || (Andim != 3) ) { */
-    mexErrMsgTxt("Inputs should have the same number of dimensions.");
-  }
-/*  
-  for( i=0; i<Andim; i++ ) {
-    if (Adims[i] != Bdims[i]) {
-      mexErrMsgTxt("Inputs should have the same shape.");
+
+  if ( cA != rB ) {
+    mexErrMsgTxt("Inner matrix dimensions must agree.");
+  }
+
+  if ( nA!=1 && nB!=1 ) {
+    /* page dimensions must be identical, apart from trailing singletons */
+    mwSize nd = (Andim > Bndim) ? Andim : Bndim;
+    for( i=2; i<nd; i++ ) {
+      mwSize a = (i<Andim) ? Adims[i] : 1;
+      mwSize b = (i<Bndim) ? Bdims[i] : 1;
+      if (a != b) {
+        mexErrMsgTxt("Page dimensions of inputs must agree, unless one of them is a single matrix.");
+      }
     }
   }
-*/
+
   /*
   ===============
   process outputs
-  =============== 
+  ===============
   */
 
+  /* page dimensions are taken from the input with more pages */
+  if ( nA>=nB ) {
+    pndim = Andim;
+    pdims = Adims;
+  }
+  else {
+    pndim = Bndim;
+    pdims = Bdims;
+  }
+  N = (nA>=nB) ? nA : nB;
 
-  Cndim    = Andim;
-  Cndim    = (Cndim > 3) ? Cndim : 3;
+  Cndim    = pndim;
   Cdims    = (mwSize *) mxMalloc( Cndim * sizeof(mwSize) );
-
-  /*
-  set Cdims[0,1]
-  */
-  rC = rA;
-  cC = cB;
-  
-  Cdims[0] = rC;
-  Cdims[1] = cC;
-
+  Cdims[0] = rA;
+  Cdims[1] = cB;
   for( i=2; i<Cndim; i++ ) {
-    Cdims[i] = Adims[i];  /* assumes that A and B are the same size */
+    Cdims[i] = pdims[i];
   }
 
-  /*
-  stride sizes
-  */
-  strideA    = rA*cA;
-  strideB    = rB*cB;
-  strideC    = rC*cC;
-
-  /*
-  N is the total number of matrix operations
-  */
-  N  = 1;
-  for( i=2; i<Cndim; i++ ) {
-    N *= Cdims[i];
-  }
+  complexity = (isComplexA || isComplexB) ? mxCOMPLEX : mxREAL;
+  plhs[0] = mxCreateNumericArray(Cndim, Cdims, classID, complexity);
+  mxFree(Cdims);
 
   /*
-  allocate C
+  stride sizes, zero for a broadcast page
   */
-  plhs[0] = mxCreateNumericArray(Cndim, Cdims, mxDOUBLE_CLASS, mxREAL);
-  nlhs    = 1;
-  C       = mxGetPr(plhs[0]);
+  incA = (nA==1) ? 0 : (long)rA*cA;
+  incB = (nB==1) ? 0 : (long)rB*cB;
+  incC = (long)rA*cB;
 
-  for( i=0; i<N; i++ ){
-    /*
-    pointers to scheduled data
-    */
-    Ai = A + strideA*i;
-    Bi = B + strideB*i;
-    /*
-    excecute the task
-    */
-    mulMatMat(Ai, rA, cA, Bi, rB, cB, C + strideC*i);
+  /* nothing to compute for empty outputs; all-zero result if cA==0 */
+  if ( N==0 || rA==0 || cB==0 || cA==0 ) {
+    return;
   }
 
+  if ( classID==mxDOUBLE_CLASS ) {
+    mulPages_d((double*)mxGetData(prhs[0]),
+               isComplexA ? (double*)mxGetImagData(prhs[0]) : NULL, incA,
+               (double*)mxGetData(prhs[1]),
+               isComplexB ? (double*)mxGetImagData(prhs[1]) : NULL, incB,
+               (double*)mxGetData(plhs[0]),
+               (double*)mxGetImagData(plhs[0]), incC,
+               rA, cA, cB, N);
+  }
+  else {
+    mulPages_s((float*)mxGetData(prhs[0]),
+               isComplexA ? (float*)mxGetImagData(prhs[0]) : NULL, incA,
+               (float*)mxGetData(prhs[1]),
+               isComplexB ? (float*)mxGetImagData(prhs[1]) : NULL, incB,
+               (float*)mxGetData(plhs[0]),
+               (float*)mxGetImagData(plhs[0]), incC,
+               rA, cA, cB, N);
+  }
 
-  mxFree(Cdims);
-}
\ No newline at end of file
+}
@@ -1,62 +1,76 @@
+#include <stdlib.h>
+#include <math.h>
 #include <mex.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "cpuinfo.h"
+#include "kernelstats.h"
 
 /*
  * multinucstick(B0,nStates,shifts,startPos,deltaPos,nPoints)
+ * multinucstick(B0,nStates,shifts,startPos,deltaPos,nPoints,Weights)
+ * multinucstick(B0,nStates,shifts,startPos,deltaPos,nPoints,Weights,Exact)
+ * [spec,Stats] = multinucstick(...)
  *
- * shifts: array of size max(2*I+1) x nNuclei
+ * B0:      center positions, one per orientation (1xN)
+ * shifts:  array of size max(2*I+1) x nNuclei, common to all
+ *          orientations, or max(2*I+1) x nNuclei x N
+ * Weights: intensity weights, one per orientation (1xN), default 1
+ * Exact:   nonzero to bin every stick at its exact position, default 0
+ *
+ * Each combination of nuclear states gives a stick at position
+ * B0 + sum of the shifts of all nuclei, which adds the orientation's
+ * weight to bin (int)((position-startPos)/deltaPos), if that lies
+ * within 0..nPoints-1. The sticks of all orientations are accumulated
+ * into one spectrum, with the orientations distributed over threads.
+ *
+ * By default, the stick pattern of each nucleus is convolved into a
+ * partial spectrum on the grid of bins relative to B0, with each shift
+ * split linearly between the two neighbouring bins. The cost is about
+ * nNuclei x nPoints x max(2*I+1) per orientation. This keeps the total
+ * intensity and the mean position of the sticks of each nucleus, and gives
+ * the same spectrum as the exact binning if all shifts are multiples of
+ * deltaPos; otherwise intensity is spread over neighbouring bins.
+ *
+ * With Exact, all combinations are enumerated for small product spaces.
+ * Otherwise the nuclei are added one at a time to a list of distinct stick
+ * positions, merging sticks with equal positions. This is fast if there
+ * are many equivalent nuclei, and gives the same spectrum as the
+ * enumeration.
+ *
+ * Stats is a structure with the numbers of orientations and sticks, the
+ * numbers of orientations computed by enumeration, by merging and by
+ * convolution, the size of the per-thread spectral buffers, and the wall
+ * times of the stick and reduction phases.
  */
 
-void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
-{
+/* Merging sticks costs about this factor more per stick than enumerating
+   them (sorting); MAXSTICKS bounds the number of distinct positions kept */
+#define MERGEOVERHEAD 4
+#define MAXSTICKS 16777216
 
-  int iNuc, nNuclei, nPeaks, i;
-  double *nStates, *shifts;
-  double p_, centerPos;
-  int *iState, M, idx;
-  double *position, *spectrum;
-  double startPos, deltaPos, nPoints;
-  int Debug = 0;
-  
-  centerPos = mxGetScalar(prhs[0]);
-  
-  nStates = mxGetPr(prhs[1]);
-  nNuclei = mxGetNumberOfElements(prhs[1]);
+/* Exhaustive enumeration of all nuclear state combinations */
+static int enumeratesticks(double *spectrum, double weight, double centerPos,
+         const double *nStates, const double *shifts, int M, int nNuclei, int nPoints)
+{
+  int iNuc, *iState, idx;
+  double p_, *position;
 
-  /* shifts array: size max(2*I+1) x nNuclei */
-  if (mxGetN(prhs[2])!=nNuclei)
-    mexErrMsgTxt("Wrong size of shifts array!");
-  shifts = mxGetPr(prhs[2]);
-  M = mxGetM(prhs[2]);
-     
-  startPos = mxGetScalar(prhs[3]);
-  deltaPos = mxGetScalar(prhs[4]);
-  nPoints = mxGetScalar(prhs[5]);
+  iState = (int*)calloc(nNuclei,sizeof(int));
+  position = (double*)calloc(nNuclei,sizeof(double));
+  if ((iState==NULL)||(position==NULL)) {
+    free(position);
+    free(iState);
+    return 1;
+  }
 
-  if (deltaPos<0)
-    mexErrMsgTxt("delta cannot be negative.");
-    
-  centerPos = (centerPos - startPos)/deltaPos;
-  for (i=0;i<mxGetNumberOfElements(prhs[2]);i++)
-     shifts[i]/=deltaPos;
-  
-  plhs[0] = mxCreateDoubleMatrix(1,nPoints,mxREAL);
-  spectrum = mxGetPr(plhs[0]);
-  
-  iState = (int*)mxMalloc(nNuclei*sizeof(int));
-  for (i=0;i<nNuclei;i++) iState[i]=0;
-  
-  position = (double*)mxMalloc(nNuclei*sizeof(double));
-  for (i=0;i<nNuclei;i++) position[i]=0;
-  
   iNuc = 0;
-  nPeaks = 0;
   while (iNuc>=0) {
     if (iNuc==nNuclei) { /*if vertex, process and then backtrack */
       idx = position[iNuc-1];
-      if ((idx>=0)&&(idx<nPoints)) {
-        spectrum[idx]+=1;
-        nPeaks++;
-      }
+      if ((idx>=0)&&(idx<nPoints))
+        spectrum[idx]+=weight;
       iNuc--;
     }
     if (iState[iNuc]<nStates[iNuc]) { /* if not last state, go deeper, next sibling */
@@ -70,10 +84,353 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
       iNuc--;
     }
   }
-  
-  if (Debug)
-    mexPrintf("%d peaks\n",nPeaks);
-  mxFree(position);
-  mxFree(iState);
-    
+
+  free(position);
+  free(iState);
+  return 0;
+}
+
+struct stick { double pos, weight; };
+
+static int comparesticks(const void *a, const void *b)
+{
+  double pa = ((const struct stick*)a)->pos, pb = ((const struct stick*)b)->pos;
+  return (pa>pb) - (pa<pb);
+}
+
+/* Range of the sums of the shifts of nuclei iNuc..nNuclei-1, in
+   minRest[iNuc] and maxRest[iNuc] */
+static void shiftranges(double *minRest, double *maxRest,
+         const double *nStates, const double *shifts, int M, int nNuclei)
+{
+  int iNuc, i;
+  double smin, smax;
+
+  minRest[nNuclei] = maxRest[nNuclei] = 0;
+  for (iNuc=nNuclei-1; iNuc>=0; iNuc--) {
+    smin = smax = shifts[iNuc*M];
+    for (i=1; i<nStates[iNuc]; i++) {
+      if (shifts[iNuc*M+i]<smin) smin = shifts[iNuc*M+i];
+      if (shifts[iNuc*M+i]>smax) smax = shifts[iNuc*M+i];
+    }
+    minRest[iNuc] = minRest[iNuc+1] + smin;
+    maxRest[iNuc] = maxRest[iNuc+1] + smax;
+  }
+}
+
+/* Convolution of the stick patterns of all nuclei on the grid of integer
+   bin offsets from centerPos. P holds the partial spectrum for offsets
+   lo..hi. Each shift s adds (1-f) of a stick to offset floor(s) and f to
+   floor(s)+1, with f = s-floor(s). Offsets from which the remaining
+   nuclei cannot reach the spectral range are dropped, with a margin of
+   one bin as in stickspectrum. */
+static int convolvesticks(double *spectrum, double weight, double centerPos,
+         const double *nStates, const double *shifts, int M, int nNuclei, int nPoints)
+{
+  int iNuc, i, idx, err;
+  long j, k, lo, hi, nlo, nhi, kmin, kmax;
+  double smin, smax, s, f, *P, *Q, *minRest, *maxRest;
+
+  minRest = (double*)calloc(nNuclei+1,sizeof(double));
+  maxRest = (double*)calloc(nNuclei+1,sizeof(double));
+  P = (double*)malloc(sizeof(double));
+  Q = NULL;
+  err = 1;
+  if ((minRest==NULL)||(maxRest==NULL)||(P==NULL)) goto cleanup;
+  shiftranges(minRest,maxRest,nStates,shifts,M,nNuclei);
+
+  P[0] = 1;
+  lo = hi = 0;
+  for (iNuc=0; iNuc<nNuclei; iNuc++) {
+    smin = minRest[iNuc] - minRest[iNuc+1];
+    smax = maxRest[iNuc] - maxRest[iNuc+1];
+    nlo = lo + (long)floor(smin);
+    nhi = hi + (long)floor(smax) + 1;
+    kmin = (long)floor(-2 - centerPos - maxRest[iNuc+1]);
+    kmax = (long)ceil(nPoints + 1 - centerPos - minRest[iNuc+1]);
+    if (nlo<kmin) nlo = kmin;
+    if (nhi>kmax) nhi = kmax;
+    if (nlo>nhi) { err = 0; goto cleanup; } /* out of range */
+    Q = (double*)calloc(nhi-nlo+1,sizeof(double));
+    if (Q==NULL) goto cleanup;
+    for (i=0; i<nStates[iNuc]; i++) {
+      s = shifts[iNuc*M+i];
+      f = s - floor(s);
+      for (j=lo; j<=hi; j++) {
+        if (P[j-lo]==0) continue;
+        k = j + (long)floor(s);
+        if ((k>=nlo)&&(k<=nhi)) Q[k-nlo] += (1-f)*P[j-lo];
+        if ((f>0)&&(k+1>=nlo)&&(k+1<=nhi)) Q[k+1-nlo] += f*P[j-lo];
+      }
+    }
+    free(P);
+    P = Q;
+    Q = NULL;
+    lo = nlo;
+    hi = nhi;
+  }
+
+  for (k=lo; k<=hi; k++) {
+    idx = centerPos + k;
+    if ((idx>=0)&&(idx<nPoints))
+      spectrum[idx] += weight*P[k-lo];
+  }
+  err = 0;
+
+cleanup:
+  free(Q);
+  free(P);
+  free(maxRest);
+  free(minRest);
+  return err;
+}
+
+/* Methods of stickspectrum, counted in Stats */
+#define ENUMERATED 0
+#define MERGED 1
+#define CONVOLVED 2
+
+/* Stick spectrum of one orientation, with center position and shifts
+   in units of bins, added with the given weight to spectrum. Sets
+   *method to the method used. Returns nonzero if memory could not be
+   allocated. */
+static int stickspectrum(double *spectrum, double weight, double centerPos,
+         const double *nStates, const double *shifts, int M, int nNuclei, int nPoints,
+         int exact, int *method)
+{
+  int iNuc, jNuc, i, k, nS, idx, err, *group, *groupCount;
+  long j, n, m;
+  double exactCost, mergedCost, nDistinct, pos, *minRest, *maxRest;
+  struct stick *s, *t;
+
+  *method = ENUMERATED;
+  if (nNuclei==0) {
+    idx = centerPos;
+    if ((idx>=0)&&(idx<nPoints)) spectrum[idx] += weight;
+    return 0;
+  }
+
+  if (!exact) {
+    *method = CONVOLVED;
+    return convolvesticks(spectrum,weight,centerPos,nStates,shifts,M,nNuclei,nPoints);
+  }
+
+  group = (int*)calloc(nNuclei,sizeof(int));
+  groupCount = (int*)calloc(nNuclei,sizeof(int));
+  minRest = (double*)calloc(nNuclei+1,sizeof(double));
+  maxRest = (double*)calloc(nNuclei+1,sizeof(double));
+  s = t = NULL;
+  err = 1;
+  if ((group==NULL)||(groupCount==NULL)||(minRest==NULL)||(maxRest==NULL))
+    goto cleanup;
+
+  /* equivalent nuclei (same number of states and same shifts) are in
+     the group of the first of them */
+  for (iNuc=0; iNuc<nNuclei; iNuc++) {
+    group[iNuc] = iNuc;
+    for (jNuc=0; jNuc<iNuc; jNuc++) {
+      if ((group[jNuc]!=jNuc) || (nStates[jNuc]!=nStates[iNuc])) continue;
+      for (i=0; i<nStates[iNuc]; i++)
+        if (shifts[jNuc*M+i]!=shifts[iNuc*M+i]) break;
+      if (i==nStates[iNuc]) { group[iNuc] = jNuc; break; }
+    }
+  }
+
+  /* cost of enumeration (number of sticks) and of merging (number of
+     distinct positions times number of states, summed over the nuclei;
+     after k nuclei of a group with nS states, there are C(k+nS-1,nS-1)
+     distinct positions) */
+  exactCost = 1;
+  mergedCost = 0;
+  nDistinct = 1;
+  for (iNuc=0; iNuc<nNuclei; iNuc++) {
+    nS = (int)nStates[iNuc];
+    exactCost *= nS;
+    mergedCost += nDistinct*nS;
+    k = groupCount[group[iNuc]]++;
+    nDistinct = nDistinct*(k+nS)/(k+1);
+  }
+  if (exactCost<=MERGEOVERHEAD*mergedCost || nDistinct>MAXSTICKS) {
+    err = enumeratesticks(spectrum,weight,centerPos,nStates,shifts,M,nNuclei,nPoints);
+    goto cleanup;
+  }
+
+  shiftranges(minRest,maxRest,nStates,shifts,M,nNuclei);
+
+  /* Add the nuclei one by one. Positions are summed in the same order as
+     in enumeratesticks, and sticks are only merged if their positions are
+     bitwise equal, so every stick lands in the same bin as there. Sticks
+     that cannot reach the spectral range are dropped, with a margin of
+     one bin for rounding. */
+  s = (struct stick*)malloc(sizeof(struct stick));
+  if (s==NULL) goto cleanup;
+  s[0].pos = centerPos;
+  s[0].weight = 1;
+  n = 1;
+  for (iNuc=0; iNuc<nNuclei; iNuc++) {
+    nS = (int)nStates[iNuc];
+    t = (struct stick*)malloc(n*nS*sizeof(struct stick));
+    if (t==NULL) goto cleanup;
+    m = 0;
+    for (j=0; j<n; j++)
+      for (i=0; i<nS; i++) {
+        pos = s[j].pos + shifts[iNuc*M+i];
+        if ((pos+maxRest[iNuc+1]<=-2) || (pos+minRest[iNuc+1]>=nPoints+1)) continue;
+        t[m].pos = pos;
+        t[m].weight = s[j].weight;
+        m++;
+      }
+    qsort(t,m,sizeof(struct stick),comparesticks);
+    n = 0;
+    for (j=0; j<m; j++) {
+      if ((n>0)&&(t[j].pos==t[n-1].pos))
+        t[n-1].weight += t[j].weight;
+      else
+        t[n++] = t[j];
+    }
+    free(s);
+    s = t;
+    t = NULL;
+  }
+  *method = MERGED;
+
+  for (j=0; j<n; j++) {
+    idx = s[j].pos;
+    if ((idx>=0)&&(idx<nPoints))
+      spectrum[idx] += weight*s[j].weight;
+  }
+  err = 0;
+
+cleanup:
+  free(t);
+  free(s);
+  free(maxRest);
+  free(minRest);
+  free(groupCount);
+  free(group);
+  return err;
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+
+  int nNuclei, M, nPoints, nThreads, iThread, nErrors, exact;
+  long nOri, nShiftSets, nShifts, nWeights, i, nMerged, nConvolved;
+  const mwSize *dims;
+  double *centerPos, *nStates, *shifts, *Weights;
+  double *spectrum, *buffer, *scaledShifts;
+  double startPos, deltaPos, nSticks, tStart, tSticks, tReduce;
+  struct KernelStats Stats;
+
+  if ((nrhs<6)||(nrhs>8))
+    mexErrMsgTxt("Wrong number of input arguments!");
+  if (nlhs>2)
+    mexErrMsgTxt("Too many output arguments!");
+  tStart = walltime();
+
+  centerPos = mxGetPr(prhs[0]);
+  nOri = mxGetNumberOfElements(prhs[0]);
+
+  nStates = mxGetPr(prhs[1]);
+  nNuclei = mxGetNumberOfElements(prhs[1]);
+
+  /* shifts array: size max(2*I+1) x nNuclei (x nOri) */
+  dims = mxGetDimensions(prhs[2]);
+  if (dims[1]!=nNuclei)
+    mexErrMsgTxt("Wrong size of shifts array!");
+  M = dims[0];
+  nShiftSets = (mxGetNumberOfDimensions(prhs[2])>2) ? dims[2] : 1;
+  if ((nShiftSets!=1)&&(nShiftSets!=nOri))
+    mexErrMsgTxt("Wrong size of shifts array!");
+  shifts = mxGetPr(prhs[2]);
+  nShifts = mxGetNumberOfElements(prhs[2]);
+
+  startPos = mxGetScalar(prhs[3]);
+  deltaPos = mxGetScalar(prhs[4]);
+  nPoints = (int)mxGetScalar(prhs[5]);
+
+  Weights = NULL;
+  nWeights = 0;
+  if (nrhs>=7) {
+    nWeights = mxGetNumberOfElements(prhs[6]);
+    if ((nWeights!=nOri)&&(nWeights!=1)&&(nWeights!=0))
+      mexErrMsgTxt("Number of weights and center positions must match!");
+    Weights = mxGetPr(prhs[6]);
+  }
+  exact = (nrhs==8) ? (mxGetScalar(prhs[7])!=0) : 0;
+
+  if (deltaPos<0)
+    mexErrMsgTxt("delta cannot be negative.");
+
+  /* shifts in units of bins (the input array is left unchanged) */
+  scaledShifts = (double*)mxMalloc((nShifts>0 ? nShifts : 1)*sizeof(double));
+  for (i=0;i<nShifts;i++)
+    scaledShifts[i] = shifts[i]/deltaPos;
+
+  plhs[0] = mxCreateDoubleMatrix(1,nPoints,mxREAL);
+  spectrum = mxGetPr(plhs[0]);
+
+  nThreads = 1;
+  #ifdef _OPENMP
+  nThreads = setthreads();
+  if (nThreads>nOri) nThreads = (int)nOri;
+  if (nThreads<1) nThreads = 1;
+  #endif
+
+  /* one spectrum per thread; the first thread uses the output array */
+  buffer = NULL;
+  if (nThreads>1)
+    buffer = (double*)mxCalloc((long)(nThreads-1)*nPoints,sizeof(double));
+
+  nErrors = 0;
+  nMerged = 0;
+  nConvolved = 0;
+  tSticks = walltime();
+  #ifdef _OPENMP
+  #pragma omp parallel for num_threads(nThreads) schedule(static,1) reduction(+:nErrors,nMerged,nConvolved)
+  #endif
+  for (iThread=0; iThread<nThreads; iThread++) {
+    long o;
+    double *spc = (iThread==0) ? spectrum : buffer+(long)(iThread-1)*nPoints;
+    for (o=nOri*iThread/nThreads; o<nOri*(iThread+1)/nThreads; o++) {
+      double wt = (nWeights==0) ? 1 : Weights[(nWeights==1) ? 0 : o];
+      double c = (centerPos[o] - startPos)/deltaPos;
+      const double *sh = scaledShifts + ((nShiftSets==1) ? 0 : o*M*(long)nNuclei);
+      int method;
+      nErrors += stickspectrum(spc,wt,c,nStates,sh,M,nNuclei,nPoints,exact,&method);
+      nMerged += (method==MERGED);
+      nConvolved += (method==CONVOLVED);
+    }
+  }
+  tReduce = walltime();
+
+  for (iThread=1; iThread<nThreads; iThread++)
+    for (i=0; i<nPoints; i++)
+      spectrum[i] += buffer[(long)(iThread-1)*nPoints+i];
+
+  if (buffer!=NULL) mxFree(buffer);
+  mxFree(scaledShifts);
+
+  if (nErrors>0)
+    mexErrMsgTxt("Out of memory.");
+
+  if (nlhs>1) {
+    nSticks = nOri;
+    for (i=0; i<nNuclei; i++) nSticks *= nStates[i];
+    Stats.nFields = 0;
+    setstat(&Stats,"nOrientations",nOri);
+    setstat(&Stats,"nNuclei",nNuclei);
+    setstat(&Stats,"nSticks",nSticks);
+    setstat(&Stats,"nEnumerated",nOri-nMerged-nConvolved);
+    setstat(&Stats,"nMerged",nMerged);
+    setstat(&Stats,"nConvolved",nConvolved);
+    setstat(&Stats,"nThreads",nThreads);
+    setstat(&Stats,"BufferSize",(double)(nThreads-1)*nPoints);
+    setstat(&Stats,"tSetup",tSticks-tStart);
+    setstat(&Stats,"tSticks",tReduce-tSticks);
+    setstat(&Stats,"tReduce",walltime()-tReduce);
+    setstat(&Stats,"tTotal",walltime()-tStart);
+    plhs[1] = statsstruct(&Stats);
+  }
+
 } /* void mexFunction  */
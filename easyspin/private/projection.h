@@ -0,0 +1,241 @@
+/*
+projection.h    projection of line positions over a spherical grid onto
+                the spectral axis
+
+  triproject projects the positions at the vertices of a triangulation,
+  with a linear distribution of each triangle between its smallest and
+  largest vertex value (projecttriangles, interpproject). zoneproject
+  projects the positions along a line of points, with a flat
+  distribution over each segment (projectzones, interpproject).
+
+  Include after mex.h and cpuinfo.h.
+ */
+
+/* guarantee portability between 32 and 64-bit systems */
+#ifdef bit64
+typedef int INT32;
+#else
+typedef int INT32;
+#endif
+
+/* Projects transitions t = tFirst..tLast-1 of the data. fun and amp
+   hold the values of vertex v and transition t at v*nTrans+t. The
+   spectrum of transition t is added to spec[(t-tFirst)*nPoints...], or,
+   if sum is set, all are added to spec[0...nPoints-1]. */
+SIMD_CLONES
+static inline void triproject(double spec[], INT32 tri[], double wei[],
+         double fun[], double amp[],
+         double x[], INT32 nPoints,
+         INT32 nTri, INT32 nTrans, INT32 tFirst, INT32 tLast,
+         INT32 isoInt, INT32 sum)
+{
+  double Amplitude, left, middle, right, delta, dum;
+  double Area, Width1, Width2, Width, f0;
+  INT32 iTri, idx1, idx2, idx3, first1, last1, first2, last2, idx, t;
+  double *s;
+
+  Amplitude = amp[0];
+  delta = x[1] - x[0];
+  for (iTri=0; iTri<nTri; iTri++) {
+
+    /* retrieve indices from triangulation */
+    idx1 = tri[3*iTri]-1;
+    idx2 = tri[3*iTri+1]-1;
+    idx3 = tri[3*iTri+2]-1;
+
+    Area = wei[iTri];
+
+    for (t=tFirst; t<tLast; t++) {
+
+      s = sum ? spec : spec + (long)(t-tFirst)*nPoints;
+
+      /* get position data */
+      left = fun[(long)idx1*nTrans+t];
+      middle = fun[(long)idx2*nTrans+t];
+      right = fun[(long)idx3*nTrans+t];
+    
+      /* skip triangles with NaN positions */
+      if ((left!=left) || (middle!=middle) || (right!=right)) continue;
+    
+      /* sort and scale positions */
+      if (right<left) {dum=left; left=right; right=dum;}
+      if (middle<left) {dum=left; left=middle; middle=dum;}
+      else
+        if (middle>right) {dum=right; right=middle; middle=dum;}
+      left   = (left  -x[0])/delta;
+      middle = (middle-x[0])/delta;
+      right  = (right -x[0])/delta;
+    
+      Width = right-left;
+      Width1 = middle-left;
+      Width2 = right-middle;
+
+      /* compute mean amplitude if necessary */
+      if (!isoInt)
+        Amplitude = (amp[(long)idx1*nTrans+t]+amp[(long)idx2*nTrans+t]+amp[(long)idx3*nTrans+t])/3;
+
+      first1 = (INT32)left;
+      last1 = (INT32)middle;
+      first2 = last1;
+      last2 = (INT32)right;
+
+      /* if left triangle has non-zero width*/
+      if (Width1>0)
+        /* if left triangle lies at least partially within range */
+        if ((first1<nPoints)&&(last1>=0)) {
+          /* compute prefactor (Height = 2*Amplitude*Area/Width) */
+          f0 = (2*Amplitude*Area/Width)/Width1/delta;
+          /* Integral over spectrum (mind x axis!) should be equal to sum of weights. */
+          if (first1==last1)
+            s[first1] += f0*Width1*Width1/2;
+          else {
+            /* update or chop first bin */
+            if (first1>=0)
+              s[first1] += f0*(first1+1-left)/2*(first1+1-left);
+            else first1 = -1;
+            /* update or chop last bin */
+            if (last1<nPoints)
+              s[last1] += f0*((last1+middle)/2-left)*(middle-last1);
+            else last1 = nPoints;
+            /* update intermediate bins */
+            left -= 0.5;
+            for (idx=first1+1; idx<last1; idx++)
+              s[idx] += f0*(idx-left);
+          }
+        }
+
+      /* if right triangle has non-zero width */
+      if (Width2>0)
+        /* if right triangle lies at least partially within range */
+        if ((first2<nPoints)&&(last2>=0)) {
+          /* compute prefactor (Height = 2*Amplitude*Area/Width) */
+          f0 = (2*Amplitude*Area/Width)/Width2/delta;
+          /* Integral over spectrum (mind x axis!) should be equal to sum of weights. */
+          if (first2==last2)
+            s[first2] += f0*Width2*Width2/2;
+          else {
+            /* update or chop first bin */
+            if (first2>=0)
+              s[first2] += f0*(first2+1-middle)*(right-(middle+first2+1)/2);
+            else first2 = -1;
+            /* update or chop last bin */
+            if (last2<nPoints)
+              s[last2] += f0*(right-last2)*(right-last2)/2;
+            else last2 = nPoints;
+            /* update intermediate bins */
+            right -= 0.5;
+            for (idx=first2+1; idx<last2; idx++)
+              s[idx] += f0*(right-idx);
+          }
+        }
+    
+      /* Both left and right are zero-width "triangles" */
+      if ((Width1==0)&&(Width2==0)) {
+        first1 = (INT32)left;
+        if ((first1>=0)&&(first1<nPoints))
+          s[first1] += Amplitude*Area/delta;
+      }
+    
+    } /* for t */
+  } /* for iTri */
+}
+
+/* Projects one transition with positions Position[0..nPeaks-1] and
+   amplitudes rAmpl/iAmpl (nAmpl is 1 or nPeaks) and adds the result
+   to rSpectrum (and iSpectrum, if Cplx). */
+SIMD_CLONES
+static inline void zoneproject(double *rSpectrum, double *iSpectrum,
+         double *Position, double *rAmpl, double *iAmpl, long nAmpl,
+         double *SegWeights, double *x, long nPoints, long nPeaks, bool Cplx)
+{
+  bool anisoAmp;
+  double rmeanAmp, imeanAmp;
+  double delta, left, right, dum;
+  double rHeight, iHeight;
+  long iSeg, nSeg, idx, first, last;
+
+  nSeg = nPeaks-1;
+  delta = x[1] - x[0];
+  anisoAmp = (nAmpl!=1);
+  rmeanAmp = rAmpl[0]/delta;
+  imeanAmp = Cplx ? iAmpl[0]/delta : 0;
+
+  for (iSeg=0; iSeg<nSeg; iSeg++) {
+
+    left = Position[iSeg];
+    right = Position[iSeg+1];
+    
+    if ((left!=left) || (right!=right)) continue;
+    
+    if (left>right) {dum = left; left = right; right = dum;}
+        
+    left  = (left -x[0])/delta;
+    right = (right-x[0])/delta;
+    first = (long)(left);
+    last =  (long)(right);
+
+    /* skip segment is completely outside */
+    if ((first>=nPoints)||(last<0)) continue;
+
+    if (Cplx) {
+      /* get possible separate amplitude for this segment */
+      if (anisoAmp) {
+        rmeanAmp = (rAmpl[iSeg]+rAmpl[iSeg+1])/2/delta;
+        imeanAmp = (iAmpl[iSeg]+iAmpl[iSeg+1])/2/delta;
+      }
+      if (first==last) {
+        rSpectrum[first] += rmeanAmp*SegWeights[iSeg];
+        iSpectrum[first] += imeanAmp*SegWeights[iSeg];
+      }
+      else {
+        /* compute height of projection rectangle */
+        rHeight = rmeanAmp*SegWeights[iSeg]/(right-left);
+        iHeight = imeanAmp*SegWeights[iSeg]/(right-left);
+        /* set first element or chop */
+        if (first>=0) {
+          rSpectrum[first] += rHeight*(first+1-left);
+          iSpectrum[first] += iHeight*(first+1-left);
+        }
+        else first = -1;
+        /* set last element or chop */
+        if (last<nPoints) {
+          rSpectrum[last] += rHeight*(right-last);
+          iSpectrum[last] += iHeight*(right-last);
+        }
+        else last = nPoints;
+
+        /* set possible intermediate elements */
+        for (idx=first+1; idx<last; idx++) {
+          rSpectrum[idx] += rHeight;
+          iSpectrum[idx] += iHeight;
+        }
+      } /* if (first==last) else */
+    }
+    else {
+      /* get possible separate amplitude for this segment */
+      if (anisoAmp)
+        rmeanAmp = (rAmpl[iSeg]+rAmpl[iSeg+1])/2/delta;
+      if (first==last)
+        rSpectrum[first] += rmeanAmp*SegWeights[iSeg];
+      else {
+        /* compute height of projection rectangle */
+        rHeight = rmeanAmp*SegWeights[iSeg]/(right-left);
+        /* set first element or chop */
+        if (first>=0)
+          rSpectrum[first] += rHeight*(first+1-left);
+        else
+          first = -1;
+        /* set last element or chop */
+        if (last<nPoints)
+          rSpectrum[last] += rHeight*(right-last);
+        else
+          last = nPoints;
+        /* set possible intermediate elements */
+        for (idx=first+1; idx<last; idx++)
+          rSpectrum[idx] += rHeight;
+      } /* if (first==last) else */
+    } /* if (Cplx) */
+    
+  } /* for iSeg */
+  
+}
@@ -1,6 +1,7 @@
 /*
 ========================================================================
 Spectrum = projecttriangles(Tri,Areas,Fun,Amplitude,x)
+Spectrum = projecttriangles(Tri,Areas,Fun,Amplitude,x,Separate)
 ========================================================================
 
   Given data Fun with a triangulation Tri and triangle
@@ -10,132 +11,35 @@ Spectrum = projecttriangles(Tri,Areas,Fun,Amplitude,x)
 
   Tri:       triangulation, 3xN uint32 array
   Areas:     1xN or Nx1 array of areas for the triangles
-  Fun:       1xM or Mx1 array of position data
-  Amplitude: 1xM or Mx1 or 1x1 array of amplitude data
+  Fun:       1xM or Mx1 array of position data, or MxL array
+             with one column for each of L transitions
+  Amplitude: array of amplitude data, same size as Fun, or 1x1
   xData:     1xK array, x axis vector for spectrum
+  Separate:  if true, return one spectrum per transition (LxK),
+             otherwise the sum over all transitions (1xK);
+             default false
+
+  With several transitions, the triangulation is read once
+  for all of them. Position and amplitude data are rearranged
+  so that the values of all transitions at one vertex are
+  adjacent in memory. The transitions are distributed over
+  threads, and, if there are more threads than transitions,
+  the triangles as well.
 
 ========================================================================
 */
 
-/* guarantee portability between 32 and 64-bit systems */
-#ifdef bit64
-typedef int INT32;
-#else
-typedef int INT32;
-#endif
-
+#include <stdlib.h>
 #include <mex.h>
 #include "math.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "cpuinfo.h"
+#include "projection.h"
 
-void triproject(double spec[], INT32 tri[], double wei[],
-         double fun[], double amp[],
-         double x[], INT32 nPoints,
-         INT32 nTri, INT32 nLines, INT32 isoInt)
-{
-  double Amplitude, left, middle, right, delta, dum;
-  double Area, Width1, Width2, Width, f0;
-  INT32 iTri, idx1, idx2, idx3, first1, last1, first2, last2, idx;
-
-  Amplitude = amp[0];
-  delta = x[1] - x[0];
-  for (iTri=0; iTri<nTri; iTri++) {
-
-    /* retrieve indices from triangulation */
-    idx1 = tri[3*iTri]-1;
-    idx2 = tri[3*iTri+1]-1;
-    idx3 = tri[3*iTri+2]-1;
-
-    /* get position data */
-    left = fun[idx1];
-    middle = fun[idx2];
-    right = fun[idx3];
-    
-    Area = wei[iTri];
-    
-    /* skip triangles with NaN positions */
-    if (mxIsNaN(left) || mxIsNaN(middle) || mxIsNaN(right)) continue;
-    
-    /* sort and scale positions */
-    if (right<left) {dum=left; left=right; right=dum;}
-    if (middle<left) {dum=left; left=middle; middle=dum;}
-    else
-      if (middle>right) {dum=right; right=middle; middle=dum;}
-    left   = (left  -x[0])/delta;
-    middle = (middle-x[0])/delta;
-    right  = (right -x[0])/delta;
-    
-    Width = right-left;
-    Width1 = middle-left;
-    Width2 = right-middle;
-
-    /* compute mean amplitude if necessary */
-    if (!isoInt) Amplitude = (amp[idx1]+amp[idx2]+amp[idx3])/3;
-
-    first1 = (INT32)left;
-    last1 = (INT32)middle;
-    first2 = last1;
-    last2 = (INT32)right;
-
-    /* if left triangle has non-zero width*/
-    if (Width1>0)
-      /* if left triangle lies at least partially within range */
-      if ((first1<nPoints)&&(last1>=0)) {
-        /* compute prefactor (Height = 2*Amplitude*Area/Width) */
-        f0 = (2*Amplitude*Area/Width)/Width1/delta;
-        /* Integral over spectrum (mind x axis!) should be equal to sum of weights. */
-        if (first1==last1)
-          spec[first1] += f0*Width1*Width1/2;
-        else {
-          /* update or chop first bin */
-          if (first1>=0)
-            spec[first1] += f0*(first1+1-left)/2*(first1+1-left);
-          else first1 = -1;
-          /* update or chop last bin */
-          if (last1<nPoints)
-            spec[last1] += f0*((last1+middle)/2-left)*(middle-last1);
-          else last1 = nPoints;
-          /* update intermediate bins */
-          left -= 0.5;
-          for (idx=first1+1; idx<last1; idx++)
-            spec[idx] += f0*(idx-left);
-        }
-      }
-
-    /* if right triangle has non-zero width */
-    if (Width2>0)
-      /* if right triangle lies at least partially within range */
-      if ((first2<nPoints)&&(last2>=0)) {
-        /* compute prefactor (Height = 2*Amplitude*Area/Width) */
-        f0 = (2*Amplitude*Area/Width)/Width2/delta;
-        /* Integral over spectrum (mind x axis!) should be equal to sum of weights. */
-        if (first2==last2)
-          spec[first2] += f0*Width2*Width2/2;
-        else {
-          /* update or chop first bin */
-          if (first2>=0)
-            spec[first2] += f0*(first2+1-middle)*(right-(middle+first2+1)/2);
-          else first2 = -1;
-          /* update or chop last bin */
-          if (last2<nPoints)
-            spec[last2] += f0*(right-last2)*(right-last2)/2;
-          else last2 = nPoints;
-          /* update intermediate bins */
-          right -= 0.5;
-          for (idx=first2+1; idx<last2; idx++)
-            spec[idx] += f0*(right-idx);
-        }
-      }
-    
-    /* Both left and right are zero-width "triangles" */
-    if ((Width1==0)&&(Width2==0)) {
-      first1 = (INT32)left;
-      if ((first1>=0)&&(first1<nPoints))
-        spec[first1] += Amplitude*Area/delta;
-    }
-    
-  } /* for iTri */
-}
-
+/* minimum number of triangles per thread */
+#define MINTRIANGLESPERTHREAD 2000
 
 void mexFunction(int nlhs, mxArray *plhs[],
          int nrhs, const mxArray *prhs[])
@@ -143,11 +47,13 @@ void mexFunction(int nlhs, mxArray *plhs[],
   INT32 *Triangulation;
   double *TriAreas, *Function, *Amplitudes, *x;
 
-  INT32 nTri, isoIntensity, nPoints, nLines, nAmps;
+  INT32 nTri, isoIntensity, nPoints, nLines, nAmps, nTrans;
+  INT32 Separate, nThreads, nTransBlocks, nTriBlocks, nBlocks, iBlock, k, t, v;
+  long i, nSpec;
 
-  double *Spectrum;
+  double *Spectrum, *fun, *amp, *buffer;
 
-  if (nrhs!=5)
+  if ((nrhs!=5)&&(nrhs!=6))
     mexErrMsgTxt("Wrong number of input arguments!");
   if (nlhs!=1)
     mexErrMsgTxt("Wrong number of output arguments!");
@@ -163,24 +69,115 @@ void mexFunction(int nlhs, mxArray *plhs[],
     mexErrMsgTxt("Number of triangles and areas must match!");
   TriAreas = mxGetPr(prhs[1]);
   Function = mxGetPr(prhs[2]);
-  nLines = mxGetNumberOfElements(prhs[2]);
+  if ((mxGetM(prhs[2])==1)||(mxGetN(prhs[2])==1)) {
+    nLines = (INT32)mxGetNumberOfElements(prhs[2]);
+    nTrans = 1;
+  }
+  else {
+    nLines = (INT32)mxGetM(prhs[2]);
+    nTrans = (INT32)mxGetN(prhs[2]);
+  }
 
   nAmps = mxGetNumberOfElements(prhs[3]);
   isoIntensity = (nAmps==1);
   if (!isoIntensity)
-    if (nAmps!=nLines)
+    if (nAmps!=(long)nLines*nTrans)
       mexErrMsgTxt("Number of line positions and amplitudes must match!");
   Amplitudes = mxGetPr(prhs[3]);
   
   x = mxGetPr(prhs[4]);
   nPoints = (INT32)(mxGetNumberOfElements(prhs[4]));
 
+  Separate = 0;
+  if (nrhs==6)
+    Separate = (mxGetScalar(prhs[5])!=0);
+
   /* allocate result array */
-  plhs[0] = mxCreateDoubleMatrix(1,nPoints,mxREAL);
+  plhs[0] = mxCreateDoubleMatrix(Separate ? nTrans : 1,nPoints,mxREAL);
   Spectrum = mxGetPr(plhs[0]);
 
-  /* call computing function */
-  triproject(Spectrum,Triangulation,TriAreas,Function,Amplitudes,
-             x,nPoints,nTri,nLines,isoIntensity);
-  
+  /* split the transitions over threads and, if there are more threads
+     than transitions, the triangles as well */
+  nThreads = 1;
+  #ifdef _OPENMP
+  nThreads = setthreads();
+  #endif
+  nTransBlocks = (nThreads<nTrans) ? nThreads : nTrans;
+  nTriBlocks = nThreads/nTransBlocks;
+  if (nTriBlocks>nTri/MINTRIANGLESPERTHREAD) nTriBlocks = nTri/MINTRIANGLESPERTHREAD;
+  if (nTriBlocks<1) nTriBlocks = 1;
+  nBlocks = nTransBlocks*nTriBlocks;
+
+  if ((nTrans==1)&&(nBlocks==1)) {
+    /* call computing function */
+    triproject(Spectrum,Triangulation,TriAreas,Function,Amplitudes,
+               x,nPoints,nTri,1,0,1,isoIntensity,1);
+    return;
+  }
+
+  /* rearrange data so that all transitions of one vertex are adjacent */
+  if (nTrans==1) {
+    fun = Function;
+    amp = Amplitudes;
+  }
+  else {
+    fun = (double*)mxMalloc((long)nLines*nTrans*sizeof(double));
+    for (t=0; t<nTrans; t++)
+      for (v=0; v<nLines; v++)
+        fun[(long)v*nTrans+t] = Function[(long)t*nLines+v];
+    if (isoIntensity)
+      amp = Amplitudes;
+    else {
+      amp = (double*)mxMalloc((long)nLines*nTrans*sizeof(double));
+      for (t=0; t<nTrans; t++)
+        for (v=0; v<nLines; v++)
+          amp[(long)v*nTrans+t] = Amplitudes[(long)t*nLines+v];
+    }
+  }
+
+  /* one set of spectra per transition for each block of triangles,
+     or one sum spectrum per thread */
+  nSpec = Separate ? (long)nTriBlocks*nTrans : nBlocks;
+  buffer = (double*)mxCalloc(nSpec*nPoints,sizeof(double));
+
+  /* each thread projects a contiguous block of transitions over a
+     contiguous block of triangles */
+  #ifdef _OPENMP
+  #pragma omp parallel for num_threads(nBlocks) schedule(static,1)
+  #endif
+  for (iBlock=0; iBlock<nBlocks; iBlock++) {
+    INT32 iTrans = iBlock%nTransBlocks, iTri = iBlock/nTransBlocks;
+    INT32 tFirst = (INT32)((long)nTrans*iTrans/nTransBlocks);
+    INT32 tLast = (INT32)((long)nTrans*(iTrans+1)/nTransBlocks);
+    INT32 triFirst = (INT32)((long)nTri*iTri/nTriBlocks);
+    INT32 triLast = (INT32)((long)nTri*(iTri+1)/nTriBlocks);
+    if (Separate)
+      triproject(buffer+((long)iTri*nTrans+tFirst)*nPoints,
+                 Triangulation+3*(long)triFirst,TriAreas+triFirst,fun,amp,
+                 x,nPoints,triLast-triFirst,nTrans,tFirst,tLast,isoIntensity,0);
+    else
+      triproject(buffer+(long)iBlock*nPoints,
+                 Triangulation+3*(long)triFirst,TriAreas+triFirst,fun,amp,
+                 x,nPoints,triLast-triFirst,nTrans,tFirst,tLast,isoIntensity,1);
+  }
+
+  /* collect results */
+  if (Separate) {
+    for (k=0; k<nTriBlocks; k++)
+      for (t=0; t<nTrans; t++)
+        for (i=0; i<nPoints; i++)
+          Spectrum[t+i*nTrans] += buffer[((long)k*nTrans+t)*nPoints+i];
+  }
+  else {
+    for (k=0; k<nBlocks; k++)
+      for (i=0; i<nPoints; i++)
+        Spectrum[i] += buffer[(long)k*nPoints+i];
+  }
+
+  mxFree(buffer);
+  if (nTrans>1) {
+    mxFree(fun);
+    if (!isoIntensity) mxFree(amp);
+  }
+
 }
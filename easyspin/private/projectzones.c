@@ -1,6 +1,7 @@
 /*
 ========================================================================
 Spectrum = projectzones(Position, Ampl, SegWeights, x)
+Spectrum = projectzones(Position, Ampl, SegWeights, x, Separate)
 ========================================================================
 
 Calculates weighted function value distribution of scalar function of
@@ -13,150 +14,148 @@ integral over the distribution between this bin and the next. This
 is NOT a sampled distribution. For flat distributions wrt to the
 value grid, it doesn't make much difference.
 
-   Position      1xN or Nx1 vector of double
-   Ampl          1xN or Nx1 vector of double or a 1x1 double
-                 real or complex
+   Position      1xN or Nx1 vector of double, or NxL array with one
+                 column for each of L transitions
+   Ampl          array of double of the same size as Position, or a
+                 1x1 double, real or complex
    SegWeights    1x(N-1) or (N-1)x1 vector of double
    xData         1xM or Mx1 vector of double
+   Separate      if true, return one spectrum per transition (LxM),
+                 otherwise the sum over all transitions (1xM);
+                 default false
+
+The transitions are distributed over threads, and, if there are more
+threads than transitions, the segments as well.
 ========================================================================
 */
 
+#include <stdlib.h>
 #include <mex.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "cpuinfo.h"
+#include "projection.h"
+
+/* minimum number of segments per thread */
+#define MINSEGMENTSPERTHREAD 2000
 
 void mexFunction(int nlhs, mxArray *plhs[],
          int nrhs, const mxArray *prhs[])
 {
-  bool anisoAmp, Cplx;
-  double meanAmp, rmeanAmp, imeanAmp;
-  double delta, left, right, dum;
-  double Height, rHeight, iHeight;
-  double *Position, *Ampl, *rAmpl, *iAmpl, *SegWeights, *x;
-  double *Spectrum, *rSpectrum, *iSpectrum;
-  long iSeg, nSeg, idx, first, last, nPoints, nPeaks, nAmpl;
-
-  if (nrhs!=4)
+  bool Cplx, Separate;
+  double *Position, *rAmpl, *iAmpl, *SegWeights, *x;
+  double *rSpectrum, *iSpectrum, *rBuffer, *iBuffer;
+  long nSeg, nPoints, nPeaks, nAmpl, nTrans, nSpec, t, i, k;
+  int nThreads, nTransBlocks, nSegBlocks, nBlocks, iBlock;
+
+  if ((nrhs!=4)&&(nrhs!=5))
     mexErrMsgTxt("Wrong number of input parameters!");
   if (nlhs!=1)
     mexErrMsgTxt("Wrong number of output parameters!");
 
   /* get all input parameters */
   Position = mxGetPr(prhs[0]);
-  nPeaks = mxGetNumberOfElements(prhs[0]);
+  if ((mxGetM(prhs[0])==1)||(mxGetN(prhs[0])==1)) {
+    nPeaks = mxGetNumberOfElements(prhs[0]);
+    nTrans = 1;
+  }
+  else {
+    nPeaks = mxGetM(prhs[0]);
+    nTrans = mxGetN(prhs[0]);
+  }
   nAmpl = mxGetNumberOfElements(prhs[1]);
   Cplx = mxIsComplex(prhs[1]);
   SegWeights = mxGetPr(prhs[2]);
   nSeg = mxGetNumberOfElements(prhs[2]);
   x = mxGetPr(prhs[3]);
   nPoints = mxGetNumberOfElements(prhs[3]);
-  delta = x[1] - x[0];
+  Separate = false;
+  if (nrhs==5)
+    Separate = (mxGetScalar(prhs[4])!=0);
 
   if (nSeg!=nPeaks-1)
     mexErrMsgTxt("Wrong number of segment weights. Should be nPeaks-1");
-  if ((nAmpl!=1)&&(nAmpl!=nPeaks))
+  if ((nAmpl!=1)&&(nAmpl!=nPeaks*nTrans))
     mexErrMsgTxt("Wrong number of amplitudes! Should be 1 or nPeaks.");
   if (mxIsComplex(prhs[0]))
     mexErrMsgTxt("Peak positions are complex! Only real are allowed.");
   if (mxIsComplex(prhs[2]))
     mexErrMsgTxt("Segment weights are complex! Only real are allowed.");
 
+  rAmpl = mxGetPr(prhs[1]);
+  iAmpl = Cplx ? mxGetPi(prhs[1]) : NULL;
+  if (nAmpl!=1) nAmpl = nPeaks;
+
   /* allocate result array */
-  if (Cplx) {
-    rAmpl = mxGetPr(prhs[1]);
-    iAmpl = mxGetPi(prhs[1]);
-    rmeanAmp = rAmpl[0]/delta;
-    imeanAmp = iAmpl[0]/delta;
-    plhs[0] = mxCreateDoubleMatrix(1,nPoints,mxCOMPLEX);
-    rSpectrum = mxGetPr(plhs[0]);
-    iSpectrum = mxGetPi(plhs[0]);
+  nSpec = Separate ? nTrans : 1;
+  plhs[0] = mxCreateDoubleMatrix(nSpec,nPoints,Cplx ? mxCOMPLEX : mxREAL);
+  rSpectrum = mxGetPr(plhs[0]);
+  iSpectrum = Cplx ? mxGetPi(plhs[0]) : NULL;
+
+  /* split the transitions over threads and, if there are more threads
+     than transitions, the segments as well */
+  nThreads = 1;
+  #ifdef _OPENMP
+  nThreads = setthreads();
+  #endif
+  nTransBlocks = (nThreads<nTrans) ? nThreads : (int)nTrans;
+  nSegBlocks = nThreads/nTransBlocks;
+  if (nSegBlocks>nSeg/MINSEGMENTSPERTHREAD) nSegBlocks = (int)(nSeg/MINSEGMENTSPERTHREAD);
+  if (nSegBlocks<1) nSegBlocks = 1;
+  nBlocks = nTransBlocks*nSegBlocks;
+
+  if ((nTrans==1)&&(nBlocks==1)) {
+    zoneproject(rSpectrum,iSpectrum,Position,rAmpl,iAmpl,nAmpl,
+                SegWeights,x,nPoints,nPeaks,Cplx);
+    return;
   }
-  else {
-    Ampl = mxGetPr(prhs[1]);
-    meanAmp = Ampl[0]/delta;
-    plhs[0] = mxCreateDoubleMatrix(1,nPoints,mxREAL);
-    Spectrum = mxGetPr(plhs[0]);
-  }
-
-  anisoAmp = (nAmpl!=1);
-
-  for (iSeg=0; iSeg<nSeg; iSeg++) {
-
-    left = Position[iSeg];
-    right = Position[iSeg+1];
-    
-    if (mxIsNaN(left) || mxIsNaN(right)) continue;
-    
-    if (left>right) {dum = left; left = right; right = dum;}
-        
-    left  = (left -x[0])/delta;
-    right = (right-x[0])/delta;
-    first = (long)(left);
-    last =  (long)(right);
-
-    /*mexPrintf("left %g  right %g  first %d  last %d\n",left, right,first,last);*/
 
-    /* skip segment is completely outside */
-    if ((first>=nPoints)||(last<0)) continue;
+  /* one set of spectra per transition for each block of segments, or
+     one sum spectrum per thread */
+  nSpec = Separate ? nSegBlocks*nTrans : nBlocks;
+  rBuffer = (double*)mxCalloc(nSpec*nPoints,sizeof(double));
+  iBuffer = Cplx ? (double*)mxCalloc(nSpec*nPoints,sizeof(double)) : NULL;
+
+  /* each thread projects a contiguous block of transitions over a
+     contiguous block of segments */
+  #ifdef _OPENMP
+  #pragma omp parallel for num_threads(nBlocks) schedule(static,1)
+  #endif
+  for (iBlock=0; iBlock<nBlocks; iBlock++) {
+    long tt, k, tFirst, tLast, sFirst, sLast, a;
+    int iTrans = iBlock%nTransBlocks, iSeg = iBlock/nTransBlocks;
+    tFirst = nTrans*iTrans/nTransBlocks;
+    tLast = nTrans*(iTrans+1)/nTransBlocks;
+    sFirst = nSeg*iSeg/nSegBlocks;
+    sLast = nSeg*(iSeg+1)/nSegBlocks;
+    for (tt=tFirst; tt<tLast; tt++) {
+      k = (Separate ? iSeg*nTrans+tt : iBlock)*nPoints;
+      a = (nAmpl==1) ? 0 : tt*nPeaks+sFirst;
+      zoneproject(rBuffer+k,Cplx ? iBuffer+k : NULL,Position+tt*nPeaks+sFirst,
+                  rAmpl+a,Cplx ? iAmpl+a : NULL,nAmpl,
+                  SegWeights+sFirst,x,nPoints,sLast-sFirst+1,Cplx);
+    }
+  }
 
-    if (Cplx) {
-      /* get possible separate amplitude for this segment */
-      if (anisoAmp) {
-        rmeanAmp = (rAmpl[iSeg]+rAmpl[iSeg+1])/2/delta;
-        imeanAmp = (iAmpl[iSeg]+iAmpl[iSeg+1])/2/delta;
-      }
-      if (first==last) {
-        rSpectrum[first] += rmeanAmp*SegWeights[iSeg];
-        iSpectrum[first] += imeanAmp*SegWeights[iSeg];
-      }
-      else {
-        /* compute height of projection rectangle */
-        rHeight = rmeanAmp*SegWeights[iSeg]/(right-left);
-        iHeight = imeanAmp*SegWeights[iSeg]/(right-left);
-        /* set first element or chop */
-        if (first>=0) {
-          rSpectrum[first] += rHeight*(first+1-left);
-          iSpectrum[first] += iHeight*(first+1-left);
-        }
-        else first = -1;
-        /* set last element or chop */
-        if (last<nPoints) {
-          rSpectrum[last] += rHeight*(right-last);
-          iSpectrum[last] += iHeight*(right-last);
+  /* collect results */
+  if (Separate) {
+    for (k=0; k<nSegBlocks; k++)
+      for (t=0; t<nTrans; t++)
+        for (i=0; i<nPoints; i++) {
+          rSpectrum[t+i*nTrans] += rBuffer[(k*nTrans+t)*nPoints+i];
+          if (Cplx) iSpectrum[t+i*nTrans] += iBuffer[(k*nTrans+t)*nPoints+i];
         }
-        else last = nPoints;
+  }
+  else {
+    for (k=0; k<nBlocks; k++)
+      for (i=0; i<nPoints; i++) {
+        rSpectrum[i] += rBuffer[k*nPoints+i];
+        if (Cplx) iSpectrum[i] += iBuffer[k*nPoints+i];
+      }
+  }
+
+  mxFree(rBuffer);
+  if (Cplx) mxFree(iBuffer);
 
-        /* set possible intermediate elements */
-        for (idx=first+1; idx<last; idx++) {
-          rSpectrum[idx] += rHeight;
-          iSpectrum[idx] += iHeight;
-        }
-      } /* if (first==last) else */
-    }
-    else {
-      /* get possible separate amplitude for this segment */
-      if (anisoAmp)
-        meanAmp = (Ampl[iSeg]+Ampl[iSeg+1])/2/delta;
-      if (first==last)
-        Spectrum[first] += meanAmp*SegWeights[iSeg];
-      else {
-        /* compute height of projection rectangle */
-        Height = meanAmp*SegWeights[iSeg]/(right-left);
-        /*mexPrintf("   right-left  %g,   height  %g,  first+1-left %g\n",right-left,Height,first+1-left); */
-        /* set first element or chop */
-        if (first>=0)
-          Spectrum[first] += Height*(first+1-left);
-        else
-          first = -1;
-        /* set last element or chop */
-        if (last<nPoints)
-          Spectrum[last] += Height*(right-last);
-        else
-          last = nPoints;
-        /* set possible intermediate elements */
-        for (idx=first+1; idx<last; idx++)
-          Spectrum[idx] += Height;
-      } /* if (first==last) else */
-    } /* if (Cplx) */
-    
-  } /* for iSeg */
-  
 } /* mexFunction */
@@ -0,0 +1,264 @@
+/*
+resfields_search.c      resonance field search over spline models
+
+  [Fields,Zeros,Segments,Trans,nRes] = ...
+       resfields_search(Bknots,E,dEdB,Transitions,mwFreq,LoopFields)
+
+  Locates the resonance fields of a batch of orientations, given the
+  spline model of the energy level diagram of each orientation, as
+  constructed by resfields.
+
+  Bknots       cell array with one 1xK vector of field knots per
+               orientation (K can differ between orientations)
+  E            cell array with one KxL array of level energies at the
+               knots per orientation
+  dEdB         cell array with one KxL array of energy derivatives
+               at the knots per orientation
+  Transitions  Tx2 array of level indices (u,v) of the transitions
+  mwFreq       microwave frequency, in the units of E
+  LoopFields   if false, only the first resonance of each transition
+               is returned
+
+  The resonances of all orientations are returned packed into 1xN
+  arrays, ordered by orientation, transition, segment and field.
+  Fields contains the resonance field, Zeros the relative position
+  0..1 within the segment (the interpolation weight for eigenvectors
+  between the segment knots), Segments and Trans the segment and
+  transition index. nRes (1 x number of orientations) contains the
+  number of resonances for each orientation.
+
+  The orientations are distributed over threads. Each orientation
+  is solved into its own buffer; the packed outputs are allocated
+  once all resonances are known.
+
+This is an EasySpin function.
+ */
+
+#include <stdlib.h>
+#include <mex.h>
+#include "cubicsolve.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "cpuinfo.h"
+
+struct Resonances {
+  long n, size;
+  double *Field, *Zero;
+  int *Seg, *Trans;
+};
+
+/* Appends one resonance, growing the buffer if needed. Returns
+   nonzero if memory could not be allocated. */
+static int addresonance(struct Resonances *R, double Field, double Zero,
+         int Seg, int Trans)
+{
+  if (R->n==R->size) {
+    long newSize = (R->size<16) ? 16 : 2*R->size;
+    double *f = (double*)realloc(R->Field,newSize*sizeof(double));
+    double *z = (f==NULL) ? NULL : (double*)realloc(R->Zero,newSize*sizeof(double));
+    int *s = (z==NULL) ? NULL : (int*)realloc(R->Seg,newSize*sizeof(int));
+    int *t = (s==NULL) ? NULL : (int*)realloc(R->Trans,newSize*sizeof(int));
+    if (f!=NULL) R->Field = f;
+    if (z!=NULL) R->Zero = z;
+    if (s!=NULL) R->Seg = s;
+    if (t==NULL) return 1;
+    R->Trans = t;
+    R->size = newSize;
+  }
+  R->Field[R->n] = Field;
+  R->Zero[R->n] = Zero;
+  R->Seg[R->n] = Seg;
+  R->Trans[R->n] = Trans;
+  R->n++;
+  return 0;
+}
+
+/* Resonances of one orientation. Returns 0 on success, 1 if out of
+   memory and 2 if a resonance polynomial is identically zero. */
+static int searchorientation(struct Resonances *R, const double *Bknots,
+         const double *E, const double *dEdB, long nKnots, long nLevels,
+         const double *Transitions, long nTrans, double mwFreq, bool LoopFields)
+{
+  long iTrans, s, u, v;
+  double dB, e0, e1, g0, g1, Cl[2][4], C[4], Solution[9], t;
+  int i, j, nSolutions;
+
+  for (iTrans=0; iTrans<nTrans; iTrans++) {
+    u = (long)Transitions[iTrans]-1;
+    v = (long)Transitions[iTrans+nTrans]-1;
+    for (s=0; s<nKnots-1; s++) {
+      dB = Bknots[s+1] - Bknots[s];
+
+      /* Cubic Hermite coefficients of Ev-Eu-mwFreq over the segment */
+      for (i=0; i<2; i++) {
+        long l = (i==0) ? u : v;
+        e0 = E[s+l*nKnots];
+        e1 = E[s+1+l*nKnots];
+        g0 = dB*dEdB[s+l*nKnots];
+        g1 = dB*dEdB[s+1+l*nKnots];
+        Cl[i][0] = 2*e0 - 2*e1 + g0 + g1;
+        Cl[i][1] = -3*e0 + 3*e1 - 2*g0 - g1;
+        Cl[i][2] = g0;
+        Cl[i][3] = e0;
+      }
+      for (i=0; i<4; i++)
+        C[i] = Cl[1][i] - Cl[0][i];
+      C[3] = C[3] - mwFreq;
+
+      nSolutions = cubicsolve(C[0],C[1],C[2],C[3],!LoopFields,Solution);
+      if (nSolutions<0) return 2;
+      if (nSolutions==0) continue;
+
+      /* Sort solutions (insertion sort) */
+      for (i=1;i<nSolutions;i++) {
+        t = Solution[i];
+        j = i;
+        while (j>0 && Solution[j-1]>t) {
+          Solution[j] = Solution[j-1];
+          j--;
+        }
+        Solution[j] = t;
+      }
+
+      for (i=0;i<nSolutions;i++)
+        if (addresonance(R,Bknots[s]+dB*Solution[i],Solution[i],(int)s+1,(int)iTrans+1))
+          return 1;
+
+      if (!LoopFields) break; /* only one resonance per transition */
+    }
+  }
+  return 0;
+}
+
+/*
+****************************************************************
+           MEX gateway function for MATLAB
+****************************************************************
+*/
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  bool LoopFields, isCell;
+  long nOri, iOri, nTrans, nLevels, nTotal, k;
+  long *offset;
+  double mwFreq, *Transitions;
+  const double **Bk, **Ek, **dEk;
+  long *nKnots;
+  double *Fields, *Zeros, *Segments, *Trans, *nRes;
+  struct Resonances *Res;
+  int Error;
+
+  if (nrhs!=6)
+    mexErrMsgTxt("Wrong number of input arguments!");
+  if (nlhs>5)
+    mexErrMsgTxt("Wrong number of output arguments!");
+
+  setthreads();
+
+  isCell = mxIsCell(prhs[0]);
+  if (isCell != mxIsCell(prhs[1]) || isCell != mxIsCell(prhs[2]))
+    mexErrMsgTxt("Bknots, E and dEdB must all be cell arrays or all be arrays!");
+  nOri = isCell ? (long)mxGetNumberOfElements(prhs[0]) : 1;
+  if (isCell && (mxGetNumberOfElements(prhs[1])!=nOri ||
+                 mxGetNumberOfElements(prhs[2])!=nOri))
+    mexErrMsgTxt("Bknots, E and dEdB must have the same number of orientations!");
+
+  if (mxGetN(prhs[3])!=2)
+    mexErrMsgTxt("Transitions must have two columns!");
+  Transitions = mxGetPr(prhs[3]);
+  nTrans = (long)mxGetM(prhs[3]);
+  mwFreq = mxGetScalar(prhs[4]);
+  LoopFields = mxGetScalar(prhs[5])!=0;
+
+  /* collect pointers to the spline data of all orientations */
+  Bk = (const double**)mxMalloc((nOri>0 ? nOri : 1)*sizeof(double*));
+  Ek = (const double**)mxMalloc((nOri>0 ? nOri : 1)*sizeof(double*));
+  dEk = (const double**)mxMalloc((nOri>0 ? nOri : 1)*sizeof(double*));
+  nKnots = (long*)mxMalloc((nOri>0 ? nOri : 1)*sizeof(long));
+  nLevels = -1;
+  for (iOri=0; iOri<nOri; iOri++) {
+    const mxArray *B_ = isCell ? mxGetCell(prhs[0],iOri) : prhs[0];
+    const mxArray *E_ = isCell ? mxGetCell(prhs[1],iOri) : prhs[1];
+    const mxArray *D_ = isCell ? mxGetCell(prhs[2],iOri) : prhs[2];
+    if (B_==NULL || E_==NULL || D_==NULL)
+      mexErrMsgTxt("Missing spline data!");
+    nKnots[iOri] = (long)mxGetNumberOfElements(B_);
+    if (mxGetM(E_)!=nKnots[iOri] || mxGetM(D_)!=nKnots[iOri] || mxGetN(D_)!=mxGetN(E_))
+      mexErrMsgTxt("E and dEdB must have one row per knot!");
+    if (nLevels<0) nLevels = (long)mxGetN(E_);
+    if (mxGetN(E_)!=nLevels)
+      mexErrMsgTxt("All orientations must have the same number of levels!");
+    Bk[iOri] = mxGetPr(B_);
+    Ek[iOri] = mxGetPr(E_);
+    dEk[iOri] = mxGetPr(D_);
+  }
+  for (k=0; k<2*nTrans; k++)
+    if (Transitions[k]<1 || Transitions[k]>nLevels)
+      mexErrMsgTxt("Level indices of transitions out of range!");
+
+  Res = (struct Resonances*)mxCalloc((nOri>0 ? nOri : 1),sizeof(struct Resonances));
+
+  /* search resonances of all orientations */
+  Error = 0;
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic) reduction(|:Error)
+  #endif
+  for (iOri=0; iOri<nOri; iOri++)
+    Error |= searchorientation(&Res[iOri],Bk[iOri],Ek[iOri],dEk[iOri],nKnots[iOri],
+                               nLevels,Transitions,nTrans,mwFreq,LoopFields);
+
+  if (Error) {
+    for (iOri=0; iOri<nOri; iOri++) {
+      free(Res[iOri].Field); free(Res[iOri].Zero);
+      free(Res[iOri].Seg); free(Res[iOri].Trans);
+    }
+    if (Error&1)
+      mexErrMsgTxt("Out of memory.");
+    mexErrMsgTxt("All coefficients of the cubic spline are zero!");
+  }
+
+  /* allocate packed outputs */
+  offset = (long*)mxMalloc((nOri+1)*sizeof(long));
+  offset[0] = 0;
+  for (iOri=0; iOri<nOri; iOri++)
+    offset[iOri+1] = offset[iOri] + Res[iOri].n;
+  nTotal = offset[nOri];
+
+  plhs[0] = mxCreateDoubleMatrix(1,nTotal,mxREAL);
+  plhs[1] = mxCreateDoubleMatrix(1,nTotal,mxREAL);
+  plhs[2] = mxCreateDoubleMatrix(1,nTotal,mxREAL);
+  plhs[3] = mxCreateDoubleMatrix(1,nTotal,mxREAL);
+  plhs[4] = mxCreateDoubleMatrix(1,nOri,mxREAL);
+  Fields = mxGetPr(plhs[0]);
+  Zeros = mxGetPr(plhs[1]);
+  Segments = mxGetPr(plhs[2]);
+  Trans = mxGetPr(plhs[3]);
+  nRes = mxGetPr(plhs[4]);
+
+  /* copy results of all orientations into the outputs */
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(static)
+  #endif
+  for (iOri=0; iOri<nOri; iOri++) {
+    long i, o = offset[iOri];
+    for (i=0; i<Res[iOri].n; i++) {
+      Fields[o+i] = Res[iOri].Field[i];
+      Zeros[o+i] = Res[iOri].Zero[i];
+      Segments[o+i] = Res[iOri].Seg[i];
+      Trans[o+i] = Res[iOri].Trans[i];
+    }
+    nRes[iOri] = (double)Res[iOri].n;
+    free(Res[iOri].Field);
+    free(Res[iOri].Zero);
+    free(Res[iOri].Seg);
+    free(Res[iOri].Trans);
+  }
+
+  mxFree(offset);
+  mxFree(Res);
+  mxFree(nKnots);
+  mxFree(dEk);
+  mxFree(Ek);
+  mxFree(Bk);
+
+} /* void mexFunction  */
@@ -0,0 +1,561 @@
+/*
+s_propagate.c    propagators and density matrix propagation for s_thyme
+
+  U = s_propagate('propagators',Ham0,xOp,Coeff,dt)
+  [L,SigmaSS] = s_propagate('liouvillians',Ham0,xOp,Coeff,dt,Gamma,eqState)
+  [Sigma,Signal,States] = s_propagate('propagate',Sigma,U,idx,DetArray)
+  [Sigma,Signal,States] = s_propagate('propagate',Sigma,L,idx,DetArray,SigmaSS)
+
+  Works on a batch of orientations at once, which are distributed over
+  all threads.
+
+  'propagators' computes U(:,:,k,o) = expm(-1i*H*dt) for the Hamiltonians
+    H = Ham0(:,:,o) + Coeff(1,k)*real(xOp) + 1i*Coeff(2,k)*imag(xOp)
+  of all orientations o (pages of Ham0) and all columns k of Coeff.
+
+  'liouvillians' computes the Liouville space propagators L(:,:,k,o) =
+  expm(G*dt) and the steady states SigmaSS(:,k,o) = -G\(Gamma*eqState)
+  with G = -1i*(kron(eye(n),H)-kron(H.',eye(n))) - Gamma(:,:,o).
+
+  'propagate' applies the steps idx(1), idx(2), ... with the propagators
+  U(:,:,idx(i),o) to the density matrices Sigma(:,:,o), as
+    Sigma = U*Sigma*U'
+  or, in Liouville space, as
+    Sigma(:) = SigmaSS + L*(Sigma(:)-SigmaSS)
+  Signal(:,i,o) = DetArray*Sigma(:) is the detected signal before the
+  first (i=1) and after each step, and States(:,:,i,o) the density matrix
+  at the same points. DetArray can be empty. Sigma can have a single
+  page, which is used as the initial state of all orientations.
+
+  All matrices are complex, with interleaved real and imaginary parts
+  internally. Matrix exponentials are computed by scaling and squaring
+  with a (6,6) Pade approximant (Golub and Van Loan, Matrix
+  Computations, Algorithm 11.3.1), accurate to about 1e-15.
+
+This is an EasySpin function.
+ */
+
+#include "mex.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "cpuinfo.h"
+
+/*===================================================================*/
+/* Complex matrix helpers, column-major with interleaved re/im       */
+/*===================================================================*/
+
+/* C = A*B, all n x n */
+SIMD_CLONES
+static void cmatmul(int n, const double *A, const double *B, double *C)
+{
+  int i, j, k;
+  memset(C,0,2*n*n*sizeof(double));
+  for (j=0; j<n; j++)
+    for (k=0; k<n; k++) {
+      const double bre = B[2*(k+j*n)], bim = B[2*(k+j*n)+1];
+      const double *a = A + 2*k*n;
+      double *c = C + 2*j*n;
+      for (i=0; i<n; i++) {
+        c[2*i]   += a[2*i]*bre - a[2*i+1]*bim;
+        c[2*i+1] += a[2*i]*bim + a[2*i+1]*bre;
+      }
+    }
+}
+
+/* C = A*B', all n x n */
+SIMD_CLONES
+static void cmatmulh(int n, const double *A, const double *B, double *C)
+{
+  int i, j, k;
+  memset(C,0,2*n*n*sizeof(double));
+  for (j=0; j<n; j++)
+    for (k=0; k<n; k++) {
+      const double bre = B[2*(j+k*n)], bim = -B[2*(j+k*n)+1];
+      const double *a = A + 2*k*n;
+      double *c = C + 2*j*n;
+      for (i=0; i<n; i++) {
+        c[2*i]   += a[2*i]*bre - a[2*i+1]*bim;
+        c[2*i+1] += a[2*i]*bim + a[2*i+1]*bre;
+      }
+    }
+}
+
+/* y = A*x, A n x n, x and y n-vectors */
+SIMD_CLONES
+static void cmatvec(int n, const double *A, const double *x, double *y)
+{
+  int i, k;
+  memset(y,0,2*n*sizeof(double));
+  for (k=0; k<n; k++) {
+    const double xre = x[2*k], xim = x[2*k+1];
+    const double *a = A + 2*k*n;
+    for (i=0; i<n; i++) {
+      y[2*i]   += a[2*i]*xre - a[2*i+1]*xim;
+      y[2*i+1] += a[2*i]*xim + a[2*i+1]*xre;
+    }
+  }
+}
+
+/* Solves A*X = B for X in place of B (n x nrhs), by LU decomposition of
+   A with partial pivoting. A is overwritten. As with mldivide, a
+   singular A gives Inf or NaN values. */
+static void csolve(int n, int nrhs, double *A, double *B)
+{
+  int i, j, k, p;
+  for (k=0; k<n; k++) {
+    double amax = -1, t;
+    p = k;
+    for (i=k; i<n; i++) {
+      t = fabs(A[2*(i+k*n)]) + fabs(A[2*(i+k*n)+1]);
+      if (t>amax) { amax = t; p = i; }
+    }
+    if (p!=k) {
+      for (j=0; j<n; j++) {
+        t = A[2*(k+j*n)]; A[2*(k+j*n)] = A[2*(p+j*n)]; A[2*(p+j*n)] = t;
+        t = A[2*(k+j*n)+1]; A[2*(k+j*n)+1] = A[2*(p+j*n)+1]; A[2*(p+j*n)+1] = t;
+      }
+      for (j=0; j<nrhs; j++) {
+        t = B[2*(k+j*n)]; B[2*(k+j*n)] = B[2*(p+j*n)]; B[2*(p+j*n)] = t;
+        t = B[2*(k+j*n)+1]; B[2*(k+j*n)+1] = B[2*(p+j*n)+1]; B[2*(p+j*n)+1] = t;
+      }
+    }
+    {
+      const double pre = A[2*(k+k*n)], pim = A[2*(k+k*n)+1];
+      const double d = pre*pre + pim*pim;
+      for (i=k+1; i<n; i++) {
+        /* l = A(i,k)/A(k,k) */
+        const double are = A[2*(i+k*n)], aim = A[2*(i+k*n)+1];
+        const double lre = (are*pre + aim*pim)/d, lim = (aim*pre - are*pim)/d;
+        A[2*(i+k*n)] = lre; A[2*(i+k*n)+1] = lim;
+        for (j=k+1; j<n; j++) {
+          const double ure = A[2*(k+j*n)], uim = A[2*(k+j*n)+1];
+          A[2*(i+j*n)]   -= lre*ure - lim*uim;
+          A[2*(i+j*n)+1] -= lre*uim + lim*ure;
+        }
+        for (j=0; j<nrhs; j++) {
+          const double ure = B[2*(k+j*n)], uim = B[2*(k+j*n)+1];
+          B[2*(i+j*n)]   -= lre*ure - lim*uim;
+          B[2*(i+j*n)+1] -= lre*uim + lim*ure;
+        }
+      }
+    }
+  }
+  /* back substitution */
+  for (j=0; j<nrhs; j++)
+    for (k=n-1; k>=0; k--) {
+      const double pre = A[2*(k+k*n)], pim = A[2*(k+k*n)+1];
+      const double d = pre*pre + pim*pim;
+      double xre = B[2*(k+j*n)], xim = B[2*(k+j*n)+1], t;
+      t = (xre*pre + xim*pim)/d;
+      xim = (xim*pre - xre*pim)/d;
+      xre = t;
+      B[2*(k+j*n)] = xre; B[2*(k+j*n)+1] = xim;
+      for (i=0; i<k; i++) {
+        const double are = A[2*(i+k*n)], aim = A[2*(i+k*n)+1];
+        B[2*(i+j*n)]   -= are*xre - aim*xim;
+        B[2*(i+j*n)+1] -= are*xim + aim*xre;
+      }
+    }
+}
+
+/* E = expm(A), A is overwritten. work must hold 8*n*n doubles. */
+static void cexpm(int n, double *A, double *E, double *work)
+{
+  const int q = 6, nn = 2*n*n;
+  double *X = work, *D = work+nn, *T = work+2*nn, *S = work+3*nn;
+  double norm = 0, c = 0.5, f;
+  int i, j, k, s = 0;
+
+  /* scale to infinity norm <= 1/2 */
+  for (i=0; i<n; i++) {
+    double r = 0;
+    for (j=0; j<n; j++) r += hypot(A[2*(i+j*n)],A[2*(i+j*n)+1]);
+    if (r>norm) norm = r;
+  }
+  if (norm>0) {
+    s = (int)floor(log2(norm)) + 2;
+    if (s<0) s = 0;
+  }
+  f = ldexp(1.0,-s);
+  for (i=0; i<nn; i++) A[i] *= f;
+
+  /* E = I + c*A, D = I - c*A */
+  memcpy(X,A,nn*sizeof(double));
+  for (i=0; i<nn; i++) { E[i] = c*A[i]; D[i] = -c*A[i]; }
+  for (i=0; i<n; i++) { E[2*(i+i*n)] += 1; D[2*(i+i*n)] += 1; }
+  for (k=2; k<=q; k++) {
+    c = c*(q-k+1)/(k*(2*q-k+1));
+    cmatmul(n,A,X,T);
+    memcpy(X,T,nn*sizeof(double));
+    for (i=0; i<nn; i++) {
+      E[i] += c*X[i];
+      D[i] += (k%2) ? -c*X[i] : c*X[i];
+    }
+  }
+  csolve(n,n,D,E);
+
+  /* undo scaling by repeated squaring */
+  for (k=0; k<s; k++) {
+    cmatmul(n,E,E,S);
+    memcpy(E,S,nn*sizeof(double));
+  }
+}
+
+/*===================================================================*/
+/* MATLAB array access                                               */
+/*===================================================================*/
+
+/* Copies page p (of size nel) of a MATLAB array into interleaved form,
+   with factor f */
+static void getpage(const mxArray *a, long p, long nel, double f, double *z)
+{
+  const double *re = mxGetPr(a) + p*nel, *im = mxGetPi(a);
+  long i;
+  for (i=0; i<nel; i++) {
+    z[2*i] = f*re[i];
+    z[2*i+1] = im ? f*im[p*nel+i] : 0;
+  }
+}
+
+static void setpage(double *re, double *im, long p, long nel, const double *z)
+{
+  long i;
+  re += p*nel; im += p*nel;
+  for (i=0; i<nel; i++) { re[i] = z[2*i]; im[i] = z[2*i+1]; }
+}
+
+/* Size of an array along dimension d (0-based) */
+static long dimsize(const mxArray *a, int d)
+{
+  return (d<(int)mxGetNumberOfDimensions(a)) ? (long)mxGetDimensions(a)[d] : 1;
+}
+
+/* Number of pages of an array beyond the first two dimensions */
+static long npages(const mxArray *a)
+{
+  const long nel = dimsize(a,0)*dimsize(a,1);
+  return (nel>0) ? (long)mxGetNumberOfElements(a)/nel : 0;
+}
+
+static void checkdouble(const mxArray *a, const char *Name)
+{
+  if (!mxIsDouble(a) || mxIsSparse(a))
+    mexErrMsgIdAndTxt("s_propagate:arg","%s must be a full double array.",Name);
+}
+
+/*===================================================================*/
+/* Propagator or Liouvillian construction                            */
+/*===================================================================*/
+static void buildpropagators(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  const mxArray *Ham0 = prhs[1], *xOp = prhs[2], *Coeff = prhs[3];
+  const mxArray *Gamma = NULL, *eqState = NULL;
+  const int Liouville = (nrhs==7);
+  int n, m, nGammaPages = 1;
+  long nOri, nCoeff, nItems, item;
+  double dt;
+  double *Ure, *Uim, *SSre = NULL, *SSim = NULL;
+  const double *c;
+  mwSize dims[4];
+  int failed = 0;
+
+  if ((nrhs!=5)&&(nrhs!=7)) mexErrMsgTxt("5 or 7 input arguments expected.");
+  checkdouble(Ham0,"Ham0");
+  checkdouble(xOp,"xOp");
+  checkdouble(Coeff,"Coeff");
+  n = (int)mxGetM(Ham0);
+  if ((dimsize(Ham0,1)!=n)||(n<1)) mexErrMsgTxt("Ham0 must consist of square matrices.");
+  if ((dimsize(xOp,0)!=n)||(dimsize(xOp,1)!=n))
+    mexErrMsgTxt("xOp must have the same size as Ham0.");
+  if ((dimsize(Coeff,0)!=2)||mxIsComplex(Coeff)) mexErrMsgTxt("Coeff must be a real 2xK array.");
+  dt = mxGetScalar(prhs[4]);
+  nOri = npages(Ham0);
+  nCoeff = (long)mxGetN(Coeff);
+  c = mxGetPr(Coeff);
+  m = Liouville ? n*n : n;
+  if (Liouville) {
+    Gamma = prhs[5];
+    eqState = prhs[6];
+    checkdouble(Gamma,"Gamma");
+    checkdouble(eqState,"eqState");
+    if ((dimsize(Gamma,0)!=m)||(dimsize(Gamma,1)!=m))
+      mexErrMsgTxt("Gamma must be n^2 x n^2.");
+    nGammaPages = (int)npages(Gamma);
+    if ((nGammaPages!=1)&&(nGammaPages!=nOri))
+      mexErrMsgTxt("Gamma must have one page, or as many pages as Ham0.");
+    if ((int)mxGetNumberOfElements(eqState)!=m)
+      mexErrMsgTxt("eqState must have n^2 elements.");
+  }
+
+  dims[0] = m; dims[1] = m; dims[2] = nCoeff; dims[3] = nOri;
+  plhs[0] = mxCreateNumericArray(4,dims,mxDOUBLE_CLASS,mxCOMPLEX);
+  Ure = mxGetPr(plhs[0]);
+  Uim = mxGetPi(plhs[0]);
+  if (Liouville) {
+    dims[0] = m; dims[1] = nCoeff; dims[2] = nOri;
+    plhs[1] = mxCreateNumericArray(3,dims,mxDOUBLE_CLASS,mxCOMPLEX);
+    SSre = mxGetPr(plhs[1]);
+    SSim = mxGetPi(plhs[1]);
+  }
+  nItems = nOri*nCoeff;
+  if (nItems==0) return;
+
+  {
+    /* copy inputs to interleaved form before the parallel region */
+    const long nn = (long)n*n, mm = (long)m*m;
+    double *H0 = (double*)mxMalloc(2*nn*nOri*sizeof(double));
+    double *X = (double*)mxMalloc(2*nn*sizeof(double));
+    double *G = NULL, *eq = NULL;
+    const double *xre = mxGetPr(xOp), *xim = mxGetPi(xOp);
+    long o;
+    int i;
+    for (o=0; o<nOri; o++) getpage(Ham0,o,nn,1,H0+2*nn*o);
+    for (i=0; i<nn; i++) { X[2*i] = xre[i]; X[2*i+1] = xim ? xim[i] : 0; }
+    if (Liouville) {
+      G = (double*)mxMalloc(2*mm*nGammaPages*sizeof(double));
+      eq = (double*)mxMalloc(2*m*sizeof(double));
+      for (o=0; o<nGammaPages; o++) getpage(Gamma,o,mm,1,G+2*mm*o);
+      getpage(eqState,0,m,1,eq);
+    }
+
+    setthreads();
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic,1)
+#endif
+    for (item=0; item<nItems; item++) {
+      const long k = item%nCoeff, o = item/nCoeff;
+      const double *h0 = H0 + 2*nn*o;
+      double *A = (double*)malloc((12*mm+2*m)*sizeof(double));
+      double *E, *work, *b;
+      int i, j;
+      if (A==NULL) { failed = 1; continue; }
+      E = A + 2*mm; work = E + 2*mm; b = work + 8*mm;
+
+      if (!Liouville) {
+        /* A = -1i*dt*H */
+        for (i=0; i<nn; i++) {
+          const double hre = h0[2*i] + c[2*k]*X[2*i];
+          const double him = h0[2*i+1] + c[2*k+1]*X[2*i+1];
+          A[2*i] = dt*him;
+          A[2*i+1] = -dt*hre;
+        }
+      }
+      else {
+        /* generator G = -1i*(kron(I,H)-kron(H.',I)) - Gamma in E */
+        const double *g = G + ((nGammaPages==1) ? 0 : 2*mm*o);
+        double *H = work;
+        int p, q;
+        for (i=0; i<nn; i++) {
+          H[2*i] = h0[2*i] + c[2*k]*X[2*i];
+          H[2*i+1] = h0[2*i+1] + c[2*k+1]*X[2*i+1];
+        }
+        for (i=0; i<2*mm; i++) E[i] = -g[i];
+        for (p=0; p<n; p++)
+          for (q=0; q<n; q++)
+            for (i=0; i<n; i++) {
+              /* kron(I,H): element (p*n+i, p*n+q) += H(i,q) */
+              long r = p*n+i, s = p*n+q;
+              E[2*(r+s*m)]   += H[2*(i+q*n)+1];
+              E[2*(r+s*m)+1] -= H[2*(i+q*n)];
+              /* kron(H.',I): element (p*n+i, q*n+i) -= H(q,p) */
+              s = q*n+i;
+              E[2*(r+s*m)]   -= H[2*(q+p*n)+1];
+              E[2*(r+s*m)+1] += H[2*(q+p*n)];
+            }
+        /* steady state: b = -G\(Gamma*eq) */
+        cmatvec(m,g,eq,b);
+        for (i=0; i<2*m; i++) b[i] = -b[i];
+        memcpy(A,E,2*mm*sizeof(double));
+        csolve(m,1,A,b);
+        for (i=0; i<m; i++) {
+          SSre[(o*nCoeff+k)*m+i] = b[2*i];
+          SSim[(o*nCoeff+k)*m+i] = b[2*i+1];
+        }
+        for (i=0; i<2*mm; i++) A[i] = dt*E[i];
+      }
+
+      cexpm(m,A,E,work);
+      for (j=0; j<mm; j++) {
+        Ure[(o*nCoeff+k)*mm+j] = E[2*j];
+        Uim[(o*nCoeff+k)*mm+j] = E[2*j+1];
+      }
+      free(A);
+    }
+
+    mxFree(H0);
+    mxFree(X);
+    if (Liouville) { mxFree(G); mxFree(eq); }
+  }
+  if (failed) mexErrMsgTxt("Out of memory in s_propagate.");
+}
+
+/*===================================================================*/
+/* Propagation of density matrices                                   */
+/*===================================================================*/
+static void propagate(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  const mxArray *Sigma = prhs[1], *U = prhs[2], *Idx = prhs[3], *Det = prhs[4];
+  const mxArray *SigmaSS = NULL;
+  const int Liouville = (nrhs==6), withStates = (nlhs>2);
+  int n, m, nDet;
+  long nSigmaPages, nOri, nProp, nSteps, nn, mm, o, i;
+  long *idx;
+  double *Sre, *Sim, *Gre = NULL, *Gim = NULL, *Tre = NULL, *Tim = NULL;
+  double *D = NULL;
+  mwSize dims[4];
+  int failed = 0;
+
+  if ((nrhs!=5)&&(nrhs!=6)) mexErrMsgTxt("5 or 6 input arguments expected.");
+  checkdouble(Sigma,"Sigma");
+  checkdouble(U,"U");
+  checkdouble(Idx,"idx");
+  checkdouble(Det,"DetArray");
+  n = (int)mxGetM(Sigma);
+  if ((dimsize(Sigma,1)!=n)||(n<1)) mexErrMsgTxt("Sigma must consist of square matrices.");
+  nn = (long)n*n;
+  m = Liouville ? n*n : n;
+  mm = (long)m*m;
+  if ((dimsize(U,0)!=m)||(dimsize(U,1)!=m))
+    mexErrMsgTxt(Liouville ? "L must be n^2 x n^2 x K x nOri." : "U must be n x n x K x nOri.");
+  nProp = dimsize(U,2);
+  nOri = dimsize(U,3);
+  nSigmaPages = npages(Sigma);
+  if ((nSigmaPages!=1)&&(nSigmaPages!=nOri))
+    mexErrMsgTxt("Sigma must have one page, or one per orientation.");
+  if (Liouville) {
+    SigmaSS = prhs[5];
+    checkdouble(SigmaSS,"SigmaSS");
+    if ((long)mxGetNumberOfElements(SigmaSS)!=m*nProp*nOri)
+      mexErrMsgTxt("SigmaSS must be n^2 x K x nOri.");
+  }
+  nDet = mxIsEmpty(Det) ? 0 : (int)mxGetM(Det);
+  if ((nDet>0)&&(dimsize(Det,1)!=nn)) mexErrMsgTxt("DetArray must have n^2 columns.");
+
+  nSteps = (long)mxGetNumberOfElements(Idx);
+  idx = (long*)mxMalloc((nSteps+1)*sizeof(long));
+  for (i=0; i<nSteps; i++) {
+    idx[i] = (long)mxGetPr(Idx)[i] - 1;
+    if ((idx[i]<0)||(idx[i]>=nProp)) mexErrMsgTxt("idx out of range.");
+  }
+  if (nDet>0) {
+    D = (double*)mxMalloc(2*nDet*nn*sizeof(double));
+    getpage(Det,0,nDet*nn,1,D);
+  }
+
+  dims[0] = n; dims[1] = n; dims[2] = nOri;
+  plhs[0] = mxCreateNumericArray(3,dims,mxDOUBLE_CLASS,mxCOMPLEX);
+  Sre = mxGetPr(plhs[0]);
+  Sim = mxGetPi(plhs[0]);
+  if (nlhs>1) {
+    dims[0] = nDet; dims[1] = nSteps+1; dims[2] = nOri;
+    plhs[1] = mxCreateNumericArray(3,dims,mxDOUBLE_CLASS,mxCOMPLEX);
+    Gre = mxGetPr(plhs[1]);
+    Gim = mxGetPi(plhs[1]);
+  }
+  if (withStates) {
+    dims[0] = n; dims[1] = n; dims[2] = nSteps+1; dims[3] = nOri;
+    plhs[2] = mxCreateNumericArray(4,dims,mxDOUBLE_CLASS,mxCOMPLEX);
+    Tre = mxGetPr(plhs[2]);
+    Tim = mxGetPi(plhs[2]);
+  }
+
+  {
+    const double *Ure = mxGetPr(U), *Uim = mxGetPi(U);
+    const double *Sin_re = mxGetPr(Sigma), *Sin_im = mxGetPi(Sigma);
+    const double *SSre = Liouville ? mxGetPr(SigmaSS) : NULL;
+    const double *SSim = Liouville ? mxGetPi(SigmaSS) : NULL;
+
+    setthreads();
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic,1)
+#endif
+    for (o=0; o<nOri; o++) {
+      /* S: density matrix, P: current propagator, T: temporary */
+      double *S = (double*)malloc((2*nn + 2*mm + 2*nn + 2*m)*sizeof(double));
+      double *P, *T, *ss;
+      const long s0 = (nSigmaPages==1) ? 0 : o*nn;
+      long step, prev = -1, j;
+      int d;
+      if (S==NULL) { failed = 1; continue; }
+      P = S + 2*nn; T = P + 2*mm; ss = T + 2*nn;
+
+      for (j=0; j<nn; j++) {
+        S[2*j] = Sin_re[s0+j];
+        S[2*j+1] = Sin_im ? Sin_im[s0+j] : 0;
+      }
+      for (step=0; step<=nSteps; step++) {
+        if (step>0) {
+          const long k = idx[step-1], u0 = (o*nProp+k)*mm;
+          if (k!=prev) {
+            /* load propagator, unless repeated */
+            for (j=0; j<mm; j++) {
+              P[2*j] = Ure[u0+j];
+              P[2*j+1] = Uim ? Uim[u0+j] : 0;
+            }
+            if (Liouville)
+              for (j=0; j<m; j++) {
+                ss[2*j] = SSre[(o*nProp+k)*m+j];
+                ss[2*j+1] = SSim ? SSim[(o*nProp+k)*m+j] : 0;
+              }
+            prev = k;
+          }
+          if (!Liouville) {
+            cmatmul(n,P,S,T);
+            cmatmulh(n,T,P,S);
+          }
+          else {
+            for (j=0; j<2*m; j++) T[j] = S[j] - ss[j];
+            cmatvec(m,P,T,S);
+            for (j=0; j<2*m; j++) S[j] += ss[j];
+          }
+        }
+        if (Gre!=NULL)
+          for (d=0; d<nDet; d++) {
+            double vre = 0, vim = 0;
+            for (j=0; j<nn; j++) {
+              const double dre = D[2*(d+j*nDet)], dim = D[2*(d+j*nDet)+1];
+              vre += dre*S[2*j] - dim*S[2*j+1];
+              vim += dre*S[2*j+1] + dim*S[2*j];
+            }
+            Gre[(o*(nSteps+1)+step)*nDet+d] = vre;
+            Gim[(o*(nSteps+1)+step)*nDet+d] = vim;
+          }
+        if (withStates)
+          setpage(Tre,Tim,o*(nSteps+1)+step,nn,S);
+      }
+      setpage(Sre,Sim,o,nn,S);
+      free(S);
+    }
+  }
+
+  mxFree(idx);
+  if (D!=NULL) mxFree(D);
+  if (failed) mexErrMsgTxt("Out of memory in s_propagate.");
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  char Mode[16] = "";
+
+  if ((nrhs>=1) && mxIsChar(prhs[0])) mxGetString(prhs[0],Mode,sizeof(Mode));
+  if (strcmp(Mode,"propagators")==0) {
+    if (nlhs>1) mexErrMsgTxt("One output argument expected.");
+    if (nrhs!=5) mexErrMsgTxt("5 input arguments expected.");
+    buildpropagators(nlhs,plhs,nrhs,prhs);
+  }
+  else if (strcmp(Mode,"liouvillians")==0) {
+    if (nlhs>2) mexErrMsgTxt("Too many output arguments.");
+    if (nrhs!=7) mexErrMsgTxt("7 input arguments expected.");
+    buildpropagators(nlhs,plhs,nrhs,prhs);
+  }
+  else if (strcmp(Mode,"propagate")==0) {
+    if (nlhs>3) mexErrMsgTxt("Too many output arguments.");
+    propagate(nlhs,plhs,nrhs,prhs);
+  }
+  else
+    mexErrMsgTxt("First input must be 'propagators', 'liouvillians' or 'propagate'.");
+}
@@ -1,16 +1,27 @@
 % thyme  Time domain evolution of density matrix
+%
+% Ham0 can contain the Hamiltonians of several orientations along the third
+% dimension, and Relaxation.Gamma the corresponding relaxation
+% superoperators. All orientations are propagated together by s_propagate,
+% and the signals, final states and state trajectories are summed over
+% orientations with the weights in Weights (default: all 1).
 function [TimeArray, SignalArray, FinalStates, StateTrajectories, Events] = ...
-  s_thyme(Sigma,Ham0,Det,Events,Relaxation,Vary)
+  s_thyme(Sigma,Ham0,Det,Events,Relaxation,Vary,Weights)
 
 if nargin==0, help(mfilename); return; end
 
 if nargout>5, error('Too many output arguments.'); end
-if nargin<4 || nargin>6, error('Wrong number of input arguments!'); end
+if nargin<4 || nargin>7, error('Wrong number of input arguments!'); end
+if nargin<7 || isempty(Weights), Weights = ones(1,size(Ham0,3)); end
+if numel(Weights)~=size(Ham0,3)
+  error('Weights must have one element per orientation.');
+end
 
 nEvents = length(Events);
 
 nDet = numel(Det);
-Ham0 = Ham0*2*pi;
+Ham0 = full(Ham0)*2*pi;
+Sigma = full(Sigma);
 
 % Create some variables for bookkeeping
 if ~isempty(Vary)
@@ -330,105 +341,32 @@ for iPoints = 1 : nPoints
           if (~currentEvent.Relaxation && ~isfield(currentEvent.Propagation,'Utotal')) ... % checks for availability if simulation is in Hilbert space
               || (currentEvent.Relaxation && ~isfield(currentEvent.Propagation,'Ltotal')) % checks for availability in Liouville space
             
-            if currentEvent.Relaxation % Set up for Liouville space simulations
-              n = size(Sigma,1);
-              Gamma = Relaxation.Gamma;
-              equilibriumState = reshape(Relaxation.equilibriumState,n*n,1);
-            end
-            
             %----------------------------------------------------------
-            % Build the Propagator table, only possible for
-            % excitation that has no imaginary part - increases speed
-            % by precomputing all propagators and later loading them,
-            % instead of calculating them at each way point (true as
-            % long as length(Wave) > vertical resolution)
+            % Each step of the wave form is given by the coefficients
+            % of real(xOp) and imag(xOp) in the pulse Hamiltonian.
+            % Propagators are only computed once for each distinct
+            % pair of coefficients, for all orientations at once, and
+            % the steps of all phase cycles refer to them by index.
             %----------------------------------------------------------
-            if currentEvent.ComplexExcitation == 0 && ~currentEvent.Relaxation
-              
-              UTable = buildPropagators(Ham0,currentEvent.xOp,currentEvent.TimeStep,vertRes,scale);
-              
-              Events{iEvent}.Propagation.UTable = UTable;
-              
-            elseif currentEvent.ComplexExcitation == 0 && currentEvent.Relaxation
-              
-              [LTable, SigmassTable] = buildLiouvillians(Ham0,Gamma,equilibriumState,currentEvent.xOp,currentEvent.TimeStep,vertRes,scale);
-              
-              Events{iEvent}.Propagation.LTable = LTable;
-              Events{iEvent}.Propagation.SigmassTable = SigmassTable;
-              
-            end
-            
-            % Set up structures for the actual propagators
-            if currentEvent.Detection && ~currentEvent.Relaxation
-              Utotal = cell(nPhaseCycle,length(realBinary));
+            if currentEvent.ComplexExcitation == 0
+              StepCoeff = [scale*(realBinary(:)-vertRes/2), zeros(numel(realBinary),1)];
             else
-              if ~currentEvent.Relaxation
-                Utotal = cell(nPhaseCycle,1);
-              else
-                Ltotal = cell(nPhaseCycle,length(realBinary));
-                SigmaSStotal = Ltotal;
-              end
-            end
-            
-            for iPhaseCycle = 1 : nPhaseCycle
-              for iWavePoint = 1 : length(realBinary)
-                if currentEvent.ComplexExcitation == 0
-                  %----------------------------------------------------
-                  % Lookup tables are only feasible for non-complex
-                  % excitation
-                  %----------------------------------------------------
-                  if ~currentEvent.Relaxation
-                    U = UTable{realBinary(iPhaseCycle,iWavePoint)+1};
-                  else
-                    L=LTable{realBinary(iPhaseCycle,iWavePoint)+1};
-                    SigmaSS=SigmassTable{realBinary(iPhaseCycle,iWavePoint)+1};
-                  end
-                else
-                  %----------------------------------------------------
-                  % For complex excitation it is not possible to use a
-                  % lookup table
-                  %----------------------------------------------------
-                  Ham1 = scale/2*(realBinary(iPhaseCycle,iWavePoint)-vertRes/2)*real(currentEvent.xOp)+1i*scale/2*(imagBinary(iPhaseCycle,iWavePoint)-vertRes/2)*imag(currentEvent.xOp);
-                  Ham =  Ham0+Ham1;
-                  if ~currentEvent.Relaxation
-                    U = Propagator(Ham,currentEvent.TimeStep);
-                  else
-                    [L, SigmaSS] = Liouvillian(Ham,Gamma,equilibriumState,currentEvent.TimeStep);
-                  end
-                end
-                
-                if ~currentEvent.Relaxation
-                  %------------------------------------------------------
-                  % Store Propagators for propation in one step
-                  % (additional speed bost if no detection) or stepwise
-                  %------------------------------------------------------
-                  if currentEvent.Detection
-                    Utotal{iPhaseCycle,iWavePoint} = U;
-                  else
-                    if iWavePoint == 1
-                      Utotal{iPhaseCycle,1} = U;
-                    else
-                      Utotal{iPhaseCycle,1} = U*Utotal{iPhaseCycle,1};
-                    end
-                  end
-                else
-                  Ltotal{iPhaseCycle,iWavePoint} = L;
-                  SigmaSStotal{iPhaseCycle,iWavePoint} = SigmaSS;
-                  
-                end
-              end
+              StepCoeff = scale/2*[realBinary(:)-vertRes/2, imagBinary(:)-vertRes/2];
             end
+            [StepCoeff,~,StepIndex] = unique(StepCoeff,'rows');
+            StepIndex = reshape(StepIndex,size(realBinary));
             
-            
-            %-------------------------------------------------------
-            % Write to Event Structure
-            %--------------------------------------------------------
             if ~currentEvent.Relaxation
+              Utotal = s_propagate('propagators',Ham0,full(currentEvent.xOp),StepCoeff.',currentEvent.TimeStep);
               Events{iEvent}.Propagation.Utotal = Utotal;
             else
+              n = size(Sigma,1);
+              equilibriumState = reshape(Relaxation.equilibriumState,n*n,1);
+              [Ltotal, SigmaSStotal] = s_propagate('liouvillians',Ham0,full(currentEvent.xOp),StepCoeff.',currentEvent.TimeStep,Relaxation.Gamma,equilibriumState);
               Events{iEvent}.Propagation.Ltotal = Ltotal;
               Events{iEvent}.Propagation.SigmaSStotal = SigmaSStotal;
             end
+            Events{iEvent}.Propagation.StepIndex = StepIndex;
           end
           
       end
@@ -470,10 +408,8 @@ for iPoints = 1 : nPoints
       switch currentEvent.type
         case 'pulse'
           tvector = currentEvent.t;
-          currentSignal = zeros(nDet,size(currentEvent.IQ,2)+1);
         case 'free evolution'
           tvector = 0:currentEvent.TimeStep:currentEvent.t;
-          currentSignal = zeros(nDet,length(tvector));
       end
       
       n = size(Sigma,1);
@@ -486,7 +422,6 @@ for iPoints = 1 : nPoints
         normDet_ = Det{iDet}*Det{iDet}';
         DetArray(iDet,:) = Det{iDet}/normDet_;
       end
-      currentSignal(:,1) = DetArray*Sigma(:);
       
     else
       switch currentEvent.type
@@ -497,18 +432,7 @@ for iPoints = 1 : nPoints
           currentEvent.TimeStep = currentEvent.t;
       end
       
-      currentSignal=[];
-    end
-    
-    if currentEvent.StateTrajectories
-      if currentEvent.Detection
-        DensityMatrices=cell(1,length(currentEvent.t));
-      else
-        DensityMatrices=cell(1,2);
-      end
-      DensityMatrices{1}=Sigma;
-    else
-      DensityMatrices = [];
+      DetArray = [];
     end
     %------------------------------------------------------------------
     
@@ -531,50 +455,29 @@ for iPoints = 1 : nPoints
         %--------------------------------------------------------------
         if nPhaseCycle>1
           StateBeforePC = Sigma;
-          loopState = zeros(size(Sigma));
+          loopState = 0;
           PCnorm = sum(abs(currentEvent.PhaseCycle(:,2)));
         end
         
+        if ~currentEvent.Relaxation
+          Propagation = {currentEvent.Propagation.Utotal};
+        else
+          Propagation = {currentEvent.Propagation.Ltotal,currentEvent.Propagation.SigmaSStotal};
+        end
+        
         %--------------------------------------------------------------
         % Propagation Starts Here, and loops over all steps of the
         % phase cycle
         %--------------------------------------------------------------
         for iPhaseCycle = 1 : nPhaseCycle
           
-          if ~currentEvent.Relaxation
-            nSteps = size(currentEvent.Propagation.Utotal,2);
-          else
-            nSteps = size(currentEvent.Propagation.Ltotal,2);
-            SigmaVector = reshape(Sigma,n*n,1);
-          end
+          StepIndex = currentEvent.Propagation.StepIndex(iPhaseCycle,:);
+          [Sigma,currentSignal,DensityMatrices] = propagate(Sigma,Propagation,StepIndex,DetArray,Weights,currentEvent.StateTrajectories);
           
-          %------------------------------------------------------------
-          % Loop over the number of necessary propagation steps (1 if
-          % detection during the pulse is not requested
-          %------------------------------------------------------------
-          for iWavePoint = 1 : nSteps
-            if ~currentEvent.Relaxation
-              U = currentEvent.Propagation.Utotal{iPhaseCycle,iWavePoint};
-              Sigma = U*Sigma*U';
-            elseif currentEvent.Relaxation
-              L = currentEvent.Propagation.Ltotal{iPhaseCycle,iWavePoint};
-              SigmaSS = currentEvent.Propagation.SigmaSStotal{iPhaseCycle,iWavePoint};
-              SigmaVector = SigmaSS+L*(SigmaVector-SigmaSS);
-              
-              Sigma = reshape(SigmaVector,n,n);
-            end
-            
-            %----------------------------------------------------------
-            % Store expectation values and density matrix if requested
-            %----------------------------------------------------------
-            if currentEvent.Detection
-              currentSignal(:,iWavePoint+1) = DetArray*Sigma(:);
-            end
-            
-            if currentEvent.StateTrajectories
-              DensityMatrices{iWavePoint+1} = Sigma;
-            end
-            %----------------------------------------------------------
+          % Without detection, only the state after the pulse is kept
+          % (Hilbert space)
+          if currentEvent.StateTrajectories && ~currentEvent.Detection && ~currentEvent.Relaxation
+            DensityMatrices = DensityMatrices([1 end]);
           end
           
           %------------------------------------------------------------
@@ -616,51 +519,28 @@ for iPoints = 1 : nPoints
         % Loads or computes the Propagator/Liouvillian if necessary
         %--------------------------------------------------------------
         if ~currentEvent.Relaxation
-          if isfield(currentEvent.Propagation,'Utotal')
-            U = currentEvent.Propagation.Utotal;
-          else
-            U = Propagator(Ham0,currentEvent.TimeStep);
-            Events{iEvent}.Propagation.Utotal = U;
+          if ~isfield(currentEvent.Propagation,'Utotal')
+            Events{iEvent}.Propagation.Utotal = ...
+              s_propagate('propagators',Ham0,zeros(n),[0;0],currentEvent.TimeStep);
           end
-        elseif currentEvent.Relaxation
-          n = size(Sigma,1);
-          SigmaVector = reshape(Sigma,n*n,1);
-          if isfield(currentEvent.Propagation,'Ltotal')
-            L = currentEvent.Propagation.Ltotal;
-            SigmaSS = currentEvent.Propagation.SigmaSStotal;
-          else
-            Gamma = Relaxation.Gamma;
+          Propagation = {Events{iEvent}.Propagation.Utotal};
+        else
+          if ~isfield(currentEvent.Propagation,'Ltotal')
+            n = size(Sigma,1);
             equilibriumState = reshape(Relaxation.equilibriumState,n*n,1);
-            [L, SigmaSS] = Liouvillian(Ham0,Gamma,equilibriumState,currentEvent.TimeStep);
+            [L, SigmaSS] = s_propagate('liouvillians',Ham0,zeros(n),[0;0],currentEvent.TimeStep,Relaxation.Gamma,equilibriumState);
             Events{iEvent}.Propagation.Ltotal = L;
             Events{iEvent}.Propagation.SigmaSStotal = SigmaSS;
           end
+          Propagation = {Events{iEvent}.Propagation.Ltotal,Events{iEvent}.Propagation.SigmaSStotal};
         end
         %--------------------------------------------------------------
         
         %--------------------------------------------------------------
-        % Loops over the time axis for propagation
+        % Propagates over the time axis, with one step per interval
         %--------------------------------------------------------------
-        for itvector=2:length(tvector)
-          if ~currentEvent.Relaxation
-            Sigma = U*Sigma*U';
-          elseif currentEvent.Relaxation
-            SigmaVector = SigmaSS+L*(SigmaVector-SigmaSS);
-            Sigma = reshape(SigmaVector,n,n);
-          end
-          
-          %------------------------------------------------------------
-          % Stores expectation values and denisty matrices if requested
-          %------------------------------------------------------------
-          if currentEvent.Detection
-            currentSignal(:,itvector) = DetArray*Sigma(:);
-          end
-          
-          if currentEvent.StateTrajectories
-            DensityMatrices{itvector} = Sigma;
-          end
-          %------------------------------------------------------------
-        end
+        StepIndex = ones(1,length(tvector)-1);
+        [Sigma,currentSignal,DensityMatrices] = propagate(Sigma,Propagation,StepIndex,DetArray,Weights,currentEvent.StateTrajectories);
     end
     
     %------------------------------------------------------------------
@@ -842,7 +722,7 @@ for iPoints = 1 : nPoints
   end
   
   % Store the final state at its correct position
-  FinalStates(AcquisitionIndex{:},:,:) = Sigma;
+  FinalStates(AcquisitionIndex{:},:,:) = orisum(Sigma,Weights,n,n);
   
   % Store the cell array with state tractories (if any) of the current
   % acquisition point in its correct position in the output cellarray
@@ -877,45 +757,31 @@ if firstDetection
 end
 
 
-function UTable = buildPropagators(Ham0,xOp,dt,vertRes,scale)
-
-UTable = cell(1,vertRes+1);
+function [Sigma,Signal,States] = propagate(Sigma,Propagation,StepIndex,DetArray,Weights,getStates)
+% Propagates the density matrices of all orientations through the steps
+% StepIndex, and returns the signal (empty without DetArray) and, if
+% requested, the density matrices before and after each step, both summed
+% over orientations.
 
-for iRes = 0:vertRes
-  Ham1 = scale*(iRes-vertRes/2)*real(xOp);
-  Ham = Ham0+Ham1;
-  U = Propagator(Ham,dt);
-  UTable{iRes+1} = U;
+n = size(Sigma,1);
+if getStates
+  [Sigma,Signal,States] = s_propagate('propagate',Sigma,Propagation{1},StepIndex,DetArray,Propagation{2:end});
+  States = reshape(num2cell(orisum(States,Weights,n,n,[]),[1 2]),1,[]);
+else
+  [Sigma,Signal] = s_propagate('propagate',Sigma,Propagation{1},StepIndex,DetArray,Propagation{2:end});
+  States = [];
 end
-
-
-function U = Propagator(Ham,dt)
-U = expm(-1i*Ham*dt);
-
-
-function [LTable, SigmassTable] = buildLiouvillians(Ham0,Gamma,equilibriumState,xOp,dt,vertRes,scale)
-
-SigmassTable = cell(1,vertRes+1);
-LTable = cell(1,vertRes+1);
-
-for ivertRes = 0:vertRes
-  Ham1 = scale*(ivertRes-vertRes/2)*real(xOp);
-  Ham = Ham0 + Ham1;
-  [L, SigmaSS] = Liouvillian(Ham,Gamma,equilibriumState,dt);
-  LTable{ivertRes+1} = L;
-  SigmassTable{ivertRes+1} = SigmaSS;
+if isempty(DetArray)
+  Signal = [];
+else
+  Signal = orisum(Signal,Weights,size(DetArray,1),[]);
 end
 
 
-function [L, SigmaSS] = Liouvillian(Ham,Gamma,equilibriumState,dt)
-
-n = size(Ham,1);
-
-HamSuOp = kron(eye(n,n),Ham)-kron(Ham.',eye(n,n));
-L = -1i*HamSuOp-Gamma;
-SigmaSS = Gamma*equilibriumState; % steady state solutions for the density matrices
-SigmaSS = -L\SigmaSS;
-L = expm(L*dt); %calculations of the Liouvillians
+function A = orisum(A,Weights,varargin)
+% Sum over orientations (last dimension of A) with weights, reshaped to the
+% size given in varargin
+A = reshape(reshape(A,[],numel(Weights))*Weights(:),varargin{:});
 
 
 function LoadedElement = LoadfromArray(Array, ArrayIndex)
@@ -0,0 +1,452 @@
+/*
+td = sf_evolve(IncSchemeID,nPoints,dt,idxFreeL,idxFreeR,Ea,Eb,G,D,M1l,M1r)
+
+  Computes the time-domain signal of all peaks of a coherence transfer
+  pathway, the time-domain counterpart of sf_peaks. Arguments are the same
+  as for sf_peaks, except that the number of points (nPoints) is given
+  instead of the spectral buffers.
+
+  td(n1,n2) = sum_peaks Amp*exp(-2i*pi*(nu1*n1*dt1 + nu2*n2*dt2))
+
+  td is 1 x nPoints for one-dimensional and nPoints(1) x nPoints(2) for
+  two-dimensional incrementation schemes.
+
+  Peaks are collected in chunks of structure-of-arrays form. Each chunk is
+  evolved in segments of time points that are distributed over all
+  threads. Within a segment, the complex exponentials are generated by
+  recurrence, and only its first point is computed with sin/cos.
+ */
+
+#include "mex.h"
+#include <math.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "cpuinfo.h"
+
+const double PI = 3.141592653589793238462643383279502884;
+
+/* number of peaks evolved together */
+#define CHUNKSIZE 4096
+/* number of time points generated by recurrence from one exact value */
+#define SEGMENT 64
+
+/* Peak chunk and output signal */
+struct PeakChunk {
+  long n;
+  double *rAmp, *iAmp, *nu1, *nu2;
+  double *rZ, *iZ;      /* phase increments along first dimension */
+  double **rW, **iW;    /* per-thread running amplitudes */
+  int nPoints1, nPoints2;
+  double dt1, dt2;
+  double *tdRe, *tdIm;
+};
+
+/*===================================================================*/
+/* Adds the time-domain signal of all peaks in the chunk to the output
+   and empties the chunk */
+void evolvechunk(struct PeakChunk *C)
+{
+  const long nPeaks = C->n;
+  const int nSeg1 = (C->nPoints1+SEGMENT-1)/SEGMENT;
+  const int nItems = nSeg1*C->nPoints2;
+  const double twopi = 2*PI;
+  int iItem;
+  long p;
+
+  if (nPeaks==0) return;
+
+  for (p=0;p<nPeaks;p++) {
+    C->rZ[p] = cos(twopi*C->nu1[p]*C->dt1);
+    C->iZ[p] = -sin(twopi*C->nu1[p]*C->dt1);
+  }
+
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static)
+#endif
+  for (iItem=0;iItem<nItems;iItem++) {
+    const int iSeg = iItem % nSeg1, n2 = iItem / nSeg1;
+    const int n1start = iSeg*SEGMENT;
+    const int n1end = (n1start+SEGMENT<C->nPoints1) ? n1start+SEGMENT : C->nPoints1;
+    double *rW, *iW, phase, c, s, rSum, iSum, r;
+    long q;
+    int n1;
+#ifdef _OPENMP
+    rW = C->rW[omp_get_thread_num()];
+    iW = C->iW[omp_get_thread_num()];
+#else
+    rW = C->rW[0];
+    iW = C->iW[0];
+#endif
+
+    /* exact amplitudes at the first point of the segment */
+    for (q=0;q<nPeaks;q++) {
+      phase = -twopi*(C->nu1[q]*n1start*C->dt1 + C->nu2[q]*n2*C->dt2);
+      c = cos(phase);
+      s = sin(phase);
+      rW[q] = C->rAmp[q]*c - C->iAmp[q]*s;
+      iW[q] = C->rAmp[q]*s + C->iAmp[q]*c;
+    }
+
+    /* sum over peaks, advance amplitudes by one time step */
+    for (n1=n1start;n1<n1end;n1++) {
+      rSum = 0;
+      iSum = 0;
+      for (q=0;q<nPeaks;q++) {
+        rSum += rW[q];
+        iSum += iW[q];
+        r     = rW[q]*C->rZ[q] - iW[q]*C->iZ[q];
+        iW[q] = rW[q]*C->iZ[q] + iW[q]*C->rZ[q];
+        rW[q] = r;
+      }
+      C->tdRe[n1+n2*C->nPoints1] += rSum;
+      C->tdIm[n1+n2*C->nPoints1] += iSum;
+    }
+  }
+
+  C->n = 0;
+}
+
+/*===================================================================*/
+/* Adds a peak to the chunk, evolving the chunk when it is full */
+void addpeak(struct PeakChunk *C, double rAmp, double iAmp, double nu1, double nu2)
+{
+  if ((rAmp==0) && (iAmp==0)) return;
+  C->rAmp[C->n] = rAmp;
+  C->iAmp[C->n] = iAmp;
+  C->nu1[C->n] = nu1;
+  C->nu2[C->n] = nu2;
+  C->n++;
+  if (C->n==CHUNKSIZE) evolvechunk(C);
+}
+
+/*===================================================================*/
+/* Returns pointers to the real and imaginary parts of a matrix argument,
+   substituting zeros for the imaginary part of real arrays */
+void getmatrix(const mxArray *M, size_t nElements, const char *errmsg,
+               const mxArray *imagZeros, double **rM, double **iM)
+{
+  if (mxGetNumberOfElements(M)!=nElements)
+    mexErrMsgTxt(errmsg);
+  *rM = mxGetPr(M);
+  *iM = mxIsComplex(M) ? mxGetPi(M) : mxGetPr(imagZeros);
+}
+
+/*===================================================================*/
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  struct PeakChunk C;
+  double *rM[6], *iM[6];
+  double *rG, *iG, *rD, *iD;
+  double *rT1l, *iT1l, *rT2l, *iT2l, *rT3l, *iT3l;
+  double *rT1r, *iT1r, *rT2r, *iT2r, *rT3r, *iT3r;
+  double *Ea, *Eb, *El[4], *Er[4], *freeL, *freeR, *nPoints, *dt;
+  double c1[4] = {0,0,0,0}, c2[4] = {0,0,0,0};
+  double f1, f2, f3, f4, nu1, nu2;
+  double rAmp, iAmp, rAmp0, iAmp0, rAmp1, iAmp1, rAmp2, iAmp2, rAmp3, iAmp3;
+  double rAmp4, iAmp4, rAmp5, iAmp5;
+  int IncSchemeID, nFreeEvolutions, nDimensions, nMix, nStates, nStates2, nThreads;
+  int i, j, k, l, m, n, o, p, q, t;
+  int a;
+  mxArray *imagZeros;
+
+  const char *mixmsg[4][6] = {
+    {"", "", "", "", "", ""},
+    {"M1l has wrong size!", "M1r has wrong size!", "", "", "", ""},
+    {"M1l has wrong size!", "M2l has wrong size!", "M1r has wrong size!", "M2r has wrong size!", "", ""},
+    {"M1l has wrong size!", "M2l has wrong size!", "M3l has wrong size!",
+     "M1r has wrong size!", "M2r has wrong size!", "M3r has wrong size!"}
+  };
+
+  /*-----------------------------------------------------------------
+     Check number of input and output arguments
+    ----------------------------------------------------------------- */
+  if (nrhs<9)
+    mexErrMsgTxt("Insufficient number of input arguments.");
+  if (nlhs>1)
+    mexErrMsgTxt("Too many output arguments.");
+
+  /*-----------------------------------------------------------------
+     Read input arguments
+    ----------------------------------------------------------------- */
+
+  a = 0;
+  /* IncSchemeID ... identifies the incrementation scheme, and
+     c1/c2 ... contributions of the free evolution periods to the
+     frequencies in the first/second dimension */
+  IncSchemeID = mxGetScalar(prhs[a]);
+  if (mxGetNumberOfElements(prhs[a])!=1)
+    mexErrMsgTxt("IncSchemeID must be a scalar!");
+  nFreeEvolutions = 0; nDimensions = 0;
+  switch (IncSchemeID) {
+    case  1: /* [1] */
+      nFreeEvolutions = 1; nDimensions = 1; c1[0] = 1; break;
+    case  2: /* [1 1] */
+      nFreeEvolutions = 2; nDimensions = 1; c1[0] = 1; c1[1] = 1; break;
+    case  3: /* [1 -1] */
+      nFreeEvolutions = 2; nDimensions = 1; c1[0] = 1; c1[1] = -1; break;
+    case 11: /* [1 2] */
+      nFreeEvolutions = 2; nDimensions = 2; c1[0] = 1; c2[1] = 1; break;
+    case 12: /* [1 2 1] */
+      nFreeEvolutions = 3; nDimensions = 2; c1[0] = 1; c2[1] = 1; c1[2] = 1; break;
+    case 13: /* [1 2 2] */
+      nFreeEvolutions = 3; nDimensions = 2; c1[0] = 1; c2[1] = 1; c2[2] = 1; break;
+    case 14: /* [1 1 2] */
+      nFreeEvolutions = 3; nDimensions = 2; c1[0] = 1; c1[1] = 1; c2[2] = 1; break;
+    case 15: /* [1 2 2 1] */
+      nFreeEvolutions = 4; nDimensions = 2; c1[0] = 1; c2[1] = 1; c2[2] = 1; c1[3] = 1; break;
+    case 16: /* [1 2 -2 1] */
+      nFreeEvolutions = 4; nDimensions = 2; c1[0] = 1; c2[1] = 1; c2[2] = -1; c1[3] = 1; break;
+    case 17: /* [1 1 2 2] */
+      nFreeEvolutions = 4; nDimensions = 2; c1[0] = 1; c1[1] = 1; c2[2] = 1; c2[3] = 1; break;
+    default: mexErrMsgTxt("Unrecognized incrementation scheme.");
+  }
+
+  nMix = 2*(nFreeEvolutions-1);
+  if (nrhs!=9+nMix)
+    mexErrMsgTxt("Wrong number of input arguments.");
+
+  a++;
+  /* nPoints ... number of points along each dimension */
+  nPoints = mxGetPr(prhs[a]);
+  if (mxGetNumberOfElements(prhs[a])!=nDimensions)
+    mexErrMsgTxt("nPoints has wrong number of elements!");
+  C.nPoints1 = nPoints[0];
+  C.nPoints2 = (nDimensions==2) ? nPoints[1] : 1;
+  if ((C.nPoints1<1) || (C.nPoints2<1))
+    mexErrMsgTxt("nPoints must be positive.");
+
+  a++;
+  /* dt ... time increment */
+  dt = mxGetPr(prhs[a]);
+  if (mxGetNumberOfElements(prhs[a])!=nDimensions)
+    mexErrMsgTxt("dt has wrong number of elements!");
+  C.dt1 = dt[0];
+  C.dt2 = (nDimensions==2) ? dt[1] : 0;
+
+  a++;
+  /* freeL ... index for left-side propagators (1=alpha,2=beta) */
+  freeL = mxGetPr(prhs[a]);
+  if (mxGetNumberOfElements(prhs[a])!=nFreeEvolutions)
+    mexErrMsgTxt("Wrong number of left evolution intervals.");
+
+  a++;
+  /* freeR ... index for right-side propagators (1=alpha,2=beta) */
+  freeR = mxGetPr(prhs[a]);
+  if (mxGetNumberOfElements(prhs[a])!=nFreeEvolutions)
+    mexErrMsgTxt("Wrong number of right evolution intervals.");
+
+  a++;
+  /* Ea ... energies for alpha manifold */
+  Ea = mxGetPr(prhs[a]);
+  if (mxIsComplex(prhs[a])) mexErrMsgTxt("Ea must be real!");
+  nStates = mxGetNumberOfElements(prhs[a]);
+  nStates2 = nStates*nStates;
+
+  a++;
+  /* Eb ... energies for beta manifold */
+  Eb = mxGetPr(prhs[a]);
+  if (mxIsComplex(prhs[a])) mexErrMsgTxt("Eb must be real!");
+  if (nStates!=mxGetNumberOfElements(prhs[a]))
+    mexErrMsgTxt("Ea and Eb must have the same number of elements.");
+
+  for (q=0;q<nFreeEvolutions;q++) {
+    El[q] = (freeL[q]==1) ? Ea : Eb;
+    Er[q] = (freeR[q]==1) ? Ea : Eb;
+  }
+
+  imagZeros = mxCreateDoubleMatrix(nStates,nStates,mxREAL);
+
+  a++;
+  /* G ... Start coherence matrix */
+  getmatrix(prhs[a],nStates2,"G has wrong size!",imagZeros,&rG,&iG);
+
+  a++;
+  /* D ... detection matrix */
+  getmatrix(prhs[a],nStates2,"D has wrong size!",imagZeros,&rD,&iD);
+
+  /* T1l, T2l, T3l, T1r, T2r, T3r ... mixing matrices */
+  for (t=0;t<nMix;t++) {
+    a++;
+    getmatrix(prhs[a],nStates2,mixmsg[nFreeEvolutions-1][t],imagZeros,&rM[t],&iM[t]);
+  }
+  rT1l = iT1l = rT2l = iT2l = rT3l = iT3l = NULL;
+  rT1r = iT1r = rT2r = iT2r = rT3r = iT3r = NULL;
+  if (nMix>=2) {
+    rT1l = rM[0]; iT1l = iM[0];
+    rT1r = rM[nMix/2]; iT1r = iM[nMix/2];
+  }
+  if (nMix>=4) {
+    rT2l = rM[1]; iT2l = iM[1];
+    rT2r = rM[nMix/2+1]; iT2r = iM[nMix/2+1];
+  }
+  if (nMix>=6) {
+    rT3l = rM[2]; iT3l = iM[2];
+    rT3r = rM[nMix/2+2]; iT3r = iM[nMix/2+2];
+  }
+
+  /*-----------------------------------------------------------------
+     Allocate output, peak chunk and per-thread workspace
+    ----------------------------------------------------------------- */
+  if (nDimensions==1)
+    plhs[0] = mxCreateDoubleMatrix(1,C.nPoints1,mxCOMPLEX);
+  else
+    plhs[0] = mxCreateDoubleMatrix(C.nPoints1,C.nPoints2,mxCOMPLEX);
+  C.tdRe = mxGetPr(plhs[0]);
+  C.tdIm = mxGetPi(plhs[0]);
+
+#ifdef _OPENMP
+  nThreads = setthreads();
+#else
+  nThreads = 1;
+#endif
+
+  C.n = 0;
+  C.rAmp = mxMalloc(CHUNKSIZE*sizeof(double));
+  C.iAmp = mxMalloc(CHUNKSIZE*sizeof(double));
+  C.nu1 = mxMalloc(CHUNKSIZE*sizeof(double));
+  C.nu2 = mxMalloc(CHUNKSIZE*sizeof(double));
+  C.rZ = mxMalloc(CHUNKSIZE*sizeof(double));
+  C.iZ = mxMalloc(CHUNKSIZE*sizeof(double));
+  C.rW = mxMalloc(nThreads*sizeof(double*));
+  C.iW = mxMalloc(nThreads*sizeof(double*));
+  for (t=0;t<nThreads;t++) {
+    C.rW[t] = mxMalloc(CHUNKSIZE*sizeof(double));
+    C.iW[t] = mxMalloc(CHUNKSIZE*sizeof(double));
+  }
+
+  /*-----------------------------------------------------------------
+     Compute amplitudes and frequencies of all peaks
+    ----------------------------------------------------------------- */
+  switch (nFreeEvolutions) {
+
+    case 1:
+      /* Amp = D[kj]*G[jk] */
+      for (j=0;j<nStates;j++) {
+        for (k=0;k<nStates;k++) {
+          f1 = El[0][j]-Er[0][k];
+          rAmp = rD[k+j*nStates]*rG[j+k*nStates] - iD[k+j*nStates]*iG[j+k*nStates];
+          iAmp = rD[k+j*nStates]*iG[j+k*nStates] + iD[k+j*nStates]*rG[j+k*nStates];
+          addpeak(&C,rAmp,iAmp,c1[0]*f1,c2[0]*f1);
+        }
+      }
+      break;
+
+    case 2:
+      /* Amp = T1l[ij]*G[jk]*T1r[kl]*D[li] */
+      for (j=0;j<nStates;j++) {
+        for (k=0;k<nStates;k++) {
+          f1 = El[0][j]-Er[0][k];
+          for (i=0;i<nStates;i++) {
+            rAmp0 = rT1l[i+j*nStates]*rG[j+k*nStates] - iT1l[i+j*nStates]*iG[j+k*nStates];
+            iAmp0 = rT1l[i+j*nStates]*iG[j+k*nStates] + iT1l[i+j*nStates]*rG[j+k*nStates];
+            if ((rAmp0==0) && (iAmp0==0)) continue;
+            for (l=0;l<nStates;l++) {
+              f2 = El[1][i]-Er[1][l];
+              rAmp1 = rAmp0*rT1r[k+l*nStates] - iAmp0*iT1r[k+l*nStates];
+              iAmp1 = rAmp0*iT1r[k+l*nStates] + iAmp0*rT1r[k+l*nStates];
+              rAmp = rAmp1*rD[l+i*nStates] - iAmp1*iD[l+i*nStates];
+              iAmp = rAmp1*iD[l+i*nStates] + iAmp1*rD[l+i*nStates];
+              nu1 = c1[0]*f1 + c1[1]*f2;
+              nu2 = c2[0]*f1 + c2[1]*f2;
+              addpeak(&C,rAmp,iAmp,nu1,nu2);
+            }
+          }
+        }
+      }
+      break;
+
+    case 3:
+      /* Amp = D[ni]*T2l[ij]*T1l[jk]*G[kl]*T1r[lm]*T2r[mn] */
+      for (k=0;k<nStates;k++) {
+        for (l=0;l<nStates;l++) {
+          f1 = El[0][k]-Er[0][l];
+          for (j=0;j<nStates;j++) {
+            rAmp0 = rT1l[j+k*nStates]*rG[k+l*nStates] - iT1l[j+k*nStates]*iG[k+l*nStates];
+            iAmp0 = rT1l[j+k*nStates]*iG[k+l*nStates] + iT1l[j+k*nStates]*rG[k+l*nStates];
+            if ((rAmp0==0) && (iAmp0==0)) continue;
+            for (m=0;m<nStates;m++) {
+              f2 = El[1][j]-Er[1][m];
+              rAmp1 = rAmp0*rT1r[l+m*nStates] - iAmp0*iT1r[l+m*nStates];
+              iAmp1 = rAmp0*iT1r[l+m*nStates] + iAmp0*rT1r[l+m*nStates];
+              for (i=0;i<nStates;i++) {
+                rAmp2 = rT2l[i+j*nStates]*rAmp1 - iT2l[i+j*nStates]*iAmp1;
+                iAmp2 = rT2l[i+j*nStates]*iAmp1 + iT2l[i+j*nStates]*rAmp1;
+                for (n=0;n<nStates;n++) {
+                  f3 = El[2][i]-Er[2][n];
+                  rAmp3 = rAmp2*rT2r[m+n*nStates] - iAmp2*iT2r[m+n*nStates];
+                  iAmp3 = rAmp2*iT2r[m+n*nStates] + iAmp2*rT2r[m+n*nStates];
+                  rAmp = rD[n+i*nStates]*rAmp3 - iD[n+i*nStates]*iAmp3;
+                  iAmp = rD[n+i*nStates]*iAmp3 + iD[n+i*nStates]*rAmp3;
+                  nu1 = c1[0]*f1 + c1[1]*f2 + c1[2]*f3;
+                  nu2 = c2[0]*f1 + c2[1]*f2 + c2[2]*f3;
+                  addpeak(&C,rAmp,iAmp,nu1,nu2);
+                }
+              }
+            }
+          }
+        }
+      }
+      break;
+
+    case 4:
+      /* Amp = D[pi]*T3l[ij]*T2l[jk]*T1l[kl]*G[lm]*T1r[mn]*T2r[no]*T3r[op] */
+      for (l=0;l<nStates;l++) {
+        for (m=0;m<nStates;m++) {
+          f1 = El[0][l]-Er[0][m];
+          for (k=0;k<nStates;k++) {
+            rAmp0 = rT1l[k+l*nStates]*rG[l+m*nStates] - iT1l[k+l*nStates]*iG[l+m*nStates];
+            iAmp0 = rT1l[k+l*nStates]*iG[l+m*nStates] + iT1l[k+l*nStates]*rG[l+m*nStates];
+            if ((rAmp0==0) && (iAmp0==0)) continue;
+            for (n=0;n<nStates;n++) {
+              f2 = El[1][k]-Er[1][n];
+              rAmp1 = rAmp0*rT1r[m+n*nStates] - iAmp0*iT1r[m+n*nStates];
+              iAmp1 = rAmp0*iT1r[m+n*nStates] + iAmp0*rT1r[m+n*nStates];
+              for (j=0;j<nStates;j++) {
+                rAmp2 = rT2l[j+k*nStates]*rAmp1 - iT2l[j+k*nStates]*iAmp1;
+                iAmp2 = rT2l[j+k*nStates]*iAmp1 + iT2l[j+k*nStates]*rAmp1;
+                for (o=0;o<nStates;o++) {
+                  f3 = El[2][j]-Er[2][o];
+                  rAmp3 = rAmp2*rT2r[n+o*nStates] - iAmp2*iT2r[n+o*nStates];
+                  iAmp3 = rAmp2*iT2r[n+o*nStates] + iAmp2*rT2r[n+o*nStates];
+                  for (i=0;i<nStates;i++) {
+                    rAmp4 = rT3l[i+j*nStates]*rAmp3 - iT3l[i+j*nStates]*iAmp3;
+                    iAmp4 = rT3l[i+j*nStates]*iAmp3 + iT3l[i+j*nStates]*rAmp3;
+                    for (p=0;p<nStates;p++) {
+                      f4 = El[3][i]-Er[3][p];
+                      rAmp5 = rAmp4*rT3r[o+p*nStates] - iAmp4*iT3r[o+p*nStates];
+                      iAmp5 = rAmp4*iT3r[o+p*nStates] + iAmp4*rT3r[o+p*nStates];
+                      rAmp = rD[p+i*nStates]*rAmp5 - iD[p+i*nStates]*iAmp5;
+                      iAmp = rD[p+i*nStates]*iAmp5 + iD[p+i*nStates]*rAmp5;
+                      nu1 = c1[0]*f1 + c1[1]*f2 + c1[2]*f3 + c1[3]*f4;
+                      nu2 = c2[0]*f1 + c2[1]*f2 + c2[2]*f3 + c2[3]*f4;
+                      addpeak(&C,rAmp,iAmp,nu1,nu2);
+                    }
+                  }
+                }
+              }
+            }
+          }
+        }
+      }
+      break;
+
+  }
+
+  /* evolve remaining peaks */
+  evolvechunk(&C);
+
+  /*-----------------------------------------------------------------
+     Clean up
+    ----------------------------------------------------------------- */
+  for (t=0;t<nThreads;t++) {
+    mxFree(C.rW[t]);
+    mxFree(C.iW[t]);
+  }
+  mxFree(C.rW); mxFree(C.iW);
+  mxFree(C.rAmp); mxFree(C.iAmp);
+  mxFree(C.nu1); mxFree(C.nu2);
+  mxFree(C.rZ); mxFree(C.iZ);
+  mxDestroyArray(imagZeros);
+
+}
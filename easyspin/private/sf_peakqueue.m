@@ -0,0 +1,102 @@
+% sf_peakqueue  Queue peak computations for batched binning with sf_peaks
+%
+%   Q = sf_peakqueue(Q,buffRe,buffIm,IncSchemeID,dt,idxFreeL,idxFreeR,Ea,Eb,G,D,M...)
+%   Q = sf_peakqueue(Q,buffRe,buffIm)
+%
+% Collects the arguments of sf_peaks over orientations and pathways instead
+% of binning them one at a time. Entries are grouped by incrementation
+% scheme, free evolution indices and number of states. Each group is binned
+% into buffRe and buffIm (in place, like sf_peaks) with a single batched
+% call to sf_peaks, which spreads the orientations over all threads.
+%
+% A group is binned as soon as it holds more than a fixed number of matrix
+% elements, to bound memory. Calling sf_peakqueue without sf_peaks arguments
+% bins all remaining groups. Start with Q = [], or with a structure with
+% the optional fields
+%   Threshold       amplitude threshold for peak pruning (see sf_peaks)
+%   SparseBinning   true/false, sort peaks by bin before binning
+%   CollectStats    true/false, collect sf_peaks statistics (default false)
+% Q.nKept and Q.nPruned accumulate the numbers of binned and pruned peaks.
+% With CollectStats, Q.Stats collects the statistics structures returned
+% by all batched sf_peaks calls.
+
+function Q = sf_peakqueue(Q,buffRe,buffIm,varargin)
+
+if ~isfield(Q,'Keys')
+  if ~isfield(Q,'Threshold'), Q.Threshold = 0; end
+  if ~isfield(Q,'SparseBinning'), Q.SparseBinning = false; end
+  if ~isfield(Q,'CollectStats'), Q.CollectStats = false; end
+  Q.Keys = {};
+  Q.Groups = {};
+  Q.MaxElements = 2^22;
+  Q.nKept = 0;
+  Q.nPruned = 0;
+  Q.Stats = [];
+end
+
+% Flush all groups
+if isempty(varargin)
+  for k = 1:numel(Q.Groups)
+    Q = binpeaks(Q,Q.Groups{k},buffRe,buffIm);
+  end
+  Q.Keys = {};
+  Q.Groups = {};
+  return
+end
+
+% Find group, or create new one
+[IncSchemeID,dt,idxFreeL,idxFreeR] = varargin{1:4};
+nStates = numel(varargin{5});
+key = sprintf('%d|%s|%s|%d',IncSchemeID,...
+  sprintf('%d ',idxFreeL),sprintf('%d ',idxFreeR),nStates);
+k = find(strcmp(Q.Keys,key));
+if isempty(k)
+  k = numel(Q.Keys)+1;
+  Q.Keys{k} = key;
+  Q.Groups{k} = struct('Head',{{IncSchemeID,dt,idxFreeL,idxFreeR}},...
+    'Args',{cell(numel(varargin)-4,0)},'nElements',0);
+end
+
+% Append entry
+grp = Q.Groups{k};
+args = varargin(5:end);
+args{1} = args{1}(:);
+args{2} = args{2}(:);
+grp.Args(:,end+1) = args(:);
+grp.nElements = grp.nElements + (numel(args)-2)*nStates^2;
+
+% Bin group if it has grown too large
+if grp.nElements>Q.MaxElements
+  Q = binpeaks(Q,grp,buffRe,buffIm);
+  grp.Args = cell(size(grp.Args,1),0);
+  grp.nElements = 0;
+end
+Q.Groups{k} = grp;
+
+end
+
+%-------------------------------------------------------------------------------
+function Q = binpeaks(Q,grp,buffRe,buffIm)
+
+nEntries = size(grp.Args,2);
+if nEntries==0, return; end
+
+Ea = [grp.Args{1,:}];
+Eb = [grp.Args{2,:}];
+Mat = cell(1,size(grp.Args,1)-2);
+for a = 1:numel(Mat)
+  Mat{a} = cat(3,grp.Args{a+2,:});
+end
+
+Args = {grp.Head{1},buffRe,buffIm,grp.Head{2:4},Ea,Eb,Mat{:},...
+  ones(1,nEntries),Q.Threshold,Q.SparseBinning};
+if Q.CollectStats
+  [nKept,nPruned,Stats] = sf_peaks(Args{:});
+  Q.Stats = [Q.Stats Stats];
+else
+  [nKept,nPruned] = sf_peaks(Args{:});
+end
+Q.nKept = Q.nKept + nKept;
+Q.nPruned = Q.nPruned + nPruned;
+
+end
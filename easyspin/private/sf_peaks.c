@@ -1,222 +1,622 @@
 /*
 sf_peaks(IncSchemeID,bufferRe,bufferIm,dt,idxFreeL,idxFreeR,Ea,Eb,G,D,M1p,M1m)
+sf_peaks(IncSchemeID,bufferRe,bufferIm,dt,idxFreeL,idxFreeR,Ea,Eb,G,D,M1p,M1m,Weights)
+sf_peaks(...,Weights,Threshold)
+sf_peaks(...,Weights,Threshold,Sparse)
+[nKept,nPruned] = sf_peaks(...)
+[nKept,nPruned,Stats] = sf_peaks(...)
+
+  Computes peak frequencies and amplitudes and bins them into the buffers
+  bufferRe and bufferIm (which are modified in place).
+
+  Batched mode: If the vector Weights is given as the last argument, Ea and
+  Eb contain the energies for nOrientations = numel(Weights) orientations
+  (nStates x nOrientations), and G, D and all mixing matrices are stacked
+  along the third dimension (nStates x nStates x nOrientations). The peaks
+  of each orientation are scaled by its weight before binning. The
+  orientations are distributed over all available threads, each with its
+  own private spectral buffer. These buffers are summed at the end.
+
+  Threshold: Peaks with amplitude magnitudes below Threshold are dropped,
+  and inner loops are skipped as soon as a partial amplitude falls below
+  it. Default is 0 (no pruning).
+  Sparse: If true, peaks are first collected in a list, which is sorted by
+  bin before being added to the buffers. Default is false.
+  nKept and nPruned are the numbers of binned and dropped peaks.
+  Stats is a structure with the peak counts, the sizes of the spectral
+  buffer, the binning workspace and the peak list, the number of list
+  flushes, the number of orientations computed with grouped contractions
+  (schemes 12, 14 and 15 without Threshold and Sparse), and the wall
+  times of the setup, peak and reduction phases.
  */
 
 #include "mex.h"
 #include <math.h>
+#include <stdlib.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "cpuinfo.h"
+#include "kernelstats.h"
 
-/*===================================================================*/
-void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
-{
-  int nPeaks, nStates, nPoints1, nPoints2, nFreeEvolutions, nDimensions;
-  double *rG, *iG, *rD, *iD, *rT1l, *iT1l, *rT1r, *iT1r;
-  double *rT2l, *iT2l, *rT2r, *iT2r, *rT3l, *iT3l, *rT3r, *iT3r;
-  double *Ea, *Eb, *E1left, *E1right, *E2left, *E2right, *E3left, *E3right, *E4left, *E4right;
-  double rAmp, iAmp, rAmp0,iAmp0, rAmp1, iAmp1, rAmp2, iAmp2, rAmp3, iAmp3, rAmp4, iAmp4, rAmp5, iAmp5;
-  double *rSpec, *iSpec;
+/* maximum number of elements in per-thread bin index tables */
+#ifndef MAX_BINTABLE
+#define MAX_BINTABLE (1L<<24)
+#endif
+
+/* minimum number of peaks in the per-thread list in sparse mode */
+#define MIN_PEAKLIST (1L<<16)
+
+/* Incrementation scheme settings, common to all orientations */
+struct IncScheme {
+  int ID;
+  int nStates, nPoints1, nPoints2;
+  double dt1, dt2;
   double *freeL, *freeR;
-  double id1, id2, nu, nu1_, nu2_;
-  int idx, *nu1, *nu2;
+  long nWork; /* number of elements in the binning workspaces */
+};
 
-  int a;
-  mxArray *imagZeros;
+/* Energies, start and detection coherence matrices and mixing matrices
+   for one orientation */
+struct PeakData {
+  double *Ea, *Eb;
+  double *rG, *iG, *rD, *iD;
+  double *rT1l, *iT1l, *rT2l, *iT2l, *rT3l, *iT3l;
+  double *rT1r, *iT1r, *rT2r, *iT2r, *rT3r, *iT3r;
+};
 
-  int IncSchemeID;
-  int i, j, k, l, ij, jk, kl, li, kj, il;
-  int m, n, o, p, lm, mn, no, op, pi, ni;
-  double *dt, dt1, dt2;
-  
-  /*-----------------------------------------------------------------
-     Check number of input and output arguments
-    ----------------------------------------------------------------- */
-  if (nrhs<10)
-    mexErrMsgTxt("Insufficient number of input arguments.");
-  
-  /*-----------------------------------------------------------------
-     Read input arguments
-    ----------------------------------------------------------------- */
+/* Peak accumulator of one thread: spectral buffers, amplitude threshold,
+   optional list of peaks sorted by bin before binning, and peak counts */
+struct PeakAcc {
+  double *rSpec, *iSpec;
+  long nSpec;
+  double Threshold;
+  int Sparse;
+  long nList, maxList;
+  int *listIdx, *sortIdx;
+  double *listRe, *listIm, *sortRe, *sortIm;
+  long *binCount;
+  long nKept, nPruned, nFlushes, nGrouped;
+};
 
-  a = 0;
-  /* IncSchemeID ... identifies the incrementation scheme */
-  /*    1    [1]         */
-  /*    2    [1 1]       */
-  /*   11    [1 2]       */
-  IncSchemeID = mxGetScalar(prhs[a]);
-  if (mxGetNumberOfElements(prhs[a])!=1)
-    mexErrMsgTxt("IncSchemeID must be a scalar!");
-  switch (IncSchemeID) {
-    case  1: nFreeEvolutions = 1; nDimensions = 1; break;
-    case  2: nFreeEvolutions = 2; nDimensions = 1; break;
-    case  3: nFreeEvolutions = 2; nDimensions = 1; break;
-    case 11: nFreeEvolutions = 2; nDimensions = 2; break;
-    case 12: nFreeEvolutions = 3; nDimensions = 2; break;
-    case 13: nFreeEvolutions = 3; nDimensions = 2; break;
-    case 14: nFreeEvolutions = 3; nDimensions = 2; break;
-    case 15: nFreeEvolutions = 4; nDimensions = 2; break;
-    case 17: nFreeEvolutions = 4; nDimensions = 2; break;
-    default: mexErrMsgTxt("Unrecognized incrementation scheme.");
+/*===================================================================*/
+/* Sorts the peaks in the list by bin index (counting sort) and adds
+   them to the spectral buffers in one sequential sweep */
+void flushpeaks(struct PeakAcc *Acc)
+{
+  long p, q, b;
+
+  if (Acc->nList==0) return;
+  Acc->nFlushes++;
+  for (b=0;b<=Acc->nSpec+1;b++) Acc->binCount[b] = 0;
+  for (p=0;p<Acc->nList;p++) Acc->binCount[Acc->listIdx[p]+1]++;
+  for (b=0;b<=Acc->nSpec;b++) Acc->binCount[b+1] += Acc->binCount[b];
+  for (p=0;p<Acc->nList;p++) {
+    q = Acc->binCount[Acc->listIdx[p]]++;
+    Acc->sortIdx[q] = Acc->listIdx[p];
+    Acc->sortRe[q] = Acc->listRe[p];
+    Acc->sortIm[q] = Acc->listIm[p];
   }
-  
-  a++;
-  /* Spec: spectral storage array */
-  rSpec = mxGetPr(prhs[a]);
-  if (nDimensions==1) {
-    nPoints1 = mxGetM(prhs[a]);
-    if (nPoints1==1) nPoints1 = mxGetN(prhs[a]);
-    nPoints2 = 1;
+  for (q=0;q<Acc->nList;q++) {
+    Acc->rSpec[Acc->sortIdx[q]] += Acc->sortRe[q];
+    Acc->iSpec[Acc->sortIdx[q]] += Acc->sortIm[q];
+  }
+  Acc->nList = 0;
+}
+
+/*===================================================================*/
+/* Bins one peak, or collects it in the peak list in sparse mode.
+   Peaks with amplitudes below the threshold are dropped. */
+void addpeak(struct PeakAcc *Acc, int idx, double rAmp, double iAmp)
+{
+  if ((Acc->Threshold>0) && (rAmp*rAmp+iAmp*iAmp<Acc->Threshold*Acc->Threshold)) {
+    Acc->nPruned++;
+    return;
+  }
+  Acc->nKept++;
+  if (Acc->Sparse) {
+    Acc->listIdx[Acc->nList] = idx;
+    Acc->listRe[Acc->nList] = rAmp;
+    Acc->listIm[Acc->nList] = iAmp;
+    Acc->nList++;
+    if (Acc->nList==Acc->maxList) flushpeaks(Acc);
   }
   else {
-    nPoints1 = mxGetM(prhs[a]);
-    nPoints2 = mxGetN(prhs[a]);
+    Acc->rSpec[idx] += rAmp;
+    Acc->iSpec[idx] += iAmp;
   }
+}
 
-  a++;
-  /* Spec: spectral storage array */
-  iSpec = mxGetPr(prhs[a]);
-  if (mxGetNumberOfElements(prhs[a])!=nPoints1*nPoints2)
-      mexErrMsgTxt("buffIm has wrong number of elements!");
+/*===================================================================*/
+/* Bin index of the frequency nu along a dimension with nPoints points
+   and time step dt. The - sign accounts for the fact that the quantum
+   evolution goes with (-omega_ij)t, but Fourier theory uses (+omega_ij)t. */
+static int freqbin(double nu, double dt, int nPoints)
+{
+  double id = fmod(-nu*dt,1.0)*nPoints;
+  if (id>=0) id = floor(id);
+  else { id = ceil(id); if (id<0) id += nPoints; }
+  return id;
+}
 
-  
-  a++;
-  /* dt ... time increment */
-  dt = mxGetPr(prhs[a]);
-  if (mxGetNumberOfElements(prhs[a])!=nDimensions)
-      mexErrMsgTxt("dt has wrong number of elements!");
-  dt1 = dt[0];
-  if (nDimensions==2) dt2 = dt[1];
-    
+/*===================================================================*/
+/* Grouped contractions for schemes 12, 14 and 15 (no threshold, no
+   peak list). The peaks are not computed one by one. Instead, index
+   pairs whose frequency contributes to only one dimension are grouped
+   by the bin they reach, and the amplitudes of a group are summed with
+   partial amplitude tensors before binning. The binned spectrum is the
+   same as with the loops in binpeaks, up to rounding.
+   Each function returns 0, 1 if grouping would not save operations
+   (or memory could not be allocated), so that binpeaks falls back to
+   the loops over all peaks, or a negative error code as binpeaks. */
 
-  a++;
-  /* freeL ... index for left-side propagators (1=alpha,2=beta) */
-  freeL = mxGetPr(prhs[a]);
-  if (mxGetNumberOfElements(prhs[a])!=nFreeEvolutions)
-    mexErrMsgTxt("Wrong number of left evolution intervals.");
-  
-  a++;
-  /* freeR ... index for right-side propagators (1=alpha,2=beta) */
-  freeR = mxGetPr(prhs[a]);
-  if (mxGetNumberOfElements(prhs[a])!=nFreeEvolutions)
-    mexErrMsgTxt("Wrong number of right evolution intervals.");
+/* Scheme 12: Amp = D[ni]*T2l[ij]*T1l[jk]*G[kl]*T1r[lm]*T2r[mn], with
+   the second-dimension bin depending only on (j,m). For each j, the m
+   are grouped into pairs q = (j,bin), and
+     RB[nl,q] = sum over m in q of T1r[lm]*T2r[mn]
+     L[ik,j] = T2l[ij]*T1l[jk]
+   so that each (k,l,i,n) needs nStates+nPairs instead of nStates^2
+   operations. */
+SIMD_CLONES
+static int group12(const struct IncScheme *Inc, const struct PeakData *Data,
+                   struct PeakAcc *Acc,
+                   const double *E1left, const double *E1right,
+                   const double *E2left, const double *E2right,
+                   const double *E3left, const double *E3right)
+{
+  const int nStates = Inc->nStates, nPoints1 = Inc->nPoints1, nPoints2 = Inc->nPoints2;
+  const long nStates2 = (long)nStates*nStates;
+  const double *rG = Data->rG, *iG = Data->iG, *rD = Data->rD, *iD = Data->iD;
+  const double *rT1l = Data->rT1l, *iT1l = Data->iT1l, *rT1r = Data->rT1r, *iT1r = Data->iT1r;
+  const double *rT2l = Data->rT2l, *iT2l = Data->iT2l, *rT2r = Data->rT2r, *iT2r = Data->iT2r;
+  double *rSpec = Acc->rSpec, *iSpec = Acc->iSpec;
+  double *rL = NULL, *iL = NULL, *rRB = NULL, *iRB = NULL;
+  int *pairOf, *pairBin, *pairStart, *slot;
+  int i, j, k, l, m, n, q, id1, id2, idx, nPairs, status;
+  long ij, jk, kl, lm, mn, ni, nl, b;
+  double rAmp0, iAmp0, rAmp1, iAmp1, rT, iT, nStates4;
 
-  a++;
-  /* Ea ... energies for alpha manifold */
-  Ea = mxGetPr(prhs[a]);
-  if (mxIsComplex(prhs[a])) mexErrMsgTxt("Ea must be real!");
-  nStates = mxGetNumberOfElements(prhs[a]);
-  
-  a++;
-  /* Eb ... energies for beta manifold */
-  Eb = mxGetPr(prhs[a]);
-  if (mxIsComplex(prhs[a])) mexErrMsgTxt("Eb must be real!");
-  if (nStates!=mxGetNumberOfElements(prhs[a])) 
-    mexErrMsgTxt("Ea and Eb must have the same number of elements.");
+  pairOf = (int*)malloc(nStates2*sizeof(int));
+  pairBin = (int*)malloc(nStates2*sizeof(int));
+  pairStart = (int*)malloc((nStates+1)*sizeof(int));
+  slot = (int*)malloc(nPoints2*sizeof(int));
+  status = 1;
+  if ((pairOf==NULL)||(pairBin==NULL)||(pairStart==NULL)||(slot==NULL)) goto done;
 
-  imagZeros = mxCreateDoubleMatrix(nStates,nStates,mxREAL);
-  
-  a++;
-  /* G ... Start coherence matrix */
-  if (mxGetNumberOfElements(prhs[a])!=nStates*nStates)
-    mexErrMsgTxt("G has wrong size!");
-  rG = mxGetPr(prhs[a]);
-  iG = mxIsComplex(prhs[a]) ? mxGetPi(prhs[a]) : mxGetPr(imagZeros);
-  
-  a++;
-  /* D ... detection matrix */
-  if (mxGetNumberOfElements(prhs[a])!=nStates*nStates)
-    mexErrMsgTxt("D has wrong size!");
-  rD = mxGetPr(prhs[a]);
-  iD = mxIsComplex(prhs[a]) ? mxGetPi(prhs[a]) : mxGetPr(imagZeros);
-  
-  /* get mixing matrices if necessary */
-  if (nFreeEvolutions==2) {
-    
-    if (nrhs!=12) mexErrMsgTxt("Wrong number of input arguments.");
-    
-    /* T1l, T1r ... mixing matrices */
-    a++;
-    if (mxGetNumberOfElements(prhs[a])!=nStates*nStates)
-      mexErrMsgTxt("M1l has wrong size!");
-    rT1l = mxGetPr(prhs[a]);
-    iT1l = mxIsComplex(prhs[a]) ? mxGetPi(prhs[a]) : mxGetPr(imagZeros);
-    a++;
-    if (mxGetNumberOfElements(prhs[a])!=nStates*nStates)
-      mexErrMsgTxt("M1r has wrong size!");
-    rT1r = mxGetPr(prhs[a]);
-    iT1r = mxIsComplex(prhs[a]) ? mxGetPi(prhs[a]) : mxGetPr(imagZeros);
+  /* pairs (j,bin) along the second dimension, nu2 = E2l[j]-E2r[m] */
+  for (b=0;b<nPoints2;b++) slot[b] = -1;
+  nPairs = 0;
+  for (j=0;j<nStates;j++) {
+    pairStart[j] = nPairs;
+    for (m=0;m<nStates;m++) {
+      id2 = freqbin(E2left[j]-E2right[m],Inc->dt2,nPoints2);
+      if ((id2<0)||(id2>=nPoints2)) { status = -1; goto done; }
+      if (slot[id2]<0) {
+        slot[id2] = nPairs;
+        pairBin[nPairs++] = id2;
+      }
+      pairOf[j+m*nStates] = slot[id2];
+    }
+    for (q=pairStart[j];q<nPairs;q++) slot[pairBin[q]] = -1;
   }
-  else if (nFreeEvolutions==1) {
-    if (nrhs!=10) mexErrMsgTxt("Wrong number of input arguments.");
+  pairStart[nStates] = nPairs;
+
+  nStates4 = (double)nStates2*nStates2;
+  if ((nStates+nPairs+1)*nStates4>0.5*nStates4*nStates2) goto done;
+  if (nStates2*nPairs>MAX_BINTABLE) goto done;
+
+  rL = (double*)malloc(nStates2*nStates*sizeof(double));
+  iL = (double*)malloc(nStates2*nStates*sizeof(double));
+  rRB = (double*)calloc(nStates2*nPairs,sizeof(double));
+  iRB = (double*)calloc(nStates2*nPairs,sizeof(double));
+  if ((rL==NULL)||(iL==NULL)||(rRB==NULL)||(iRB==NULL)) goto done;
+
+  /* L[j+nStates*(i+nStates*k)] = T2l[ij]*T1l[jk] */
+  for (k=0;k<nStates;k++)
+    for (i=0;i<nStates;i++)
+      for (j=0;j<nStates;j++) {
+        ij = i+j*nStates;
+        jk = j+k*nStates;
+        b = j+nStates*(i+nStates*k);
+        rL[b] = rT2l[ij]*rT1l[jk] - iT2l[ij]*iT1l[jk];
+        iL[b] = rT2l[ij]*iT1l[jk] + iT2l[ij]*rT1l[jk];
+      }
+
+  /* RB[q+nPairs*(n+nStates*l)] = sum over m in q of T1r[lm]*T2r[mn] */
+  for (l=0;l<nStates;l++)
+    for (n=0;n<nStates;n++) {
+      nl = nPairs*(n+nStates*(long)l);
+      for (m=0;m<nStates;m++) {
+        lm = l+m*nStates;
+        mn = m+n*nStates;
+        rT = rT1r[lm]*rT2r[mn] - iT1r[lm]*iT2r[mn];
+        iT = rT1r[lm]*iT2r[mn] + iT1r[lm]*rT2r[mn];
+        for (j=0;j<nStates;j++) {
+          q = pairOf[j+m*nStates];
+          rRB[nl+q] += rT;
+          iRB[nl+q] += iT;
+        }
+      }
+    }
+
+  /* bin the pairs for each (k,l,i,n) */
+  for (k=0;k<nStates;k++) {
+    for (l=0;l<nStates;l++) {
+      kl = k+l*nStates;
+      for (i=0;i<nStates;i++) {
+        for (n=0;n<nStates;n++) {
+          const double *rLp = rL+nStates*(i+nStates*(long)k), *iLp = iL+nStates*(i+nStates*(long)k);
+          const double *rRp = rRB+nPairs*(n+nStates*(long)l), *iRp = iRB+nPairs*(n+nStates*(long)l);
+          ni = n+i*nStates;
+          /* nu1 = E1l[k]-E1r[l] + E3l[i]-E3r[n] */
+          id1 = freqbin((E1left[k]-E1right[l]) + (E3left[i]-E3right[n]),Inc->dt1,nPoints1);
+          if ((id1<0)||(id1>=nPoints1)) { status = -1; goto done; }
+          /* Amp0 = D[ni]*G[kl] */
+          rAmp0 = rD[ni]*rG[kl] - iD[ni]*iG[kl];
+          iAmp0 = rD[ni]*iG[kl] + iD[ni]*rG[kl];
+          for (j=0;j<nStates;j++) {
+            rAmp1 = rAmp0*rLp[j] - iAmp0*iLp[j];
+            iAmp1 = rAmp0*iLp[j] + iAmp0*rLp[j];
+            for (q=pairStart[j];q<pairStart[j+1];q++) {
+              idx = id1 + pairBin[q]*nPoints1;
+              rSpec[idx] += rAmp1*rRp[q] - iAmp1*iRp[q];
+              iSpec[idx] += rAmp1*iRp[q] + iAmp1*rRp[q];
+            }
+          }
+        }
+      }
+    }
   }
-  else if (nFreeEvolutions==4) {
-    if (nrhs!=16) mexErrMsgTxt("Wrong number of input arguments.");
+  Acc->nKept += (long)nStates4*nStates2;
+  status = 0;
 
-    a++;
-    if (mxGetNumberOfElements(prhs[a])!=nStates*nStates)
-      mexErrMsgTxt("M1l has wrong size!");
-    rT1l = mxGetPr(prhs[a]);
-    iT1l = mxIsComplex(prhs[a]) ? mxGetPi(prhs[a]) : mxGetPr(imagZeros);
-    
-    a++;
-    if (mxGetNumberOfElements(prhs[a])!=nStates*nStates)
-      mexErrMsgTxt("M2l has wrong size!");
-    rT2l = mxGetPr(prhs[a]);
-    iT2l = mxIsComplex(prhs[a]) ? mxGetPi(prhs[a]) : mxGetPr(imagZeros);
-    
-    a++;
-    if (mxGetNumberOfElements(prhs[a])!=nStates*nStates)
-      mexErrMsgTxt("M3l has wrong size!");
-    rT3l = mxGetPr(prhs[a]);
-    iT3l = mxIsComplex(prhs[a]) ? mxGetPi(prhs[a]) : mxGetPr(imagZeros);
-    
-    a++;
-    if (mxGetNumberOfElements(prhs[a])!=nStates*nStates)
-      mexErrMsgTxt("M1r has wrong size!");
-    rT1r = mxGetPr(prhs[a]);
-    iT1r = mxIsComplex(prhs[a]) ? mxGetPi(prhs[a]) : mxGetPr(imagZeros);
-    
-    a++;
-    if (mxGetNumberOfElements(prhs[a])!=nStates*nStates)
-      mexErrMsgTxt("M2r has wrong size!");
-    rT2r = mxGetPr(prhs[a]);
-    iT2r = mxIsComplex(prhs[a]) ? mxGetPi(prhs[a]) : mxGetPr(imagZeros);
-    
-    a++;
-    if (mxGetNumberOfElements(prhs[a])!=nStates*nStates)
-      mexErrMsgTxt("M3r has wrong size!");
-    rT3r = mxGetPr(prhs[a]);
-    iT3r = mxIsComplex(prhs[a]) ? mxGetPi(prhs[a]) : mxGetPr(imagZeros);
+done:
+  free(iRB); free(rRB); free(iL); free(rL);
+  free(slot); free(pairStart); free(pairBin); free(pairOf);
+  return status;
+}
+
+/* Scheme 14: Amp = D[ni]*T2l[ij]*T1l[jk]*G[kl]*T1r[lm]*T2r[mn], with
+   the second-dimension bin depending only on (i,n). The (i,n) are
+   grouped by bin g, and
+     W[jm,g] = sum over (i,n) in g of D[ni]*T2l[ij]*T2r[mn]
+   so that the spectrum needs nStates^4*nGroups operations. */
+SIMD_CLONES
+static int group14(const struct IncScheme *Inc, const struct PeakData *Data,
+                   struct PeakAcc *Acc,
+                   const double *E1left, const double *E1right,
+                   const double *E2left, const double *E2right,
+                   const double *E3left, const double *E3right)
+{
+  const int nStates = Inc->nStates, nPoints1 = Inc->nPoints1, nPoints2 = Inc->nPoints2;
+  const long nStates2 = (long)nStates*nStates;
+  const double *rG = Data->rG, *iG = Data->iG, *rD = Data->rD, *iD = Data->iD;
+  const double *rT1l = Data->rT1l, *iT1l = Data->iT1l, *rT1r = Data->rT1r, *iT1r = Data->iT1r;
+  const double *rT2l = Data->rT2l, *iT2l = Data->iT2l, *rT2r = Data->rT2r, *iT2r = Data->iT2r;
+  double *rSpec = Acc->rSpec, *iSpec = Acc->iSpec;
+  double *rW = NULL, *iW = NULL;
+  int *groupOf, *groupBin, *slot;
+  int i, j, k, l, m, n, g, id1, id2, idx, nGroups, status;
+  long ij, jk, kl, lm, mn, ni, w, b;
+  double rAmp0, iAmp0, rAmp1, iAmp1, rAmp2, iAmp2, nStates4;
+
+  groupOf = (int*)malloc(nStates2*sizeof(int));
+  groupBin = (int*)malloc(nStates2*sizeof(int));
+  slot = (int*)malloc(nPoints2*sizeof(int));
+  status = 1;
+  if ((groupOf==NULL)||(groupBin==NULL)||(slot==NULL)) goto done;
+
+  /* groups of (i,n) along the second dimension, nu2 = E3l[i]-E3r[n] */
+  for (b=0;b<nPoints2;b++) slot[b] = -1;
+  nGroups = 0;
+  for (i=0;i<nStates;i++)
+    for (n=0;n<nStates;n++) {
+      id2 = freqbin(E3left[i]-E3right[n],Inc->dt2,nPoints2);
+      if ((id2<0)||(id2>=nPoints2)) { status = -1; goto done; }
+      if (slot[id2]<0) {
+        slot[id2] = nGroups;
+        groupBin[nGroups++] = id2;
+      }
+      groupOf[n+i*nStates] = slot[id2];
+    }
+
+  nStates4 = (double)nStates2*nStates2;
+  if ((nGroups+2)*nStates4>0.5*nStates4*nStates2) goto done;
+  if (nStates2*nGroups>MAX_BINTABLE) goto done;
+
+  rW = (double*)calloc(nStates2*nGroups,sizeof(double));
+  iW = (double*)calloc(nStates2*nGroups,sizeof(double));
+  if ((rW==NULL)||(iW==NULL)) goto done;
+
+  /* W[g+nGroups*(j+nStates*m)] */
+  for (i=0;i<nStates;i++)
+    for (n=0;n<nStates;n++) {
+      ni = n+i*nStates;
+      g = groupOf[ni];
+      for (j=0;j<nStates;j++) {
+        ij = i+j*nStates;
+        /* Amp0 = D[ni]*T2l[ij] */
+        rAmp0 = rD[ni]*rT2l[ij] - iD[ni]*iT2l[ij];
+        iAmp0 = rD[ni]*iT2l[ij] + iD[ni]*rT2l[ij];
+        for (m=0;m<nStates;m++) {
+          mn = m+n*nStates;
+          w = g+nGroups*(j+nStates*(long)m);
+          rW[w] += rAmp0*rT2r[mn] - iAmp0*iT2r[mn];
+          iW[w] += rAmp0*iT2r[mn] + iAmp0*rT2r[mn];
+        }
+      }
+    }
+
+  for (k=0;k<nStates;k++) {
+    for (l=0;l<nStates;l++) {
+      kl = k+l*nStates;
+      for (j=0;j<nStates;j++) {
+        jk = j+k*nStates;
+        /* Amp0 = T1l[jk]*G[kl] */
+        rAmp0 = rT1l[jk]*rG[kl] - iT1l[jk]*iG[kl];
+        iAmp0 = rT1l[jk]*iG[kl] + iT1l[jk]*rG[kl];
+        for (m=0;m<nStates;m++) {
+          const double *rWp = rW+nGroups*(j+nStates*(long)m), *iWp = iW+nGroups*(j+nStates*(long)m);
+          lm = l+m*nStates;
+          /* Amp1 = Amp0*T1r[lm] */
+          rAmp1 = rAmp0*rT1r[lm] - iAmp0*iT1r[lm];
+          iAmp1 = rAmp0*iT1r[lm] + iAmp0*rT1r[lm];
+          /* nu1 = E1l[k]-E1r[l]+E2l[j]-E2r[m] */
+          id1 = freqbin((E1left[k]-E1right[l]) + (E2left[j]-E2right[m]),Inc->dt1,nPoints1);
+          if ((id1<0)||(id1>=nPoints1)) { status = -1; goto done; }
+          for (g=0;g<nGroups;g++) {
+            idx = id1 + groupBin[g]*nPoints1;
+            rAmp2 = rAmp1*rWp[g] - iAmp1*iWp[g];
+            iAmp2 = rAmp1*iWp[g] + iAmp1*rWp[g];
+            rSpec[idx] += rAmp2;
+            iSpec[idx] += iAmp2;
+          }
+        }
+      }
+    }
   }
-  else if (nFreeEvolutions==3) {
-    if (nrhs!=14) mexErrMsgTxt("Wrong number of input arguments.");
+  Acc->nKept += (long)nStates4*nStates2;
+  status = 0;
 
-    a++;
-    if (mxGetNumberOfElements(prhs[a])!=nStates*nStates)
-      mexErrMsgTxt("M1l has wrong size!");
-    rT1l = mxGetPr(prhs[a]);
-    iT1l = mxIsComplex(prhs[a]) ? mxGetPi(prhs[a]) : mxGetPr(imagZeros);
-    
-    a++;
-    if (mxGetNumberOfElements(prhs[a])!=nStates*nStates)
-      mexErrMsgTxt("M2l has wrong size!");
-    rT2l = mxGetPr(prhs[a]);
-    iT2l = mxIsComplex(prhs[a]) ? mxGetPi(prhs[a]) : mxGetPr(imagZeros);
-    
-    a++;
-    if (mxGetNumberOfElements(prhs[a])!=nStates*nStates)
-      mexErrMsgTxt("M1r has wrong size!");
-    rT1r = mxGetPr(prhs[a]);
-    iT1r = mxIsComplex(prhs[a]) ? mxGetPi(prhs[a]) : mxGetPr(imagZeros);
-    
-    a++;
-    if (mxGetNumberOfElements(prhs[a])!=nStates*nStates)
-      mexErrMsgTxt("M2r has wrong size!");
-    rT2r = mxGetPr(prhs[a]);
-    iT2r = mxIsComplex(prhs[a]) ? mxGetPi(prhs[a]) : mxGetPr(imagZeros);
+done:
+  free(iW); free(rW);
+  free(slot); free(groupBin); free(groupOf);
+  return status;
+}
+
+/* Scheme 15: Amp = D[pi]*T3l[ij]*T2l[jk]*T1l[kl]*G[lm]*T1r[mn]*T2r[no]*T3r[op],
+   with the first-dimension bin depending on (l,m,i,p) and the second on
+   (k,n,j,o). For each (i,p), the (l,m) are grouped by first-dimension
+   bin s and, for each (k,n), the (j,o) by second-dimension bin t:
+     U[kn,s] = sum over (l,m) in s of D[pi]*G[lm]*T1l[kl]*T1r[mn]
+     Z[kn,t] = sum over (j,o) in t of T3l[ij]*T2l[jk]*T2r[no]*T3r[op]
+   and the spectrum at (s,t) is incremented by the sum over kn of
+   U[kn,s]*Z[kn,t], accumulated in the dense block C for each (i,p).
+   This needs about nStates^4*nBins1*nBins2 instead of nStates^8
+   operations. bins2 is the table of second-dimension bins
+   computed in binpeaks. */
+SIMD_CLONES
+static int group15(const struct IncScheme *Inc, const struct PeakData *Data,
+                   struct PeakAcc *Acc, const int *bins2,
+                   const double *E1left, const double *E1right,
+                   const double *E4left, const double *E4right)
+{
+  const int nStates = Inc->nStates, nPoints1 = Inc->nPoints1, nPoints2 = Inc->nPoints2;
+  const long nStates2 = (long)nStates*nStates;
+  const double *rG = Data->rG, *iG = Data->iG, *rD = Data->rD, *iD = Data->iD;
+  const double *rT1l = Data->rT1l, *iT1l = Data->iT1l, *rT1r = Data->rT1r, *iT1r = Data->iT1r;
+  const double *rT2l = Data->rT2l, *iT2l = Data->iT2l, *rT2r = Data->rT2r, *iT2r = Data->iT2r;
+  const double *rT3l = Data->rT3l, *iT3l = Data->iT3l, *rT3r = Data->rT3r, *iT3r = Data->iT3r;
+  double *rSpec = Acc->rSpec, *iSpec = Acc->iSpec;
+  double *rU, *iU, *rX, *iX, *rY, *iY, *rZ, *iZ, *rC, *iC;
+  int *slot1, *slot2, *binOf, *bin1, *bin2, *rows;
+  char *rowUsed;
+  int i, j, k, l, m, n, o, p, s, t, id1, nBins1, nBins2, nRows, maxBins1, maxBins2, status;
+  long ij, jk, kl, lm, mn, no, op, pi, kn, b;
+  double rAmp0, iAmp0, rAmp1, iAmp1, rV, iV, nStates4, cost;
+
+  maxBins1 = (nStates2<nPoints1) ? nStates2 : nPoints1;
+  maxBins2 = (nStates2<nPoints2) ? nStates2 : nPoints2;
+  nStates4 = (double)nStates2*nStates2;
+  cost = nStates2*(3*nStates4 + (double)nStates2*maxBins1*maxBins2);
+  if (cost>0.5*nStates4*nStates4) return 1;
+  if ((nStates2+nPoints2)*(long)maxBins1>MAX_BINTABLE) return 1;
+
+  rU = (double*)malloc(nStates2*maxBins1*sizeof(double));
+  iU = (double*)malloc(nStates2*maxBins1*sizeof(double));
+  rX = (double*)malloc(nStates2*sizeof(double));
+  iX = (double*)malloc(nStates2*sizeof(double));
+  rY = (double*)malloc(nStates2*sizeof(double));
+  iY = (double*)malloc(nStates2*sizeof(double));
+  rZ = (double*)malloc(maxBins2*sizeof(double));
+  iZ = (double*)malloc(maxBins2*sizeof(double));
+  slot1 = (int*)malloc(nPoints1*sizeof(int));
+  slot2 = (int*)malloc(nPoints2*sizeof(int));
+  binOf = (int*)malloc(nStates2*sizeof(int));
+  bin1 = (int*)malloc(maxBins1*sizeof(int));
+  bin2 = (int*)malloc(maxBins2*sizeof(int));
+  rC = (double*)calloc((long)maxBins1*nPoints2,sizeof(double));
+  iC = (double*)calloc((long)maxBins1*nPoints2,sizeof(double));
+  rows = (int*)malloc(nPoints2*sizeof(int));
+  rowUsed = (char*)calloc(nPoints2,sizeof(char));
+  status = 1;
+  if ((rU==NULL)||(iU==NULL)||(rX==NULL)||(iX==NULL)||(rY==NULL)||(iY==NULL)||
+      (rZ==NULL)||(iZ==NULL)||(slot1==NULL)||(slot2==NULL)||(binOf==NULL)||
+      (bin1==NULL)||(bin2==NULL)||(rC==NULL)||(iC==NULL)||(rows==NULL)||
+      (rowUsed==NULL)) goto done;
+  nRows = 0;
+  for (b=0;b<nPoints1;b++) slot1[b] = -1;
+  for (b=0;b<nPoints2;b++) slot2[b] = -1;
+
+  for (i=0;i<nStates;i++) {
+    for (p=0;p<nStates;p++) {
+      pi = p+i*nStates;
+
+      /* groups of (l,m) along the first dimension,
+         nu1 = E1l[l]-E1r[m]+E4l[i]-E4r[p] */
+      nBins1 = 0;
+      for (l=0;l<nStates;l++)
+        for (m=0;m<nStates;m++) {
+          id1 = freqbin((E1left[l]-E1right[m]) + (E4left[i]-E4right[p]),Inc->dt1,nPoints1);
+          if ((id1<0)||(id1>=nPoints1)) { status = -3; goto done; }
+          if (slot1[id1]<0) {
+            slot1[id1] = nBins1;
+            bin1[nBins1++] = id1;
+          }
+          binOf[l+m*nStates] = slot1[id1];
+        }
+      for (s=0;s<nBins1;s++) slot1[bin1[s]] = -1;
+
+      /* U[s+nBins1*(k+nStates*n)] */
+      for (b=0;b<nStates2*nBins1;b++) rU[b] = iU[b] = 0;
+      for (l=0;l<nStates;l++)
+        for (m=0;m<nStates;m++) {
+          lm = l+m*nStates;
+          s = binOf[lm];
+          /* Amp0 = D[pi]*G[lm] */
+          rAmp0 = rD[pi]*rG[lm] - iD[pi]*iG[lm];
+          iAmp0 = rD[pi]*iG[lm] + iD[pi]*rG[lm];
+          for (k=0;k<nStates;k++) {
+            kl = k+l*nStates;
+            /* Amp1 = Amp0*T1l[kl] */
+            rAmp1 = rAmp0*rT1l[kl] - iAmp0*iT1l[kl];
+            iAmp1 = rAmp0*iT1l[kl] + iAmp0*rT1l[kl];
+            for (n=0;n<nStates;n++) {
+              mn = m+n*nStates;
+              b = s+nBins1*(k+nStates*(long)n);
+              rU[b] += rAmp1*rT1r[mn] - iAmp1*iT1r[mn];
+              iU[b] += rAmp1*iT1r[mn] + iAmp1*rT1r[mn];
+            }
+          }
+        }
+
+      /* X[j+nStates*k] = T3l[ij]*T2l[jk], Y[o+nStates*n] = T2r[no]*T3r[op] */
+      for (k=0;k<nStates;k++)
+        for (j=0;j<nStates;j++) {
+          ij = i+j*nStates;
+          jk = j+k*nStates;
+          rX[jk] = rT3l[ij]*rT2l[jk] - iT3l[ij]*iT2l[jk];
+          iX[jk] = rT3l[ij]*iT2l[jk] + iT3l[ij]*rT2l[jk];
+        }
+      for (n=0;n<nStates;n++)
+        for (o=0;o<nStates;o++) {
+          no = n+o*nStates;
+          op = o+p*nStates;
+          rY[o+n*nStates] = rT2r[no]*rT3r[op] - iT2r[no]*iT3r[op];
+          iY[o+n*nStates] = rT2r[no]*iT3r[op] + iT2r[no]*rT3r[op];
+        }
+
+      for (k=0;k<nStates;k++) {
+        for (n=0;n<nStates;n++) {
+          const int *bins2kn = bins2 + nStates2*(n+nStates*(long)k);
+          const double *rUp, *iUp;
+          kn = k+n*nStates;
+
+          /* Z over groups of (j,o) along the second dimension */
+          nBins2 = 0;
+          for (j=0;j<nStates;j++) {
+            jk = j+k*nStates;
+            for (o=0;o<nStates;o++) {
+              const int id2 = bins2kn[o+nStates*j]/nPoints1;
+              rV = rX[jk]*rY[o+n*nStates] - iX[jk]*iY[o+n*nStates];
+              iV = rX[jk]*iY[o+n*nStates] + iX[jk]*rY[o+n*nStates];
+              t = slot2[id2];
+              if (t<0) {
+                t = slot2[id2] = nBins2;
+                bin2[nBins2++] = id2;
+                rZ[t] = iZ[t] = 0;
+              }
+              rZ[t] += rV;
+              iZ[t] += iV;
+            }
+          }
+
+          /* C(s,t) += U[kn,s]*Z[kn,t] */
+          rUp = rU + nBins1*kn;
+          iUp = iU + nBins1*kn;
+          for (t=0;t<nBins2;t++) {
+            double *rCp = rC + (long)bin2[t]*nBins1, *iCp = iC + (long)bin2[t]*nBins1;
+            const double rz = rZ[t], iz = iZ[t];
+            slot2[bin2[t]] = -1;
+            if (!rowUsed[bin2[t]]) {
+              rowUsed[bin2[t]] = 1;
+              rows[nRows++] = bin2[t];
+            }
+#ifdef _OPENMP
+            #pragma omp simd
+#endif
+            for (s=0;s<nBins1;s++) {
+              rCp[s] += rUp[s]*rz - iUp[s]*iz;
+              iCp[s] += rUp[s]*iz + iUp[s]*rz;
+            }
+          }
+        }
+      }
+
+      /* add C to the spectrum */
+      for (t=0;t<nRows;t++) {
+        double *rCp = rC + (long)rows[t]*nBins1, *iCp = iC + (long)rows[t]*nBins1;
+        const long base = (long)rows[t]*nPoints1;
+        for (s=0;s<nBins1;s++) {
+          rSpec[base+bin1[s]] += rCp[s];
+          iSpec[base+bin1[s]] += iCp[s];
+          rCp[s] = iCp[s] = 0;
+        }
+        rowUsed[rows[t]] = 0;
+      }
+      nRows = 0;
+
+    }
   }
-  else
-    mexErrMsgTxt("Unsupported number of free evolution periods.");
-  
-  nPeaks = 0;
+  Acc->nKept += (long)(nStates4*nStates4);
+  status = 0;
+
+done:
+  free(rowUsed); free(rows); free(iC); free(rC);
+  free(bin2); free(bin1); free(binOf); free(slot2); free(slot1);
+  free(iZ); free(rZ); free(iY); free(rY); free(iX); free(rX); free(iU); free(rU);
+  return status;
+}
+
+/*===================================================================*/
+/* Computes all peaks for one orientation and bins them via Acc.
+   nu1 and nu2 are workspace arrays with Inc->nWork elements each, at
+   least nStates^2. For scheme 15, nStates^4 elements avoid re-computing
+   the bins along the second dimension.
+   Without threshold and peak list, schemes 12, 14 and 15 use the grouped
+   contractions above if they need fewer operations.
+   Whole inner loops are skipped once the partial amplitude T1l*G falls
+   below the threshold. This assumes that all remaining factors have
+   magnitudes not exceeding one, as for the elements of mixing matrices.
+   Returns 0, or a negative error code: -1 if a peak index is out of
+   range, -2 if the incrementation scheme is not supported, -3/-4 if a
+   peak lies outside the first/second dimension. */
+SIMD_CLONES
+int binpeaks(const struct IncScheme *Inc, const struct PeakData *Data,
+             struct PeakAcc *Acc, int *nu1, int *nu2)
+{
+  const int IncSchemeID = Inc->ID;
+  const int nStates = Inc->nStates;
+  const int nPoints1 = Inc->nPoints1, nPoints2 = Inc->nPoints2;
+  const double dt1 = Inc->dt1, dt2 = Inc->dt2;
+  const double *freeL = Inc->freeL, *freeR = Inc->freeR;
+
+  double *Ea = Data->Ea, *Eb = Data->Eb;
+  double *rG = Data->rG, *iG = Data->iG, *rD = Data->rD, *iD = Data->iD;
+  double *rT1l = Data->rT1l, *iT1l = Data->iT1l, *rT1r = Data->rT1r, *iT1r = Data->iT1r;
+  double *rT2l = Data->rT2l, *iT2l = Data->iT2l, *rT2r = Data->rT2r, *iT2r = Data->iT2r;
+  double *rT3l = Data->rT3l, *iT3l = Data->iT3l, *rT3r = Data->rT3r, *iT3r = Data->iT3r;
+
+  double *E1left, *E1right, *E2left, *E2right, *E3left, *E3right, *E4left, *E4right;
+  double rAmp, iAmp, rAmp0,iAmp0, rAmp1, iAmp1, rAmp2, iAmp2, rAmp3, iAmp3, rAmp4, iAmp4, rAmp5, iAmp5;
+  double id1, id2, nu, nu1_, nu2_;
+  const double Threshold2 = Acc->Threshold*Acc->Threshold;
+  const long nStates2 = (long)nStates*nStates, nStates3 = nStates2*nStates;
+  long nStates4;
+  int idx, idx1, idx2, useTable, grouped, *bins2;
+  int i, j, k, l, ij, jk, kl, li, kj, il;
+  int m, n, o, p, lm, mn, no, op, pi, ni;
+
   switch (IncSchemeID) {
 
     case 1: /* [1], e.g. three-pulse ESEEM */
@@ -243,9 +643,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
           rAmp = rD[kj]*rG[jk] - iD[kj]*iG[jk];
           iAmp = rD[kj]*iG[jk] + iD[kj]*rG[jk];
           
-          rSpec[idx] += rAmp;
-          iSpec[idx] += iAmp;
-          nPeaks++;
+          addpeak(Acc,idx,rAmp,iAmp);
         }
       }
       break;
@@ -265,6 +663,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
             ij = i+j*nStates;
             rAmp = rT1l[ij]*rG[jk] - iT1l[ij]*iG[jk];
             iAmp = rT1l[ij]*iG[jk] + iT1l[ij]*rG[jk];
+            if (rAmp*rAmp+iAmp*iAmp<Threshold2) { Acc->nPruned += nStates; continue; }
             for (l=0;l<nStates;l++) {
               kl = k+l*nStates;
               li = l+i*nStates;
@@ -282,9 +681,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
               rAmp2 = rAmp1*rD[li] - iAmp1*iD[li];
               iAmp2 = rAmp1*iD[li] + iAmp1*rD[li];
               
-              rSpec[idx] += rAmp2;
-              iSpec[idx] += iAmp2;
-              nPeaks++;
+              addpeak(Acc,idx,rAmp2,iAmp2);
             }
           }
         }
@@ -298,11 +695,6 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
       E2left  = (freeL[1]==1) ? Ea : Eb;
       E2right = (freeR[1]==1) ? Ea : Eb;
       
-      nu1 = mxCalloc(nStates*nStates,sizeof(int));
-      nu2 = mxCalloc(nStates*nStates,sizeof(int));
-      if ((!nu1) || (!nu2))
-        mexErrMsgTxt("Could not allocate memory for binning.");
-
       /* pre-compute nuclear frequencies */
       idx = 0;
       for (j=0;j<nStates;j++) {
@@ -321,10 +713,8 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 
           nu1[idx] = id1;
           nu2[idx] = id2;
-          if ((id1<0)||(id1>nPoints1-1))
-            mexErrMsgTxt("id1 is out of range.");
-          if ((id2<0)||(id2>nPoints2-1))
-            mexErrMsgTxt("id2 is out of range.");
+          if ((id1<0)||(id1>nPoints1-1)) return -3;
+          if ((id2<0)||(id2>nPoints2-1)) return -4;
 
           idx++;
         }
@@ -332,7 +722,6 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 
       /* compute amplitudes and bin peaks */
       /* Amp = Mp[ij]*S[jk]*Mm[kl]*T[li]; */
-      nPeaks = 0;
       for (j=0;j<nStates;j++) {
         for (k=0;k<nStates;k++) {
           jk = j+k*nStates;
@@ -340,6 +729,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
             ij = i+j*nStates;
             rAmp = rT1l[ij]*rG[jk] - iT1l[ij]*iG[jk];
             iAmp = rT1l[ij]*iG[jk] + iT1l[ij]*rG[jk];
+            if (rAmp*rAmp+iAmp*iAmp<Threshold2) { Acc->nPruned += nStates; continue; }
             for (l=0;l<nStates;l++) {
               kl = k+l*nStates;
               li = l+i*nStates;
@@ -349,16 +739,12 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
               rAmp2 = rAmp1*rD[li] - iAmp1*iD[li];
               iAmp2 = rAmp1*iD[li] + iAmp1*rD[li];
               idx = nu1[jk] + nu2[il]*nPoints1;
-              rSpec[idx] += rAmp2;
-              iSpec[idx] += iAmp2;
-              nPeaks++;
+              addpeak(Acc,idx,rAmp2,iAmp2);
             }
           }
         }
       }
 
-      mxFree(nu1);
-      mxFree(nu2);
       break;
     
     case 3: /* [1, -1] */
@@ -373,6 +759,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
             ij = i+j*nStates;
             rAmp = rT1l[ij]*rG[jk] - iT1l[ij]*iG[jk];
             iAmp = rT1l[ij]*iG[jk] + iT1l[ij]*rG[jk];
+            if (rAmp*rAmp+iAmp*iAmp<Threshold2) { Acc->nPruned += nStates; continue; }
             for (l=0;l<nStates;l++) {
               kl = k+l*nStates;
               li = l+i*nStates;
@@ -390,9 +777,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
               rAmp2 = rAmp1*rD[li] - iAmp1*iD[li];
               iAmp2 = rAmp1*iD[li] + iAmp1*rD[li];
               
-              rSpec[idx] += rAmp2;
-              iSpec[idx] += iAmp2;
-              nPeaks++;
+              addpeak(Acc,idx,rAmp2,iAmp2);
             }
           }
         }
@@ -409,14 +794,35 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
       E2right = (freeR[1]==1) ? Ea : Eb;
       E3right = (freeR[2]==1) ? Ea : Eb;
       
+      if ((Acc->Threshold==0) && !Acc->Sparse) {
+        grouped = group12(Inc,Data,Acc,E1left,E1right,E2left,E2right,E3left,E3right);
+        if (grouped==0) Acc->nGrouped++;
+        if (grouped<=0) return grouped;
+      }
+
       for (k=0;k<nStates;k++) {
         for (l=0;l<nStates;l++) {
           kl = k + l*nStates;
+
+          /* pre-compute bins along first dimension, which depend only
+             on k, l, i and n and are re-used for all j and m */
+          for (i=0;i<nStates;i++) {
+            for (n=0;n<nStates;n++) {
+              /* nu1 = E1l[k]-E1r[l] + E3l[i]-E3r[n] */
+              nu1_ = (E1left[k]-E1right[l]) + (E3left[i]-E3right[n]);
+              id1 = fmod(-nu1_*dt1,1.0)*nPoints1;
+              if (id1>=0) id1 = floor(id1);
+              else { id1 = ceil(id1); if (id1<0) id1 += nPoints1; }
+              nu1[n + i*nStates] = id1;
+            }
+          }
+
           for (j=0;j<nStates;j++) {
             jk = j + k*nStates;
             /* Amp0 = T1l[jk]*G[kl] */
             rAmp0 = rT1l[jk]*rG[kl] - iT1l[jk]*iG[kl];
             iAmp0 = rT1l[jk]*iG[kl] + iT1l[jk]*rG[kl];
+            if (rAmp0*rAmp0+iAmp0*iAmp0<Threshold2) { Acc->nPruned += nStates3; continue; }
             for (m=0;m<nStates;m++) {
               lm = l + m*nStates;
               /* Amp1 = Amp0*T1r[lm] */
@@ -428,6 +834,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
               id2 = fmod(-nu2_*dt2,1.0)*nPoints2;
               if (id2>=0) id2 = floor(id2);
               else { id2 = ceil(id2); if (id2<0) id2 += nPoints2; }
+              idx2 = id2*nPoints1;
               
               for (i=0;i<nStates;i++) {
                 ij = i + j*nStates;
@@ -443,19 +850,11 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
                   rAmp = rD[ni]*rAmp3 - iD[ni]*iAmp3;
                   iAmp = rD[ni]*iAmp3 + iD[ni]*rAmp3;
                   
-                  /* nu1 = E1l[k]-E1r[l] + E3l[i]-E3r[n] */
-                  nu1_ = (E1left[k]-E1right[l]) + (E3left[i]-E3right[n]);
-                  id1 = fmod(-nu1_*dt1,1.0)*nPoints1;
-                  if (id1>=0) id1 = floor(id1);
-                  else { id1 = ceil(id1); if (id1<0) id1 += nPoints1; }
+                  idx = nu1[ni] + idx2;
+                  if ((idx<0)||(idx>=nPoints1*nPoints2))
+                    return -1;
                   
-                  idx = id1 + id2*nPoints1;
-                  if ((idx<0)||(idx>nPoints1*nPoints2))
-                    mexErrMsgTxt("idx out of range.");
-                  
-                  rSpec[idx] += rAmp;
-                  iSpec[idx] += iAmp;
-                  nPeaks++;
+                  addpeak(Acc,idx,rAmp,iAmp);
                 }
               }
               
@@ -475,6 +874,25 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
       E2right = (freeR[1]==1) ? Ea : Eb;      
       E3right = (freeR[2]==1) ? Ea : Eb;      
       
+      /* pre-compute bins along second dimension, which depend only on
+         i and n and are re-used for all other indices */
+      for (i=0;i<nStates;i++) {
+        for (n=0;n<nStates;n++) {
+          /* nu2 = (E3l[i]-E3r[n]) */
+          nu2_ = (E3left[i]-E3right[n]);
+          id2 = fmod(-nu2_*dt2,1.0)*nPoints2;
+          if (id2>=0) id2 = floor(id2);
+          else { id2 = ceil(id2); if (id2<0) id2 += nPoints2; }
+          nu2[n + i*nStates] = id2*nPoints1;
+        }
+      }
+
+      if ((Acc->Threshold==0) && !Acc->Sparse) {
+        grouped = group14(Inc,Data,Acc,E1left,E1right,E2left,E2right,E3left,E3right);
+        if (grouped==0) Acc->nGrouped++;
+        if (grouped<=0) return grouped;
+      }
+
       for (k=0;k<nStates;k++) {
         for (l=0;l<nStates;l++) {
           kl = k + l*nStates;
@@ -483,6 +901,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
             /* Amp0 = T1l[jk]*G[kl] */
             rAmp0 = rT1l[jk]*rG[kl] - iT1l[jk]*iG[kl];
             iAmp0 = rT1l[jk]*iG[kl] + iT1l[jk]*rG[kl];
+            if (rAmp0*rAmp0+iAmp0*iAmp0<Threshold2) { Acc->nPruned += nStates3; continue; }
             for (m=0;m<nStates;m++) {
               lm = l + m*nStates;
               /* Amp1 = Amp0*T1r[lm] */
@@ -493,6 +912,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
               id1 = fmod(-nu1_*dt1,1.0)*nPoints1;
               if (id1>=0) id1 = floor(id1);
               else { id1 = ceil(id1); if (id1<0) id1 += nPoints1; }
+              idx1 = id1;
               
               for (i=0;i<nStates;i++) {
                 ij = i + j*nStates;
@@ -508,19 +928,11 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
                   rAmp = rD[ni]*rAmp3 - iD[ni]*iAmp3;
                   iAmp = rD[ni]*iAmp3 + iD[ni]*rAmp3;
                   
-                  /* nu2 = (E3l[i]-E3r[n]) */
-                  nu2_ = (E3left[i]-E3right[n]);
-                  id2 = fmod(-nu2_*dt2,1.0)*nPoints2;
-                  if (id2>=0) id2 = floor(id2);
-                  else { id2 = ceil(id2); if (id2<0) id2 += nPoints2; }
+                  idx = idx1 + nu2[ni];
+                  if ((idx<0)||(idx>=nPoints1*nPoints2))
+                    return -1;
                   
-                  idx = id1 + id2*nPoints1;
-                  if ((idx<0)||(idx>nPoints1*nPoints2))
-                    mexErrMsgTxt("idx out of range.");
-                  
-                  rSpec[idx] += rAmp;
-                  iSpec[idx] += iAmp;
-                  nPeaks++;
+                  addpeak(Acc,idx,rAmp,iAmp);
                 }
               }
               
@@ -543,6 +955,35 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
       E3right = (freeR[2]==1) ? Ea : Eb;
       E4right = (freeR[3]==1) ? Ea : Eb;
       
+      /* pre-compute bins along second dimension, which depend only on
+         k, n, j and o and are re-used for all l, m, i and p (if the
+         workspace is large enough) */
+      nStates4 = (long)nStates*nStates*nStates*nStates;
+      useTable = (Inc->nWork>=nStates4);
+      if (useTable) {
+        for (k=0;k<nStates;k++) {
+          for (n=0;n<nStates;n++) {
+            for (j=0;j<nStates;j++) {
+              for (o=0;o<nStates;o++) {
+                /* nu2 = E2l[k]-E2r[n] + E3l[j]-E3r[o] */
+                nu2_ = (E2left[k]-E2right[n]) + (E3left[j]-E3right[o]);
+                id2 = fmod(-nu2_*dt2,1.0)*nPoints2;
+                if (id2>=0) id2 = floor(id2);
+                else { id2 = ceil(id2); if (id2<0) id2 += nPoints2; }
+                if ((id2<0)||(id2>nPoints2-1)) return -4;
+                nu2[o + nStates*(j + nStates*(n + nStates*k))] = id2*nPoints1;
+              }
+            }
+          }
+        }
+      }
+
+      if (useTable && (Acc->Threshold==0) && !Acc->Sparse) {
+        grouped = group15(Inc,Data,Acc,nu2,E1left,E1right,E4left,E4right);
+        if (grouped==0) Acc->nGrouped++;
+        if (grouped<=0) return grouped;
+      }
+      
       for (l=0;l<nStates;l++) {
         for (m=0;m<nStates;m++) {
           lm = l + m*nStates;
@@ -554,12 +995,15 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
               id1 = fmod(-nu1_*dt1,1.0)*nPoints1;
               if (id1>=0) id1 = floor(id1);
               else { id1 = ceil(id1); if (id1<0) id1 += nPoints1; }
+              if ((id1<0)||(id1>nPoints1-1)) return -3;
+              idx1 = id1;
               
               for (k=0;k<nStates;k++) {
                 kl = k + l*nStates;
                 /* Amp0 = T1l[kl]*G[lm] */
                 rAmp0 = rT1l[kl]*rG[lm] - iT1l[kl]*iG[lm];
                 iAmp0 = rT1l[kl]*iG[lm] + iT1l[kl]*rG[lm];     
+                if (rAmp0*rAmp0+iAmp0*iAmp0<Threshold2) { Acc->nPruned += nStates3; continue; }
                 for (n=0;n<nStates;n++) {
                   mn = m + n*nStates;
                   /* Amp1 = Amp0*T1r[mn] */
@@ -575,6 +1019,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
                     iAmp3 = rT3l[ij]*iAmp2 + iT3l[ij]*rAmp2;
                     rAmp2 = rD[pi]*rAmp3 - iD[pi]*iAmp3;
                     iAmp2 = rD[pi]*iAmp3 + iD[pi]*rAmp3;
+                    bins2 = nu2 + nStates*(j + nStates*(n + nStates*k));
                     for (o=0;o<nStates;o++) {
                       no = n + o*nStates;
                       op = o + p*nStates;
@@ -583,22 +1028,21 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
                       rAmp3 = rAmp2*rT2r[no] - iAmp2*iT2r[no];
                       iAmp3 = rAmp2*iT2r[no] + iAmp2*rT2r[no];
                       rAmp = rAmp3*rT3r[op] - iAmp3*iT3r[op];
-                      iAmp = rAmp3*iT2r[op] + iAmp3*rT3r[op];
+                      iAmp = rAmp3*iT3r[op] + iAmp3*rT3r[op];
                       
-                      /* nu2 = E2l[k]-E2r[n] + E3l[j]-E3r[o] */
-                      nu2_ = (E2left[k]-E2right[n]) + (E3left[j]-E3right[o]);
-                      id2 = fmod(-nu2_*dt2,1.0)*nPoints2;
-                      if (id2>=0) id2 = floor(id2);
-                      else { id2 = ceil(id2); if (id2<0) id2 += nPoints2; }
-                      if ((id1<0)||(id1>nPoints1-1))
-                        mexErrMsgTxt("id1 is out of range.");
-                      if ((id2<0)||(id2>nPoints2-1))
-                        mexErrMsgTxt("id2 is out of range.");
-                      idx = id1 + id2*nPoints1;
+                      if (useTable)
+                        idx = idx1 + bins2[o];
+                      else {
+                        /* nu2 = E2l[k]-E2r[n] + E3l[j]-E3r[o] */
+                        nu2_ = (E2left[k]-E2right[n]) + (E3left[j]-E3right[o]);
+                        id2 = fmod(-nu2_*dt2,1.0)*nPoints2;
+                        if (id2>=0) id2 = floor(id2);
+                        else { id2 = ceil(id2); if (id2<0) id2 += nPoints2; }
+                        if ((id2<0)||(id2>nPoints2-1)) return -4;
+                        idx = id1 + id2*nPoints1;
+                      }
                       
-                      rSpec[idx] += rAmp;
-                      iSpec[idx] += iAmp;
-                      nPeaks++;                    
+                      addpeak(Acc,idx,rAmp,iAmp);
                     }
                   }
                 }
@@ -631,6 +1075,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
             /* Amp0 = T1l[kl]*G[lm] */
             rAmp0 = rT1l[kl]*rG[lm] - iT1l[kl]*iG[lm];
             iAmp0 = rT1l[kl]*iG[lm] + iT1l[kl]*rG[lm];
+            if (rAmp0*rAmp0+iAmp0*iAmp0<Threshold2) { Acc->nPruned += nStates3*nStates2; continue; }
             for (n=0;n<nStates;n++) {
               mn = m + n*nStates;
               /* nu1 = E1l[l]-E1r[m]+E2l[k]-E2r[n] */
@@ -674,12 +1119,10 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
                       else { id2 = ceil(id2); if (id2<0) id2 += nPoints2; }
               
                       idx = id1 + id2*nPoints1;
-                      if ((idx<0)||(idx>nPoints1*nPoints2))
-                        mexErrMsgTxt("idx out of range.");
+                      if ((idx<0)||(idx>=nPoints1*nPoints2))
+                        return -1;
                       
-                      rSpec[idx] += rAmp;
-                      iSpec[idx] += iAmp;
-                      nPeaks++;                    
+                      addpeak(Acc,idx,rAmp,iAmp);
                     }
                   }
                 }
@@ -691,13 +1134,363 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
       }
       break;
 
-      default:
-      mexErrMsgTxt("Incrementation scheme is currently not supported.");
-      break;      
+    default:
+      return -2;
+
+  }
+
+
+
+  return 0;
+}
+
+/*===================================================================*/
+/* Returns pointers to the real and imaginary parts of a matrix argument,
+   substituting zeros for the imaginary part of real arrays */
+void getmatrix(const mxArray *M, size_t nElements, const char *errmsg,
+               const mxArray *imagZeros, double **rM, double **iM)
+{
+  if (mxGetNumberOfElements(M)!=nElements)
+    mexErrMsgTxt(errmsg);
+  *rM = mxGetPr(M);
+  *iM = mxIsComplex(M) ? mxGetPi(M) : mxGetPr(imagZeros);
+}
+
+/*===================================================================*/
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  struct IncScheme Inc;
+  struct PeakData Data0, Data;
+  double *rM[6], *iM[6];
+  double *Ea, *Eb, *Weights;
+  double *rSpec, *iSpec, *dt;
+  double **rGw, **iGw, Threshold;
+  int **nu1, **nu2;
+  int nFreeEvolutions, nDimensions, nMix, nArgs;
+  int nStates, nStates2, nOrientations, nThreads, iOri, t;
+  long nSpec, s, q, nKept, nPruned, nFlushes, nGrouped, listSize;
+  int status, Sparse;
+  bool Batched;
+  struct PeakAcc *Acc;
+  struct KernelStats Stats;
+  double tStart, tPeaks, tReduce;
+
+  int a;
+  mxArray *imagZeros;
+
+  const char *mixmsg[4][6] = {
+    {"", "", "", "", "", ""},
+    {"M1l has wrong size!", "M1r has wrong size!", "", "", "", ""},
+    {"M1l has wrong size!", "M2l has wrong size!", "M1r has wrong size!", "M2r has wrong size!", "", ""},
+    {"M1l has wrong size!", "M2l has wrong size!", "M3l has wrong size!",
+     "M1r has wrong size!", "M2r has wrong size!", "M3r has wrong size!"}
+  };
+
+  /*-----------------------------------------------------------------
+     Check number of input and output arguments
+    ----------------------------------------------------------------- */
+  if (nrhs<10)
+    mexErrMsgTxt("Insufficient number of input arguments.");
+  tStart = walltime();
+
+  /*-----------------------------------------------------------------
+     Read input arguments
+    ----------------------------------------------------------------- */
+
+  a = 0;
+  /* IncSchemeID ... identifies the incrementation scheme */
+  /*    1    [1]         */
+  /*    2    [1 1]       */
+  /*   11    [1 2]       */
+  Inc.ID = mxGetScalar(prhs[a]);
+  if (mxGetNumberOfElements(prhs[a])!=1)
+    mexErrMsgTxt("IncSchemeID must be a scalar!");
+  nFreeEvolutions = 0; nDimensions = 0;
+  switch (Inc.ID) {
+    case  1: nFreeEvolutions = 1; nDimensions = 1; break;
+    case  2: nFreeEvolutions = 2; nDimensions = 1; break;
+    case  3: nFreeEvolutions = 2; nDimensions = 1; break;
+    case 11: nFreeEvolutions = 2; nDimensions = 2; break;
+    case 12: nFreeEvolutions = 3; nDimensions = 2; break;
+    case 13: nFreeEvolutions = 3; nDimensions = 2; break;
+    case 14: nFreeEvolutions = 3; nDimensions = 2; break;
+    case 15: nFreeEvolutions = 4; nDimensions = 2; break;
+    case 17: nFreeEvolutions = 4; nDimensions = 2; break;
+    default: mexErrMsgTxt("Unrecognized incrementation scheme.");
+  }
+
+  /* number of mixing matrices, and of arguments without weights */
+  nMix = 2*(nFreeEvolutions-1);
+  nArgs = 10 + nMix;
+  if ((nrhs<nArgs) || (nrhs>nArgs+3))
+    mexErrMsgTxt("Wrong number of input arguments.");
+  Batched = (nrhs>nArgs);
+  if (nlhs>3)
+    mexErrMsgTxt("Too many output arguments.");
+
+  a++;
+  /* Spec: spectral storage array */
+  rSpec = mxGetPr(prhs[a]);
+  if (nDimensions==1) {
+    Inc.nPoints1 = mxGetM(prhs[a]);
+    if (Inc.nPoints1==1) Inc.nPoints1 = mxGetN(prhs[a]);
+    Inc.nPoints2 = 1;
+  }
+  else {
+    Inc.nPoints1 = mxGetM(prhs[a]);
+    Inc.nPoints2 = mxGetN(prhs[a]);
+  }
+  nSpec = (long)Inc.nPoints1*Inc.nPoints2;
+
+  a++;
+  /* Spec: spectral storage array */
+  iSpec = mxGetPr(prhs[a]);
+  if (mxGetNumberOfElements(prhs[a])!=nSpec)
+      mexErrMsgTxt("buffIm has wrong number of elements!");
+
+
+  a++;
+  /* dt ... time increment */
+  dt = mxGetPr(prhs[a]);
+  if (mxGetNumberOfElements(prhs[a])!=nDimensions)
+      mexErrMsgTxt("dt has wrong number of elements!");
+  Inc.dt1 = dt[0];
+  Inc.dt2 = (nDimensions==2) ? dt[1] : 0;
+
+
+  a++;
+  /* freeL ... index for left-side propagators (1=alpha,2=beta) */
+  Inc.freeL = mxGetPr(prhs[a]);
+  if (mxGetNumberOfElements(prhs[a])!=nFreeEvolutions)
+    mexErrMsgTxt("Wrong number of left evolution intervals.");
+
+  a++;
+  /* freeR ... index for right-side propagators (1=alpha,2=beta) */
+  Inc.freeR = mxGetPr(prhs[a]);
+  if (mxGetNumberOfElements(prhs[a])!=nFreeEvolutions)
+    mexErrMsgTxt("Wrong number of right evolution intervals.");
+
+  /* Weights ... orientation weights (batched mode only) */
+  if (Batched) {
+    Weights = mxGetPr(prhs[nArgs]);
+    nOrientations = mxGetNumberOfElements(prhs[nArgs]);
+    if (nOrientations<1)
+      mexErrMsgTxt("Weights must contain at least one element.");
+  }
+  else {
+    Weights = NULL;
+    nOrientations = 1;
+  }
+
+  /* Threshold ... amplitude threshold for pruning */
+  Threshold = (nrhs>nArgs+1) ? mxGetScalar(prhs[nArgs+1]) : 0;
+  if (Threshold<0)
+    mexErrMsgTxt("Threshold must be non-negative.");
 
+  /* Sparse ... collect and sort peaks before binning */
+  Sparse = (nrhs>nArgs+2) ? (mxGetScalar(prhs[nArgs+2])!=0) : 0;
+
+  a++;
+  /* Ea ... energies for alpha manifold */
+  Ea = mxGetPr(prhs[a]);
+  if (mxIsComplex(prhs[a])) mexErrMsgTxt("Ea must be real!");
+  nStates = mxGetNumberOfElements(prhs[a])/nOrientations;
+  if (nStates*nOrientations!=mxGetNumberOfElements(prhs[a]))
+    mexErrMsgTxt("Ea must contain the same number of energies for each orientation.");
+  nStates2 = nStates*nStates;
+  Inc.nStates = nStates;
+
+  a++;
+  /* Eb ... energies for beta manifold */
+  Eb = mxGetPr(prhs[a]);
+  if (mxIsComplex(prhs[a])) mexErrMsgTxt("Eb must be real!");
+  if (nStates*nOrientations!=mxGetNumberOfElements(prhs[a]))
+    mexErrMsgTxt("Ea and Eb must have the same number of elements.");
+
+  imagZeros = mxCreateDoubleMatrix(nStates2,nOrientations,mxREAL);
+
+  a++;
+  /* G ... Start coherence matrix */
+  getmatrix(prhs[a],nStates2*nOrientations,"G has wrong size!",imagZeros,&Data0.rG,&Data0.iG);
+
+  a++;
+  /* D ... detection matrix */
+  getmatrix(prhs[a],nStates2*nOrientations,"D has wrong size!",imagZeros,&Data0.rD,&Data0.iD);
+
+  /* T1l, T2l, T3l, T1r, T2r, T3r ... mixing matrices */
+  for (t=0;t<nMix;t++) {
+    a++;
+    getmatrix(prhs[a],nStates2*nOrientations,mixmsg[nFreeEvolutions-1][t],imagZeros,&rM[t],&iM[t]);
   }
+  for (t=nMix;t<6;t++) rM[t] = iM[t] = NULL;
+  Data0.rT1l = rM[0]; Data0.iT1l = iM[0];
+  Data0.rT2l = (nMix>=4) ? rM[1] : NULL; Data0.iT2l = (nMix>=4) ? iM[1] : NULL;
+  Data0.rT3l = (nMix>=6) ? rM[2] : NULL; Data0.iT3l = (nMix>=6) ? iM[2] : NULL;
+  Data0.rT1r = rM[nMix/2]; Data0.iT1r = iM[nMix/2];
+  Data0.rT2r = (nMix>=4) ? rM[nMix/2+1] : NULL; Data0.iT2r = (nMix>=4) ? iM[nMix/2+1] : NULL;
+  Data0.rT3r = (nMix>=6) ? rM[nMix/2+2] : NULL; Data0.iT3r = (nMix>=6) ? iM[nMix/2+2] : NULL;
+
+  /*-----------------------------------------------------------------
+     Allocate per-thread buffers and workspace
+    ----------------------------------------------------------------- */
+#ifdef _OPENMP
+  nThreads = setthreads();
+  if (nThreads>nOrientations) nThreads = nOrientations;
+#else
+  nThreads = 1;
+#endif
+
+  /* binning workspace, see binpeaks() */
+  Inc.nWork = nStates2;
+  if ((Inc.ID==15) && ((long)nStates2*nStates2<=MAX_BINTABLE))
+    Inc.nWork = (long)nStates2*nStates2;
+
+  Acc = mxCalloc(nThreads,sizeof(struct PeakAcc));
+  rGw = mxMalloc(nThreads*sizeof(double*));
+  iGw = mxMalloc(nThreads*sizeof(double*));
+  nu1 = mxMalloc(nThreads*sizeof(int*));
+  nu2 = mxMalloc(nThreads*sizeof(int*));
+  for (t=0;t<nThreads;t++) {
+    /* the first thread bins directly into the output buffers */
+    Acc[t].rSpec = (t==0) ? rSpec : mxCalloc(nSpec,sizeof(double));
+    Acc[t].iSpec = (t==0) ? iSpec : mxCalloc(nSpec,sizeof(double));
+    Acc[t].nSpec = nSpec;
+    Acc[t].Threshold = Threshold;
+    Acc[t].Sparse = Sparse;
+    if (Sparse) {
+      Acc[t].maxList = (nSpec>MIN_PEAKLIST) ? nSpec : MIN_PEAKLIST;
+      Acc[t].listIdx = mxMalloc(Acc[t].maxList*sizeof(int));
+      Acc[t].sortIdx = mxMalloc(Acc[t].maxList*sizeof(int));
+      Acc[t].listRe = mxMalloc(Acc[t].maxList*sizeof(double));
+      Acc[t].listIm = mxMalloc(Acc[t].maxList*sizeof(double));
+      Acc[t].sortRe = mxMalloc(Acc[t].maxList*sizeof(double));
+      Acc[t].sortIm = mxMalloc(Acc[t].maxList*sizeof(double));
+      Acc[t].binCount = mxMalloc((nSpec+2)*sizeof(long));
+    }
+    rGw[t] = mxCalloc(nStates2,sizeof(double));
+    iGw[t] = mxCalloc(nStates2,sizeof(double));
+    nu1[t] = mxCalloc(Inc.nWork,sizeof(int));
+    nu2[t] = mxCalloc(Inc.nWork,sizeof(int));
+    if ((!Acc[t].rSpec) || (!Acc[t].iSpec) || (!nu1[t]) || (!nu2[t]) || (!rGw[t]) || (!iGw[t]))
+      mexErrMsgTxt("Could not allocate memory for binning.");
+  }
+
+  /*-----------------------------------------------------------------
+     Loop over all orientations, compute and bin peaks
+    ----------------------------------------------------------------- */
+  status = 0;
+  tPeaks = walltime();
+#ifdef _OPENMP
+  #pragma omp parallel for num_threads(nThreads) schedule(dynamic) private(Data,t,q)
+#endif
+  for (iOri=0;iOri<nOrientations;iOri++) {
+    int s_;
+    const long o = (long)iOri*nStates2;
+#ifdef _OPENMP
+    t = omp_get_thread_num();
+#else
+    t = 0;
+#endif
+
+    Data.Ea = Ea + (long)iOri*nStates;
+    Data.Eb = Eb + (long)iOri*nStates;
+    Data.rG = Data0.rG + o; Data.iG = Data0.iG + o;
+    Data.rD = Data0.rD + o; Data.iD = Data0.iD + o;
+    Data.rT1l = Data0.rT1l ? Data0.rT1l + o : NULL; Data.iT1l = Data0.iT1l ? Data0.iT1l + o : NULL;
+    Data.rT2l = Data0.rT2l ? Data0.rT2l + o : NULL; Data.iT2l = Data0.iT2l ? Data0.iT2l + o : NULL;
+    Data.rT3l = Data0.rT3l ? Data0.rT3l + o : NULL; Data.iT3l = Data0.iT3l ? Data0.iT3l + o : NULL;
+    Data.rT1r = Data0.rT1r ? Data0.rT1r + o : NULL; Data.iT1r = Data0.iT1r ? Data0.iT1r + o : NULL;
+    Data.rT2r = Data0.rT2r ? Data0.rT2r + o : NULL; Data.iT2r = Data0.iT2r ? Data0.iT2r + o : NULL;
+    Data.rT3r = Data0.rT3r ? Data0.rT3r + o : NULL; Data.iT3r = Data0.iT3r ? Data0.iT3r + o : NULL;
+
+    /* fold orientation weight into start coherence matrix */
+    if (Batched && (Weights[iOri]!=1)) {
+      for (q=0;q<nStates2;q++) {
+        rGw[t][q] = Weights[iOri]*Data.rG[q];
+        iGw[t][q] = Weights[iOri]*Data.iG[q];
+      }
+      Data.rG = rGw[t];
+      Data.iG = iGw[t];
+    }
+
+    s_ = binpeaks(&Inc,&Data,&Acc[t],nu1[t],nu2[t]);
+    if (s_<0) {
+#ifdef _OPENMP
+      #pragma omp critical
+#endif
+      status = s_;
+    }
+  }
+
+  /*-----------------------------------------------------------------
+     Sum per-thread buffers and clean up
+    ----------------------------------------------------------------- */
+  tReduce = walltime();
+  nKept = 0;
+  nPruned = 0;
+  nFlushes = 0;
+  nGrouped = 0;
+  for (t=0;t<nThreads;t++) {
+    if (Sparse) {
+      flushpeaks(&Acc[t]);
+      mxFree(Acc[t].listIdx); mxFree(Acc[t].sortIdx);
+      mxFree(Acc[t].listRe); mxFree(Acc[t].listIm);
+      mxFree(Acc[t].sortRe); mxFree(Acc[t].sortIm);
+      mxFree(Acc[t].binCount);
+    }
+    if (t>0) {
+      for (s=0;s<nSpec;s++) {
+        rSpec[s] += Acc[t].rSpec[s];
+        iSpec[s] += Acc[t].iSpec[s];
+      }
+      mxFree(Acc[t].rSpec);
+      mxFree(Acc[t].iSpec);
+    }
+    nKept += Acc[t].nKept;
+    nPruned += Acc[t].nPruned;
+    nFlushes += Acc[t].nFlushes;
+    nGrouped += Acc[t].nGrouped;
+    mxFree(rGw[t]); mxFree(iGw[t]);
+    mxFree(nu1[t]); mxFree(nu2[t]);
+  }
+  listSize = Acc[0].maxList;
+  mxFree(Acc);
+  mxFree(rGw); mxFree(iGw);
+  mxFree(nu1); mxFree(nu2);
 
-  
   mxDestroyArray(imagZeros);
-  
+
+  if (status==-1)
+    mexErrMsgTxt("idx out of range.");
+  if (status==-3)
+    mexErrMsgTxt("id1 is out of range.");
+  if (status==-4)
+    mexErrMsgTxt("id2 is out of range.");
+  if (status==-2)
+    mexErrMsgTxt("Incrementation scheme is currently not supported.");
+
+  /*-----------------------------------------------------------------
+     Return peak counts
+    ----------------------------------------------------------------- */
+  if (nlhs>0) plhs[0] = mxCreateDoubleScalar((double)nKept);
+  if (nlhs>1) plhs[1] = mxCreateDoubleScalar((double)nPruned);
+  if (nlhs>2) {
+    Stats.nFields = 0;
+    setstat(&Stats,"nKept",(double)nKept);
+    setstat(&Stats,"nPruned",(double)nPruned);
+    setstat(&Stats,"nOrientations",nOrientations);
+    setstat(&Stats,"nStates",nStates);
+    setstat(&Stats,"nThreads",nThreads);
+    setstat(&Stats,"SpectrumSize",(double)nSpec);
+    setstat(&Stats,"WorkspaceSize",(double)Inc.nWork);
+    setstat(&Stats,"ListSize",(double)listSize);
+    setstat(&Stats,"nListFlushes",(double)nFlushes);
+    setstat(&Stats,"nGrouped",(double)nGrouped);
+    setstat(&Stats,"tSetup",tPeaks-tStart);
+    setstat(&Stats,"tPeaks",tReduce-tPeaks);
+    setstat(&Stats,"tReduce",walltime()-tReduce);
+    setstat(&Stats,"tTotal",walltime()-tStart);
+    plhs[2] = statsstruct(&Stats);
+  }
+
 }
@@ -33,13 +33,7 @@ end
 
 % Mex compilation check
 %-------------------------------------------------------------------------------
-fileName = 'cubicsolve';
-if exist(fileName,'file')~=3
- easyspin_compile;
-  if exist(fileName,'file')~=3
-    error('EasySpin: Generation of mex files failed.');
-  end
-end
+checkmex;
 
 % Spell check field names (capitalization)
 %-------------------------------------------------------------------------------
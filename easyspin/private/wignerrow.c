@@ -0,0 +1,105 @@
+/*
+wignerrow.c    whole rows of Wigner 3j and 6j symbols
+
+  [j1,v] = wignerrow('3j',j2,j3,m2,m3)
+  [m2,v] = wignerrow('3jm',j1,j2,j3,m1)
+  [j1,v] = wignerrow('6j',j2,j3,l1,l2,l3)
+
+  '3j'   v(k) = ( j1(k) j2 j3 ; -m2-m3 m2 m3 ) for all allowed j1
+  '3jm'  v(k) = ( j1 j2 j3 ; m1 m2(k) -m1-m2(k) ) for all allowed m2
+  '6j'   v(k) = { j1(k) j2 j3 ; l1 l2 l3 } for all allowed j1
+
+  The values are computed together with the three-term recursions of
+  Schulten and Gordon (see jjj.h), which are stable and accurate also for
+  large quantum numbers. j1 (or m2) and v are column vectors, and are
+  empty if all symbols in the row vanish. All j and m must be integers
+  or half-integers, with |m|<=j and j-m integer.
+
+This is an EasySpin function.
+ */
+
+#include "mex.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int parity(int k)
+{
+  return (k%2) ? -1 : +1;
+}
+
+#include "jjj.h"
+
+static double jarg(const mxArray *a, const char *Name)
+{
+  double v;
+  if (!mxIsDouble(a) || mxIsComplex(a) || (mxGetNumberOfElements(a)!=1))
+    mexErrMsgIdAndTxt("wignerrow:arg","%s must be a real scalar.",Name);
+  v = mxGetScalar(a);
+  if (2*v!=floor(2*v))
+    mexErrMsgIdAndTxt("wignerrow:arg","%s must be an integer or half-integer.",Name);
+  return v;
+}
+
+static void checkjm(double j, double m, const char *Name)
+{
+  if ((j<0)||(fabs(m)>j)||(j-m!=floor(j-m)))
+    mexErrMsgIdAndTxt("wignerrow:arg","Nonphysical %s. It must be one of -j,-j+1,...,j-1,j.",Name);
+}
+
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+  enum {ROW_3J, ROW_3JM, ROW_6J} Kind = ROW_3J;
+  char Type[4] = "";
+  double q[5], qmin = 0, *values, *work;
+  int i, n = 0, nmax, nArgs;
+
+  if (nrhs>=1 && mxIsChar(prhs[0])) mxGetString(prhs[0],Type,sizeof(Type));
+  if (strcmp(Type,"3j")==0) Kind = ROW_3J;
+  else if (strcmp(Type,"3jm")==0) Kind = ROW_3JM;
+  else if (strcmp(Type,"6j")==0) Kind = ROW_6J;
+  else mexErrMsgTxt("First input must be '3j', '3jm' or '6j'.");
+  nArgs = (Kind==ROW_6J) ? 5 : 4;
+  if (nrhs!=nArgs+1) mexErrMsgIdAndTxt("wignerrow:nargs","%d input arguments expected.",nArgs+1);
+  if (nlhs>2) mexErrMsgTxt("Too many output arguments.");
+
+  for (i=0; i<nArgs; i++) q[i] = jarg(prhs[i+1],"All j and m");
+
+  if (Kind==ROW_3J) {
+    /* q = (j2,j3,m2,m3) */
+    checkjm(q[0],q[2],"m2");
+    checkjm(q[1],q[3],"m3");
+    nmax = (int)floor(2*((q[0]<q[1]) ? q[0] : q[1]) + 1.5);
+  }
+  else if (Kind==ROW_3JM) {
+    /* q = (j1,j2,j3,m1) */
+    if ((q[1]<0)||(q[2]<0)) mexErrMsgTxt("j2 and j3 must be nonnegative.");
+    checkjm(q[0],q[3],"m1");
+    nmax = (int)floor(2*q[1] + 1.5);
+  }
+  else {
+    /* q = (j2,j3,l1,l2,l3) */
+    for (i=0; i<nArgs; i++)
+      if (q[i]<0) mexErrMsgTxt("All j must be nonnegative.");
+    nmax = (int)floor(2*((q[0]<q[1]) ? q[0] : q[1]) + 1.5);
+  }
+
+  values = (double*)mxMalloc(5*nmax*sizeof(double));
+  work = values + nmax;
+  if (Kind==ROW_3J)
+    n = jjjrowj(q[0],q[1],q[2],q[3],&qmin,values,work);
+  else if (Kind==ROW_3JM) {
+    if (fmod(q[0]+q[1]+q[2],1)==0)
+      n = jjjrowm(q[0],q[1],q[2],q[3],&qmin,values,work);
+  }
+  else
+    n = sixjrowj(q[0],q[1],q[2],q[3],q[4],&qmin,values,work);
+
+  plhs[0] = mxCreateDoubleMatrix(n,1,mxREAL);
+  for (i=0; i<n; i++) mxGetPr(plhs[0])[i] = qmin + i;
+  if (nlhs>1) {
+    plhs[1] = mxCreateDoubleMatrix(n,1,mxREAL);
+    if (n>0) memcpy(mxGetPr(plhs[1]),values,n*sizeof(double));
+  }
+  mxFree(values);
+}
@@ -845,14 +845,15 @@ else
 end
 logmsg(1,'- Resonance data: computing %s',msg);
 
-idxTr = [(1:nTransitions).'; inf];
+% Number of data rows reserved for each transition (one per resonance
+% of the transition at a given orientation)
+nSlots = ones(nTransitions,1);
 
 % Preparation for the adaptive iterative bisection
 %---------------------------------------------------------
 Accuracy = mwFreq*Opt.ModellingAccuracy;
 
 M = [2 -2 1 1; -3 3 -2 -1; 0 0 1 0; 1 0 0 0];
-ZeroRow = NaN*ones(1,nOrientations);
 if higherOrder
   maxSlope = 0;
   for iOri = 1:nOrientations
@@ -878,474 +879,530 @@ logmsg(2,'  ## modelling accuracy %0.3f MHz, max slope %g MHz/mT',Accuracy,maxSl
 % Loop over all given orientations.
 %-----------------------------------------------------------------------
 
+% Orientations are processed in chunks. The energy level diagrams of all
+% orientations in a chunk are modelled first. Then the resonance fields of
+% the whole chunk are located with a single call to resfields_search, and
+% finally the resonance data are computed orientation by orientation.
+% Chunks are limited in size to bound the memory used for the eigenvectors.
+maxChunkOrientations = 256;
+maxChunkBytes = 2^28;
+
 startTime = cputime;
 logstr = '';
-for iOri = 1:nOrientations
-
-  if EasySpinLogLevel>=1
-    if iOri>1
-      remainingTime = (cputime-startTime)/(iOri-1)*(nOrientations-iOri+1);
-      backspace = repmat(sprintf('\b'),1,numel(logstr));
-      hours = fix(remainingTime/3600);
-      minutes = fix(remainingTime/60 - 60*hours);
-      seconds = remainingTime - 3600*hours - 60*minutes;
-      logstr = sprintf('  %d/%d orientations, remaining time %02d:%02d:%0.1f\n', ...
-        iOri, nOrientations, hours, minutes, seconds);
-      if EasySpinLogLevel==1, fprintf(backspace); end
-      fprintf(logstr);
-    else
-      if nOrientations>1
-        logstr = sprintf('  1/%d orientations, remaining time unknown\n',nOrientations);
+iOriNext = 1;
+while iOriNext<=nOrientations
+
+  % Model energy level diagrams for a chunk of orientations
+  %=====================================================================
+  chunkOri = zeros(1,0);
+  chunkBknots = {};
+  chunkE = {};
+  chunkdEdB = {};
+  chunkData = {};
+  chunkBytes = 0;
+  while iOriNext<=nOrientations && numel(chunkOri)<maxChunkOrientations && ...
+      chunkBytes<maxChunkBytes
+    iOri = iOriNext;
+    iOriNext = iOriNext + 1;
+
+    if EasySpinLogLevel>=1
+      if iOri>1
+        remainingTime = (cputime-startTime)/(iOri-1)*(nOrientations-iOri+1);
+        backspace = repmat(sprintf('\b'),1,numel(logstr));
+        hours = fix(remainingTime/3600);
+        minutes = fix(remainingTime/60 - 60*hours);
+        seconds = remainingTime - 3600*hours - 60*minutes;
+        logstr = sprintf('  %d/%d orientations, remaining time %02d:%02d:%0.1f\n', ...
+          iOri, nOrientations, hours, minutes, seconds);
+        if EasySpinLogLevel==1, fprintf(backspace); end
         fprintf(logstr);
+      else
+        if nOrientations>1
+          logstr = sprintf('  1/%d orientations, remaining time unknown\n',nOrientations);
+          fprintf(logstr);
+        end
       end
     end
-  end
   
-  % Set up Hamiltonians for 3 lab principal directions
-  %-----------------------------------------------------
-  % xLab, yLab, zLab represented in the molecular frame M
-  [xLab_M,yLab_M,zLab_M] = erot(angles_M2L(iOri,:),'rows');
+    % Set up Hamiltonians for 3 lab principal directions
+    %-----------------------------------------------------
+    % xLab, yLab, zLab represented in the molecular frame M
+    [xLab_M,yLab_M,zLab_M] = erot(angles_M2L(iOri,:),'rows');
   
-  if ~higherOrder
-    % zLab axis: external static field
-    kmuzL = zLab_M(1)*kmuxM + zLab_M(2)*kmuyM + zLab_M(3)*kmuzM;
-    % xLab axis: mw excitation field
-    kmuxL = xLab_M(1)*kmuxM + xLab_M(2)*kmuyM + xLab_M(3)*kmuzM;
-    % yLab axis: needed for gradient calculation
-    % and the integration over all mw field orientations
-    kmuyL = yLab_M(1)*kmuxM + yLab_M(2)*kmuyM + yLab_M(3)*kmuzM;
-    if usegStrain && ~simplegStrain
-      for e = Sys.nElectrons:-1:1
-        kSzL{e} = zLab_M(1)*kSxM{e} + zLab_M(2)*kSyM{e} + zLab_M(3)*kSzM{e};
+    if ~higherOrder
+      % zLab axis: external static field
+      kmuzL = zLab_M(1)*kmuxM + zLab_M(2)*kmuyM + zLab_M(3)*kmuzM;
+      % xLab axis: mw excitation field
+      kmuxL = xLab_M(1)*kmuxM + xLab_M(2)*kmuyM + xLab_M(3)*kmuzM;
+      % yLab axis: needed for gradient calculation
+      % and the integration over all mw field orientations
+      kmuyL = yLab_M(1)*kmuxM + yLab_M(2)*kmuyM + yLab_M(3)*kmuzM;
+      if usegStrain && ~simplegStrain
+        for e = Sys.nElectrons:-1:1
+          kSzL{e} = zLab_M(1)*kSxM{e} + zLab_M(2)*kSyM{e} + zLab_M(3)*kSzM{e};
+        end
       end
     end
-  end
-  if computeStrains
-    LineWidthSquared = HStrain2*zLab_M.^2;
-  end
+    if computeStrains
+      LineWidthSquared = HStrain2*zLab_M.^2;
+    end
   
-  % Pre-calculate photoselection weight if needed
-  if usePhotoSelection
-    k = Exp.lightBeam{1};  % propagation direction
-    alpha = Exp.lightBeam{2};  % polarization angle
-    if averageOverChi
-      ori = angles_M2L(iOri,1:2);  % omit chi
+    % Pre-calculate photoselection weight if needed
+    if usePhotoSelection
+      k = Exp.lightBeam{1};  % propagation direction
+      alpha = Exp.lightBeam{2};  % polarization angle
+      if averageOverChi
+        ori = angles_M2L(iOri,1:2);  % omit chi
+      else
+        ori = angles_M2L(iOri,1:3);
+      end
+      photoWeight = photoselect(Sys.tdm,ori,k,alpha);
+      % Add isotropic contribution (from scattering)
+      photoWeight = (1-Exp.lightScatter)*photoWeight + Exp.lightScatter;
     else
-      ori = angles_M2L(iOri,1:3);
+      photoWeight = 1;
     end
-    photoWeight = photoselect(Sys.tdm,ori,k,alpha);
-    % Add isotropic contribution (from scattering)
-    photoWeight = (1-Exp.lightScatter)*photoWeight + Exp.lightScatter;
-  else
-    photoWeight = 1;
-  end
   
-  %===========================================================
-  % Iterative bisection
-  %-----------------------------------------------------------  
+    %===========================================================
+    % Iterative bisection
+    %-----------------------------------------------------------  
   
-  % Vectors: eigenvectors, E: energies, dEdB: dE/dB
-  % deltaE: transition energies for transitions in list Trans
-  Vectors = cell(1,2); E = cell(1,2); dEdB = cell(1,2); deltaE = cell(1,2);
+    % Vectors: eigenvectors, E: energies, dEdB: dE/dB
+    % deltaE: transition energies for transitions in list Trans
+    Vectors = cell(1,2); E = cell(1,2); dEdB = cell(1,2); deltaE = cell(1,2);
   
-  Bknots = Exp.Range; % initial segment spans full field range
-  nSegments = 1;
-  if higherOrder
-    [Vectors{2},E{2},dEdB{2},deltaE{2}] = gethamdata_hO(Bknots(2),zLab_M,CoreSys,Opt.Sparse,Trans,nLevels);
-    [Vectors{1},E{1},dEdB{1},deltaE{1}] = gethamdata_hO(Bknots(1),zLab_M,CoreSys,Opt.Sparse,Trans,nLevels);
-  else
-    [Vectors{2},E{2},dEdB{2},deltaE{2}] = gethamdata(Bknots(2),kH0,kmuzL,Trans,nLevels);
-    [Vectors{1},E{1},dEdB{1},deltaE{1}] = gethamdata(Bknots(1),kH0,kmuzL,Trans,nLevels);
-  end
-  nDiagonalizations = nDiagonalizations + 2;
-  unfinished = true;
+    Bknots = Exp.Range; % initial segment spans full field range
+    nSegments = 1;
+    if higherOrder
+      [Vectors{2},E{2},dEdB{2},deltaE{2}] = gethamdata_hO(Bknots(2),zLab_M,CoreSys,Opt.Sparse,Trans,nLevels);
+      [Vectors{1},E{1},dEdB{1},deltaE{1}] = gethamdata_hO(Bknots(1),zLab_M,CoreSys,Opt.Sparse,Trans,nLevels);
+    else
+      [Vectors{2},E{2},dEdB{2},deltaE{2}] = gethamdata(Bknots(2),kH0,kmuzL,Trans,nLevels);
+      [Vectors{1},E{1},dEdB{1},deltaE{1}] = gethamdata(Bknots(1),kH0,kmuzL,Trans,nLevels);
+    end
+    nDiagonalizations = nDiagonalizations + 2;
+    unfinished = true;
   
-  % Iterative bisection until energy level diagram is accurately modeled.
-  while any(unfinished) && nSegments<Opt.maxSegments
+    % Iterative bisection until energy level diagram is accurately modeled.
+    while any(unfinished) && nSegments<Opt.maxSegments
     
-    s = find(unfinished,1); % find first unfinished segment
-    dB = Bknots(s+1) - Bknots(s);
-    if E{s+1}(end)-E{s+1}(1) > mwFreq
-      if LoopFields
-        ResonancePossible = abs((deltaE{s}+deltaE{s+1})/2-mwFreq) <= maxSlope*dB;
+      s = find(unfinished,1); % find first unfinished segment
+      dB = Bknots(s+1) - Bknots(s);
+      if E{s+1}(end)-E{s+1}(1) > mwFreq
+        if LoopFields
+          ResonancePossible = abs((deltaE{s}+deltaE{s+1})/2-mwFreq) <= maxSlope*dB;
+        else
+          ResonancePossible = (deltaE{s}-mwFreq).*(deltaE{s+1}-mwFreq) <= 0;
+        end
       else
-        ResonancePossible = (deltaE{s}-mwFreq).*(deltaE{s+1}-mwFreq) <= 0;
+        ResonancePossible = false;
       end
-    else
-      ResonancePossible = false;
-    end
     
-    if any(ResonancePossible)
-      % diagonalize at center and compute error
-      newB = (Bknots(s)+Bknots(s+1))/2;
-      if higherOrder
-        [Ve,En,Di1,dEn] = gethamdata_hO(newB,zLab_M,CoreSys,Opt.Sparse,Trans,nLevels);
+      if any(ResonancePossible)
+        % diagonalize at center and compute error
+        newB = (Bknots(s)+Bknots(s+1))/2;
+        if higherOrder
+          [Ve,En,Di1,dEn] = gethamdata_hO(newB,zLab_M,CoreSys,Opt.Sparse,Trans,nLevels);
+        else
+          [Ve,En,Di1,dEn] = gethamdata(newB,kH0,kmuzL,Trans,nLevels);
+        end
+        nDiagonalizations = nDiagonalizations+1;
+        Error = 2*(1/2*(E{s}+E{s+1}) + dB/8*(dEdB{s}-dEdB{s+1}) - En);
+        Incl = false(1,nCore); % levels to include in accuracy check
+        Incl([u(ResonancePossible) v(ResonancePossible)]) = true;
+        Error = abs(Error(Incl));
+        % bisect
+        Bknots = [Bknots(1:s) newB Bknots(s+1:end)];
+        E = [E(1:s) {En} E(s+1:end)];
+        Vectors = [Vectors(1:s) {Ve} Vectors(s+1:end)];
+        dEdB = [dEdB(1:s) {Di1} dEdB(s+1:end)];
+        deltaE = [deltaE(1:s) {dEn} deltaE(s+1:end)];
+        nSegments = nSegments + 1;
+        % mark unfinished or finished depending on error
+        done = max(Error) <= Accuracy;
+        unfinished = [unfinished(1:s-1) ~done ~done unfinished(s+1:end)];
       else
-        [Ve,En,Di1,dEn] = gethamdata(newB,kH0,kmuzL,Trans,nLevels);
+        unfinished(s) = false; % mark segment as finished
       end
-      nDiagonalizations = nDiagonalizations+1;
-      Error = 2*(1/2*(E{s}+E{s+1}) + dB/8*(dEdB{s}-dEdB{s+1}) - En);
-      Incl = false(1,nCore); % levels to include in accuracy check
-      Incl([u(ResonancePossible) v(ResonancePossible)]) = true;
-      Error = abs(Error(Incl));
-      % bisect
-      Bknots = [Bknots(1:s) newB Bknots(s+1:end)];
-      E = [E(1:s) {En} E(s+1:end)];
-      Vectors = [Vectors(1:s) {Ve} Vectors(s+1:end)];
-      dEdB = [dEdB(1:s) {Di1} dEdB(s+1:end)];
-      deltaE = [deltaE(1:s) {dEn} deltaE(s+1:end)];
-      nSegments = nSegments + 1;
-      % mark unfinished or finished depending on error
-      done = max(Error) <= Accuracy;
-      unfinished = [unfinished(1:s-1) ~done ~done unfinished(s+1:end)];
-    else
-      unfinished(s) = false; % mark segment as finished
-    end
     
-  end
+    end
+  
+    if nSegments>=Opt.maxSegments
+      nMaxSegmentsReached = nMaxSegmentsReached + 1;
+    end
+  
+    logmsg(2,'   segmentation finished, %d segments',nSegments);
+  
+    % Compute eigenvector cross products to determine how strongly eigenvectors
+    % change over a segment.
+    for s = nSegments:-1:1
+      %StateStability(:,s) = abs(diag(VV{s+1}'*VV{s}));
+      StateStability(:,s) = abs(sum(conj(Vectors{s+1}).*Vectors{s})).';
+    end
+
+    % Store spline model and orientation-dependent quantities
+    j = numel(chunkOri) + 1;
+    chunkOri(j) = iOri;
+    chunkBknots{j} = Bknots;
+    chunkE{j} = vertcat(E{:});
+    chunkdEdB{j} = vertcat(dEdB{:});
+    oriData = struct('Vectors',{Vectors},'StateStability',StateStability,...
+      'xLab_M',xLab_M,'yLab_M',yLab_M,'zLab_M',zLab_M,'photoWeight',photoWeight);
+    if ~higherOrder
+      oriData.kmuzL = kmuzL;
+      oriData.kmuxL = kmuxL;
+      oriData.kmuyL = kmuyL;
+      if usegStrain && ~simplegStrain
+        oriData.kSzL = kSzL;
+      end
+    end
+    if computeStrains
+      oriData.LineWidthSquared = LineWidthSquared;
+    end
+    chunkData{j} = oriData;
+    chunkBytes = chunkBytes + 16*numel(Vectors{1})*numel(Vectors);
   
-  if nSegments>=Opt.maxSegments
-    nMaxSegmentsReached = nMaxSegmentsReached + 1;
   end
   
-  logmsg(2,'   segmentation finished, %d segments',nSegments);
+  % Locate resonance fields for all orientations in the chunk
+  %=====================================================================
+  [chunkFields,chunkZeros,chunkSegs,chunkTrans,chunkNRes] = ...
+    resfields_search(chunkBknots,chunkE,chunkdEdB,[u v],mwFreq,LoopFields);
+  chunkPtr = [0 cumsum(chunkNRes)];
   
-  % Compute eigenvector cross products to determine how strongly eigenvectors
-  % change over a segment.
-  for s = nSegments:-1:1
-    %StateStability(:,s) = abs(diag(VV{s+1}'*VV{s}));
-    StateStability(:,s) = abs(sum(conj(Vectors{s+1}).*Vectors{s})).';
+  % Number each resonance within its orientation and transition, and add
+  % data rows for transitions with more resonances than seen so far
+  nChunkRes = numel(chunkFields);
+  chunkOriIdx = zeros(1,nChunkRes);
+  for j = 1:numel(chunkOri)
+    chunkOriIdx(chunkPtr(j)+1:chunkPtr(j+1)) = j;
   end
-
-  % Cubic polynomial coefficients of the entire spline model of the energy level diagram.
-  dB = diff(Bknots);
-  SplineModelCoeffs = cell(1,nSegments);
-  for s = 1:nSegments
-    SplineModelCoeffs{s} = M*[E{s}; E{s+1}; dB(s)*dEdB{s}; dB(s)*dEdB{s+1}];
+  newRun = diff([0 chunkTrans+nTransitions*chunkOriIdx])~=0;
+  runStart = find(newRun);
+  chunkSlot = (1:nChunkRes) - runStart(cumsum(newRun)) + 1;
+  nSlotsNew = max(nSlots,accumarray(chunkTrans(:),chunkSlot(:),[nTransitions 1],@max));
+  if any(nSlotsNew>nSlots)
+    Pdat = growrowblocks(Pdat,nSlots,nSlotsNew,NaN);
+    if computeIntensities
+      Idat = growrowblocks(Idat,nSlots,nSlotsNew,NaN);
+    end
+    if computeStrains
+      Wdat = growrowblocks(Wdat,nSlots,nSlotsNew,NaN);
+    end
+    if computeGradient
+      Gdat = growrowblocks(Gdat,nSlots,nSlotsNew,NaN);
+    end
+    for iiNuc = 1:nPerturbNuclei
+      pPdatN{iiNuc} = growrowblocks(pPdatN{iiNuc},nSlots,nSlotsNew,0);
+      if computeIntensities
+        pIdatN{iiNuc} = growrowblocks(pIdatN{iiNuc},nSlots,nSlotsNew,0);
+      end
+    end
+    nSlots = nSlotsNew;
   end
+  rowStart = cumsum([0; nSlots(1:end-1)]);
   
-  iiTrans = 1;
-  for iTrans = 1:nTransitions % run over all level pairs
-
-    % Find first position of transition iTrans in idxTr.
-    while idxTr(iiTrans)<iTrans, iiTrans=iiTrans+1; end
-
-    % Loop over all field segments and compute resonance fields
-    %-----------------------------------------------------------
-    for s = 1:nSegments
-
-      % Construct cubic polynomial coeffs of resonance function Ev-Eu-freq
-      Co = SplineModelCoeffs{s};
-      C = Co(:,v(iTrans)) - Co(:,u(iTrans));
-      C(4) = C(4) - mwFreq;
-
-      % Find zeros, first and second derivatives of E(v)-E(u)-mwFreq
-      %[Zeros,Diff1,Diff2] = cubicsolve(C,LoopFields);
-
-      % Problem here: cubicsolve should only be called if a resonance
-      % is possible. This can be determined as above using maxSlope etc.
-      % cubicsolve takes too long to find this out (esp. for LoopFields=1).
-      cubicZeros = cubicsolve(C,LoopFields);
-      if isempty(cubicZeros), continue, end
-
-      ResonanceFields = Bknots(s) + dB(s)*cubicZeros;
-
-      % loop over all resonances for transition iTrans in the current segment
-      for iReson = 1:numel(ResonanceFields)
-
-        % Insert new row into data arrays if the current one is not for transition iTrans!!
-        %-----------------------------------------------------------------------------------
-        if idxTr(iiTrans)>iTrans
-          Pdat = [Pdat(1:iiTrans-1,:); ZeroRow; Pdat(iiTrans:end,:)];
-          if computeIntensities
-            Idat = [Idat(1:iiTrans-1,:); ZeroRow; Idat(iiTrans:end,:)];
-          end
-          if computeStrains
-            Wdat = [Wdat(1:iiTrans-1,:); ZeroRow; Wdat(iiTrans:end,:)];
-          end
-          if computeGradient
-            Gdat = [Gdat(1:iiTrans-1,:); ZeroRow; Gdat(iiTrans:end,:)];
-          end
-          idxTr = [idxTr(1:iiTrans-1); iTrans; idxTr(iiTrans:end)];
-          if nPerturbNuclei>0
-            for iiNuc = nPerturbNuclei:-1:1
-              p_ = pPdatN{iiNuc};
-              z_ = zeros(1,nOrientations,size(p_,3));
-              pPdatN{iiNuc} = [p_(1:iiTrans-1,:,:); z_; p_(iiTrans:end,:,:)];
-              p_ = pIdatN{iiNuc};
-              pIdatN{iiNuc} = [p_(1:iiTrans-1,:,:); z_; p_(iiTrans:end,:,:)];
-            end
-          end
-        end
-
-        % Update position data
-        %------------------------------------------------
-        Pdat(iiTrans,iOri) = ResonanceFields(iReson);
-
-        % Compute eigenvectors, eigenvalues and 1/g factor = 1/(dE/dB) if needed
-        %--------------------------------------------------
-        if computeEigenPairs || nPerturbNuclei>0
-          % Compute resonant state vectors
-          % u: lower level, v: higher level
-          uv = Transitions(idxTr(iiTrans),:);
-
-          % If eigenvectors change too much between knots, we have to
-          % rediagonalize the Hamiltonian at the resonance field.
-          if any(StateStability(uv,s)<Opt.RediagLimit)
-            nRediags = nRediags + 1;
-            if higherOrder
-              [Vectors_,Energies] = gethamdata_hO(ResonanceFields(iReson),zLab_M,CoreSys,Opt.Sparse,Trans,nLevels);
-              if Opt.Sparse
-                [Energies,ind] = sort(diag(Energies));
-                Energies = diag(Energies);
-                Vectors_ = Vectors_(:,ind);
-              end
-            else
-              if issparse(kH0)
-                [Vectors_,Energies] = eigs(kH0-ResonanceFields(iReson)*kmuzL,nLevels);
-                % A sort of workaround for diagonalization using eigs, the
-                % energies are not ordered which results in a miscalculation
-                % of mu
-                [Energies,ind] = sort(diag(Energies));
-                Energies = diag(Energies);
-                Vectors_ = Vectors_(:,ind);
-                
-                %[Vectors_,Energies] = eig(full(kF+ResonanceFields(iReson)*kGzL));
-              else
-                [Vectors_,Energies] = eig(kH0-ResonanceFields(iReson)*kmuzL);
-              end
+  % Compute resonance data for all orientations in the chunk
+  %=====================================================================
+  for j = 1:numel(chunkOri)
+    iOri = chunkOri(j);
+    Bknots = chunkBknots{j};
+    Eknots = chunkE{j};
+    dEdBknots = chunkdEdB{j};
+    oriData = chunkData{j};
+    Vectors = oriData.Vectors;
+    StateStability = oriData.StateStability;
+    xLab_M = oriData.xLab_M;
+    yLab_M = oriData.yLab_M;
+    zLab_M = oriData.zLab_M;
+    photoWeight = oriData.photoWeight;
+    if ~higherOrder
+      kmuzL = oriData.kmuzL;
+      kmuxL = oriData.kmuxL;
+      kmuyL = oriData.kmuyL;
+      if usegStrain && ~simplegStrain
+        kSzL = oriData.kSzL;
+      end
+    end
+    if computeStrains
+      LineWidthSquared = oriData.LineWidthSquared;
+    end
+    
+    % Loop over all resonances of this orientation
+    for iRes = chunkPtr(j)+1:chunkPtr(j+1)
+      iTrans = chunkTrans(iRes);
+      s = chunkSegs(iRes);
+      iiTrans = rowStart(iTrans) + chunkSlot(iRes);
+      ResonanceField = chunkFields(iRes);
+      z = chunkZeros(iRes);
+      
+      % Update position data
+      %------------------------------------------------
+      Pdat(iiTrans,iOri) = ResonanceField;
+
+      % Compute eigenvectors, eigenvalues and 1/g factor = 1/(dE/dB) if needed
+      %--------------------------------------------------
+      if computeEigenPairs || nPerturbNuclei>0
+        % Compute resonant state vectors
+        % u: lower level, v: higher level
+        uv = Transitions(iTrans,:);
+
+        % If eigenvectors change too much between knots, we have to
+        % rediagonalize the Hamiltonian at the resonance field.
+        if any(StateStability(uv,s)<Opt.RediagLimit)
+          nRediags = nRediags + 1;
+          if higherOrder
+            [Vectors_,Energies] = gethamdata_hO(ResonanceField,zLab_M,CoreSys,Opt.Sparse,Trans,nLevels);
+            if Opt.Sparse
+              [Energies,ind] = sort(diag(Energies));
               Energies = diag(Energies);
+              Vectors_ = Vectors_(:,ind);
             end
-            U = Vectors_(:,uv(1));
-            V = Vectors_(:,uv(2));
-            %Energies = diag(Energies);
-            %V'*kGxL*U
-            logmsg(3,sprintf('   %d-%d: stabilities %f and %f ===> rediagonalization',uv,StateStability(uv,s)));
           else
+            if issparse(kH0)
+              [Vectors_,Energies] = eigs(kH0-ResonanceField*kmuzL,nLevels);
+              % A sort of workaround for diagonalization using eigs, the
+              % energies are not ordered which results in a miscalculation
+              % of mu
+              [Energies,ind] = sort(diag(Energies));
+              Energies = diag(Energies);
+              Vectors_ = Vectors_(:,ind);
+              
+              %[Vectors_,Energies] = eig(full(kF+ResonanceField*kGzL));
+            else
+              [Vectors_,Energies] = eig(kH0-ResonanceField*kmuzL);
+            end
+            Energies = diag(Energies);
+          end
+          U = Vectors_(:,uv(1));
+          V = Vectors_(:,uv(2));
+          %Energies = diag(Energies);
+          %V'*kGxL*U
+          logmsg(3,sprintf('   %d-%d: stabilities %f and %f ===> rediagonalization',uv,StateStability(uv,s)));
+        else
 
-            z = cubicZeros(iReson);
 
-            Ua = Vectors{s}(:,uv(1)); Ub = Vectors{s+1}(:,uv(1));
-            [~,idx] = max(abs(Ua));
-            phase = Ua(idx)/Ub(idx);
-            U = Ua*(1-z) + z*phase/abs(phase)*Ub;
-            U = U/norm(U);
+          Ua = Vectors{s}(:,uv(1)); Ub = Vectors{s+1}(:,uv(1));
+          [~,idx] = max(abs(Ua));
+          phase = Ua(idx)/Ub(idx);
+          U = Ua*(1-z) + z*phase/abs(phase)*Ub;
+          U = U/norm(U);
 
-            Va = Vectors{s}(:,uv(2)); Vb = Vectors{s+1}(:,uv(2));
-            [~,idx] = max(abs(Va));
-            phase = Va(idx)/Vb(idx);
-            V = Va*(1-z) + z*phase/abs(phase)*Vb;
-            V = V/norm(V);
+          Va = Vectors{s}(:,uv(2)); Vb = Vectors{s+1}(:,uv(2));
+          [~,idx] = max(abs(Va));
+          phase = Va(idx)/Vb(idx);
+          V = Va*(1-z) + z*phase/abs(phase)*Vb;
+          V = V/norm(V);
 
-            if computeBoltzmannPopulations
-              t = cubicZeros(iReson);
-              Energies = [t^3 t^2 t 1]*SplineModelCoeffs{s};
-            end
-          end
-
-          if higherOrder
-            if Opt.Sparse
-              sp = 'sparse';
-            else
-              sp = '';
-            end
-            g1 = ham_ezho(CoreSys,[],[],sp,1);
-            [g0{1},g0{2},g0{3}] = ham_ez(CoreSys,[],sp);
-            if Sys.nNuclei>0
-              [mu0n{1},mu0n{2},mu0n{3}] = ham_nz(CoreSys,[],sp);
-              for k = 1:3
-                g0{k} = g0{k} - mu0n{k};
-              end
-            end
-            for n =3:-1:1
-              kmuM{n} = -(g1{1}{n}+g0{n});
-            end
-            % calculate lab-frame components
-            kmuzL = zLab_M(1)*kmuM{1} + zLab_M(2)*kmuM{2} + zLab_M(3)*kmuM{3};
-            kmuxL = xLab_M(1)*kmuM{1} + xLab_M(2)*kmuM{2} + xLab_M(3)*kmuM{3};
-            kmuyL = yLab_M(1)*kmuM{1} + yLab_M(2)*kmuM{2} + yLab_M(3)*kmuM{3};
-          end
-          
-          % Compute dB/dE
-          % dBdE is the general form of the famous 1/g factor
-          % dBdE = (d(Ev-Eu)/dB)^(-1) = 1/(<v|dH/dB|v>-<u|dH/dB|u>)
-          if computeFreq2Field
-            dBdE = 1/abs(real((V-U)'*(-kmuzL)*(V+U)));
-            % It might be quicker to take it from the first derivative
-            % of the transition energy!
-            %dBdE = dB(s)/abs(Diff1(iReson));
-            %dBdE2 = dB(s)^2/abs(Diff2(iReson)); % second derivative
-            %dBdE/dBdEold-1
-            % Guard against d(Ev-Eu)/dB==0
-            if dBdE>1e5
-              error('1/g factor diverges because d(Ev-Eu)/dB is almost zero for transition between levels u=%d and v=%d.',uv(1),uv(2));
-            end
-          else
-            dBdE = 1;
+          if computeBoltzmannPopulations
+            t = z;
+            dBs = Bknots(s+1)-Bknots(s);
+            SplineModelCoeffs = M*[Eknots(s,:); Eknots(s+1,:); dBs*dEdBknots(s,:); dBs*dEdBknots(s+1,:)];
+            Energies = [t^3 t^2 t 1]*SplineModelCoeffs;
           end
         end
 
-        % Calculate intensity if requested
-        %--------------------------------------------------
-        if computeIntensities
-          
-          % Compute quantum-mechanical transition rate
-          mu_L = [V'*kmuxL*U; V'*kmuyL*U; V'*kmuzL*U]; % magnetic transition dipole moment, in lab frame
-          if averageOverChi
-            if mwmode.linearpolarizedMode
-              TransitionRate = ((1-xi1^2)*norm(mu_L)^2+(3*xi1^2-1)*abs(nB0_L.'*mu_L)^2)/2;
-            elseif mwmode.unpolarizedMode
-              TransitionRate = ((1+xik^2)*norm(mu_L)^2+(1-3*xik^2)*abs(nB0_L.'*mu_L)^2)/4;
-            elseif mwmode.circpolarizedMode
-              TransitionRate = ((1+xik^2)*norm(mu_L)^2+(1-3*xik^2)*abs(nB0_L.'*mu_L)^2)/2 - ...
-                mwmode.circSense*xik*(nB0_L.'*cross(1i*mu_L,conj(mu_L)));
-            end
+        if higherOrder
+          if Opt.Sparse
+            sp = 'sparse';
           else
-            if mwmode.linearpolarizedMode
-              TransitionRate = abs(nB1_L.'*mu_L)^2;
-            elseif mwmode.unpolarizedMode
-              TransitionRate = (norm(mu_L)^2-abs(nk_L.'*mu_L)^2)/2;
-            elseif mwmode.circpolarizedMode
-              TransitionRate = (norm(mu_L)^2-abs(nk_L.'*mu_L)^2) - ...
-                mwmode.circSense*(nk_L.'*cross(1i*mu_L,conj(mu_L)));
+            sp = '';
+          end
+          g1 = ham_ezho(CoreSys,[],[],sp,1);
+          [g0{1},g0{2},g0{3}] = ham_ez(CoreSys,[],sp);
+          if Sys.nNuclei>0
+            [mu0n{1},mu0n{2},mu0n{3}] = ham_nz(CoreSys,[],sp);
+            for k = 1:3
+              g0{k} = g0{k} - mu0n{k};
             end
           end
-          if abs(TransitionRate)<1e-10
-            TransitionRate = 0;
+          for n =3:-1:1
+            kmuM{n} = -(g1{1}{n}+g0{n});
           end
-          
-          % Compute polarizations if temperature or zero-field populations are given.
-          if computeBoltzmannPopulations
-            Populations = exp(-BoltzmannPreFactor*(Energies-Energies(1)));
-            Populations = Populations/sum(Populations);
-            Polarization = Populations(u(iTrans)) - Populations(v(iTrans));
-            if Polarization<0
-              error('Negative thermal polarization for transition %d<->%d: %f',u(iTrans),v(iTrans),Polarization);
-            end
-            if nPerturbNuclei>0
-              Polarization = Polarization/prod(2*Sys.I+1);            
-            end
-          elseif computeNonEquiPops
-            switch initStateBasis
-              case 'eigen'
-                PopulationU = initState(uv(1),uv(1)); % lower level
-                PopulationV = initState(uv(2),uv(2)); % upper level
-              otherwise
-                PopulationU = U'*initState*U; % lower level
-                PopulationV = V'*initState*V; % upper level
-            end
-            Polarization = real(PopulationU - PopulationV);
-            if nPerturbNuclei>0
-              Polarization = Polarization/prod(2*Sys.I+1);            
-            end
-          else
-            % no temperature given
-            Polarization = 1; % same polarization for each electron transition
-            Polarization = Polarization/prod(2*Sys.I+1);
+          % calculate lab-frame components
+          kmuzL = zLab_M(1)*kmuM{1} + zLab_M(2)*kmuM{2} + zLab_M(3)*kmuM{3};
+          kmuxL = xLab_M(1)*kmuM{1} + xLab_M(2)*kmuM{2} + xLab_M(3)*kmuM{3};
+          kmuyL = yLab_M(1)*kmuM{1} + yLab_M(2)*kmuM{2} + yLab_M(3)*kmuM{3};
+        end
+        
+        % Compute dB/dE
+        % dBdE is the general form of the famous 1/g factor
+        % dBdE = (d(Ev-Eu)/dB)^(-1) = 1/(<v|dH/dB|v>-<u|dH/dB|u>)
+        if computeFreq2Field
+          dBdE = 1/abs(real((V-U)'*(-kmuzL)*(V+U)));
+          % It might be quicker to take it from the first derivative
+          % of the transition energy!
+          %dBdE = dB(s)/abs(Diff1(iReson));
+          %dBdE2 = dB(s)^2/abs(Diff2(iReson)); % second derivative
+          %dBdE/dBdEold-1
+          % Guard against d(Ev-Eu)/dB==0
+          if dBdE>1e5
+            error('1/g factor diverges because d(Ev-Eu)/dB is almost zero for transition between levels u=%d and v=%d.',uv(1),uv(2));
           end
-          
-          % Update intensity results array
-          Idat(iiTrans,iOri) = dBdE * TransitionRate * Polarization * photoWeight;
-          % dBdE proportionality not valid near looping field coalescences!
+        else
+          dBdE = 1;
         end
+      end
+
+      % Calculate intensity if requested
+      %--------------------------------------------------
+      if computeIntensities
         
-        % Calculate gradient of resonance frequency
-        %---------------------------------------------------
-        if computeGradient
-          Gradient2 = real((V'-U')*kmuxL*(V+U)).^2 + real((V'-U')*kmuyL*(V+U)).^2;
-          % dBdE proportionality not valid near looping field coalescences
-          Gdat(iiTrans,iOri) = dBdE * ResonanceFields(iReson) * sqrt(Gradient2);
+        % Compute quantum-mechanical transition rate
+        mu_L = [V'*kmuxL*U; V'*kmuyL*U; V'*kmuzL*U]; % magnetic transition dipole moment, in lab frame
+        if averageOverChi
+          if mwmode.linearpolarizedMode
+            TransitionRate = ((1-xi1^2)*norm(mu_L)^2+(3*xi1^2-1)*abs(nB0_L.'*mu_L)^2)/2;
+          elseif mwmode.unpolarizedMode
+            TransitionRate = ((1+xik^2)*norm(mu_L)^2+(1-3*xik^2)*abs(nB0_L.'*mu_L)^2)/4;
+          elseif mwmode.circpolarizedMode
+            TransitionRate = ((1+xik^2)*norm(mu_L)^2+(1-3*xik^2)*abs(nB0_L.'*mu_L)^2)/2 - ...
+              mwmode.circSense*xik*(nB0_L.'*cross(1i*mu_L,conj(mu_L)));
+          end
+        else
+          if mwmode.linearpolarizedMode
+            TransitionRate = abs(nB1_L.'*mu_L)^2;
+          elseif mwmode.unpolarizedMode
+            TransitionRate = (norm(mu_L)^2-abs(nk_L.'*mu_L)^2)/2;
+          elseif mwmode.circpolarizedMode
+            TransitionRate = (norm(mu_L)^2-abs(nk_L.'*mu_L)^2) - ...
+              mwmode.circSense*(nk_L.'*cross(1i*mu_L,conj(mu_L)));
+          end
+        end
+        if abs(TransitionRate)<1e-10
+          TransitionRate = 0;
         end
         
-        % Calculate width if requested
-        %--------------------------------------------------
-        if computeStrains
-          %m = @(Op) real(V'*Op*V) - real(U'*Op*U);
-          m = @(Op) real((V'-U')*Op*(V+U)); % equivalent to prev. line
-
-          % H strain
-          LineWidth2 = LineWidthSquared;
-          
-          % D strain
-          if useDStrain
-            for iEl = 1:CoreSys.nElectrons
-              LineWidth2 = LineWidth2 + abs(m(dHdD{iEl}))^2;
-              LineWidth2 = LineWidth2 + abs(m(dHdE{iEl}))^2;
-            end
+        % Compute polarizations if temperature or zero-field populations are given.
+        if computeBoltzmannPopulations
+          Populations = exp(-BoltzmannPreFactor*(Energies-Energies(1)));
+          Populations = Populations/sum(Populations);
+          Polarization = Populations(u(iTrans)) - Populations(v(iTrans));
+          if Polarization<0
+            error('Negative thermal polarization for transition %d<->%d: %f',u(iTrans),v(iTrans),Polarization);
           end
-          
-          % g and A strain
-          if usegStrain || useAStrain
-            if simplegStrain
-              gA2 = gAslw2{1}(:,:,iTrans);
-            else
-              gA2 = 0;
-              for iEl = 1:Sys.nElectrons
-                gA2 = gA2 + abs(m(kSzL{iEl}))*gAslw2{iEl}(:,:,iTrans);
-              end
-            end
-            LineWidth2 = LineWidth2 + zLab_M.'*gA2*zLab_M;
+          if nPerturbNuclei>0
+            Polarization = Polarization/prod(2*Sys.I+1);            
           end
-          
-          % Convert to field value and save
-          % (dBdE proportionality not valid near looping field coalescences!)
-          Wdat(iiTrans,iOri) = dBdE * sqrt(LineWidth2);
+        elseif computeNonEquiPops
+          switch initStateBasis
+            case 'eigen'
+              PopulationU = initState(uv(1),uv(1)); % lower level
+              PopulationV = initState(uv(2),uv(2)); % upper level
+            otherwise
+              PopulationU = U'*initState*U; % lower level
+              PopulationV = V'*initState*V; % upper level
+          end
+          Polarization = real(PopulationU - PopulationV);
+          if nPerturbNuclei>0
+            Polarization = Polarization/prod(2*Sys.I+1);            
+          end
+        else
+          % no temperature given
+          Polarization = 1; % same polarization for each electron transition
+          Polarization = Polarization/prod(2*Sys.I+1);
         end
-        %--------------------------------------------------
         
+        % Update intensity results array
+        Idat(iiTrans,iOri) = dBdE * TransitionRate * Polarization * photoWeight;
+        % dBdE proportionality not valid near looping field coalescences!
+      end
+      
+      % Calculate gradient of resonance frequency
+      %---------------------------------------------------
+      if computeGradient
+        Gradient2 = real((V'-U')*kmuxL*(V+U)).^2 + real((V'-U')*kmuyL*(V+U)).^2;
+        % dBdE proportionality not valid near looping field coalescences
+        Gdat(iiTrans,iOri) = dBdE * ResonanceField * sqrt(Gradient2);
+      end
+      
+      % Calculate width if requested
+      %--------------------------------------------------
+      if computeStrains
+        %m = @(Op) real(V'*Op*V) - real(U'*Op*U);
+        m = @(Op) real((V'-U')*Op*(V+U)); % equivalent to prev. line
+
+        % H strain
+        LineWidth2 = LineWidthSquared;
         
-        % First-order approximation for nuclei
-        %-------------------------------------------------------
-        if nPerturbNuclei>0
-          % Compute S vector expectation values for all electron spins
-          for iEl = Sys.nElectrons:-1:1
-            Su(:,iEl) = [U'*S(iEl).x*U; U'*S(iEl).y*U; U'*S(iEl).z*U];
-            Sv(:,iEl) = [V'*S(iEl).x*V; V'*S(iEl).y*V; V'*S(iEl).z*V];
+        % D strain
+        if useDStrain
+          for iEl = 1:CoreSys.nElectrons
+            LineWidth2 = LineWidth2 + abs(m(dHdD{iEl}))^2;
+            LineWidth2 = LineWidth2 + abs(m(dHdE{iEl}))^2;
           end
-          % Build and diagonalize nuclear sub-Hamiltonians
-          for iiNuc = 1:nPerturbNuclei
-            Hu = 0;
-            Hv = 0;
-            % Hyperfine (dependent on S)
+        end
+        
+        % g and A strain
+        if usegStrain || useAStrain
+          if simplegStrain
+            gA2 = gAslw2{1}(:,:,iTrans);
+          else
+            gA2 = 0;
             for iEl = 1:Sys.nElectrons
-              Hu = Hu + Su(1,iEl)*Hhfi(iEl,iiNuc).x + Su(2,iEl)*Hhfi(iEl,iiNuc).y + Su(3,iEl)*Hhfi(iEl,iiNuc).z;
-              Hv = Hv + Sv(1,iEl)*Hhfi(iEl,iiNuc).x + Sv(2,iEl)*Hhfi(iEl,iiNuc).y + Sv(3,iEl)*Hhfi(iEl,iiNuc).z;
-            end
-            % Nuclear Zeeman and quadrupole (independent of S)
-            if ~Opt.HybridOnlyHFI
-              Hc = Hquad{iiNuc} + ResonanceFields(iReson)*...
-                (zLab_M(1)*Hzeem(iiNuc).x + zLab_M(2)*Hzeem(iiNuc).y + zLab_M(3)*Hzeem(iiNuc).z);
-              Hu = Hu + Hc;
-              Hv = Hv + Hc;
+              gA2 = gA2 + abs(m(kSzL{iEl}))*gAslw2{iEl}(:,:,iTrans);
             end
-            % hermitianize (important, otherwise eig returns unsorted values)
-            Hu = (Hu+Hu')/2; 
-            Hv = (Hv+Hv')/2;
-            [Vu,dEu] = eig(Hu); dEu = diag(dEu);
-            [Vv,dEv] = eig(Hv); dEv = diag(dEv);
-            NucTransitionRates = abs(Vu'*Vv).^2; % the famous Mims matrix M
-            % Compute and store all resonance field shifts and amplitude factors.
-            % Intensity thresholds are applied later.
-            [vidx,uidx] = find(ones(size(NucTransitionRates)));
-            pPdatN{iiNuc}(iiTrans,iOri,:) = -dBdE*(dEv(vidx(:)) - dEu(uidx(:)));
-            pIdatN{iiNuc}(iiTrans,iOri,:) = NucTransitionRates(:);
           end
+          LineWidth2 = LineWidth2 + zLab_M.'*gA2*zLab_M;
         end
-        %-------------------------------------------------------
-
-        iiTrans = iiTrans + 1;
         
-      end % for all resonance fields of a given transitions
+        % Convert to field value and save
+        % (dBdE proportionality not valid near looping field coalescences!)
+        Wdat(iiTrans,iOri) = dBdE * sqrt(LineWidth2);
+      end
+      %--------------------------------------------------
       
-      if ~LoopFields, break; end % only one resfield per transition ->
-        % quit segment loop if resfield processed!
       
-    end  % for all segments
-  end % for all transitions
-end % for all orientations
+      % First-order approximation for nuclei
+      %-------------------------------------------------------
+      if nPerturbNuclei>0
+        % Compute S vector expectation values for all electron spins
+        for iEl = Sys.nElectrons:-1:1
+          Su(:,iEl) = [U'*S(iEl).x*U; U'*S(iEl).y*U; U'*S(iEl).z*U];
+          Sv(:,iEl) = [V'*S(iEl).x*V; V'*S(iEl).y*V; V'*S(iEl).z*V];
+        end
+        % Build and diagonalize nuclear sub-Hamiltonians
+        for iiNuc = 1:nPerturbNuclei
+          Hu = 0;
+          Hv = 0;
+          % Hyperfine (dependent on S)
+          for iEl = 1:Sys.nElectrons
+            Hu = Hu + Su(1,iEl)*Hhfi(iEl,iiNuc).x + Su(2,iEl)*Hhfi(iEl,iiNuc).y + Su(3,iEl)*Hhfi(iEl,iiNuc).z;
+            Hv = Hv + Sv(1,iEl)*Hhfi(iEl,iiNuc).x + Sv(2,iEl)*Hhfi(iEl,iiNuc).y + Sv(3,iEl)*Hhfi(iEl,iiNuc).z;
+          end
+          % Nuclear Zeeman and quadrupole (independent of S)
+          if ~Opt.HybridOnlyHFI
+            Hc = Hquad{iiNuc} + ResonanceField*...
+              (zLab_M(1)*Hzeem(iiNuc).x + zLab_M(2)*Hzeem(iiNuc).y + zLab_M(3)*Hzeem(iiNuc).z);
+            Hu = Hu + Hc;
+            Hv = Hv + Hc;
+          end
+          % hermitianize (important, otherwise eig returns unsorted values)
+          Hu = (Hu+Hu')/2; 
+          Hv = (Hv+Hv')/2;
+          [Vu,dEu] = eig(Hu); dEu = diag(dEu);
+          [Vv,dEv] = eig(Hv); dEv = diag(dEv);
+          NucTransitionRates = abs(Vu'*Vv).^2; % the famous Mims matrix M
+          % Compute and store all resonance field shifts and amplitude factors.
+          % Intensity thresholds are applied later.
+          [vidx,uidx] = find(ones(size(NucTransitionRates)));
+          pPdatN{iiNuc}(iiTrans,iOri,:) = -dBdE*(dEv(vidx(:)) - dEu(uidx(:)));
+          pIdatN{iiNuc}(iiTrans,iOri,:) = NucTransitionRates(:);
+        end
+      end
+      %-------------------------------------------------------
+      
+    end % for all resonances of the orientation
+  end % for all orientations of the chunk
+  
+end % for all chunks of orientations
 
 clear fH1 fVu fVv Hu Hv pVu pVv NucTransitionRates vidx uidx
-idxTr(end) = [];
+
+% Transition index of each data row
+idxTr = zeros(sum(nSlots),1);
+idxTr(cumsum([1; nSlots(1:end-1)])) = 1;
+idxTr = cumsum(idxTr);
 %=======================================================================
 
 logmsg(2,'  ## %2d resonances total from %d level pairs',size(Pdat,1),nTransitions);
@@ -1556,3 +1613,18 @@ Output = {Pdat,Idat,Wdat,Transitions,Gdat};
 varargout = Output(1:max(nargout,1));
 
 end
+
+
+%=======================================================================
+% Inserts rows into A such that the block of nOld(k) rows belonging to
+% transition k grows to nNew(k) rows. New rows are set to fillValue.
+function B = growrowblocks(A,nOld,nNew,fillValue)
+siz = size(A);
+siz(1) = sum(nNew);
+B = repmat(fillValue,siz);
+oldStart = cumsum([0; nOld(1:end-1)]);
+newStart = cumsum([0; nNew(1:end-1)]);
+for k = 1:numel(nOld)
+  B(newStart(k)+(1:nOld(k)),:) = A(oldStart(k)+(1:nOld(k)),:);
+end
+end
@@ -246,6 +246,8 @@ else
   logmsg(1,'1st order perturbation theory');
 end
 
+% Opt.ImmediateBinning: 1 bins the nuclear stick patterns convolved on the
+% spectral axis, 2 bins every stick at its exact position
 if ~isfield(Opt,'ImmediateBinning'), Opt.ImmediateBinning = 0; end
 %---------------------------------------------------------------------
 
@@ -264,7 +266,8 @@ if highSpin
 end
 II1 = I.*(I+1);
 
-immediateBinning = Opt.ImmediateBinning;
+immediateBinning = Opt.ImmediateBinning>0;
+exactBinning = Opt.ImmediateBinning==2;
 
 if immediateBinning
 else
@@ -280,7 +283,13 @@ if immediateBinning
   E1A = zeros(max(nNucStates),nNuclei);
   Baxis = linspace(Exp.Range(1),Exp.Range(2),Exp.nPoints);
   dB = Baxis(2)-Baxis(1);
-  spec = zeros(1,Exp.nPoints);
+  % stick spectra of all orientations and transitions, binned with a
+  % single call to multinucstick after the orientation loop
+  nSticks = nOrientations*2*S;
+  stickB0 = zeros(1,nSticks);
+  stickWeights = zeros(1,nSticks);
+  stickShifts = zeros(max(nNucStates),nNuclei,nSticks);
+  iStick = 0;
 end
 
 if ~isnan(Exp.Temperature)
@@ -447,9 +456,11 @@ for iOri = nOrientations:-1:1
       B0 = (E0-E1D-E2D)*preOri*1e3; % mT
       % compute B shifts
       Bshifts = (-(E1A+E2A+E2DA))*preOri*1e3; % mT
-      % directly accumulate into spectrum
-      spec = spec + Intensity(imS,iOri)*Exp.AccumWeights(iOri)*...
-        multinucstick(B0,nNucStates,Bshifts,Baxis(1),dB,Exp.nPoints);
+      % collect for binning
+      iStick = iStick + 1;
+      stickB0(iStick) = B0;
+      stickWeights(iStick) = Intensity(imS,iOri)*Exp.AccumWeights(iOri);
+      stickShifts(:,:,iStick) = Bshifts;
     else
       if secondOrder
         Bfinal{imS}(iOri,:) = (E0-E1D-E2D-sum(E1A+E2A+E2DA,2))*preOri;
@@ -462,11 +473,18 @@ for iOri = nOrientations:-1:1
   
 end
 
+KernelStats = struct;
 if immediateBinning
   B = [];
   Int = [];
   Wid = [];
   Transitions = [];
+  if Opt.Verbosity>0
+    [spec,KernelStats.multinucstick] = ...
+      multinucstick(stickB0,nNucStates,stickShifts,Baxis(1),dB,Exp.nPoints,stickWeights,exactBinning);
+  else
+    spec = multinucstick(stickB0,nNucStates,stickShifts,Baxis(1),dB,Exp.nPoints,stickWeights,exactBinning);
+  end
   spec = spec/dB/prod(nNucStates);
   spec = spec*(2*pi); % powder chi integral
 else
@@ -599,7 +617,7 @@ end
 
 % Arrange output
 %---------------------------------------------------------------
-Output = {B,Int,Wid,Transitions,spec};
+Output = {B,Int,Wid,Transitions,spec,KernelStats};
 varargout = Output(1:max(nargout,1));
 
 end
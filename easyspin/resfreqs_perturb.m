@@ -233,6 +233,8 @@ else
   logmsg(1,'1st order perturbation theory');
 end
 
+% Opt.ImmediateBinning: 1 bins the nuclear stick patterns convolved on the
+% spectral axis, 2 bins every stick at its exact position
 if ~isfield(Opt,'ImmediateBinning'), Opt.ImmediateBinning = 0; end
 %---------------------------------------------------------------------
 
@@ -251,7 +253,8 @@ if highSpin
 end
 II1 = I.*(I+1);
 
-immediateBinning = Opt.ImmediateBinning;
+immediateBinning = Opt.ImmediateBinning>0;
+exactBinning = Opt.ImmediateBinning==2;
 
 if immediateBinning
 else
@@ -267,7 +270,13 @@ if immediateBinning
   dE1A = zeros(max(nNucStates),nNuclei);
   nuaxis = linspace(Exp.Range(1),Exp.Range(2),Exp.nPoints);
   dnu = nuaxis(2)-nuaxis(1);
-  spec = zeros(1,Exp.nPoints);
+  % stick spectra of all orientations and transitions, binned with a
+  % single call to multinucstick after the orientation loop
+  nSticks = nOrientations*2*S;
+  stickNu0 = zeros(1,nSticks);
+  stickWeights = zeros(1,nSticks);
+  stickShifts = zeros(max(nNucStates),nNuclei,nSticks);
+  iStick = 0;
 end
 
 if ~isnan(Exp.Temperature)
@@ -428,10 +437,11 @@ for iOri = nOrientations:-1:1
     end
     
     if immediateBinning
-      dE = dE0 + dE1D + dE2D + dE1A + dE2A + dE2DA;
-      % directly accumulate into spectrum
-      spec = spec + Intensity(imS,iOri)*Exp.AccumWeights(iOri)*...
-        multinucstick(dE,nNucStates,Bshifts,nuaxis(1),dnu,Exp.nPoints);
+      % collect for binning
+      iStick = iStick + 1;
+      stickNu0(iStick) = E0 + dE1D + dE2D; % MHz
+      stickWeights(iStick) = Intensity(imS,iOri)*Exp.AccumWeights(iOri);
+      stickShifts(:,:,iStick) = dE1A + dE2A + dE2DA; % MHz
     else
       if secondOrder
         dEfinal{imS}(iOri,:) = E0+dE1D+dE2D+sum(dE1A+dE2A+dE2DA,2);
@@ -444,11 +454,18 @@ for iOri = nOrientations:-1:1
   
 end
 
+KernelStats = struct;
 if immediateBinning
   nu = [];
   Int = [];
   Wid = [];
   Transitions = [];
+  if Opt.Verbosity>0
+    [spec,KernelStats.multinucstick] = ...
+      multinucstick(stickNu0,nNucStates,stickShifts,nuaxis(1),dnu,Exp.nPoints,stickWeights,exactBinning);
+  else
+    spec = multinucstick(stickNu0,nNucStates,stickShifts,nuaxis(1),dnu,Exp.nPoints,stickWeights,exactBinning);
+  end
   spec = spec/dnu/prod(nNucStates);
   spec = spec*(2*pi); % powder chi integral
 else
@@ -583,7 +600,7 @@ end
 
 % Arrange output
 %---------------------------------------------------------------
-Output = {nu,Int,Wid,Transitions,spec};
+Output = {nu,Int,Wid,Transitions,spec,KernelStats};
 varargout = Output(1:max(nargout,1));
 
 return
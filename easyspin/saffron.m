@@ -26,6 +26,9 @@ error(eschecker);
 % Check Matlab version
 error(chkmlver);
 
+% sf_evolve and sf_peaks are mex files
+checkmex;
+
 % Get time for performance report at the end
 startTime = datetime;
 
@@ -777,6 +780,8 @@ if fastSimulationMode
   if ~isfield(Opt,'logplot'), Opt.logplot = 0; end
   if ~isfield(Opt,'PartialIFFT'), Opt.PartialIFFT = 1; end
   if ~isfield(Opt,'TimeDomain'), Opt.TimeDomain = 0; end
+  if ~isfield(Opt,'PeakThreshold'), Opt.PeakThreshold = 0; end
+  if ~isfield(Opt,'SparseBinning'), Opt.SparseBinning = false; end
 
 
   logmsg(1,'-Hamiltonians------------------------------------------');
@@ -1031,6 +1036,10 @@ if fastSimulationMode
     end
   end
 
+  % Peaks are collected over orientations and binned in batches
+  PeakQueue = struct('Threshold',Opt.PeakThreshold,'SparseBinning',Opt.SparseBinning,...
+    'CollectStats',Opt.Verbosity>0);
+
   nSkippedOrientations = 0;
   for iOri = 1:nOrientations
 
@@ -1277,7 +1286,7 @@ if fastSimulationMode
                   idxIncL(iPathway,:),idxIncR(iPathway,:),...
                   Ea,Eb,G,D,BlockL{:},BlockR{:});
               else
-                sf_peaks(IncSchemeID,buffRe,buffIm,Exp.dt,...
+                PeakQueue = sf_peakqueue(PeakQueue,buffRe,buffIm,IncSchemeID,Exp.dt,...
                   idxIncL(iPathway,:),idxIncR(iPathway,:),...
                   Ea,Eb,G,D,BlockL{:},BlockR{:});
               end
@@ -1453,8 +1462,8 @@ if fastSimulationMode
                     sf_peaks(IncSchemeID,pathwaybuffRe{1,iSpace},pathwaybuffIm{1,iSpace},Exp.dt,[1 2],[1 2],Ea,Eb,G1,D1,Tl1,Tr1);
                     sf_peaks(IncSchemeID,pathwaybuffRe{2,iSpace},pathwaybuffIm{2,iSpace},Exp.dt,[2 1],[2 1],Ea,Eb,G2,D2,Tl2,Tr2);
                   else
-                    sf_peaks(IncSchemeID,buffRe,buffIm,Exp.dt,[1 2],[1 2],Ea,Eb,G1,D1,Tl1,Tr1);
-                    sf_peaks(IncSchemeID,buffRe,buffIm,Exp.dt,[2 1],[2 1],Ea,Eb,G2,D2,Tl2,Tr2);
+                    PeakQueue = sf_peakqueue(PeakQueue,buffRe,buffIm,IncSchemeID,Exp.dt,[1 2],[1 2],Ea,Eb,G1,D1,Tl1,Tr1);
+                    PeakQueue = sf_peakqueue(PeakQueue,buffRe,buffIm,IncSchemeID,Exp.dt,[2 1],[2 1],Ea,Eb,G2,D2,Tl2,Tr2);
                   end
                 end
 
@@ -1495,8 +1504,8 @@ if fastSimulationMode
                     sf_peaks(IncSchemeID,pathwaybuffRe{1,iSpace},pathwaybuffIm{1,iSpace},Exp.dt,[1 2],[1 2],Ea,Eb,G1,D1,Tl1,Tr1);
                     sf_peaks(IncSchemeID,pathwaybuffRe{2,iSpace},pathwaybuffIm{2,iSpace},Exp.dt,[2 1],[2 1],Ea,Eb,G2,D2,Tl2,Tr2);
                   else
-                    sf_peaks(IncSchemeID,buffRe,buffIm,Exp.dt,[1 2],[1 2],Ea,Eb,G1,D1,Tl1,Tr1);
-                    sf_peaks(IncSchemeID,buffRe,buffIm,Exp.dt,[2 1],[2 1],Ea,Eb,G2,D2,Tl2,Tr2);
+                    PeakQueue = sf_peakqueue(PeakQueue,buffRe,buffIm,IncSchemeID,Exp.dt,[1 2],[1 2],Ea,Eb,G1,D1,Tl1,Tr1);
+                    PeakQueue = sf_peakqueue(PeakQueue,buffRe,buffIm,IncSchemeID,Exp.dt,[2 1],[2 1],Ea,Eb,G2,D2,Tl2,Tr2);
                   end
                 end
 
@@ -1533,8 +1542,8 @@ if fastSimulationMode
                     sf_peaks(IncSchemeID,pathwaybuffRe{1,iSpace},pathwaybuffIm{1,iSpace},Exp.dt,1,1,Ea,Eb,G1,D1);
                     sf_peaks(IncSchemeID,pathwaybuffRe{2,iSpace},pathwaybuffIm{2,iSpace},Exp.dt,2,2,Ea,Eb,G2,D2);
                   else
-                    sf_peaks(IncSchemeID,buffRe,buffIm,Exp.dt,1,1,Ea,Eb,G1,D1);
-                    sf_peaks(IncSchemeID,buffRe,buffIm,Exp.dt,2,2,Ea,Eb,G2,D2);
+                    PeakQueue = sf_peakqueue(PeakQueue,buffRe,buffIm,IncSchemeID,Exp.dt,1,1,Ea,Eb,G1,D1);
+                    PeakQueue = sf_peakqueue(PeakQueue,buffRe,buffIm,IncSchemeID,Exp.dt,2,2,Ea,Eb,G2,D2);
                   end
                 end
 
@@ -1565,7 +1574,7 @@ if fastSimulationMode
                   if Opt.ProductRule
                     sf_peaks(IncSchemeID,pathwaybuffRe{1,iSpace},pathwaybuffIm{1,iSpace},Exp.dt,[1 2],[2 1],Ea,Eb,G,D,T1left,T1right);
                   else
-                    sf_peaks(IncSchemeID,buffRe,buffIm,Exp.dt,[1 2],[2 1],Ea,Eb,G,D,T1left,T1right);
+                    PeakQueue = sf_peakqueue(PeakQueue,buffRe,buffIm,IncSchemeID,Exp.dt,[1 2],[2 1],Ea,Eb,G,D,T1left,T1right);
                   end
                 end
 
@@ -1614,6 +1623,11 @@ if fastSimulationMode
 
   end % orientation loop
 
+  if ~isENDOR && ~Opt.ProductRule && ~Opt.TimeDomain
+    PeakQueue = sf_peakqueue(PeakQueue,buffRe,buffIm);
+    logmsg(1,'%d peaks binned, %d peaks below threshold',PeakQueue.nKept,PeakQueue.nPruned);
+  end
+
   logmsg(1,'end of orientation/transition loop');
   logmsg(1,'%d of %d orientations skipped',nSkippedOrientations,nOrientations);
   %=================================================================
@@ -1817,6 +1831,9 @@ if fastSimulationMode
     info.td = td;
     info.fd = fd;
   end
+  if isfield(PeakQueue,'Stats') && ~isempty(PeakQueue.Stats)
+    info.KernelStats.sf_peaks = PeakQueue.Stats;
+  end
 
   switch nargout
     case 1, varargout = {y_out};
@@ -1849,41 +1866,50 @@ else  % if fastSimulationMode
   end
   %----------------------------------------------------------------------
 
-  rawSignals = cell(1,nOrientations);
-  timeAxis = cell(1,nOrientations);
-
   logmsg(1,'-starting orientation loop-----------------------------');
   if Opt.Relaxation
     logmsg(1,'  relaxation is active during simulation');
   else
     logmsg(1,'  no relaxation during propagation');
   end
-  logmsg(1,'  propagating %d orientations',nOrientations);
   Field = Exp.Field;
 
-  parfor iOrientation = 1 : nOrientations
-
-    Sys_L = rotatesystem(Sys,Orientations(iOrientation,:)); % mol->lab frame
+  % Orientations are propagated in batches, with all Hamiltonians of a
+  % batch passed to s_thyme at once. The batch size is chosen such that
+  % the propagators of all pulses stay within a fixed memory budget.
+  nStates = size(Sigma,1);
+  if ~isempty(Relaxation), nStates = nStates^2; end
+  nPulses = max(1,sum(cellfun(@(e)strcmp(e.type,'pulse'),Events)));
+  maxMemory = 2^28; % bytes
+  nBatch = floor(maxMemory/(16*nStates^2*1025*nPulses));
+  nBatch = min(max(nBatch,1),nOrientations);
+  logmsg(1,'  propagating %d orientations in batches of %d',nOrientations,nBatch);
+  if ~isempty(Relaxation)
+    logmsg(1,'  adapting relaxation superoperator to system frame');
+  end
 
-    Ham = ham(Sys_L,Field*[0 0 1]);  % lab frame
+  Signal = 0;
+  for iBatch = 1:nBatch:nOrientations
+    idx = iBatch:min(iBatch+nBatch-1,nOrientations);
+    Ham = zeros(size(Sigma,1),size(Sigma,1),numel(idx));
+    for k = 1:numel(idx)
+      Sys_L = rotatesystem(Sys,Orientations(idx(k),:)); % mol->lab frame
+      Ham(:,:,k) = full(ham(Sys_L,Field*[0 0 1]));  % lab frame
+    end
 
     Relaxation_ = Relaxation;
     if ~isempty(Relaxation_)
-      logmsg(1,'  adapting relaxation superoperator to system frame');
-      [U,~] = eig(Ham);
-      R = kron(transpose(U),U');
-      Relaxation_.Gamma = R'*Relaxation_.Gamma*R;
+      Gamma = zeros(nStates,nStates,numel(idx));
+      for k = 1:numel(idx)
+        [U,~] = eig(Ham(:,:,k));
+        R = kron(transpose(U),U');
+        Gamma(:,:,k) = full(R'*Relaxation.Gamma*R);
+      end
+      Relaxation_.Gamma = Gamma;
     end
 
-    [timeAxis{iOrientation}, rawSignals{iOrientation}] = s_thyme(Sigma, Ham, DetOps, Events, Relaxation_, Vary);
-  end
-
-  timeAxis = timeAxis{1};
-
-  % Accumulate powder signal
-  Signal = 0;
-  for iOrientation = 1 : nOrientations
-    Signal = Signal + rawSignals{iOrientation}*Exp.OriWeights(iOrientation);
+    [timeAxis, Signal_] = s_thyme(Sigma, Ham, DetOps, Events, Relaxation_, Vary, Exp.OriWeights(idx));
+    Signal = Signal + Signal_;
   end
 
   if isfield(Exp,'DetPhase')
@@ -2062,94 +2088,6 @@ else
 end
 end
 
-%==========================================================================
-%==========================================================================
-%==========================================================================
-function Signal = sf_evolve(IncSchemeID,nPoints,dt,incL,incR,Ea,Eb,G,D,T1l,T1r)
-
-if nargin-9~=2*(numel(incL)-1)
-  error('Time-domain evolution kernel: Wrong number of transfer matrices.');
-end
-
-NN = numel(G);
-Density = G;
-Detector = reshape(D.',1,NN);
-E = {Ea,Eb};
-
-% Pre-allocate signal array
-if numel(nPoints)==1
-  Signal = zeros(1,nPoints);
-else
-  Signal = zeros(nPoints);
-end
-
-switch IncSchemeID
-
-  case 1 % IncScheme [1], three-pulse ESEEM, five-pulse ESEEM
-    FinalDensity = Density(:);
-    UUt = exp(-2i*pi*E{incL(1)}*dt)*exp(-2i*pi*E{incR(1)}*dt)';
-    UUt = UUt(:);
-    for k1 = 1:nPoints
-      Signal(k1) = Detector*FinalDensity;
-      FinalDensity = UUt.*FinalDensity;
-    end
-
-  case 2 % IncScheme [1 1], two-pulse ESEEM, 1D-CP, refocused two-pulse ESEEM
-    UUleft  = exp(-2i*pi*E{incL(2)}*dt)*exp(-2i*pi*E{incL(1)}*dt).';
-    UUright = exp(+2i*pi*E{incR(1)}*dt)*exp(+2i*pi*E{incR(2)}*dt).';
-    for k = 1:nPoints
-      % compute density right before detection
-      FinalDensity = T1l*Density*T1r;
-      % compute trace(Detector*FinalDensity)
-      Signal(k) = Detector*FinalDensity(:);
-      % Evolve transfer matrices forward and backwards at the same time.
-      T1l = UUleft.*T1l; % equivalent to U*T1Left*U'
-      T1r = UUright.*T1r; % equivalent to U*T1Right*U'
-    end
-
-  case 3 % IncScheme [1 -1]
-    error('Time-domain evolution for incrementation scheme [1 -1] not supported.');
-
-  case 11 % IncScheme [1 2], HYSCORE
-    UUt1 = exp(-2i*pi*E{incL(1)}*dt(1))*exp(-2i*pi*E{incR(1)}*dt(1))';
-    UUt2 = exp(-2i*pi*E{incL(2)}*dt(2))*exp(-2i*pi*E{incR(2)}*dt(2))';
-    UUt2 = UUt2(:);
-    for k1 = 1:nPoints(1)
-      FinalDensity = reshape(T1l*Density*T1r,NN,1);
-      for k2 = 1:nPoints(2)
-        Signal(k1,k2) = Detector*FinalDensity;
-        FinalDensity = UUt2.*FinalDensity;
-      end
-      Density = UUt1.*Density;
-    end
-
-  case 12 % IncScheme [1 2 2]
-    error('Time-domain evolution for this experiment not supported.');
-
-  case 13 % IncScheme [1 2 1] 2D-3p
-    error('Time-domain evolution for this experiment not supported.');
-
-  case 14 % IncScheme [1 1 2], CF-NF
-    error('Time-domain evolution for this experiment not supported.');
-
-  case 15 % IncScheme [1 2 2 1], 2D-CP
-    error('Time-domain evolution for this experiment not supported.');
-
-  case 16 % IncScheme [1 2 -2 1]
-    error('Time-domain evolution for this experiment not supported.');
-
-  case 17 % IncScheme [1 1 2 2], 2D refocused primary ESEEM
-    error('Time-domain evolution for this experiment not supported.');
-
-  otherwise
-
-    error('Time-domain evolution for this experiment not supported.');
-
-end
-
-end
-
-
 %-------------------------------------------------------------------------------
 % Coherence transfer pathway parser
 %-------------------------------------------------------------------------------
@@ -28,6 +28,9 @@ error(eschecker);
 % Check Matlab version
 error(chkmlver);
 
+% Propagation (s_propagate) is done in a mex file
+checkmex;
+
 StartTime = clock;
 
 % Input argument scanning, get display level and prompt
@@ -2,6 +2,7 @@
 %
 %   [t,RTraj] = stochtraj_diffusion(Sys)
 %   [t,RTraj,qTraj] = stochtraj_diffusion(...)
+%   [t,RTraj,qTraj,Sim] = stochtraj_diffusion(...)
 %   ... = stochtraj_diffusion(Sys,Par)
 %   ... = stochtraj_diffusion(Sys,Par,Opt)
 %
@@ -92,6 +93,10 @@
 %
 %     qTraj          3D array, size = (4,nSteps,nTraj)
 %                    trajectories of normalized quaternions
+%
+%     Sim            structure
+%                    settings of the stochastic propagation, used by cardamom
+%                    to continue the trajectories in chunks
 
 function varargout = stochtraj_diffusion(Sys,Par,Opt)
 
@@ -120,6 +125,7 @@ switch nargout
   case 0 % plotting
   case 2 % t, RTraj
   case 3 % t, RTraj, qTraj
+  case 4 % t, RTraj, qTraj, Sim
   otherwise
     error('Incorrect number of output arguments.');
 end
@@ -447,6 +453,8 @@ switch nargout
     varargout = {t, RTraj};
   case 3  % Output rotation matrix and quaternion trajectories
     varargout = {t, RTraj, qTraj};
+  case 4  % Output also the propagation settings
+    varargout = {t, RTraj, qTraj, Sim};
 end
 
 clear global EasySpinLogLevel
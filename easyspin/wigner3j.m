@@ -15,6 +15,13 @@
 %   a)  jm1 = [j1 m2], jm2 = [j2 m2], jm3 = [j3 m3]
 %   b)  jjj = [j1 j2 j3], mmm = [m1 m2 m3]
 %   c)  jjjmmm = [j1 j2 j3; m1 m2 m3]
+%
+%   v = wigner3j(...,Method)
+%
+%   Method selects the computation: 'f' (logarithmic factorials), 'b'
+%   (arbitrary-precision integers), or 'r' (three-term recursion over all
+%   j1, stable for large j). A '+' uses explicit expressions where they
+%   exist. The default is 'f+' for j up to 20 and 'r+' beyond.
 
 function value = wigner3j(varargin)
 
@@ -58,10 +65,16 @@ end
 if isempty(Method)
   Method = 'f+';
   if max([j1 j2 j3])>20
-    Method = 'b+';
+    Method = 'r+';
   end
 end
 
+% The recursion is done in a mex file (wignerrow). Without it, use
+% arbitrary-precision integers, which are exact for large j as well.
+if any(Method=='r') && exist('wignerrow','file')~=3
+  Method(Method=='r') = 'b';
+end
+
 isint = @(x) x==floor(x);
 istriangle = @(a,b,c) (a+b>=c) && (b+c>=a) && (c+a>=b);
 
@@ -214,6 +227,13 @@ elseif any(Method=='b')
   
   value = (-1)^(j1-j2-m3)*exp(prefactor_ln/2+n*log(10))*b;
   
+elseif any(Method=='r')
+  % all j1 of the row at once, by recursion
+  % K. Schulten, R. G. Gordon, J. Math. Phys. 16, 1961-1970 (1975)
+  % https://doi.org/10.1063/1.522426
+  [j1row,v] = wignerrow('3j',j2,j3,m2,m3);
+  value = v(round(j1-j1row(1))+1);
+
 else
   
   error('Unknown computation method.');
@@ -80,6 +80,19 @@ end
 % Nonzero value: computation
 %--------------------------------------------------
 
+% For large j, the factorials below overflow. Compute all j1 of the row
+% at once by recursion instead, see
+%  K. Schulten, R. G. Gordon, J. Math. Phys. 16, 1961-1970 (1975)
+if max([j1 j2 j3 j4 j5 j6])>20 && exist('wignerrow','file')==3
+  [j1row,v] = wignerrow('6j',j2,j3,j4,j5,j6);
+  if isempty(j1row)
+    value = 0;
+  else
+    value = v(round(j1-j1row(1))+1);
+  end
+  return
+end
+
 alpha = [j1+j2+j4+j5, j1+j3+j4+j6, j2+j3+j5+j6];
 beta = [j1+j2+j3, j1+j5+j6, j2+j4+j6, j3+j4+j5];
 
@@ -0,0 +1,52 @@
+function ok = test()
+
+% Streaming propagation in chunks against propagation of all steps at once,
+% with rotational trajectories that are generated chunk by chunk: diffusion,
+% diffusion with global dynamics, diffusion in an orienting potential (which
+% includes discarded burn-in steps), and jumps
+
+Sys.g = [2.009, 2.006, 2.002];
+Sys.Nucs = '14N';
+Sys.A = unitconvert([6, 36]/10,'mT->MHz'); % MHz
+Sys.tcorr = 5e-9; % s
+
+Exp.mwFreq = 9.4;
+
+Par.dtSpatial = 1e-9; % s
+Par.dtSpin = 2e-9; % s
+Par.nSteps = 100;
+Par.nTraj = 10;
+Par.nOrients = 5;
+Par.Model = 'diffusion';
+
+Opt.Method = 'fast';
+
+ok(1) = chunkedmatches(Sys,Exp,Par,Opt);
+
+SysG = Sys;
+SysG.DiffGlobal = 3e7; % s^-1
+ok(2) = chunkedmatches(SysG,Exp,Par,Opt);
+
+SysP = Sys;
+SysP.Potential = [2 0 0 1.5];
+ok(3) = chunkedmatches(SysP,Exp,Par,Opt);
+
+SysJ = rmfield(Sys,'tcorr');
+SysJ.TransProb = [0.2 0.8; 0.55 0.45];
+SysJ.Orientations = [0 0 0; 0 pi/3 pi/4];
+ParJ = Par;
+ParJ.Model = 'jump';
+ok(4) = chunkedmatches(SysJ,Exp,ParJ,Opt);
+
+end
+
+function ok = chunkedmatches(Sys,Exp,Par,Opt)
+rng(1)
+[~,y1] = cardamom(Sys,Exp,Par,Opt);
+
+Opt.ChunkLength = 30;
+rng(1)
+[~,y2] = cardamom(Sys,Exp,Par,Opt);
+
+ok = areequal(y1,y2,1e-10,'rel');
+end
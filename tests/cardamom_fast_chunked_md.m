@@ -0,0 +1,68 @@
+function ok = test()
+
+% Streaming propagation in chunks against propagation of all steps at once,
+% for MD-direct with sliding window processing (the trajectories overlap by
+% lag*BlockLength MD frames, and with global dynamics) and for MD-HMM (state
+% tensors accumulated over chunks of frames)
+
+load('mdfiles/MTSSL_polyAla_traj.mat')
+MD = Traj;
+
+% Correct array sizes such that nTraj is last dimension
+f = fieldnames(MD);
+for k = 1:numel(f)
+  fn = f{k};
+  if ndims(MD.(fn))~=4, continue; end
+  MD.(fn) = permute(MD.(fn),[1 2 4 3]);
+end
+
+tScale = 2.5;
+MD.dt = MD.dt*tScale;
+MD.removeGlobal = false;
+
+Sys.Nucs = '14N';
+Sys.g = [2.009, 2.006, 2.002];
+Sys.A = unitconvert([6, 36]/10,'mT->MHz');
+
+Exp.mwFreq = 9.4;
+
+Opt.Method = 'fast';
+
+% MD-direct, sliding window
+MDd = MD;
+MDd.DiffGlobal = 6e6;
+Par.dtSpin = 1.0e-9;
+Par.nSteps = 100;
+Par.Model = 'MD-direct';
+Par.nOrients = 5;
+OptD = Opt;
+OptD.LagTime = 20e-9;
+ok(1) = chunkedmatches(Sys,Exp,Par,OptD,MDd,1e-10);
+
+% MD-HMM
+MDh = MD;
+MDh.tLag = 100e-12*tScale;
+MDh.nStates = 8;
+ParH.dtSpatial = MDh.tLag;
+ParH.dtSpin = 4*ParH.dtSpatial;
+ParH.nSteps = 100;
+ParH.Model = 'MD-HMM';
+ParH.nTraj = 10;
+ParH.nOrients = 5;
+OptH = Opt;
+OptH.nTrials = 2;
+% the state tensors are summed in a different order when chunked
+ok(2) = chunkedmatches(Sys,Exp,ParH,OptH,MDh,1e-8);
+
+end
+
+function ok = chunkedmatches(Sys,Exp,Par,Opt,MD,tol)
+rng(1)
+[~,y1] = cardamom(Sys,Exp,Par,Opt,MD);
+
+Opt.ChunkLength = 30;
+rng(1)
+[~,y2] = cardamom(Sys,Exp,Par,Opt,MD);
+
+ok = areequal(y1,y2,tol,'rel');
+end
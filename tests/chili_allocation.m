@@ -1,26 +1,50 @@
 function ok = test()
 
-% Test memory reallocation in chili_lm
+% chili_lm allocates its outputs with the exact number of elements found
+% in its counting pass: the sparse, split-field and COO outputs hold as
+% many elements as the statistics report, for systems with zero, one and
+% two nuclei
 
 Sys.g = [2.01 2.02 2.03];
 Sys.tcorr = 1e-8;
 Sys.lw = 0.1;
 Exp.mwFreq = 9.7;
 
-% no nuclei
-Opt.AllocationBlockSize = 2e3;
-[B,spc] = chili(Sys,Exp,Opt);
+Opt.Diagnostics = 'chili_allocation_diagnostics';
 
-% one nucleus
+Systems = {Sys};
 Sys.Nucs = '14N';
 Sys.A = [10 20 30];
-Opt.AllocationBlockSize = 5e4;
-[B,spc] = chili(Sys,Exp,Opt);
-
-% two nuclei
+Systems{2} = Sys;
 Sys.Nucs = '15N,15N';
 Sys.A = [10 10 20; 10 10 20];
-Opt.AllocationBlockSize = 5e4;
-[B,spc] = chili(Sys,Exp,Opt);
+Systems{3} = Sys;
+
+ok = [];
+for k = 1:numel(Systems)
+  chili(Systems{k},Exp,Opt);
+  diagnostics = evalin('base',Opt.Diagnostics);
+  args = diagnostics.chili_lm;
+
+  [L,nRows,Stats] = runprivate('chili_lm',args{:},true);
+  [LG,LB,nRowsGB,StatsGB] = runprivate('chili_lm',args{:},true);
+  [r,c,Vals,nRowsC,StatsC] = runprivate('chili_lm',args{:},true);
+
+  nElements = Stats.nElements;
+  ok(end+1) = isequal(size(L),[nRows nRows]) && nzmax(L)==nElements;
+  ok(end+1) = nRowsGB==nRows && nzmax(LG)==nElements && nzmax(LB)==nElements;
+  ok(end+1) = nRowsC==nRows && StatsC.nElements==nElements && ...
+    numel(r)==nElements && numel(c)==nElements && numel(Vals)==nElements;
+
+  % the staging buffer holds the upper triangle, and each off-diagonal
+  % element of it is stored twice in the output
+  nDiag = 2*Stats.StagingElements - nElements;
+  ok(end+1) = StatsGB.StagingElements==Stats.StagingElements && ...
+    StatsC.StagingElements==0 && nDiag>=0 && nDiag<=nRows;
+
+  % the COO elements have distinct positions and include all nonzeros of L
+  idxC = sub2ind([nRows nRows],r,c);
+  ok(end+1) = numel(unique(idxC))==nElements && all(ismember(find(L),idxC));
+end
 
-ok = true;
+evalin('base',['clear ' Opt.Diagnostics]);
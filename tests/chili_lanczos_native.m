@@ -0,0 +1,39 @@
+function ok = test()
+
+% chili_lanczos_ (sparse input) against the MATLAB implementation in
+% chili_lanczos (full input) and a direct solve, for a small complex
+% symmetric matrix, with both continued-fraction evaluations, and for a
+% starting vector that is an eigenvector (Lanczos stops with beta = 0)
+
+N = 12;
+rng(2);
+A = complex(randn(N),randn(N));
+A = A + A.';
+b = randn(N,1);
+z = linspace(-5,5,50) + 0.5i;
+
+Opt.Threshold = 1e-14;
+ok = [];
+for Lentz = [true false]
+  Opt.Lentz = Lentz;
+  [spec0,conv0,change0] = runprivate('chili_lanczos',A,b,z,Opt);
+  [spec,conv,change] = runprivate('chili_lanczos',sparse(A),b,z,Opt);
+  ok(end+1) = areequal(spec(:),spec0(:),1e-8,'rel');
+  ok(end+1) = conv==conv0 && numel(change)==numel(change0);
+
+  ref = zeros(size(z));
+  for k = 1:numel(z)
+    ref(k) = b.'*((A+z(k)*eye(N))\b)/(b.'*b);
+  end
+  ok(end+1) = areequal(spec(:),ref(:),1e-6,'rel');
+end
+
+% Invariant subspace after the first step
+D = diag(1:N);
+e1 = [1; zeros(N-1,1)];
+Opt.Lentz = true;
+[spec0,~,change0] = runprivate('chili_lanczos',D,e1,z,Opt);
+[spec,~,change] = runprivate('chili_lanczos',sparse(D),e1,z,Opt);
+ok(end+1) = isequal(change,change0) && isequal(change,0);
+ok(end+1) = areequal(spec(:),spec0(:),1e-12,'rel') && ...
+  areequal(spec(:),1./(1+z(:)),1e-12,'rel');
@@ -0,0 +1,21 @@
+function ok = test()
+
+% Comparison of fast and general code for Liouvillian, three nuclei
+
+Sys.g = [2.008 2.0061 2.0027];
+Sys.Nucs = '14N,1H,1H';
+Sys.A = [20 20 100; 8 8 12; 3 3 5];
+Sys.tcorr = 3e-9;
+
+Exp.mwFreq = 9.5;
+Exp.Range = [334 345];
+Exp.Harmonic = 0;
+
+Opt.LLMK = [6 3 2 2];
+
+Opt.LiouvMethod = 'fast';
+[x,y1] = chili(Sys,Exp,Opt);
+Opt.LiouvMethod = 'general';
+[x,y2] = chili(Sys,Exp,Opt);
+
+ok = areequal(y1,y2,1e-3,'rel');
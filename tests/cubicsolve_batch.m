@@ -0,0 +1,50 @@
+function ok = test()
+
+% cubicsolve with a 4xN coefficient array against one call per column,
+% and derivatives of the sorted roots, including a root at t=0
+
+rng(7);
+nSegments = 5;
+nTrans = 4;
+C = randn(4,nSegments*nTrans);
+C(:,3) = poly([0.8 0.2 0.5]).';  % three roots, not found in sorted order
+C(:,8) = [2; 1; -0.7; 0];         % root at t=0
+C(:,12) = [1; 0; 0; 5];           % no root in [0,1]
+
+ok = [];
+
+for MultipleRoots = [true false]
+  r0 = [];
+  d10 = [];
+  d20 = [];
+  idx0 = [];
+  for k = 1:size(C,2)
+    [r,d1,d2] = runprivate('cubicsolve',C(:,k),MultipleRoots);
+    r0 = [r0 r];
+    d10 = [d10 d1];
+    d20 = [d20 d2];
+    idx0 = [idx0 k*ones(size(r))];
+  end
+
+  [r,d1,d2,idx] = runprivate('cubicsolve',C,MultipleRoots);
+  [rs,d1s,d2s,iSeg,iTrans] = runprivate('cubicsolve',C,MultipleRoots,nSegments);
+
+  ok(end+1) = isequal(r,r0) && isequal(d1,d10) && isequal(d2,d20) && isequal(idx,idx0);
+  ok(end+1) = isequal(rs,r0) && isequal(d1s,d10) && isequal(d2s,d20);
+  ok(end+1) = isequal(iSeg,mod(idx0-1,nSegments)+1) && ...
+              isequal(iTrans,floor((idx0-1)/nSegments)+1);
+end
+
+% Roots are sorted and the derivatives are reordered with them
+[r,d1,d2] = runprivate('cubicsolve',C(:,3),true);
+ok(end+1) = areequal(r,[0.2 0.5 0.8],1e-10,'abs');
+ok(end+1) = areequal(d1,polyval(polyder(C(:,3).'),r),1e-10,'abs');
+ok(end+1) = areequal(d2,polyval(polyder(polyder(C(:,3).')),r),1e-10,'abs');
+
+% Derivatives at a root at t=0
+[r,d1,d2] = runprivate('cubicsolve',C(:,8),true);
+ok(end+1) = isequal(r,0) && isequal(d1,C(3,8)) && isequal(d2,2*C(2,8));
+
+% No root
+r = runprivate('cubicsolve',C(:,12),true);
+ok(end+1) = isempty(r);
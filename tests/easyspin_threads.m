@@ -0,0 +1,26 @@
+function ok = test()
+
+% Thread count option of the MEX files: the number of threads is set and
+% reset with easyspin threads, and the spectrum does not depend on it
+
+Info = runprivate('cpuinfo');
+ok(1) = any(strcmp(Info.SIMD,{'AVX-512','AVX2','SSE2','NEON','scalar'}));
+
+Sys.g = [2 2.1 2.2];
+Sys.Nucs = '1H';
+Sys.A = [10 20 30];
+Sys.lwpp = 0.5;
+Exp.mwFreq = 9.5;
+Exp.Range = [300 350];
+
+easyspin('threads',1);
+ok(2) = easyspin('threads')==1;
+[~,spc1] = pepper(Sys,Exp);
+
+easyspin('threads',2);
+ok(3) = easyspin('threads')==2 || ~Info.OpenMP;
+[~,spc2] = pepper(Sys,Exp);
+
+easyspin('threads',0);
+ok(4) = easyspin('threads')==Info.Threads;
+ok(5) = areequal(spc1,spc2,1e-10,'rel');
@@ -0,0 +1,43 @@
+function ok = test()
+
+% lisum1i with many lines, with and without Group/nGroups, against one
+% call per line. Enough lines to be split over several threads.
+
+x0T = 5e4;
+wT = x0T/2.5;
+xT = 0:2*x0T-1;
+Template = gaussian(xT,x0T,wT,-1);
+
+rng(5);
+nLines = 5000;
+nGroups = 3;
+xAxis = linspace(300,350,2001);
+Pos = 305 + 40*rand(1,nLines);
+Amp = rand(1,nLines);
+Wid = 0.2 + rand(1,nLines);
+Group = randi(nGroups,1,nLines);
+
+% Reference: one call per line
+ref = zeros(nGroups,numel(xAxis));
+for k = 1:nLines
+  y = runprivate('lisum1i',Template,x0T,wT,Pos(k),Amp(k),Wid(k),xAxis);
+  ref(Group(k),:) = ref(Group(k),:) + y;
+end
+
+yAll = runprivate('lisum1i',Template,x0T,wT,Pos,Amp,Wid,xAxis);
+yGrouped = runprivate('lisum1i',Template,x0T,wT,Pos,Amp,Wid,xAxis,Group,nGroups);
+
+thr = 1e-10*max(abs(ref(:)));
+ok(1) = isequal(size(yGrouped),[nGroups numel(xAxis)]);
+ok(2) = areequal(yGrouped,ref,thr,'abs');
+ok(3) = areequal(yAll,sum(ref,1),thr,'abs');
+
+% Scalar amplitude and width are used for all lines
+w = 0.5;
+ref1 = zeros(nGroups,numel(xAxis));
+for g = 1:nGroups
+  idx = Group==g;
+  ref1(g,:) = runprivate('lisum1i',Template,x0T,wT,Pos(idx),1,w,xAxis);
+end
+yScalar = runprivate('lisum1i',Template,x0T,wT,Pos,1,w,xAxis,Group,nGroups);
+ok(4) = areequal(yScalar,ref1,1e-10*max(abs(ref1(:))),'abs');
@@ -0,0 +1,105 @@
+function ok = test()
+
+% Compare log-likelihood, state posteriors and summed statistics from the
+% forward-backward kernel of mdhmm_em with a brute-force sum over all
+% state sequences, for one and for several trajectories
+
+rng(2);
+nStates = 2;
+nSteps = 4;
+data = (rand(2,nSteps)-0.5)*2*pi;
+initDistr = [0.3 0.7];
+TransProb = [0.9 0.1; 0.25 0.75];
+mu = [-2 1; 2.5 0];
+Sigma = cat(3,[0.5 0.1; 0.1 0.8],[1 -0.2; -0.2 0.6]);
+
+% Observation likelihoods with periodic distances
+B = obslik(data,mu,Sigma);
+
+% Sum over all state sequences
+P = 0;
+gamma = zeros(nStates,nSteps);
+for k = 0:nStates^nSteps-1
+  q = mod(floor(k./nStates.^(0:nSteps-1)),nStates) + 1;
+  p = initDistr(q(1))*B(q(1),1);
+  for t = 2:nSteps
+    p = p*TransProb(q(t-1),q(t))*B(q(t),t);
+  end
+  P = P + p;
+  idx = sub2ind(size(gamma),q,1:nSteps);
+  gamma(idx) = gamma(idx) + p;
+end
+gamma = gamma/P;
+
+[logLik,~,expNumVisits1,weightsSummed,~,gammaLast] = ...
+  runprivate('mdhmm_fwdback',data,initDistr,TransProb,mu,Sigma);
+
+ok(1) = areequal(logLik,log(P),1e-10,'abs');
+ok(2) = areequal(gammaLast,gamma,1e-10,'abs');
+ok(3) = areequal(expNumVisits1,gamma(:,1),1e-10,'abs');
+ok(4) = areequal(weightsSummed,sum(gamma,2),1e-10,'abs');
+
+% Several trajectories of different lengths: all statistics, including
+% muUpdater, are summed over the trajectories
+nStepsTraj = [4 3 5];
+nTraj = numel(nStepsTraj);
+trajs = cell(1,nTraj);
+logLikRef = 0;
+transCountsRef = zeros(nStates);
+visits1Ref = zeros(nStates,1);
+weightsRef = zeros(nStates,1);
+muUpdaterRef = zeros(size(mu));
+for iTraj = 1:nTraj
+  n = nStepsTraj(iTraj);
+  obs = (rand(2,n)-0.5)*2*pi;
+  trajs{iTraj} = obs;
+  B = obslik(obs,mu,Sigma);
+  P = 0;
+  gamma = zeros(nStates,n);
+  xi = zeros(nStates^2,1);
+  for k = 0:nStates^n-1
+    q = mod(floor(k./nStates.^(0:n-1)),nStates) + 1;
+    p = initDistr(q(1))*B(q(1),1);
+    for t = 2:n
+      p = p*TransProb(q(t-1),q(t))*B(q(t),t);
+    end
+    P = P + p;
+    idx = sub2ind(size(gamma),q,1:n);
+    gamma(idx) = gamma(idx) + p;
+    idx = sub2ind([nStates nStates],q(1:n-1),q(2:n));
+    xi = xi + accumarray(idx(:),p,[nStates^2 1]);
+  end
+  gamma = gamma/P;
+  logLikRef = logLikRef + log(P);
+  transCountsRef = transCountsRef + reshape(xi,nStates,nStates)/P;
+  visits1Ref = visits1Ref + gamma(:,1);
+  weightsRef = weightsRef + sum(gamma,2);
+  for s = 1:nStates
+    d = obs - mu(:,s);
+    d(d>pi) = d(d>pi) - 2*pi;
+    d(d<-pi) = d(d<-pi) + 2*pi;
+    muUpdaterRef(:,s) = muUpdaterRef(:,s) + d*gamma(s,:).';
+  end
+end
+
+[logLik,transCounts,expNumVisits1,weightsSummed,muUpdater,gammaLast] = ...
+  runprivate('mdhmm_fwdback',trajs,initDistr,TransProb,mu,Sigma);
+
+ok(5) = areequal(logLik,logLikRef,1e-10,'abs');
+ok(6) = areequal(transCounts,transCountsRef,1e-10,'abs');
+ok(7) = areequal(expNumVisits1,visits1Ref,1e-10,'abs');
+ok(8) = areequal(weightsSummed,weightsRef,1e-10,'abs');
+ok(9) = areequal(muUpdater,muUpdaterRef,1e-10,'abs');
+ok(10) = areequal(gammaLast,gamma,1e-10,'abs');
+
+%-------------------------------------------------------------------------------
+function B = obslik(data,mu,Sigma)
+nStates = size(mu,2);
+B = zeros(nStates,size(data,2));
+for s = 1:nStates
+  d = data - mu(:,s);
+  d(d>pi) = d(d>pi) - 2*pi;
+  d(d<-pi) = d(d<-pi) + 2*pi;
+  mahal = sum((Sigma(:,:,s)\d).*d,1);
+  B(s,:) = exp(-mahal/2)/(2*pi*sqrt(det(Sigma(:,:,s)))+eps);
+end
@@ -0,0 +1,43 @@
+function ok = test()
+
+% Compare the native reversible MSM objective of mdhmm_lbfgsb with the
+% same objective evaluated in MATLAB, and check the ranking of several
+% starting points
+
+rng(5);
+nStates = 4;
+c = randi(50,nStates) + 100*eye(nStates);
+c_i = sum(c,2);
+c_sym = c + c.';
+n = nStates^2;
+
+opts.maxIts = 1000;
+opts.maxTotalIts = 50000;
+opts.x0 = c_sym(:);
+fcn = @(x) msmobjective(reshape(x,nStates,nStates),c,c_i);
+[xRef,fRef] = runprivate('mdhmm_lbfgsb',fcn,zeros(n,1),Inf(n,1),opts);
+
+opts.x0 = [c_sym(:)+5, c_sym(:), 2*c_sym(:)];
+opts.counts = c;
+[x,f,info] = runprivate('mdhmm_lbfgsb','msmreversible',zeros(n,1),Inf(n,1),opts);
+
+TPM = @(x) reshape(x,nStates,nStates)./sum(reshape(x,nStates,nStates),2);
+
+ok(1) = size(x,2)==3 && numel(f)==3 && numel(info.iterations)==3;
+ok(2) = issorted(f);
+ok(3) = areequal(f(1),fRef,1e-6,'rel');
+ok(4) = areequal(TPM(x(:,1)),TPM(xRef),1e-4,'abs');
+
+end
+
+function [f,g] = msmobjective(x,c,c_i)
+x_i = sum(x,2);
+tmp = c.*log(x./x_i);
+f = -sum(tmp(x>10*eps));
+t = c_i./x_i;
+g = c./x + c.'./x.' - (t+t.');
+g(x_i<10*eps,:) = 0;
+g(~(x>10*eps & x.'>10*eps)) = 0;
+g(isnan(g)) = 0;
+g = -g(:);
+end
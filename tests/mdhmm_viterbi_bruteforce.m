@@ -0,0 +1,43 @@
+function ok = test()
+
+% Compare Viterbi state trajectories with a brute-force search over all
+% state sequences, for two trajectories
+
+rng(3);
+nStates = 3;
+nSteps = 5;
+nTraj = 2;
+data = (rand(2,nSteps,nTraj)-0.5)*2*pi;
+eqDistr = [0.2 0.5 0.3];
+TransProb = [0.8 0.1 0.1; 0.2 0.7 0.1; 0.15 0.15 0.7];
+mu = [-2 1 3; 2.5 0 -1];
+Sigma = cat(3,[0.5 0.1; 0.1 0.8],[1 -0.2; -0.2 0.6],[0.7 0; 0 0.7]);
+
+vTraj = runprivate('mdhmm_viterbi',data,eqDistr,TransProb,mu,Sigma);
+
+vTrajRef = zeros(nSteps,nTraj);
+for iTraj = 1:nTraj
+  % Observation log-likelihoods with periodic distances
+  logB = zeros(nStates,nSteps);
+  for s = 1:nStates
+    d = data(:,:,iTraj) - mu(:,s);
+    d(d>pi) = d(d>pi) - 2*pi;
+    d(d<-pi) = d(d<-pi) + 2*pi;
+    mahal = sum((Sigma(:,:,s)\d).*d,1);
+    logB(s,:) = -mahal/2 - log(2*pi*sqrt(det(Sigma(:,:,s)))+eps);
+  end
+  best = -inf;
+  for k = 0:nStates^nSteps-1
+    q = mod(floor(k./nStates.^(0:nSteps-1)),nStates) + 1;
+    logp = log(eqDistr(q(1))) + logB(q(1),1);
+    for t = 2:nSteps
+      logp = logp + log(TransProb(q(t-1),q(t))) + logB(q(t),t);
+    end
+    if logp>best
+      best = logp;
+      vTrajRef(:,iTraj) = q(:);
+    end
+  end
+end
+
+ok = isequal(vTraj,vTrajRef);
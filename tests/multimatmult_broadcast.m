@@ -0,0 +1,26 @@
+function ok = test()
+
+% Compare page-wise products from multimatmult with explicit loops, for
+% real, complex and single inputs, with and without page broadcasting
+
+rng(1);
+nPages = 20;
+A = rand(3,3,nPages) + 1i*rand(3,3,nPages);
+B = rand(3,3,nPages);
+A1 = rand(3,3);
+Bs = single(rand(4,4,nPages));
+As = single(rand(4,4));
+
+C = runprivate('multimatmult',A,B);
+C1 = runprivate('multimatmult',A1,B);
+Cs = runprivate('multimatmult',As,Bs);
+
+for k = nPages:-1:1
+  Cref(:,:,k) = A(:,:,k)*B(:,:,k);
+  C1ref(:,:,k) = A1*B(:,:,k);
+  Csref(:,:,k) = As*Bs(:,:,k);
+end
+
+ok(1) = areequal(C,Cref,1e-12,'abs');
+ok(2) = areequal(C1,C1ref,1e-12,'abs');
+ok(3) = isa(Cs,'single') && areequal(Cs,Csref,1e-5,'abs');
@@ -0,0 +1,32 @@
+function ok = test()
+
+% Compare fused sandwich products R*T*R.' and R*T*Rinv from multimatmult
+% with explicit loops, for several tensors sharing the same rotations
+
+rng(1);
+nPages = 20;
+R = zeros(3,3,nPages);
+for k = 1:nPages
+  R(:,:,k) = erot(rand(1,3)*2*pi);
+end
+T1 = rand(3,3);
+T2 = rand(3,3,nPages) + 1i*rand(3,3,nPages);
+M = rand(4,4,nPages);
+Minv = zeros(4,4,nPages);
+for k = 1:nPages
+  Minv(:,:,k) = inv(M(:,:,k));
+end
+T3 = rand(4,4,nPages);
+
+C = runprivate('multimatmult',R,{T1,T2},'t');
+C3 = runprivate('multimatmult',M,T3,Minv);
+
+for k = nPages:-1:1
+  C1ref(:,:,k) = R(:,:,k)*T1*R(:,:,k).';
+  C2ref(:,:,k) = R(:,:,k)*T2(:,:,k)*R(:,:,k).';
+  C3ref(:,:,k) = M(:,:,k)*T3(:,:,k)*Minv(:,:,k);
+end
+
+ok(1) = areequal(C{1},C1ref,1e-12,'abs');
+ok(2) = areequal(C{2},C2ref,1e-12,'abs');
+ok(3) = areequal(C3,C3ref,1e-10,'abs');
@@ -0,0 +1,32 @@
+function ok = test()
+
+% Convolution of the nuclear stick patterns on the spectral grid against
+% exact binning of all sticks. With shifts that are multiples of the bin
+% width, both give the same spectrum. Otherwise, the convolution keeps the
+% total intensity and the mean position up to the bin rounding.
+
+B0 = 340 + 0.125*(0:3);
+nOri = numel(B0);
+nStates = [2 3 2 3 2 2];
+nNuclei = numel(nStates);
+startPos = 300;
+deltaPos = 0.25;
+nPoints = 1024;
+
+rng(5);
+shifts = deltaPos*randi([-20 20],3,nNuclei,nOri);
+
+[spc,Stats] = runprivate('multinucstick',B0,nStates,shifts,startPos,deltaPos,nPoints);
+ref = runprivate('multinucstick',B0,nStates,shifts,startPos,deltaPos,nPoints,[],true);
+
+ok(1) = Stats.nConvolved==nOri;
+ok(2) = isequal(spc,ref);
+
+shifts = 3*rand(3,nNuclei,nOri)-1.5;
+spc = runprivate('multinucstick',B0,nStates,shifts,startPos,deltaPos,nPoints);
+ref = runprivate('multinucstick',B0,nStates,shifts,startPos,deltaPos,nPoints,[],true);
+
+idx = 1:nPoints;
+ok(3) = areequal(sum(spc),nOri*prod(nStates),1e-10,'rel');
+ok(4) = areequal(sum(ref),nOri*prod(nStates),1e-10,'rel');
+ok(5) = abs(idx*spc.'/sum(spc)-idx*ref.'/sum(ref))<1;
@@ -0,0 +1,49 @@
+function ok = test()
+
+% Exact binning of many equivalent and inequivalent nuclei, for which
+% multinucstick merges sticks instead of enumerating them, against an
+% explicit enumeration of all sticks. Positions are summed in the same
+% order as in multinucstick, so all sticks must fall into the same bins.
+
+B0 = 340 + 0.37*(0:4);
+nOri = numel(B0);
+nStates = [2 2 2 2 2 2 3 3 3 3 2 2 2 2];
+nNuclei = numel(nStates);
+startPos = 330;
+deltaPos = 0.01;
+nPoints = 4096;
+
+shifts = zeros(3,nNuclei,nOri);
+for o = 1:nOri
+  for k = 1:nNuclei
+    if k<=6
+      a = 1.2345 + 0.01*o;
+    elseif k<=10
+      a = 0.7777 + 0.013*o;
+    else
+      a = 0.31*(k-10) + 0.0071*o;
+    end
+    if nStates(k)==2
+      shifts(:,k,o) = [-a/2; a/2; 0];
+    else
+      shifts(:,k,o) = [-a; 0; a];
+    end
+  end
+end
+
+[spc,Stats] = runprivate('multinucstick',B0,nStates,shifts,startPos,deltaPos,nPoints,[],true);
+
+ref = zeros(1,nPoints);
+for o = 1:nOri
+  pos = (B0(o)-startPos)/deltaPos;
+  for k = 1:nNuclei
+    pos = pos(:) + shifts(1:nStates(k),k,o).'/deltaPos;
+  end
+  idx = fix(pos(:));
+  idx = idx(idx>=0 & idx<nPoints);
+  ref = ref + accumarray(idx+1,1,[nPoints 1]).';
+end
+
+ok(1) = Stats.nMerged==nOri;
+ok(2) = isequal(spc~=0,ref~=0);
+ok(3) = areequal(spc,ref,1e-12,'rel');
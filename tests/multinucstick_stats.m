@@ -0,0 +1,20 @@
+function ok = test()
+
+% Check the statistics output of multinucstick: the spectrum must not
+% change, and the stick and orientation counts must match the input
+
+B0 = [340 345];
+nStates = [2 2 2];
+shifts = [-1 -2 -3; 1 2 3];
+Weights = [1 2];
+nPoints = 256;
+
+spec0 = runprivate('multinucstick',B0,nStates,shifts,330,0.1,nPoints,Weights);
+[spec,Stats] = runprivate('multinucstick',B0,nStates,shifts,330,0.1,nPoints,Weights);
+
+ok(1) = isequal(spec,spec0);
+ok(2) = areequal(sum(spec),sum(Weights)*prod(nStates),1e-12,'abs');
+ok(3) = Stats.nOrientations==2 && Stats.nNuclei==3;
+ok(4) = Stats.nSticks==numel(B0)*prod(nStates);
+ok(5) = Stats.nEnumerated+Stats.nMerged+Stats.nConvolved==numel(B0);
+ok(6) = Stats.tTotal>=0;
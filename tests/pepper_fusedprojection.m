@@ -0,0 +1,44 @@
+function ok = test()
+
+% Fused interpolation and projection (interpproject) against interpolation
+% onto the fine grid followed by projection
+
+x = linspace(300,360,1000);
+GridSize = [10 4];
+nfKnots = (GridSize(1)-1)*GridSize(2) + 1;
+Symmetry = {'D2h','Ci','Dinfh'};
+
+for k = 1:numel(Symmetry)
+  [grid,tri] = sphgrid(Symmetry{k},GridSize(1));
+  GridParams = [numel(grid.phi),GridSize(1),grid.closedPhi,grid.nOctants,grid.maxPhi];
+  v = grid.vecs;
+  Pos = 330 + 20*v(3,:).^2 - 5*v(1,:).^2;
+  Int = 1 + 0.5*v(1,:).^2;
+
+  axial = grid.nOctants==0;
+  if axial
+    fgrid = sphgrid(0,nfKnots);
+    Modes = {'G3','L3'};
+  else
+    [fgrid,ftri] = sphgrid(Symmetry{k},nfKnots);
+    Modes = {'G3','L1'};
+  end
+  fphi = fgrid.phi;
+  fthe = fgrid.theta;
+
+  fPos = runprivate('gridinterp',Pos,GridParams,fphi,fthe,Modes{1});
+  fInt = runprivate('gridinterp',Int,GridParams,fphi,fthe,Modes{2});
+  [pPos,Cells,Local] = runprivate('gridinterp',Pos,GridParams,fphi,fthe,Modes{1},'pp');
+  pInt = runprivate('gridinterp',Int,GridParams,fphi,fthe,Modes{2},'pp');
+
+  if axial
+    SegWeights = -diff(cos(fthe))*4*pi;
+    ref = runprivate('projectzones',fPos,fInt,SegWeights,x);
+    spc = runprivate('interpproject',pPos,pInt,Cells,Local,[],SegWeights,x);
+  else
+    idxTri = ftri.idx.';
+    ref = runprivate('projecttriangles',idxTri,ftri.areas,fPos,fInt,x);
+    spc = runprivate('interpproject',pPos,pInt,Cells,Local,idxTri,ftri.areas,x);
+  end
+  ok(k) = areequal(spc,ref,1e-10,'rel');
+end
@@ -0,0 +1,51 @@
+function ok = test()
+
+% projecttriangles and projectzones with several transitions, summed and
+% separate, against one call per transition
+
+rng(2);
+x = linspace(300,360,1000);
+nTrans = 3;
+
+% Triangles
+[grid,tri] = sphgrid('D2h',91);
+idxTri = tri.idx.';
+v = grid.vecs;
+nVert = size(v,2);
+Pos = 330 + 20*v(3,:).'.^2 - 5*v(1,:).'.^2 + 10*randn(1,nTrans);
+Pos(7,2) = NaN;
+Int = 1 + rand(nVert,nTrans);
+
+ok = [];
+for Amp = {Int,1}
+  A = Amp{1};
+  ref = zeros(nTrans,numel(x));
+  for t = 1:nTrans
+    if isscalar(A), At = A; else, At = A(:,t); end
+    ref(t,:) = runprivate('projecttriangles',idxTri,tri.areas,Pos(:,t),At,x);
+  end
+  spcSum = runprivate('projecttriangles',idxTri,tri.areas,Pos,A,x);
+  spcSep = runprivate('projecttriangles',idxTri,tri.areas,Pos,A,x,true);
+  ok(end+1) = areequal(spcSum,sum(ref,1),1e-10,'rel');
+  ok(end+1) = isequal(size(spcSep),size(ref)) && areequal(spcSep,ref,1e-10,'rel');
+end
+
+% Segments, with real and complex amplitudes
+grid = sphgrid('Dinfh',5001);
+SegWeights = -diff(cos(grid.theta))*4*pi;
+nPeaks = numel(grid.theta);
+Pos = 330 + 20*cos(grid.theta(:)).^2 + 10*randn(1,nTrans);
+Pos(9,3) = NaN;
+Int = 1 + rand(nPeaks,nTrans);
+for Amp = {Int,complex(Int,rand(nPeaks,nTrans)),1}
+  A = Amp{1};
+  ref = zeros(nTrans,numel(x));
+  for t = 1:nTrans
+    if isscalar(A), At = A; else, At = A(:,t); end
+    ref(t,:) = runprivate('projectzones',Pos(:,t),At,SegWeights,x);
+  end
+  spcSum = runprivate('projectzones',Pos,A,SegWeights,x);
+  spcSep = runprivate('projectzones',Pos,A,SegWeights,x,true);
+  ok(end+1) = areequal(spcSum,sum(ref,1),1e-10,'rel');
+  ok(end+1) = isequal(size(spcSep),size(ref)) && areequal(spcSep,ref,1e-10,'rel');
+end
@@ -0,0 +1,31 @@
+function ok = test()
+
+% Compare resonance fields computed for many orientations at once (spanning
+% several orientation chunks) with those computed one orientation at a time
+
+Sys.S = 1;
+Sys.D = [3000 300];  % MHz
+
+Exp.mwFreq = 9.5;  % GHz
+Exp.Range = [0 800];  % mT
+
+nOri = 300;
+rng(1);
+Exp.SampleFrame = rand(nOri,3)*pi;
+
+Opt.Threshold = 0;
+[Pos,Int] = resfields(Sys,Exp,Opt);
+
+ok = true;
+for iOri = [1 2 256 257 nOri]
+  Exp1 = Exp;
+  Exp1.SampleFrame = Exp.SampleFrame(iOri,:);
+  [Pos1,Int1] = resfields(Sys,Exp1,Opt);
+  idx = ~isnan(Pos(:,iOri));
+  [p,i] = sort(Pos(idx,iOri));
+  I = Int(idx,iOri);
+  [p1,i1] = sort(Pos1(~isnan(Pos1)));
+  I1 = Int1(~isnan(Pos1));
+  ok = ok && numel(p)==numel(p1) && ...
+    areequal(p,p1,1e-8,'abs') && areequal(I(i),I1(i1),1e-8*max(I1),'abs');
+end
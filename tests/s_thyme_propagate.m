@@ -0,0 +1,34 @@
+function ok = test()
+
+% Propagators and propagation of s_propagate against expm, for a batch
+% of two orientations of a spin-1/2
+
+Sx = sop(1/2,'x'); Sz = sop(1/2,'z');
+Ham0 = cat(3,2*pi*95*Sz,2*pi*105*Sz);
+xOp = Sx + 1i*sop(1/2,'y');
+Coeff = [0 20; 0 -20];
+dt = 1e-3;
+
+U = runprivate('s_propagate','propagators',Ham0,xOp,Coeff,dt);
+ok(1) = isequal(size(U),[2 2 2 2]);
+for o = 1:2
+  for k = 1:2
+    H = Ham0(:,:,o) + Coeff(1,k)*real(xOp) + 1i*Coeff(2,k)*imag(xOp);
+    ok(end+1) = areequal(U(:,:,k,o),expm(-1i*H*dt),1e-12,'abs');
+  end
+end
+
+% Signal before and after each step, for both orientations
+idx = [1 2 2 1 2];
+Det = reshape(Sx.',1,[])/trace(Sx*Sx');
+[Sigma,Signal] = runprivate('s_propagate','propagate',-Sz,U,idx,Det);
+for o = 1:2
+  rho = -Sz;
+  ref = Det*rho(:);
+  for i = 1:numel(idx)
+    rho = U(:,:,idx(i),o)*rho*U(:,:,idx(i),o)';
+    ref(end+1) = Det*rho(:);
+  end
+  ok(end+1) = areequal(Signal(1,:,o),ref,1e-12,'abs');
+  ok(end+1) = areequal(Sigma(:,:,o),rho,1e-12,'abs');
+end
@@ -0,0 +1,65 @@
+function ok = test()
+
+% Liouville space propagators, steady states and propagation of
+% s_propagate against expm, for a batch of two orientations of a
+% spin-1/2 with relaxation towards equilibrium
+
+Sx = sop(1/2,'x'); Sz = sop(1/2,'z');
+n = 2;
+Ham0 = cat(3,2*pi*95*Sz,2*pi*105*Sz);
+xOp = Sx + 1i*sop(1/2,'y');
+Coeff = [0 20; 0 -20];
+dt = 1e-3;
+eqState = reshape(-Sz,n^2,1);
+Gamma = cat(3,diag([1/0.02 1/0.005 1/0.005 1/0.02]),...
+              diag([1/0.03 1/0.004 1/0.004 1/0.03]));
+
+% Generator and inhomogeneous term of d(rho)/dt = G*rho + Gamma*eqState
+generator = @(H,Gam) -1i*(kron(eye(n),H)-kron(H.',eye(n))) - Gam;
+
+ok = [];
+for sharedGamma = [false true]
+  if sharedGamma, Gam = Gamma(:,:,1); else, Gam = Gamma; end
+  [L,SigmaSS] = runprivate('s_propagate','liouvillians',Ham0,xOp,Coeff,dt,Gam,eqState);
+  ok(end+1) = isequal(size(L),[n^2 n^2 2 2]) && isequal(size(SigmaSS),[n^2 2 2]);
+  for o = 1:2
+    g = Gam(:,:,min(o,size(Gam,3)));
+    for k = 1:2
+      H = Ham0(:,:,o) + Coeff(1,k)*real(xOp) + 1i*Coeff(2,k)*imag(xOp);
+      G = generator(H,g);
+      ok(end+1) = areequal(L(:,:,k,o),expm(G*dt),1e-12,'abs');
+      % Steady state, and one step of the inhomogeneous equation from an
+      % augmented matrix exponential
+      ok(end+1) = areequal(G*SigmaSS(:,k,o),-g*eqState,1e-10,'abs');
+      rho0 = reshape(Sx,[],1);
+      E = expm([G g*eqState; zeros(1,n^2+1)]*dt);
+      rho1 = E*[rho0; 1];
+      ref = SigmaSS(:,k,o) + L(:,:,k,o)*(rho0-SigmaSS(:,k,o));
+      ok(end+1) = areequal(ref,rho1(1:n^2),1e-12,'abs');
+    end
+  end
+end
+
+% Signal and states before and after each step, for both orientations
+idx = [1 2 2 1 2];
+Det = reshape(Sx.',1,[])/trace(Sx*Sx');
+[L,SigmaSS] = runprivate('s_propagate','liouvillians',Ham0,xOp,Coeff,dt,Gamma,eqState);
+[Sigma,Signal,States] = runprivate('s_propagate','propagate',-Sz,L,idx,Det,SigmaSS);
+ok(end+1) = isequal(size(States),[n n numel(idx)+1 2]);
+for o = 1:2
+  rho = reshape(-Sz,[],1);
+  ref = Det*rho;
+  refStates = reshape(rho,n,n);
+  for i = 1:numel(idx)
+    H = Ham0(:,:,o) + Coeff(1,idx(i))*real(xOp) + 1i*Coeff(2,idx(i))*imag(xOp);
+    G = generator(H,Gamma(:,:,o));
+    E = expm([G Gamma(:,:,o)*eqState; zeros(1,n^2+1)]*dt);
+    rho = E*[rho; 1];
+    rho = rho(1:n^2);
+    ref(end+1) = Det*rho;
+    refStates(:,:,end+1) = reshape(rho,n,n);
+  end
+  ok(end+1) = areequal(Signal(1,:,o),ref,1e-12,'abs');
+  ok(end+1) = areequal(Sigma(:,:,o),reshape(rho,n,n),1e-12,'abs');
+  ok(end+1) = areequal(States(:,:,:,o),refStates,1e-12,'abs');
+end
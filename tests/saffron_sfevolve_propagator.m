@@ -0,0 +1,51 @@
+function ok = test()
+
+% sf_evolve against explicit propagation of the density matrix through
+% the free evolution periods and mixing blocks, for the HYSCORE ([1 2])
+% and 2D-CP ([1 2 2 1]) incrementation schemes
+
+nStates = 4;
+nPoints = [12 9];
+dt = [0.011 0.017];
+rng(3);
+Ea = 10*randn(nStates,1);
+Eb = 10*randn(nStates,1);
+E = [Ea Eb];
+rc = @() complex(randn(nStates),randn(nStates));
+G = rc();
+D = rc();
+
+Schemes = {11,[1 2]; 15,[1 2 2 1]};
+for s = 1:size(Schemes,1)
+  Dims = Schemes{s,2};  % time axis of each free evolution period
+  nFree = numel(Dims);
+  freeL = 1 + mod(0:nFree-1,2);
+  freeR = 3 - freeL;
+  Ml = cell(1,nFree-1);
+  Mr = cell(1,nFree-1);
+  for k = 1:nFree-1
+    Ml{k} = rc();
+    Mr{k} = rc();
+  end
+  td = runprivate('sf_evolve',Schemes{s,1},nPoints,dt,freeL,freeR,Ea,Eb,G,D,Ml{:},Mr{:});
+
+  ref = zeros(nPoints);
+  for n1 = 0:nPoints(1)-1
+    for n2 = 0:nPoints(2)-1
+      t = [n1*dt(1) n2*dt(2)];
+      rho = G;
+      for k = 1:nFree
+        tau = t(Dims(k));
+        Ul = diag(exp(-2i*pi*E(:,freeL(k))*tau));
+        Ur = diag(exp(-2i*pi*E(:,freeR(k))*tau));
+        rho = Ul*rho*Ur';
+        if k<nFree
+          rho = Ml{k}*rho*Mr{k};
+        end
+      end
+      ref(n1+1,n2+1) = trace(D*rho);
+    end
+  end
+
+  ok(s) = areequal(td,ref,1e-10*max(abs(ref(:))),'abs');
+end
@@ -0,0 +1,42 @@
+function ok = test()
+
+% Time-domain 2D-CP ([1 2 2 1]) from saffron against 1D sequences with the
+% same pulses that increment only the first or only the second pair of
+% delays. The first column and row of the 2D signal must match them. All
+% three use the pathways that refocus in the 2D sequence.
+
+Sys = struct('Nucs','1H','A',[3 3 7]);
+
+p90.Flip = pi/2;
+p180.Flip = pi;
+tau = 0.1;
+dt = 0.012;
+nPoints = [40 30];
+
+Exp.Field = 350;
+Exp.SampleFrame = [0 pi/5 0];
+Exp.Sequence = {p90 tau p180 tau p180 tau p180 tau};
+code = 'ab+-';
+Exp.Pathways = code(runprivate('sf_pathways',tau*ones(1,4),[1 2 2 1]));
+
+Opt.TimeDomain = 1;
+
+Exp2D = Exp;
+Exp2D.nPoints = nPoints;
+Exp2D.Dim1 = {'d1,d4' dt};
+Exp2D.Dim2 = {'d2,d3' dt};
+[~,td2] = saffron(Sys,Exp2D,Opt);
+
+Exp1 = Exp;
+Exp1.nPoints = nPoints(1);
+Exp1.Dim1 = {'d1,d4' dt};
+[~,td1] = saffron(Sys,Exp1,Opt);
+
+Exp2 = Exp;
+Exp2.nPoints = nPoints(2);
+Exp2.Dim1 = {'d2,d3' dt};
+[~,tdr] = saffron(Sys,Exp2,Opt);
+
+ok(1) = isequal(size(td2),nPoints);
+ok(2) = areequal(td2(:,1).',td1,1e-10*max(abs(td1)),'abs');
+ok(3) = areequal(td2(1,:),tdr,1e-10*max(abs(tdr)),'abs');
@@ -0,0 +1,21 @@
+function ok = test()
+
+% Assert that time-domain 3pESEEM sims with product rule agree with
+% time-domain sims without product rule.
+
+Sys = struct('Nucs','1H,2H','A',[2 2 5; 0.3 0.3 0.8]);
+
+Exp.Sequence = '3pESEEM';
+Exp.Field = 350;
+Exp.dt = 0.010;
+Exp.tau = 0.120;
+Exp.nPoints = 200;
+Exp.SampleFrame = [0 pi/5];
+
+Opt.TimeDomain = 1;
+Opt.ProductRule = 0;
+[t,y0] = saffron(Sys,Exp,Opt);
+Opt.ProductRule = 1;
+[t,y1] = saffron(Sys,Exp,Opt);
+
+ok = areequal(y0,y1,1e-6*max(abs(y0)),'abs');
@@ -0,0 +1,32 @@
+function ok = test()
+
+% Grouped contractions of sf_peaks (schemes 12, 14 and 15, no threshold)
+% against the loops over all peaks, which are used with the peak list
+
+nStates = 8;
+nPoints = [16 2];
+dt = [0.013 0.017];
+rng(5);
+Ea = 30*randn(nStates,1);
+Eb = 30*randn(nStates,1);
+rc = @() complex(randn(nStates),randn(nStates));
+
+Schemes = [12 14 15];
+nFree = [3 3 4];
+for s = 1:numel(Schemes)
+  free = 1 + mod(0:nFree(s)-1,2);
+  M = cell(1,2*(nFree(s)-1));
+  for k = 1:numel(M), M{k} = rc(); end
+  Args = {dt,free,3-free,Ea,Eb,rc(),rc(),M{:}};
+
+  bufRe = zeros(nPoints);
+  bufIm = zeros(nPoints);
+  [~,~,Stats] = runprivate('sf_peaks',Schemes(s),bufRe,bufIm,Args{:},1,0,false);
+  refRe = zeros(nPoints);
+  refIm = zeros(nPoints);
+  [~,~,refStats] = runprivate('sf_peaks',Schemes(s),refRe,refIm,Args{:},1,0,true);
+
+  ok(s,1) = Stats.nGrouped==1 && refStats.nGrouped==0;
+  ok(s,2) = Stats.nKept==refStats.nKept;
+  ok(s,3) = areequal(complex(bufRe,bufIm),complex(refRe,refIm),1e-10,'rel');
+end
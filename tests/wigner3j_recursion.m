@@ -0,0 +1,24 @@
+function ok = test()
+
+% Recursion against factorial sums, row orthogonality, and large values
+
+j = [10 8 6; 15/2 9/2 5; 20 15 11; 12 12 12];
+m = [-3 2 1; 1/2 -3/2 1; 0 0 0; 4 -6 2];
+ref = [-0.07118447181362782 -0.022447892035757686 -0.042411222912660855 ...
+  -0.03062128569169099];
+for k = 1:size(j,1)
+  a(k) = wigner3j(j(k,:),m(k,:),'r');
+  b(k) = wigner3j(j(k,:),m(k,:),'f');
+end
+ok(1) = areequal(a,ref,1e-12,'abs') && areequal(b,ref,1e-12,'abs');
+
+% sum over j1 of (2*j1+1)*v^2 is 1, sum over m2 of v^2 is 1/(2*j1+1)
+[j1,v] = runprivate('wignerrow','3j',40,25,-7,3);
+ok(2) = areequal(sum((2*j1+1).*v.^2),1,1e-12,'abs');
+[m2,v] = runprivate('wignerrow','3jm',50,40,30,5);
+ok(3) = isequal(m2([1 end]).',[-35 25]) && ...
+  areequal(sum(v.^2),1/101,1e-12,'abs');
+
+a = [wigner3j(300,200,150,3,-7,4) wigner3j(1000,700,600,0,0,0,'r')];
+b = [0.00301587060739391 0.0008769151551772445];
+ok(4) = areequal(a,b,1e-12,'rel');
@@ -0,0 +1,17 @@
+function ok = test()
+
+% Values with j>20, computed by recursion, and row orthogonality
+
+a(1) = wigner6j(30,25,20,25,30,35);
+a(2) = wigner6j(61/2,45/2,20,25,30,57/2);
+a(3) = wigner6j(50,40,30,35,25,30);
+b = [-0.0018725850233776203 0.0015205119814853303 -0.003439629217711091];
+ok(1) = areequal(a,b,1e-12,'rel');
+
+% sum over j1 of (2*j1+1)*(2*l1+1)*v^2 is 1
+[j1,v] = runprivate('wignerrow','6j',40,30,35,25,20);
+ok(2) = areequal(sum((2*j1+1)*(2*35+1).*v.^2),1,1e-12,'abs');
+
+% invalid triads give an empty row
+[j1,v] = runprivate('wignerrow','6j',3/2,5/2,1,3/2,2);
+ok(3) = isempty(j1) && isempty(v);